@@ -0,0 +1,1042 @@
+/***************************************************
+ * Implementation of a B-tree                      *
+ * same interface and comparator contract as       *
+ * RB_tree/RBT_implementation.c so the two can be  *
+ * swapped and run against the same workloads      *
+ * nodes are sized to BT_NODE_BYTES so one node    *
+ * is one cache line (64) or one page (4096)       *
+ ***************************************************/
+
+// for posix_memalign under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <limits.h>
+
+// ordered_ops, so the tree can be picked at runtime with the RB tree
+// and skip list; bt_ordered_ops is at the end of IMPLEMENTATION
+#include "../modularizing_baby/ordered.h"
+
+// same values as the RB tree so comparators work in both
+#define LESS 61
+#define EQUAL 121
+#define GREATER 124
+
+// bytes per node; 64 makes each node one cache line (a 2-3-4 tree),
+// 4096 makes it one page
+#ifndef BT_NODE_BYTES
+#define BT_NODE_BYTES 4096
+#endif
+
+// 1 keeps an int copy of every key (BT_KEY_OF below) next to the
+// pointers, and node searches compare the probe against a run of them
+// at once with SIMD instead of calling comp on each; costs 4 bytes a key
+#ifndef BT_INLINE_KEYS
+#define BT_INLINE_KEYS 1
+#endif
+
+// nodes hold BT_MIN_DEGREE - 1 to 2 * BT_MIN_DEGREE - 1 keys (root
+// can go down to 1) and one more child than keys; derived from
+// BT_NODE_BYTES so a node is two ints, the keys and the children
+// never less than 2, so with inline keys a 64 byte node spills to 80
+#define BT_KEY_BYTES ((int) sizeof(void *) + (BT_INLINE_KEYS ? (int) sizeof(int) : 0))
+#define BT_DEGREE_FIT ((BT_NODE_BYTES - 2 * (int) sizeof(int) + BT_KEY_BYTES) \
+                       / (2 * BT_KEY_BYTES + 2 * (int) sizeof(void *)))
+#define BT_MIN_DEGREE (BT_DEGREE_FIT < 2 ? 2 : BT_DEGREE_FIT)
+#define BT_MAX_KEYS (2 * BT_MIN_DEGREE - 1)
+
+// node search binary searches the inline keys down to this many and
+// then counts the ones below the probe with SIMD
+#define BT_SIMD_WINDOW 16
+
+// pick the widest kernel the compiler is targeting; BT_NO_SIMD forces
+// the scalar one (the test checks the two agree)
+#if BT_INLINE_KEYS && defined(__GNUC__) && !defined(BT_NO_SIMD)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BT_SIMD_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BT_SIMD_SSE2 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BT_SIMD_NEON 1
+#endif
+#endif
+
+// nodes are aligned to this so they don't straddle cache lines
+#define CACHE_LINE 64
+
+// deepest a tree gets; a B-tree with fan-out >= 4 and INT_MAX keys is
+// nowhere near this, it just sizes the validator's stack
+#define BT_MAX_DEPTH 64
+
+/****************
+ * USER-DEFINED *
+ ****************/
+
+// struct to be put in the tree
+typedef struct my_type {
+  int x;
+} my_type;
+
+// comparison function over my_types
+// returns LESS iff "a < b", EQUAL iff "a == b", GREATER iff "a > b"
+int int_compare(my_type *a, my_type *b) {
+  if (a->x < b->x)
+    return LESS;
+  else if (a->x > b->x)
+    return GREATER;
+  else
+    return EQUAL;
+}
+
+// int the inline keys are made of, and the comparator it orders my_types
+// exactly like (int_compare orders by x); trees made with any other
+// comp search with comp instead
+#define BT_KEY_OF(d) ((d)->x)
+#define BT_KEY_COMP int_compare
+
+/*************
+ * INTERFACE *
+ *************/
+typedef struct bt_node {
+  int num_keys;
+
+  // 1 if the node has no children; kids is garbage then
+  int leaf;
+
+  // sorted; kids[i] holds everything between keys[i - 1] and keys[i]
+  my_type *keys[BT_MAX_KEYS];
+#if BT_INLINE_KEYS
+  // BT_KEY_OF(keys[i]), so searching doesn't touch the my_types
+  int ikeys[BT_MAX_KEYS];
+#endif
+  struct bt_node *kids[BT_MAX_KEYS + 1];
+} bt_node;
+
+typedef struct sexy_b_tree {
+  bt_node *root;
+  int num_keys;
+
+  // returns LESS iff "a < b", EQUAL iff "a == b", GREATER iff "a > b"
+  int (*comp)(my_type *, my_type *);
+
+  // 1 if comp is BT_KEY_COMP, so node searches can go by the inline
+  // keys; they're kept up either way
+  int inline_search;
+} sexy_b_tree;
+
+// usual "create, insert, remove, search, and free" functions, same
+// contract as the RB tree: the tree owns what gets inserted, remove
+// hands the data back (or NULL if it wasn't there), free frees it all
+// insert_bt returns 1 on success, 0 if something EQUAL is already in
+// the tree (tree is left alone) or if out of memory
+sexy_b_tree *create_bt(int (*)(my_type *, my_type *));
+int insert_bt(my_type *, sexy_b_tree *);
+my_type *remove_bt(my_type *, sexy_b_tree *);
+my_type *search_bt(my_type *, sexy_b_tree *);
+void free_bt(sexy_b_tree *);
+
+// calls cb(data, arg) on everything in order, stopping early if cb
+// returns 0; returns how many times cb was called
+int bt_foreach(sexy_b_tree *, int (*cb)(my_type *, void *), void *arg);
+int bt_size(sexy_b_tree *);
+
+// checks key counts, ordering, that every leaf is at the same depth
+// and that num_keys matches; an empty tree is valid
+int is_valid_b_tree(sexy_b_tree *);
+
+// helper functions: DO NOT EXPOSE
+
+// every key write goes through these so ikeys stays in step with keys
+static void set_key(bt_node *n, int i, my_type *d);
+static void copy_key(bt_node *dst, int i, bt_node *src, int j);
+
+#if BT_INLINE_KEYS
+// number of keys[0 .. n) that are < probe; the SIMD one is whichever
+// of AVX2/SSE2/NEON is compiled in (same as scalar if none)
+static int count_less_scalar(const int *keys, int n, int probe);
+static int count_less(const int *keys, int n, int probe);
+#endif
+
+// bt_foreach from n down; adds the calls to *count and returns 0 once
+// cb has said stop
+static int bt_walk(bt_node *n, int (*cb)(my_type *, void *), void *arg, int *count);
+
+// NULL if out of memory
+static bt_node *alloc_bt_node(int leaf);
+static void free_bt_nodes(bt_node *);
+
+// first i with keys[i] not LESS than elem (n->num_keys if none) under
+// t's ordering; *found is set to whether keys[i] is EQUAL to elem
+static int node_lower_bound(bt_node *n, my_type *elem, sexy_b_tree *t, int *found);
+
+// splits p's full child kids[i] in two around its middle key, which
+// moves up into p; p must not be full
+static void split_child(bt_node *p, int i, bt_node *right);
+
+// moves keys[i] and everything in kids[i + 1] onto the end of
+// kids[i] and frees kids[i + 1]; both must have BT_MIN_DEGREE - 1 keys
+static void merge_children(bt_node *p, int i);
+
+// makes sure p->kids[i] has at least BT_MIN_DEGREE keys before a
+// remove goes into it, borrowing from a sibling or merging with one;
+// returns the child to go into (changes after merging with the left)
+static bt_node *fill_child(bt_node *p, int i);
+
+// returns the depth of every leaf under n, -1 if anything is wrong
+static int check_bt_subtree(bt_node *n, int is_root, my_type *lo, my_type *hi,
+                            int (*comp)(my_type *, my_type *), int *count);
+
+/******************
+ * IMPLEMENTATION *
+ ******************/
+
+sexy_b_tree *create_bt(int (*comp)(my_type *, my_type *)) {
+  sexy_b_tree *ret = (sexy_b_tree *) malloc(sizeof(sexy_b_tree));
+  if (ret == NULL)
+    return NULL;
+
+  ret->root = NULL;
+  ret->num_keys = 0;
+  ret->comp = comp;
+  ret->inline_search = BT_INLINE_KEYS && comp == &BT_KEY_COMP;
+
+  return ret;
+}
+
+static bt_node *alloc_bt_node(int leaf) {
+  void *mem;
+  if (posix_memalign(&mem, CACHE_LINE, sizeof(bt_node)) != 0)
+    return NULL;
+
+  bt_node *ret = (bt_node *) mem;
+  ret->num_keys = 0;
+  ret->leaf = leaf;
+
+  return ret;
+}
+
+static void free_bt_nodes(bt_node *n) {
+  if (!n->leaf)
+    for (int i = 0; i <= n->num_keys; i++)
+      free_bt_nodes(n->kids[i]);
+
+  for (int i = 0; i < n->num_keys; i++)
+    free(n->keys[i]);
+  free(n);
+}
+
+void free_bt(sexy_b_tree *t) {
+  // tree might be empty if everything was removed
+  if (t->root != NULL)
+    free_bt_nodes(t->root);
+  free(t);
+}
+
+static void set_key(bt_node *n, int i, my_type *d) {
+  n->keys[i] = d;
+#if BT_INLINE_KEYS
+  n->ikeys[i] = BT_KEY_OF(d);
+#endif
+}
+
+static void copy_key(bt_node *dst, int i, bt_node *src, int j) {
+  dst->keys[i] = src->keys[j];
+#if BT_INLINE_KEYS
+  dst->ikeys[i] = src->ikeys[j];
+#endif
+}
+
+#if BT_INLINE_KEYS
+static int count_less_scalar(const int *keys, int n, int probe) {
+  int ret = 0;
+  for (int i = 0; i < n; i++)
+    ret += keys[i] < probe;
+  return ret;
+}
+
+static int count_less(const int *keys, int n, int probe) {
+  int ret = 0;
+  int i = 0;
+
+#if defined(BT_SIMD_AVX2)
+  __m256i p8 = _mm256_set1_epi32(probe);
+  for (; i + 8 <= n; i += 8) {
+    __m256i k = _mm256_loadu_si256((const __m256i *) (keys + i));
+    // all ones in every lane where probe > key
+    __m256i lt = _mm256_cmpgt_epi32(p8, k);
+    ret += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+  }
+#endif
+
+#if defined(BT_SIMD_AVX2) || defined(BT_SIMD_SSE2)
+  __m128i p4 = _mm_set1_epi32(probe);
+  for (; i + 4 <= n; i += 4) {
+    __m128i k = _mm_loadu_si128((const __m128i *) (keys + i));
+    __m128i lt = _mm_cmpgt_epi32(p4, k);
+    ret += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+  }
+#elif defined(BT_SIMD_NEON)
+  int32x4_t p4 = vdupq_n_s32(probe);
+  for (; i + 4 <= n; i += 4) {
+    uint32x4_t lt = vcltq_s32(vld1q_s32(keys + i), p4);
+    // lanes are all ones or zero; add up the top bits
+    ret += (int) vaddvq_u32(vshrq_n_u32(lt, 31));
+  }
+#endif
+
+  // whatever didn't fill a vector
+  return ret + count_less_scalar(keys + i, n - i, probe);
+}
+#endif
+
+static int node_lower_bound(bt_node *n, my_type *elem, sexy_b_tree *t, int *found) {
+#if BT_INLINE_KEYS
+  if (t->inline_search) {
+    // comp isn't needed; BT_KEY_OF orders the same way
+    int probe = BT_KEY_OF(elem);
+    int lo = 0;
+    int hi = n->num_keys;
+
+    // narrow down to a window, then count the window in one go; keys
+    // are sorted so everything below the probe comes first
+    while (hi - lo > BT_SIMD_WINDOW) {
+      int mid = lo + (hi - lo) / 2;
+      if (n->ikeys[mid] < probe)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    int i = lo + count_less(n->ikeys + lo, hi - lo, probe);
+    *found = (i < n->num_keys && n->ikeys[i] == probe);
+    return i;
+  }
+#endif
+  // binary search; the keys are all in this one node so it's
+  // log2(fan-out) comparisons and no pointer chasing between them
+  int lo = 0;
+  int hi = n->num_keys;
+  *found = 0;
+
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    int res = t->comp(elem, n->keys[mid]);
+
+    if (res == GREATER) {
+      lo = mid + 1;
+    } else if (res == LESS) {
+      hi = mid;
+    } else {
+      *found = 1;
+      return mid;
+    }
+  }
+
+  return lo;
+}
+
+my_type *search_bt(my_type *elem, sexy_b_tree *t) {
+  assert(elem != NULL);
+
+  bt_node *cur = t->root;
+
+  while (cur != NULL) {
+    int found;
+    int i = node_lower_bound(cur, elem, t, &found);
+
+    if (found)
+      return cur->keys[i];
+    if (cur->leaf)
+      return NULL;
+    cur = cur->kids[i];
+  }
+
+  return NULL;
+}
+
+static void split_child(bt_node *p, int i, bt_node *right) {
+  bt_node *left = p->kids[i];
+  int t = BT_MIN_DEGREE;
+
+  assert(left->num_keys == BT_MAX_KEYS);
+
+  // right gets the top t - 1 keys (and t kids)
+  right->leaf = left->leaf;
+  right->num_keys = t - 1;
+  for (int j = 0; j < t - 1; j++)
+    copy_key(right, j, left, j + t);
+  if (!left->leaf)
+    for (int j = 0; j < t; j++)
+      right->kids[j] = left->kids[j + t];
+  left->num_keys = t - 1;
+
+  // middle key goes up between left and right
+  for (int j = p->num_keys; j > i; j--) {
+    copy_key(p, j, p, j - 1);
+    p->kids[j + 1] = p->kids[j];
+  }
+  copy_key(p, i, left, t - 1);
+  p->kids[i + 1] = right;
+  p->num_keys++;
+}
+
+int insert_bt(my_type *data, sexy_b_tree *t) {
+  assert(data != NULL);
+
+  // splits happen on the way down, so look first; DON'T ALLOW DUPLICATES
+  if (search_bt(data, t) != NULL)
+    return 0;
+
+  if (t->root == NULL) {
+    t->root = alloc_bt_node(1);
+    if (t->root == NULL)
+      return 0;
+  }
+
+  // full root: grow a level by splitting it under a new root
+  if (t->root->num_keys == BT_MAX_KEYS) {
+    bt_node *new_root = alloc_bt_node(0);
+    bt_node *right = alloc_bt_node(1);
+    if (new_root == NULL || right == NULL) {
+      free(new_root);
+      free(right);
+      return 0;
+    }
+
+    new_root->kids[0] = t->root;
+    split_child(new_root, 0, right);
+    t->root = new_root;
+  }
+
+  // every node we go into has room, so a split never has to go back up
+  bt_node *cur = t->root;
+  while (!cur->leaf) {
+    int found;
+    int i = node_lower_bound(cur, data, t, &found);
+
+    if (cur->kids[i]->num_keys == BT_MAX_KEYS) {
+      bt_node *right = alloc_bt_node(1);
+      // nothing's been changed that breaks the tree, so bailing is fine
+      if (right == NULL)
+        return 0;
+
+      split_child(cur, i, right);
+      // the middle key just came up to keys[i]; ask the same search
+      // which side of it data goes, so it can't disagree with lookups
+      i = node_lower_bound(cur, data, t, &found);
+    }
+
+    cur = cur->kids[i];
+  }
+
+  int found;
+  int i = node_lower_bound(cur, data, t, &found);
+  for (int j = cur->num_keys; j > i; j--)
+    copy_key(cur, j, cur, j - 1);
+  set_key(cur, i, data);
+  cur->num_keys++;
+  t->num_keys++;
+
+  return 1;
+}
+
+static void merge_children(bt_node *p, int i) {
+  bt_node *left = p->kids[i];
+  bt_node *right = p->kids[i + 1];
+  int n = left->num_keys;
+
+  copy_key(left, n, p, i);
+  for (int j = 0; j < right->num_keys; j++)
+    copy_key(left, n + 1 + j, right, j);
+  if (!left->leaf)
+    for (int j = 0; j <= right->num_keys; j++)
+      left->kids[n + 1 + j] = right->kids[j];
+  left->num_keys = n + 1 + right->num_keys;
+
+  for (int j = i; j < p->num_keys - 1; j++) {
+    copy_key(p, j, p, j + 1);
+    p->kids[j + 1] = p->kids[j + 2];
+  }
+  p->num_keys--;
+
+  free(right);
+}
+
+static bt_node *fill_child(bt_node *p, int i) {
+  bt_node *c = p->kids[i];
+
+  if (c->num_keys >= BT_MIN_DEGREE)
+    return c;
+
+  bt_node *l = (i > 0) ? p->kids[i - 1] : NULL;
+  bt_node *r = (i < p->num_keys) ? p->kids[i + 1] : NULL;
+
+  if (l != NULL && l->num_keys >= BT_MIN_DEGREE) {
+    // borrow through the parent from the left sibling
+    for (int j = c->num_keys; j > 0; j--)
+      copy_key(c, j, c, j - 1);
+    if (!c->leaf)
+      for (int j = c->num_keys + 1; j > 0; j--)
+        c->kids[j] = c->kids[j - 1];
+
+    copy_key(c, 0, p, i - 1);
+    if (!c->leaf)
+      c->kids[0] = l->kids[l->num_keys];
+    copy_key(p, i - 1, l, l->num_keys - 1);
+
+    l->num_keys--;
+    c->num_keys++;
+    return c;
+  }
+
+  if (r != NULL && r->num_keys >= BT_MIN_DEGREE) {
+    // and from the right
+    copy_key(c, c->num_keys, p, i);
+    if (!c->leaf)
+      c->kids[c->num_keys + 1] = r->kids[0];
+    copy_key(p, i, r, 0);
+
+    for (int j = 0; j < r->num_keys - 1; j++)
+      copy_key(r, j, r, j + 1);
+    if (!r->leaf)
+      for (int j = 0; j < r->num_keys; j++)
+        r->kids[j] = r->kids[j + 1];
+
+    r->num_keys--;
+    c->num_keys++;
+    return c;
+  }
+
+  // both siblings are minimal: merge with one of them
+  if (r != NULL) {
+    merge_children(p, i);
+    return c;
+  }
+
+  merge_children(p, i - 1);
+  return l;
+}
+
+my_type *remove_bt(my_type *elem, sexy_b_tree *t) {
+  assert(elem != NULL);
+
+  // fixups happen on the way down, so look first
+  my_type *ret = search_bt(elem, t);
+  if (ret == NULL)
+    return NULL;
+
+  // every node we go into (except the root) has at least BT_MIN_DEGREE
+  // keys, so taking one out never has to go back up
+  bt_node *cur = t->root;
+  my_type *key = elem;
+
+  for (;;) {
+    int found;
+    int i = node_lower_bound(cur, key, t, &found);
+
+    if (found && cur->leaf) {
+      for (int j = i; j < cur->num_keys - 1; j++)
+        copy_key(cur, j, cur, j + 1);
+      cur->num_keys--;
+      break;
+    }
+
+    bt_node *next;
+
+    if (found) {
+      bt_node *l = cur->kids[i];
+      bt_node *r = cur->kids[i + 1];
+
+      if (l->num_keys >= BT_MIN_DEGREE) {
+        // pull the predecessor up into the slot and go delete it
+        bt_node *m = l;
+        while (!m->leaf)
+          m = m->kids[m->num_keys];
+        key = m->keys[m->num_keys - 1];
+        set_key(cur, i, key);
+        next = l;
+      } else if (r->num_keys >= BT_MIN_DEGREE) {
+        // or the successor
+        bt_node *m = r;
+        while (!m->leaf)
+          m = m->kids[0];
+        key = m->keys[0];
+        set_key(cur, i, key);
+        next = r;
+      } else {
+        // neither can spare one: key moves down into the merged node
+        merge_children(cur, i);
+        next = l;
+      }
+    } else {
+      next = fill_child(cur, i);
+    }
+
+    // a merge can empty the root; its only child takes over
+    if (cur == t->root && cur->num_keys == 0) {
+      t->root = next;
+      free(cur);
+    }
+
+    cur = next;
+  }
+
+  t->num_keys--;
+
+  if (t->root->num_keys == 0) {
+    // was the last key
+    assert(t->root->leaf && t->num_keys == 0);
+    free(t->root);
+    t->root = NULL;
+  }
+
+  return ret;
+}
+
+static int check_bt_subtree(bt_node *n, int is_root, my_type *lo, my_type *hi,
+                            int (*comp)(my_type *, my_type *), int *count) {
+  if (n->num_keys > BT_MAX_KEYS || n->num_keys < (is_root ? 1 : BT_MIN_DEGREE - 1))
+    return -1;
+
+  for (int i = 0; i < n->num_keys; i++) {
+    my_type *prev = (i == 0) ? lo : n->keys[i - 1];
+    if (n->keys[i] == NULL || (prev != NULL && comp(n->keys[i], prev) != GREATER))
+      return -1;
+#if BT_INLINE_KEYS
+    if (n->ikeys[i] != BT_KEY_OF(n->keys[i]))
+      return -1;
+#endif
+  }
+  if (hi != NULL && comp(n->keys[n->num_keys - 1], hi) != LESS)
+    return -1;
+
+  *count += n->num_keys;
+
+  if (n->leaf)
+    return 0;
+
+  int depth = -1;
+  for (int i = 0; i <= n->num_keys; i++) {
+    my_type *klo = (i == 0) ? lo : n->keys[i - 1];
+    my_type *khi = (i == n->num_keys) ? hi : n->keys[i];
+    int d = check_bt_subtree(n->kids[i], 0, klo, khi, comp, count);
+
+    if (d < 0 || (depth >= 0 && d != depth) || d >= BT_MAX_DEPTH)
+      return -1;
+    depth = d;
+  }
+
+  return depth + 1;
+}
+
+int is_valid_b_tree(sexy_b_tree *t) {
+  if (t->root == NULL)
+    return t->num_keys == 0;
+
+  int count = 0;
+  if (check_bt_subtree(t->root, 1, NULL, NULL, t->comp, &count) < 0)
+    return 0;
+
+  return count == t->num_keys;
+}
+
+int bt_foreach(sexy_b_tree *t, int (*cb)(my_type *, void *), void *arg) {
+  int count = 0;
+  if (t->root != NULL)
+    bt_walk(t->root, cb, arg, &count);
+  return count;
+}
+
+static int bt_walk(bt_node *n, int (*cb)(my_type *, void *), void *arg, int *count) {
+  // kids[i] comes before keys[i], kids[num_keys] after the lot
+  for (int i = 0; i < n->num_keys; i++) {
+    if (!n->leaf && !bt_walk(n->kids[i], cb, arg, count))
+      return 0;
+    (*count)++;
+    if (!cb(n->keys[i], arg))
+      return 0;
+  }
+  return n->leaf || bt_walk(n->kids[n->num_keys], cb, arg, count);
+}
+
+int bt_size(sexy_b_tree *t) {
+  return t->num_keys;
+}
+
+ORDERED_DEFINE(bt, "b_tree", sexy_b_tree, create_bt, insert_bt, search_bt, remove_bt,
+               bt_foreach, bt_size, free_bt)
+
+/***************
+ * TEST SCRIPT *
+ ***************/
+
+static void test_node_layout(void) {
+  printf("beginning test_node_layout()\n");
+
+  // node fits in BT_NODE_BYTES unless even the minimum degree doesn't
+  assert(BT_MIN_DEGREE >= 2);
+  assert(sizeof(bt_node) <= BT_NODE_BYTES || BT_DEGREE_FIT < 2);
+
+  // and without inline keys, keys and kids fill it with nothing left over
+  assert(BT_INLINE_KEYS || BT_NODE_BYTES % 32 != 0 || sizeof(bt_node) == BT_NODE_BYTES);
+
+  bt_node *n = alloc_bt_node(1);
+  assert(n != NULL && ((size_t) n) % CACHE_LINE == 0);
+  free(n);
+
+  printf("test_node_layout() passed!\n");
+}
+
+#if BT_INLINE_KEYS
+static void test_count_less(void) {
+  printf("beginning test_count_less()\n");
+
+  // every length across a couple of vector widths plus the tail, and
+  // probes right at the ends of the int range
+  int keys[40];
+  srand(15);
+
+  for (int n = 0; n <= 40; n++) {
+    for (int it = 0; it < 200; it++) {
+      for (int i = 0; i < n; i++)
+        keys[i] = (it % 4 == 0) ? (rand() % 2 ? INT_MIN : INT_MAX) : rand() % 64 - 32;
+
+      int probes[4] = {rand() % 64 - 32, INT_MIN, INT_MAX, n ? keys[rand() % n] : 0};
+      for (int j = 0; j < 4; j++)
+        assert(count_less(keys, n, probes[j]) == count_less_scalar(keys, n, probes[j]));
+    }
+  }
+
+  printf("test_count_less() passed!\n");
+}
+#endif
+
+static void test_insert_search(void) {
+  printf("beginning test_insert_search()\n");
+
+  int n = 50000;
+  sexy_b_tree *t = create_bt(&int_compare);
+  assert(is_valid_b_tree(t));
+
+  my_type key;
+  key.x = 0;
+  assert(search_bt(&key, t) == NULL);
+
+  // scattered order; 7919 is prime so this hits every i once
+  for (int i = 0; i < n; i++) {
+    my_type *d = (my_type *) malloc(sizeof(my_type));
+    d->x = 2 * ((i * 7919) % n);
+    assert(insert_bt(d, t));
+
+    if (i % 5000 == 0)
+      assert(is_valid_b_tree(t));
+  }
+
+  assert(t->num_keys == n);
+  assert(is_valid_b_tree(t));
+
+  // duplicates are turned away and the tree is left alone
+  key.x = 10;
+  assert(!insert_bt(&key, t));
+  assert(t->num_keys == n);
+
+  for (int i = -1; i < 2 * n + 1; i++) {
+    key.x = i;
+    my_type *got = search_bt(&key, t);
+    if (i >= 0 && i < 2 * n && i % 2 == 0)
+      assert(got != NULL && got->x == i);
+    else
+      assert(got == NULL);
+  }
+
+  free_bt(t);
+  printf("test_insert_search() passed!\n");
+}
+
+static void test_remove(void) {
+  printf("beginning test_remove()\n");
+
+  int n = 50000;
+  sexy_b_tree *t = create_bt(&int_compare);
+  my_type **dat = (my_type **) malloc(n * sizeof(my_type *));
+
+  for (int i = 0; i < n; i++) {
+    dat[i] = (my_type *) malloc(sizeof(my_type));
+    dat[i]->x = i;
+    assert(insert_bt(dat[i], t));
+  }
+
+  // removing something not there does nothing
+  my_type missing;
+  missing.x = n;
+  assert(remove_bt(&missing, t) == NULL);
+  assert(t->num_keys == n);
+
+  // take out every other one in scattered order
+  for (int i = 0; i < n; i += 2) {
+    int k = (i * 7919) % n;
+    assert(remove_bt(dat[k], t) == dat[k]);
+    free(dat[k]);
+    dat[k] = NULL;
+
+    if (i % 5000 == 0)
+      assert(is_valid_b_tree(t));
+  }
+
+  assert(t->num_keys == n / 2);
+  assert(is_valid_b_tree(t));
+
+  for (int i = 0; i < n; i++) {
+    int k = (i * 7919) % n;
+    my_type key;
+    key.x = k;
+    assert(search_bt(&key, t) == dat[k]);
+  }
+
+  // empty it out completely, then make sure it's still usable
+  for (int i = 0; i < n; i++) {
+    if (dat[i] != NULL) {
+      assert(remove_bt(dat[i], t) == dat[i]);
+      free(dat[i]);
+    }
+  }
+
+  assert(t->num_keys == 0 && t->root == NULL);
+  assert(is_valid_b_tree(t));
+
+  my_type *d = (my_type *) malloc(sizeof(my_type));
+  d->x = 7;
+  assert(insert_bt(d, t));
+  assert(search_bt(d, t) == d);
+
+  free(dat);
+  free_bt(t);
+  printf("test_remove() passed!\n");
+}
+
+static void test_mixed(void) {
+  printf("beginning test_mixed()\n");
+
+  // random inserts and removes, checked against a plain array
+  int n = 4000;
+  sexy_b_tree *t = create_bt(&int_compare);
+  int *in = (int *) calloc(n, sizeof(int));
+  int count = 0;
+
+  srand(23);
+  for (int it = 0; it < 200000; it++) {
+    my_type key;
+    key.x = rand() % n;
+
+    if (rand() % 2) {
+      my_type *d = (my_type *) malloc(sizeof(my_type));
+      d->x = key.x;
+      int ok = insert_bt(d, t);
+      assert(ok == !in[key.x]);
+      if (!ok)
+        free(d);
+      count += ok;
+      in[key.x] = 1;
+    } else {
+      my_type *got = remove_bt(&key, t);
+      assert((got != NULL) == in[key.x]);
+      if (got != NULL) {
+        free(got);
+        count--;
+      }
+      in[key.x] = 0;
+    }
+
+    if (it % 20000 == 0)
+      assert(is_valid_b_tree(t));
+  }
+
+  assert(t->num_keys == count);
+  assert(is_valid_b_tree(t));
+
+  free(in);
+  free_bt(t);
+  printf("test_mixed() passed!\n");
+}
+
+// int_compare backwards
+static int reverse_compare(my_type *a, my_type *b) {
+  return int_compare(b, a);
+}
+
+// cb for bt_foreach: data has to come in decreasing order
+static int check_reversed(my_type *d, void *arg) {
+  int *last = (int *) arg;
+  assert(d->x < *last);
+  *last = d->x;
+  return 1;
+}
+
+static void test_other_comp(void) {
+  printf("beginning test_other_comp()\n");
+
+  // BT_KEY_OF doesn't order like this, so the tree has to search with
+  // comp and still come out valid
+  int n = 5000;
+  sexy_b_tree *t = create_bt(&reverse_compare);
+  sexy_b_tree *same = create_bt(&int_compare);
+  assert(!t->inline_search && same->inline_search == BT_INLINE_KEYS);
+  free_bt(same);
+
+  for (int i = 0; i < n; i++) {
+    my_type *d = (my_type *) malloc(sizeof(my_type));
+    d->x = (int) ((i * 7919LL) % n);
+    assert(insert_bt(d, t));
+  }
+  assert(is_valid_b_tree(t));
+
+  my_type key;
+  for (int i = 0; i < n; i++) {
+    key.x = i;
+    assert(search_bt(&key, t) != NULL && search_bt(&key, t)->x == i);
+  }
+  key.x = n;
+  assert(search_bt(&key, t) == NULL);
+
+  int last = n;
+  assert(bt_foreach(t, &check_reversed, &last) == n && last == 0);
+
+  for (int i = 0; i < n; i += 2) {
+    key.x = i;
+    my_type *d = remove_bt(&key, t);
+    assert(d != NULL && d->x == i);
+    free(d);
+  }
+  assert(t->num_keys == n / 2 && is_valid_b_tree(t));
+
+  free_bt(t);
+  printf("test_other_comp() passed!\n");
+}
+
+// cb for bt_foreach: data has to come in increasing order; stops
+// once *arg more have gone by
+static int check_ordered(my_type *d, void *arg) {
+  int *state = (int *) arg;
+  assert(d->x > state[0]);
+  state[0] = d->x;
+  return --state[1] > 0;
+}
+
+static void test_ordered(void) {
+  printf("beginning test_ordered()\n");
+  ordered *o = ordered_create(&bt_ordered_ops, &int_compare);
+  assert(o != NULL && ordered_size(o) == 0);
+  assert(strcmp(o->ops->name, "b_tree") == 0);
+
+  // enough for a few levels at any node size
+  int n = 20000;
+  my_type key;
+  for (int i = 0; i < n; i++) {
+    my_type *d = (my_type *) malloc(sizeof(my_type));
+    d->x = (int) ((i * 7919LL) % n);
+    assert(ordered_insert(o, d));
+    assert(ordered_search(o, d) == d);
+  }
+  key.x = 3;
+  assert(!ordered_insert(o, &key));
+  assert(ordered_size(o) == n);
+
+  int state[2] = {-1, n + 1};
+  assert(ordered_iterate(o, &check_ordered, state) == n && state[0] == n - 1);
+  state[0] = -1;
+  state[1] = 300;
+  assert(ordered_iterate(o, &check_ordered, state) == 300 && state[0] == 299);
+
+  for (int i = 0; i < n; i += 2) {
+    key.x = i;
+    my_type *d = ordered_remove(o, &key);
+    assert(d != NULL && d->x == i);
+    free(d);
+  }
+  assert(ordered_size(o) == n / 2 && ordered_search(o, &key) == NULL);
+
+  // knowing it's a B-tree gets the tree back for direct calls
+  sexy_b_tree *t = bt_of(o);
+  assert(t != NULL && is_valid_b_tree(t));
+  key.x = 1;
+  assert(search_bt(&key, t)->x == 1);
+
+  ordered_destroy(o);
+  printf("test_ordered() passed!\n");
+}
+
+static void test_all(void) {
+  test_node_layout();
+  printf("\n");
+#if BT_INLINE_KEYS
+  test_count_less();
+  printf("\n");
+#endif
+  test_insert_search();
+  printf("\n");
+  test_remove();
+  printf("\n");
+  test_mixed();
+  printf("\n");
+  test_other_comp();
+  printf("\n");
+  test_ordered();
+  printf("\n");
+}
+
+#ifndef BT_BENCH
+int main(void) {
+  test_all();
+}
+#else
+
+/*************
+ * BENCHMARK *
+ *************/
+
+// `make bench`: the ../bench/bench.h workloads at BT_NODE_BYTES
+#include "../bench/bench.h"
+
+static void *bench_create(void) {
+  return create_bt(&int_compare);
+}
+
+static int bench_insert(void *c, int key) {
+  my_type *d = (my_type *) malloc(sizeof(my_type));
+  d->x = key;
+  if (insert_bt(d, (sexy_b_tree *) c))
+    return 1;
+  free(d);
+  return 0;
+}
+
+static int bench_search(void *c, int key) {
+  my_type k;
+  k.x = key;
+  return search_bt(&k, (sexy_b_tree *) c) != NULL;
+}
+
+static int bench_remove(void *c, int key) {
+  my_type k;
+  k.x = key;
+  my_type *d = remove_bt(&k, (sexy_b_tree *) c);
+  free(d);
+  return d != NULL;
+}
+
+static void bench_destroy(void *c) {
+  free_bt((sexy_b_tree *) c);
+}
+
+int main(int argc, char **argv) {
+  bench_ops ops[] = {
+    {"b_tree", &bench_create, &bench_insert, &bench_search, &bench_remove, &bench_destroy},
+  };
+  return bench_main(argc, argv, ops, 1);
+}
+#endif
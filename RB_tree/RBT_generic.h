@@ -0,0 +1,684 @@
+/***************************************************
+ * Type-specialized red-black trees                *
+ * RB_DEFINE(name, key_t, cmp) spits out a whole   *
+ * tree for one key type, keys stored right in the *
+ * node and cmp inlined at compile time            *
+ ***************************************************/
+
+#ifndef RBT_GENERIC_H
+#define RBT_GENERIC_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef RED
+#define RED 50
+#define BLACK 51
+#endif
+
+#ifndef LESS
+#define LESS 61
+#define EQUAL 121
+#define GREATER 124
+#endif
+
+// color bit of an indexed node's parent_color; the rest is the index
+#define RB_IDX_RED 0x80000000u
+#define RB_IDX_MAX 0x7fffffffu
+
+/*************
+ * INTERFACE *
+ *************/
+
+// RB_DEFINE(name, key_t, cmp) defines
+//   name_node, name_tree
+//   name_tree *name_create(void)
+//   int name_insert(name_tree *, key_t)      1 on success, 0 on duplicate/no memory
+//   key_t *name_search(name_tree *, key_t)   pointer to stored key, NULL if missing
+//   int name_remove(name_tree *, key_t)      1 if removed, 0 if missing
+//   void name_free(name_tree *)
+//   int name_size(name_tree *)
+//   int name_is_valid(name_tree *)           1 for "yes," 0 for "no"; tests everything
+//
+// RB_DEFINE_PACKED(name, key_t, cmp) is the same tree but the color
+// lives in the low bit of the parent pointer (one word less per node)
+//
+// RB_DEFINE_INDEXED(name, key_t, cmp) is the same tree again but nodes
+// live in one array owned by the tree and link to each other with 32-bit
+// indices (color in the top bit of the parent index); name_free is O(1)
+// NOTE: name_insert can move the array, so a key_t * from name_search
+// is only good until the next insert
+//
+// cmp(const key_t *, const key_t *) has the same contract as the
+// comp passed into create_rb(): returns LESS, EQUAL or GREATER
+// make it a static inline function (or a macro) so it gets inlined
+//
+// keys are copied in with "=", so key_t should be a plain value type;
+// the tree never frees anything a key points to
+
+#define RB_DEFINE(name, key_t, cmp)                                         \
+  RB_LAYOUT_PLAIN_(name, key_t)                                             \
+  RB_PTR_TREE_(name)                                                        \
+  RB_BODY_(name, key_t, cmp)
+
+#define RB_DEFINE_PACKED(name, key_t, cmp)                                  \
+  RB_LAYOUT_PACKED_(name, key_t)                                            \
+  RB_PTR_TREE_(name)                                                        \
+  RB_BODY_(name, key_t, cmp)
+
+#define RB_DEFINE_INDEXED(name, key_t, cmp)                                 \
+  RB_LAYOUT_INDEXED_(name, key_t)                                           \
+  RB_BODY_(name, key_t, cmp)
+
+/******************
+ * IMPLEMENTATION *
+ ******************/
+
+// every layout provides name_ref (a node handle where 0 means "no node"),
+// the accessors below, name_new_node/name_release and the tree struct
+// (starting with root, num_nodes and use_pred); RB_BODY_ only talks to
+// nodes through those, so it compiles down to plain field accesses
+
+// the original layout: int color next to three pointers
+#define RB_LAYOUT_PLAIN_(name, key_t)                                       \
+  typedef struct name##_node {                                              \
+    key_t key;                                                              \
+                                                                            \
+    /* either RED or BLACK */                                               \
+    int node_color;                                                         \
+                                                                            \
+    struct name##_node *parent;                                             \
+    struct name##_node *left;                                               \
+    struct name##_node *right;                                              \
+  } name##_node;                                                            \
+                                                                            \
+  typedef name##_node *name##_ref;                                          \
+                                                                            \
+  typedef struct name##_tree {                                              \
+    name##_ref root;                                                        \
+    int num_nodes;                                                          \
+                                                                            \
+    /* alternates between pred and succ replacement on remove */            \
+    int use_pred;                                                           \
+  } name##_tree;                                                            \
+                                                                            \
+  static inline name##_ref name##_parent(name##_tree *t, name##_ref n) {    \
+    (void) t;                                                               \
+    return n->parent;                                                       \
+  }                                                                         \
+                                                                            \
+  static inline void name##_set_parent(name##_tree *t, name##_ref n,        \
+                                       name##_ref p) {                      \
+    (void) t;                                                               \
+    n->parent = p;                                                          \
+  }                                                                         \
+                                                                            \
+  static inline int name##_color(name##_tree *t, name##_ref n) {            \
+    (void) t;                                                               \
+    return n->node_color;                                                   \
+  }                                                                         \
+                                                                            \
+  static inline void name##_set_color(name##_tree *t, name##_ref n,         \
+                                      int color) {                          \
+    (void) t;                                                               \
+    n->node_color = color;                                                  \
+  }                                                                         \
+                                                                            \
+  RB_PTR_CHILDREN_(name, key_t)                                             \
+                                                                            \
+  static inline name##_ref name##_new_node(name##_tree *t, name##_ref p) {  \
+    (void) t;                                                               \
+    name##_ref n = (name##_ref) malloc(sizeof(name##_node));                \
+    if (n == NULL)                                                          \
+      return NULL;                                                          \
+                                                                            \
+    n->node_color = RED;                                                    \
+    n->parent = p;                                                          \
+    n->left = NULL;                                                         \
+    n->right = NULL;                                                        \
+    return n;                                                               \
+  }
+
+// color in the low bit of the parent pointer; malloc'ed nodes are at
+// least pointer aligned so that bit is always free (1 means red)
+#define RB_LAYOUT_PACKED_(name, key_t)                                      \
+  typedef struct name##_node {                                              \
+    struct name##_node *left;                                               \
+    struct name##_node *right;                                              \
+    uintptr_t parent_color;                                                 \
+    key_t key;                                                              \
+  } name##_node;                                                            \
+                                                                            \
+  typedef name##_node *name##_ref;                                          \
+                                                                            \
+  typedef struct name##_tree {                                              \
+    name##_ref root;                                                        \
+    int num_nodes;                                                          \
+    int use_pred;                                                           \
+  } name##_tree;                                                            \
+                                                                            \
+  static inline name##_ref name##_parent(name##_tree *t, name##_ref n) {    \
+    (void) t;                                                               \
+    return (name##_ref) (n->parent_color & ~(uintptr_t) 1);                 \
+  }                                                                         \
+                                                                            \
+  static inline void name##_set_parent(name##_tree *t, name##_ref n,        \
+                                       name##_ref p) {                      \
+    (void) t;                                                               \
+    n->parent_color = (uintptr_t) p | (n->parent_color & 1);                \
+  }                                                                         \
+                                                                            \
+  static inline int name##_color(name##_tree *t, name##_ref n) {            \
+    (void) t;                                                               \
+    return (n->parent_color & 1) ? RED : BLACK;                             \
+  }                                                                         \
+                                                                            \
+  static inline void name##_set_color(name##_tree *t, name##_ref n,         \
+                                      int color) {                          \
+    (void) t;                                                               \
+    n->parent_color = (n->parent_color & ~(uintptr_t) 1) | (color == RED);  \
+  }                                                                         \
+                                                                            \
+  RB_PTR_CHILDREN_(name, key_t)                                             \
+                                                                            \
+  static inline name##_ref name##_new_node(name##_tree *t, name##_ref p) {  \
+    (void) t;                                                               \
+    name##_ref n = (name##_ref) malloc(sizeof(name##_node));                \
+    if (n == NULL)                                                          \
+      return NULL;                                                          \
+                                                                            \
+    n->parent_color = (uintptr_t) p | 1;                                    \
+    n->left = NULL;                                                         \
+    n->right = NULL;                                                        \
+    return n;                                                               \
+  }
+
+// child and key accessors shared by the two pointer layouts
+#define RB_PTR_CHILDREN_(name, key_t)                                       \
+  static inline name##_ref name##_left(name##_tree *t, name##_ref n) {      \
+    (void) t;                                                               \
+    return n->left;                                                         \
+  }                                                                         \
+                                                                            \
+  static inline name##_ref name##_right(name##_tree *t, name##_ref n) {     \
+    (void) t;                                                               \
+    return n->right;                                                        \
+  }                                                                         \
+                                                                            \
+  static inline void name##_set_left(name##_tree *t, name##_ref n,          \
+                                     name##_ref c) {                        \
+    (void) t;                                                               \
+    n->left = c;                                                            \
+  }                                                                         \
+                                                                            \
+  static inline void name##_set_right(name##_tree *t, name##_ref n,         \
+                                      name##_ref c) {                       \
+    (void) t;                                                               \
+    n->right = c;                                                           \
+  }                                                                         \
+                                                                            \
+  static inline key_t *name##_key(name##_tree *t, name##_ref n) {           \
+    (void) t;                                                               \
+    return &n->key;                                                         \
+  }
+
+// create/free/release for trees made of malloc'ed nodes
+#define RB_PTR_TREE_(name)                                                  \
+  static inline name##_tree *name##_create(void) {                          \
+    name##_tree *ret = (name##_tree *) malloc(sizeof(name##_tree));         \
+    if (ret == NULL)                                                        \
+      return NULL;                                                          \
+                                                                            \
+    ret->root = NULL;                                                       \
+    ret->num_nodes = 0;                                                     \
+    ret->use_pred = 0;                                                      \
+    return ret;                                                             \
+  }                                                                         \
+                                                                            \
+  static inline void name##_release(name##_tree *t, name##_ref n) {         \
+    (void) t;                                                               \
+    free(n);                                                                \
+  }                                                                         \
+                                                                            \
+  /* walks down with parent pointers so no recursion or stack needed */     \
+  static inline void name##_free(name##_tree *t) {                          \
+    name##_ref n = t->root;                                                 \
+                                                                            \
+    while (n != NULL) {                                                     \
+      if (n->left != NULL) {                                                \
+        n = n->left;                                                        \
+      } else if (n->right != NULL) {                                        \
+        n = n->right;                                                       \
+      } else {                                                              \
+        name##_ref p = name##_parent(t, n);                                 \
+        if (p != NULL) {                                                    \
+          if (p->left == n)                                                 \
+            p->left = NULL;                                                 \
+          else                                                              \
+            p->right = NULL;                                                \
+        }                                                                   \
+        free(n);                                                            \
+        n = p;                                                              \
+      }                                                                     \
+    }                                                                       \
+                                                                            \
+    free(t);                                                                \
+  }
+
+// nodes in one array; slot 0 is never handed out so 0 can mean "no node"
+// removed slots go on a free list threaded through left
+#define RB_LAYOUT_INDEXED_(name, key_t)                                     \
+  typedef struct name##_node {                                              \
+    key_t key;                                                              \
+    uint32_t parent_color;                                                  \
+    uint32_t left;                                                          \
+    uint32_t right;                                                         \
+  } name##_node;                                                            \
+                                                                            \
+  typedef uint32_t name##_ref;                                              \
+                                                                            \
+  typedef struct name##_tree {                                              \
+    name##_ref root;                                                        \
+    int num_nodes;                                                          \
+    int use_pred;                                                           \
+                                                                            \
+    name##_node *nodes;                                                     \
+    uint32_t capacity;                                                      \
+    uint32_t used;                                                          \
+    name##_ref free_list;                                                   \
+  } name##_tree;                                                            \
+                                                                            \
+  static inline name##_ref name##_parent(name##_tree *t, name##_ref n) {    \
+    return t->nodes[n].parent_color & RB_IDX_MAX;                           \
+  }                                                                         \
+                                                                            \
+  static inline void name##_set_parent(name##_tree *t, name##_ref n,        \
+                                       name##_ref p) {                      \
+    t->nodes[n].parent_color = p | (t->nodes[n].parent_color & RB_IDX_RED); \
+  }                                                                         \
+                                                                            \
+  static inline int name##_color(name##_tree *t, name##_ref n) {            \
+    return (t->nodes[n].parent_color & RB_IDX_RED) ? RED : BLACK;           \
+  }                                                                         \
+                                                                            \
+  static inline void name##_set_color(name##_tree *t, name##_ref n,         \
+                                      int color) {                          \
+    t->nodes[n].parent_color = (t->nodes[n].parent_color & RB_IDX_MAX) |    \
+                               ((color == RED) ? RB_IDX_RED : 0);           \
+  }                                                                         \
+                                                                            \
+  static inline name##_ref name##_left(name##_tree *t, name##_ref n) {      \
+    return t->nodes[n].left;                                                \
+  }                                                                         \
+                                                                            \
+  static inline name##_ref name##_right(name##_tree *t, name##_ref n) {     \
+    return t->nodes[n].right;                                               \
+  }                                                                         \
+                                                                            \
+  static inline void name##_set_left(name##_tree *t, name##_ref n,          \
+                                     name##_ref c) {                        \
+    t->nodes[n].left = c;                                                   \
+  }                                                                         \
+                                                                            \
+  static inline void name##_set_right(name##_tree *t, name##_ref n,         \
+                                      name##_ref c) {                       \
+    t->nodes[n].right = c;                                                  \
+  }                                                                         \
+                                                                            \
+  static inline key_t *name##_key(name##_tree *t, name##_ref n) {           \
+    return &t->nodes[n].key;                                                \
+  }                                                                         \
+                                                                            \
+  static inline name##_tree *name##_create(void) {                          \
+    name##_tree *ret = (name##_tree *) malloc(sizeof(name##_tree));         \
+    if (ret == NULL)                                                        \
+      return NULL;                                                          \
+                                                                            \
+    ret->root = 0;                                                          \
+    ret->num_nodes = 0;                                                     \
+    ret->use_pred = 0;                                                      \
+    ret->nodes = NULL;                                                      \
+    ret->capacity = 0;                                                      \
+    ret->used = 1;                                                          \
+    ret->free_list = 0;                                                     \
+    return ret;                                                             \
+  }                                                                         \
+                                                                            \
+  /* returns 0 when out of memory or out of indices */                      \
+  static inline name##_ref name##_new_node(name##_tree *t, name##_ref p) {  \
+    name##_ref n = t->free_list;                                            \
+                                                                            \
+    if (n != 0) {                                                           \
+      t->free_list = t->nodes[n].left;                                      \
+    } else {                                                                \
+      if (t->used >= t->capacity) {                                         \
+        if (t->capacity > RB_IDX_MAX / 2)                                   \
+          return 0;                                                         \
+                                                                            \
+        uint32_t new_cap = (t->capacity == 0) ? 16 : t->capacity * 2;       \
+        name##_node *nodes = (name##_node *)                                \
+          realloc(t->nodes, new_cap * sizeof(name##_node));                 \
+        if (nodes == NULL)                                                  \
+          return 0;                                                         \
+                                                                            \
+        t->nodes = nodes;                                                   \
+        t->capacity = new_cap;                                              \
+      }                                                                     \
+      n = t->used++;                                                        \
+    }                                                                       \
+                                                                            \
+    t->nodes[n].parent_color = p | RB_IDX_RED;                              \
+    t->nodes[n].left = 0;                                                   \
+    t->nodes[n].right = 0;                                                  \
+    return n;                                                               \
+  }                                                                         \
+                                                                            \
+  static inline void name##_release(name##_tree *t, name##_ref n) {         \
+    t->nodes[n].left = t->free_list;                                        \
+    t->free_list = n;                                                       \
+  }                                                                         \
+                                                                            \
+  static inline void name##_free(name##_tree *t) {                          \
+    free(t->nodes);                                                         \
+    free(t);                                                                \
+  }
+
+// the actual red-black tree, same cases as RBT_implementation.c
+#define RB_BODY_(name, key_t, cmp)                                          \
+  static inline int name##_is_red(name##_tree *t, name##_ref n) {           \
+    return n != 0 && name##_color(t, n) == RED;                             \
+  }                                                                         \
+                                                                            \
+  static inline int name##_size(name##_tree *t) {                           \
+    return t->num_nodes;                                                    \
+  }                                                                         \
+                                                                            \
+  /* c (possibly 0) takes n's place under p (possibly 0 for the root) */    \
+  static inline void name##_replace_child(name##_tree *t, name##_ref p,     \
+                                          name##_ref n, name##_ref c) {     \
+    if (p == 0)                                                             \
+      t->root = c;                                                          \
+    else if (name##_left(t, p) == n)                                        \
+      name##_set_left(t, p, c);                                             \
+    else                                                                    \
+      name##_set_right(t, p, c);                                            \
+  }                                                                         \
+                                                                            \
+  static inline void name##_lrot(name##_tree *t, name##_ref n) {            \
+    name##_ref r = name##_right(t, n);                                      \
+    name##_ref p = name##_parent(t, n);                                     \
+    name##_ref rl = name##_left(t, r);                                      \
+                                                                            \
+    name##_set_right(t, n, rl);                                             \
+    if (rl != 0)                                                            \
+      name##_set_parent(t, rl, n);                                          \
+                                                                            \
+    name##_set_left(t, r, n);                                               \
+    name##_set_parent(t, n, r);                                             \
+    name##_set_parent(t, r, p);                                             \
+    name##_replace_child(t, p, n, r);                                       \
+  }                                                                         \
+                                                                            \
+  static inline void name##_rrot(name##_tree *t, name##_ref n) {            \
+    name##_ref l = name##_left(t, n);                                       \
+    name##_ref p = name##_parent(t, n);                                     \
+    name##_ref lr = name##_right(t, l);                                     \
+                                                                            \
+    name##_set_left(t, n, lr);                                              \
+    if (lr != 0)                                                            \
+      name##_set_parent(t, lr, n);                                          \
+                                                                            \
+    name##_set_right(t, l, n);                                              \
+    name##_set_parent(t, n, l);                                             \
+    name##_set_parent(t, l, p);                                             \
+    name##_replace_child(t, p, n, l);                                       \
+  }                                                                         \
+                                                                            \
+  static inline key_t *name##_search(name##_tree *t, key_t key) {           \
+    name##_ref cur = t->root;                                               \
+                                                                            \
+    while (cur != 0) {                                                      \
+      int res = cmp(&key, name##_key(t, cur));                              \
+      if (res == LESS)                                                      \
+        cur = name##_left(t, cur);                                          \
+      else if (res == GREATER)                                              \
+        cur = name##_right(t, cur);                                         \
+      else                                                                  \
+        return name##_key(t, cur);                                          \
+    }                                                                       \
+                                                                            \
+    return NULL;                                                            \
+  }                                                                         \
+                                                                            \
+  static inline int name##_insert(name##_tree *t, key_t key) {              \
+    name##_ref p = 0;                                                       \
+    name##_ref cur = t->root;                                               \
+    int res = EQUAL;                                                        \
+                                                                            \
+    /* one comparison per level on the way down */                          \
+    while (cur != 0) {                                                      \
+      p = cur;                                                              \
+      res = cmp(&key, name##_key(t, cur));                                  \
+      if (res == LESS)                                                      \
+        cur = name##_left(t, cur);                                          \
+      else if (res == GREATER)                                              \
+        cur = name##_right(t, cur);                                         \
+      else                                                                  \
+        /* DON'T ALLOW DUPLICATES */                                        \
+        return 0;                                                           \
+    }                                                                       \
+                                                                            \
+    name##_ref n = name##_new_node(t, p);                                   \
+    if (n == 0)                                                             \
+      return 0;                                                             \
+                                                                            \
+    *name##_key(t, n) = key;                                                \
+    if (p == 0)                                                             \
+      t->root = n;                                                          \
+    else if (res == LESS)                                                   \
+      name##_set_left(t, p, n);                                             \
+    else                                                                    \
+      name##_set_right(t, p, n);                                            \
+    t->num_nodes++;                                                         \
+                                                                            \
+    /* fix red-red violations going up */                                   \
+    while (name##_is_red(t, name##_parent(t, n))) {                         \
+      p = name##_parent(t, n);                                              \
+      /* p is red so it isn't the root and g exists */                      \
+      name##_ref g = name##_parent(t, p);                                   \
+                                                                            \
+      if (p == name##_left(t, g)) {                                         \
+        name##_ref u = name##_right(t, g);                                  \
+        if (name##_is_red(t, u)) {                                          \
+          name##_set_color(t, p, BLACK);                                    \
+          name##_set_color(t, u, BLACK);                                    \
+          name##_set_color(t, g, RED);                                      \
+          n = g;                                                            \
+          continue;                                                         \
+        }                                                                   \
+        if (n == name##_right(t, p)) {                                      \
+          name##_lrot(t, p);                                                \
+          n = p;                                                            \
+          p = name##_parent(t, n);                                          \
+        }                                                                   \
+        name##_set_color(t, p, BLACK);                                      \
+        name##_set_color(t, g, RED);                                        \
+        name##_rrot(t, g);                                                  \
+      } else {                                                              \
+        name##_ref u = name##_left(t, g);                                   \
+        if (name##_is_red(t, u)) {                                          \
+          name##_set_color(t, p, BLACK);                                    \
+          name##_set_color(t, u, BLACK);                                    \
+          name##_set_color(t, g, RED);                                      \
+          n = g;                                                            \
+          continue;                                                         \
+        }                                                                   \
+        if (n == name##_left(t, p)) {                                       \
+          name##_rrot(t, p);                                                \
+          n = p;                                                            \
+          p = name##_parent(t, n);                                          \
+        }                                                                   \
+        name##_set_color(t, p, BLACK);                                      \
+        name##_set_color(t, g, RED);                                        \
+        name##_lrot(t, g);                                                  \
+      }                                                                     \
+    }                                                                       \
+                                                                            \
+    name##_set_color(t, t->root, BLACK);                                    \
+    return 1;                                                               \
+  }                                                                         \
+                                                                            \
+  /* n is a black leaf still in the tree; same cases as remove_fixup */     \
+  static inline void name##_remove_fixup(name##_tree *t, name##_ref n) {    \
+    while (n != t->root) {                                                  \
+      name##_ref p = name##_parent(t, n);                                   \
+      int n_left = (n == name##_left(t, p));                                \
+      name##_ref s = n_left ? name##_right(t, p) : name##_left(t, p);       \
+                                                                            \
+      if (name##_is_red(t, s)) {                                            \
+        name##_set_color(t, p, RED);                                        \
+        name##_set_color(t, s, BLACK);                                      \
+        if (n_left)                                                         \
+          name##_lrot(t, p);                                                \
+        else                                                                \
+          name##_rrot(t, p);                                                \
+        s = n_left ? name##_right(t, p) : name##_left(t, p);                \
+      }                                                                     \
+                                                                            \
+      name##_ref sl = name##_left(t, s);                                    \
+      name##_ref sr = name##_right(t, s);                                   \
+                                                                            \
+      if (!name##_is_red(t, sl) && !name##_is_red(t, sr)) {                 \
+        name##_set_color(t, s, RED);                                        \
+        if (name##_is_red(t, p)) {                                          \
+          name##_set_color(t, p, BLACK);                                    \
+          return;                                                           \
+        }                                                                   \
+        n = p;                                                              \
+        continue;                                                           \
+      }                                                                     \
+                                                                            \
+      if (n_left && !name##_is_red(t, sr)) {                                \
+        name##_set_color(t, s, RED);                                        \
+        name##_set_color(t, sl, BLACK);                                     \
+        name##_rrot(t, s);                                                  \
+        s = name##_right(t, p);                                             \
+      } else if (!n_left && !name##_is_red(t, sl)) {                        \
+        name##_set_color(t, s, RED);                                        \
+        name##_set_color(t, sr, BLACK);                                     \
+        name##_lrot(t, s);                                                  \
+        s = name##_left(t, p);                                              \
+      }                                                                     \
+                                                                            \
+      name##_set_color(t, s, name##_color(t, p));                           \
+      name##_set_color(t, p, BLACK);                                        \
+      if (n_left) {                                                         \
+        name##_set_color(t, name##_right(t, s), BLACK);                     \
+        name##_lrot(t, p);                                                  \
+      } else {                                                              \
+        name##_set_color(t, name##_left(t, s), BLACK);                      \
+        name##_rrot(t, p);                                                  \
+      }                                                                     \
+      return;                                                               \
+    }                                                                       \
+  }                                                                         \
+                                                                            \
+  static inline int name##_remove(name##_tree *t, key_t key) {              \
+    name##_ref n = t->root;                                                 \
+                                                                            \
+    while (n != 0) {                                                        \
+      int res = cmp(&key, name##_key(t, n));                                \
+      if (res == LESS)                                                      \
+        n = name##_left(t, n);                                              \
+      else if (res == GREATER)                                              \
+        n = name##_right(t, n);                                             \
+      else                                                                  \
+        break;                                                              \
+    }                                                                       \
+                                                                            \
+    if (n == 0)                                                             \
+      return 0;                                                             \
+                                                                            \
+    /* two children: pull pred/succ key up and remove that node instead */  \
+    if (name##_left(t, n) != 0 && name##_right(t, n) != 0) {                \
+      name##_ref rep;                                                       \
+      if (t->use_pred) {                                                    \
+        rep = name##_left(t, n);                                            \
+        while (name##_right(t, rep) != 0)                                   \
+          rep = name##_right(t, rep);                                       \
+      } else {                                                              \
+        rep = name##_right(t, n);                                           \
+        while (name##_left(t, rep) != 0)                                    \
+          rep = name##_left(t, rep);                                        \
+      }                                                                     \
+      t->use_pred = !t->use_pred;                                           \
+      *name##_key(t, n) = *name##_key(t, rep);                              \
+      n = rep;                                                              \
+    }                                                                       \
+                                                                            \
+    name##_ref child = (name##_left(t, n) != 0) ? name##_left(t, n)         \
+                                                : name##_right(t, n);       \
+                                                                            \
+    if (!name##_is_red(t, n)) {                                             \
+      if (name##_is_red(t, child))                                          \
+        name##_set_color(t, child, BLACK);                                  \
+      else                                                                  \
+        name##_remove_fixup(t, n);                                          \
+    }                                                                       \
+                                                                            \
+    /* cut n out */                                                         \
+    name##_ref p = name##_parent(t, n);                                     \
+    if (child != 0)                                                         \
+      name##_set_parent(t, child, p);                                       \
+    name##_replace_child(t, p, n, child);                                   \
+                                                                            \
+    name##_release(t, n);                                                   \
+    t->num_nodes--;                                                         \
+    return 1;                                                               \
+  }                                                                         \
+                                                                            \
+  /* returns black height of n's subtree, -1 if anything is wrong */        \
+  /* lo and hi are exclusive bounds on keys (NULL for none) */              \
+  static inline int name##_check(name##_tree *t, name##_ref n,              \
+                                 name##_ref p, key_t *lo, key_t *hi,        \
+                                 int *count) {                              \
+    if (n == 0)                                                             \
+      return 1;                                                             \
+                                                                            \
+    key_t *k = name##_key(t, n);                                            \
+                                                                            \
+    if (name##_parent(t, n) != p)                                           \
+      return -1;                                                            \
+    if (lo != NULL && cmp(k, lo) != GREATER)                                \
+      return -1;                                                            \
+    if (hi != NULL && cmp(k, hi) != LESS)                                   \
+      return -1;                                                            \
+    if (name##_is_red(t, n) &&                                              \
+        (name##_is_red(t, name##_left(t, n)) ||                             \
+         name##_is_red(t, name##_right(t, n))))                             \
+      return -1;                                                            \
+                                                                            \
+    (*count)++;                                                             \
+                                                                            \
+    int l = name##_check(t, name##_left(t, n), n, lo, k, count);            \
+    int r = name##_check(t, name##_right(t, n), n, k, hi, count);           \
+    if (l < 0 || r < 0 || l != r)                                           \
+      return -1;                                                            \
+                                                                            \
+    return l + (name##_is_red(t, n) ? 0 : 1);                               \
+  }                                                                         \
+                                                                            \
+  static inline int name##_is_valid(name##_tree *t) {                       \
+    if (t == NULL)                                                          \
+      return 0;                                                             \
+    if (name##_is_red(t, t->root))                                          \
+      return 0;                                                             \
+                                                                            \
+    int count = 0;                                                          \
+    if (name##_check(t, t->root, 0, NULL, NULL, &count) < 0)                \
+      return 0;                                                             \
+                                                                            \
+    return count == t->num_nodes;                                           \
+  }
+
+#endif
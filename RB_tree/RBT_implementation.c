@@ -7,10 +7,21 @@
  * http://en.wikipedia.org/wiki/Red_Black_tree     *
  ***************************************************/
 
+// for pthreads, posix_memalign and sched_yield under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #define RED 50
 #define BLACK 51
@@ -19,6 +30,49 @@
 #define GREATER 124
 #define PRED 153
 #define SUCC 161
+#define RB_CACHE_LRU 171
+#define RB_CACHE_LFU 183
+
+// default number of nodes carved out of each arena slab
+#define SLAB_NODES 4096
+
+// keep subtree sizes in every node so rb_select/rb_rank are O(log n)
+// the int fits in padding next to node_color, so rb_node doesn't grow;
+// build with -DRB_ORDER_STATS=0 to skip the upkeep on insert/remove
+#ifndef RB_ORDER_STATS
+#define RB_ORDER_STATS 1
+#endif
+
+// build with -DRB_STATS=1 to count what the hot paths do (see rb_stats)
+// off by default; every counter compiles away to nothing then
+#ifndef RB_STATS
+#define RB_STATS 0
+#endif
+
+// concurrent mode: reader slots are padded out to this so readers
+// never share a line; MAX_READ_DEPTH is a path no valid tree of
+// INT_MAX nodes can need, so a read that goes longer got lost in a
+// rotation and starts over
+#define CACHE_LINE 64
+#define MAX_READERS 64
+#define MAX_READ_DEPTH 128
+
+// how many lookups search_batch walks down the tree at once
+#define SEARCH_BATCH_WIDTH 16
+
+// hint that p is about to be read; compiles to nothing if unsupported
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void) (p))
+#endif
+
+// RB_DEFINE for trees specialized to one key type
+#include "RBT_generic.h"
+
+// ordered_ops, so the tree can be picked at runtime with the B-tree
+// and skip list (see the ORDERED section)
+#include "../modularizing_baby/ordered.h"
 
 /****************
  * USER-DEFINED *
@@ -49,15 +103,102 @@ typedef struct rb_node {
   // either RED or BLACK
   int node_color;
 
+#if RB_ORDER_STATS
+  // number of nodes in the subtree rooted here, counting this one
+  int size;
+#endif
+
   struct rb_node *parent;
   struct rb_node *left;
   struct rb_node *right;
 } rb_node;
 
+// one block of nodes handed out by a node arena
+typedef struct rb_slab {
+  struct rb_slab *next;
+  rb_node nodes[];
+} rb_slab;
+
+// optional per-tree node allocator; nodes come out of big slabs
+// and removed nodes go on a free list (threaded through ->right)
+// so the next insert reuses them
+typedef struct rb_arena {
+  // most recent slab first; only the first one is partly used
+  rb_slab *slabs;
+  int num_slabs;
+  int slab_nodes;
+  int used;
+
+  rb_node *free_list;
+} rb_arena;
+
+// one per reader thread in concurrent mode; see rb_reader_join
+// all unsigned long / pointer sized so the padding comes out exact
+typedef struct rb_reader {
+  // odd while the reader is inside a lookup
+  unsigned long ctr;
+  unsigned long in_use;
+  struct sexy_rb_tree *tree;
+  char pad[CACHE_LINE - 3 * sizeof(unsigned long)];
+} rb_reader;
+
+// what a tree needs for concurrent mode: writers take write_lock
+// and make seq odd while they change the tree; readers don't lock,
+// they walk the tree and start over if seq moved underneath them
+typedef struct rb_sync {
+  unsigned long seq;
+  pthread_mutex_t write_lock;
+
+  int max_readers;
+  rb_reader *readers;
+} rb_sync;
+
+#if RB_STATS
+// what rb_stats hands back; all running totals since the tree was
+// made, so diff two of them to get rates (e.g. comparisons per op)
+typedef struct rb_counters {
+  // calls to search_baby/search_baby_read (each search_batch key is one)
+  unsigned long searches;
+  // insert_baby/remove_baby calls, including ones that found a duplicate
+  // or nothing to remove
+  unsigned long inserts;
+  unsigned long removes;
+
+  // comp calls made walking down the tree
+  unsigned long comparisons;
+  unsigned long lrots;
+  unsigned long rrots;
+  // times insert_fixup found a red parent and a red uncle and pushed
+  // the red up to the grand parent
+  unsigned long recolors;
+  // trips around insert_fixup's and remove_fixup's loops
+  unsigned long fixup_iterations;
+  // most nodes any one walk down the tree went through
+  unsigned long max_depth;
+  // nodes asked of alloc_node (malloc or arena)
+  unsigned long node_allocs;
+} rb_counters;
+
+// each thread counts into its own slot (picked the first time it
+// touches any tree), padded so no two slots share a line; threads past
+// RB_STATS_SLOTS double up on slots and may lose the odd count
+#define RB_STATS_SLOTS 64
+typedef struct rb_stats_slot {
+  rb_counters c;
+  char pad[CACHE_LINE - sizeof(rb_counters) % CACHE_LINE];
+} rb_stats_slot;
+#endif
+
 typedef struct sexy_rb_tree {
   rb_node *root;
   int num_nodes;
 
+  // NULL means nodes are malloc'ed and free'd one at a time
+  rb_arena *arena;
+
+  // NULL unless the tree was made with create_rb_concurrent
+  rb_sync *sync;
+
   // keeps track of whether replacement
   // (subroutine of remove_baby) should try to use
   // successor or predecessor; can be either PRED or SUPP
@@ -65,31 +206,155 @@ typedef struct sexy_rb_tree {
 
   // returns LESS iff "a < b", EQUAL iff "a == b", GREATER iff "a > b"
   int (*comp)(my_type *, my_type *);
+
+#if RB_STATS
+  // RB_STATS_SLOTS of them, CACHE_LINE aligned; NULL counts nothing
+  rb_stats_slot *stats;
+#endif
 } sexy_rb_tree;
 
 // usual "create, insert, remove, search, and free" functions
 // first 4 rely on the comparison function passed into create_rb()
+// insert_baby returns 1 on success, 0 if something EQUAL is already
+// in the tree (tree is left alone) or if out of memory
 sexy_rb_tree *create_rb(int (*)(my_type *, my_type *));
+// same as create_rb but nodes come from a slab arena with
+// slab_nodes nodes per slab (SLAB_NODES if slab_nodes <= 0)
+sexy_rb_tree *create_rb_arena(int (*)(my_type *, my_type *), int slab_nodes);
+
+// CONCURRENT MODE
+// an arena tree that many threads can read while one at a time writes
+// insert_baby/remove_baby/bulk_load_rb serialize among themselves and
+// readers never block on them; each reader thread joins once and
+// looks things up with search_baby_read (NOT search_baby)
+// nodes stay in the arena until free_rb, so a reader racing a write
+// never touches freed memory; the data is yours though, so after
+// remove_baby call rb_synchronize before freeing what it returned
+// max_readers <= 0 means MAX_READERS
+sexy_rb_tree *create_rb_concurrent(int (*)(my_type *, my_type *), int slab_nodes,
+                                   int max_readers);
+
+// claims a reader slot for the calling thread; NULL if the tree isn't
+// concurrent or every slot is taken
+rb_reader *rb_reader_join(sexy_rb_tree *);
+void rb_reader_leave(rb_reader *);
+
+// search_baby for readers; lock-free, retries if a write got in the way
+// rb_synchronize only waits out searches still running, so what this
+// hands back can be removed and freed as soon as it returns unless the
+// caller knows nothing's removing it
+my_type *search_baby_read(my_type *, rb_reader *);
+
+// waits until every search_baby_read that was running when this was
+// called has finished; after that nothing removed before the call can
+// still be looked at by a reader
+void rb_synchronize(sexy_rb_tree *);
 int insert_baby(my_type *, sexy_rb_tree *);
 my_type *remove_baby(my_type *, sexy_rb_tree *);
 my_type *search_baby(my_type *, sexy_rb_tree *);
 void free_rb(sexy_rb_tree *);
 rb_node *get_root(sexy_rb_tree *);
 
-// primarily for testing purposes
-// DOES NOT TEST BST INVARIANTS!
+// same as calling search_baby on each of keys[0 .. n) and putting
+// the results in out[0 .. n), but walks SEARCH_BATCH_WIDTH lookups
+// down the tree in lockstep and prefetches each one's next node and
+// data so their cache misses overlap instead of happening one by one
+void search_batch(sexy_rb_tree *, my_type **keys, size_t n, my_type **out);
+
+// builds a perfectly balanced tree out of n my_type *'s that are
+// already sorted (strictly increasing under the tree's comp) in O(n)
+// t must be empty; tree takes ownership of the data like insert_baby
+// returns 1 on success, 0 if t isn't empty, sorted isn't sorted,
+// or out of memory (t is left empty in all those cases)
+int bulk_load_rb(sexy_rb_tree *t, my_type **sorted, size_t n);
+
+// in-order cursors; follow parent pointers so no stack or allocation
+// NULL means "off the end"; removing the node a cursor is on kills
+// the cursor (and remove_baby may move data between nodes)
+rb_node *rb_first(sexy_rb_tree *);
+rb_node *rb_last(sexy_rb_tree *);
+rb_node *rb_next(rb_node *);
+rb_node *rb_prev(rb_node *);
+
+// first node whose data isn't LESS than key, NULL if none
+rb_node *rb_lower_bound(my_type *key, sexy_rb_tree *);
+
+#if RB_ORDER_STATS
+// k-th smallest thing in the tree (counting from 0), NULL if k is out of range
+my_type *rb_select(int k, sexy_rb_tree *);
+
+// how many things in the tree are LESS than key
+// (so the index key has or would have in sorted order)
+int rb_rank(my_type *key, sexy_rb_tree *);
+#endif
+
+#if RB_STATS
+// adds up every thread's counters (max_depth is the max over them)
+// safe to call while other threads are using the tree; counts from
+// operations still in flight may or may not be in it yet
+rb_counters rb_stats(sexy_rb_tree *);
+#endif
+
+// calls cb(data, arg) in order on everything from lo to hi (inclusive)
+// stops early if cb returns 0; returns how many times cb was called
+int rb_range(my_type *lo, my_type *hi, sexy_rb_tree *,
+             int (*cb)(my_type *, void *), void *arg);
+
+// rb_range over the whole tree
+int rb_foreach(sexy_rb_tree *, int (*cb)(my_type *, void *), void *arg);
+int rb_size(sexy_rb_tree *);
+
+// checks everything in one O(n) pass: root is black, no red node has
+// a red child, every path has the same number of black nodes, BST
+// order, parent pointers, subtree sizes, and num_nodes
+// uses no globals, so it's fine to run on a live tree from any thread
+// that holds off the writers; an empty tree is valid
 // returns 1 for "yes," 0 for "no"
 int is_valid_rb_tree(sexy_rb_tree *);
 
-static int red_parent_black_children(rb_node *);
-static int path_black_nodes(rb_node *);
+// checks the subtree at n, whose parent should be p; lo and hi are
+// exclusive bounds on n's data (NULL for no bound); adds the number
+// of nodes seen to *count
+// returns the black height of the subtree (NULL counts as 1),
+// -1 if anything is wrong
+static int check_subtree(rb_node *n, rb_node *p, my_type *lo, my_type *hi,
+                         int (*comp)(my_type *, my_type *), int *count);
 
 // returns 1 if red, 0 if black
 static int is_red(rb_node *);
 
 // helper functions: DO NOT EXPOSE
 static void free_rb_nodes(rb_node *);
-static int insert_rb_node(rb_node *, sexy_rb_tree *);
+
+// get a node from the tree's arena (or malloc if it has none)
+// returns NULL on failure
+static rb_node *alloc_node(sexy_rb_tree *);
+
+// give a node back to the tree's arena (or free if it has none)
+// doesn't touch n->data
+static void release_node(rb_node *, sexy_rb_tree *);
+
+// frees all the data held in the arena and then the slabs themselves
+static void free_arena(rb_arena *);
+
+// bracket every change a writer makes in concurrent mode
+static void write_begin(sexy_rb_tree *);
+static void write_end(sexy_rb_tree *);
+
+// the actual insert/remove/bulk load; the public versions wrap
+// these in write_begin/write_end for concurrent trees
+static int insert_unlocked(my_type *, sexy_rb_tree *);
+static my_type *remove_unlocked(my_type *, sexy_rb_tree *);
+static int bulk_load_unlocked(sexy_rb_tree *, my_type **, size_t);
+
+// gives back every node under n without touching the data
+static void release_nodes(rb_node *, sexy_rb_tree *);
+
+// links sorted[lo, hi) in under p (on side dir) as a balanced subtree
+// nodes at depth red_depth are colored red, everything else black
+// returns 0 if ran out of memory
+static int build_balanced(my_type **sorted, size_t lo, size_t hi, rb_node *p,
+                          int dir, int depth, int red_depth, sexy_rb_tree *);
 
 
 // traversing functions
@@ -98,6 +363,19 @@ static rb_node *uncle(rb_node *);
 static rb_node *parent(rb_node *);
 static rb_node *get_left(rb_node *);
 static rb_node *get_right(rb_node *);
+static rb_node *sibling(rb_node *);
+
+// stores to the fields search_baby_read walks (root, left, right,
+// data), atomic so in a concurrent tree they pair with the readers'
+// atomic loads; release (and the reader's loads acquire) so a reader
+// that follows a link sees the node as it was linked, and one that
+// picks up data (even data a remove just moved up) sees the my_type
+// as it was inserted; on x86 all of these are plain stores, so
+// single-threaded trees use them too
+static void set_root(sexy_rb_tree *, rb_node *);
+static void set_left(rb_node *, rb_node *);
+static void set_right(rb_node *, rb_node *);
+static void set_data(rb_node *, my_type *);
 
 // left and right rotate for trees
 static int lrot(rb_node *, sexy_rb_tree *);
@@ -106,22 +384,29 @@ static int rrot(rb_node *, sexy_rb_tree *);
 static int set_color (rb_node *, int);
 
 
-// returns 1 on success
-static int insert_base(rb_node *, sexy_rb_tree *);
-static int insert_black_parent(rb_node *, sexy_rb_tree *);
+// walks down from the root with one comparison per level
+// returns the node that would become the parent of a node holding
+// elem (NULL if the tree is empty) and sets *dir to LESS or GREATER
+// for which side it goes on; if elem is already in the tree sets
+// *dir to EQUAL and returns the node holding it instead
+static rb_node *find_insert_parent(my_type *elem, sexy_rb_tree *, int *dir);
 
-// both parent and uncle are red
-static int insert_both_red(rb_node *, sexy_rb_tree *);
+// hooks n in under p on side dir (or as the root if p is NULL)
+// without fixing the tree
+static void link_node(rb_node *n, rb_node *p, int dir, sexy_rb_tree *);
 
-// parent red, uncle black
-static int insert_pred_ublack_opp(rb_node *, sexy_rb_tree *);
+// fixes red-red violations from n up to the root
+// loops instead of recursing
+static void insert_fixup(rb_node *, sexy_rb_tree *);
 
-static int insert_pred_ublack_same(rb_node *, sexy_rb_tree *);
+// insert_fixup up to (not including) making the root black; the root
+// is red after it iff the red got pushed all the way up, which is when
+// the black height goes up by one
+static void insert_rebalance(rb_node *, sexy_rb_tree *);
 
 // insert node without fixing tree
-// returns the node after insertion into the tree
-static rb_node *node_insert_node(rb_node *, rb_node *, int (*)(my_type *, my_type *));
-
+// returns n after insertion into the tree, NULL if
+// something equal to n->data is already there
 static rb_node *binary_insert_node(rb_node *, sexy_rb_tree *);
 
 // update data with predecessor
@@ -141,6 +426,590 @@ static rb_node *replace_with_succ(rb_node *);
 // both n->left and n->right are NULL
 static rb_node *simple_replace(rb_node *n, int sorp);
 
+// finds the node holding data equal to elem
+// returns NULL if no such node
+static rb_node *search_node(my_type *, sexy_rb_tree *);
+
+// puts child (possibly NULL) where n used to be; doesn't free n
+static void splice_node(rb_node *n, rb_node *child, sexy_rb_tree *);
+
+// if n has two children moves pred/succ data up into n (flipping
+// t->sorp); returns the node that has to come out of the tree
+// afterwards, which has at most one child (n itself if no move)
+static rb_node *pick_removed(rb_node *n, sexy_rb_tree *);
+
+// removes a node with at most one child and frees it
+// (but not its data); fixes the tree as necessary
+static void remove_one_child(rb_node *, sexy_rb_tree *);
+
+// rebalances after removing a black node with no children;
+// n is still in the tree and acts as the "doubly black" node
+// loops up the tree instead of recursing and never allocates
+static void remove_fixup(rb_node *, sexy_rb_tree *);
+
+// adds delta to the size of n and every ancestor of n
+// does nothing if RB_ORDER_STATS is off
+static void adjust_sizes(rb_node *n, int delta);
+
+#if RB_ORDER_STATS
+// size of the subtree at n; 0 for NULL
+static int node_size(rb_node *);
+
+// recomputes n's size from its children
+static void update_size(rb_node *);
+#endif
+
+#if RB_STATS
+// the calling thread's counters in t; NULL if t counts nothing
+static rb_counters *stats_of(sexy_rb_tree *t);
+
+// relaxed load and store, not an atomic add: only the slot's own
+// thread writes it, so this is a plain add that rb_stats can read
+// without a data race
+static void stat_bump(unsigned long *c, unsigned long v);
+static void stat_max(unsigned long *c, unsigned long v);
+
+#define STAT_ADD(t, field, v)                   \
+  do {                                          \
+    rb_counters *c_ = stats_of(t);              \
+    if (c_ != NULL)                             \
+      stat_bump(&c_->field, (v));               \
+  } while (0)
+
+// one walk down the tree: cmps comparisons, depth nodes deep
+#define STAT_WALK(t, cmps, depth)               \
+  do {                                          \
+    rb_counters *c_ = stats_of(t);              \
+    if (c_ != NULL) {                           \
+      stat_bump(&c_->comparisons, (cmps));      \
+      stat_max(&c_->max_depth, (depth));        \
+    }                                           \
+  } while (0)
+
+// a counter that only lives for one call
+#define STAT_LOCAL(v) unsigned long v = 0
+#define STAT_INC(v) ((v)++)
+#else
+#define STAT_ADD(t, field, v) ((void) 0)
+#define STAT_WALK(t, cmps, depth) ((void) 0)
+#define STAT_LOCAL(v)
+#define STAT_INC(v) ((void) 0)
+#endif
+
+/*********************
+ * PERSISTENT TREES  *
+ *********************/
+
+// longest root-to-leaf path a persistent tree can have
+// (2 * log2(INT_MAX) with room to spare); sizes the path stacks
+#define PRB_MAX_DEPTH 128
+
+// nodes of a persistent tree can be shared between versions, so
+// there's no parent pointer (that would pin a node to one version);
+// writes walk down keeping the path on a stack instead
+typedef struct prb_node {
+  my_type *data;
+
+  // either RED or BLACK
+  int node_color;
+
+  // how many nodes/versions point here; 1 means only the live tree
+  // has it, so it can be changed in place; only changed atomically
+  int refs;
+
+  struct prb_node *left;
+  struct prb_node *right;
+} prb_node;
+
+typedef struct persistent_rb {
+  prb_node *root;
+  int num_nodes;
+
+  // same as sexy_rb_tree
+  int sorp;
+  int (*comp)(my_type *, my_type *);
+
+  // nodes for prb_cow (and insert's new node) to take, chained through
+  // left; every write tops this up to its worst case before it changes
+  // anything, so running out of memory never leaves a write half done
+  prb_node *spare;
+  int num_spare;
+} persistent_rb;
+
+// read-only view of a persistent_rb as of rb_snapshot
+typedef struct rb_version {
+  prb_node *root;
+  int num_nodes;
+  int (*comp)(my_type *, my_type *);
+} rb_version;
+
+// usual create/insert/remove/search/free but insert_prb and remove_prb
+// copy only the nodes on the path they change (plus the odd sibling
+// the fixup recolors) if those nodes are shared with a snapshot, and
+// change them in place otherwise
+// unlike sexy_rb_tree the tree NEVER frees data: snapshots can still
+// be pointing at data removed from the live tree
+// one writer thread; snapshots can be read and released from anywhere
+// insert_prb returns 0 (and remove_prb NULL) if out of memory too; the
+// tree is left as it was
+persistent_rb *create_prb(int (*)(my_type *, my_type *));
+int insert_prb(my_type *, persistent_rb *);
+my_type *remove_prb(my_type *, persistent_rb *);
+my_type *search_prb(my_type *, persistent_rb *);
+void free_prb(persistent_rb *);
+
+// O(1): shares the live tree's root; NULL if out of memory
+// call from the writer thread (or with writes held off)
+rb_version *rb_snapshot(persistent_rb *);
+my_type *search_version(my_type *, rb_version *);
+
+// calls cb(data, arg) on everything in the version in order; stops
+// early if cb returns 0; returns how many times cb was called
+int version_foreach(rb_version *, int (*cb)(my_type *, void *), void *arg);
+void release_version(rb_version *);
+
+// same checks as is_valid_rb_tree minus parent pointers and sizes
+int is_valid_prb(persistent_rb *);
+int is_valid_version(rb_version *);
+
+// makes sure t->spare has at least n nodes; returns 1 on success, 0
+// if out of memory (whatever did get allocated stays for next time)
+static int prb_reserve(persistent_rb *, int n);
+
+// a node off t->spare; prb_reserve has to have made room for it
+static prb_node *prb_take(persistent_rb *);
+
+// gets a node at *link that's safe to change, copying it (and
+// pointing *link at the copy) if it's shared; *link must be
+// reachable only from the live tree, i.e. already made mutable
+// copies come off t->spare, so this can't fail
+static prb_node *prb_cow(persistent_rb *, prb_node **link);
+
+// drops one reference to n, freeing it (and dropping its children)
+// when nothing points at it anymore
+static void prb_release(prb_node *n);
+
+// link to path[i] from its parent (or the root)
+static prb_node **prb_link(persistent_rb *, prb_node **path, int i);
+
+// rotate the node at *link; it and the child coming up must be mutable
+static void prb_lrot(prb_node **link);
+static void prb_rrot(prb_node **link);
+
+// same cases as remove_fixup; the missing black is on side n_left
+// of path[i - 1] (whose whole path from the root is mutable)
+static void prb_remove_fixup(persistent_rb *, prb_node **path, int i, int n_left);
+
+/********************
+ * ON-DISK FORMAT   *
+ ********************/
+
+// file is a header followed by num_nodes rb_disk_nodes in preorder
+// (so a node's left child is right after it); links are indexes into
+// the node array instead of pointers, and the my_type is stored by
+// value, so this only works while my_type has no pointers in it
+// everything's in the host's byte order; byte_order catches a file
+// written on a machine with the other one
+#define RB_DISK_MAGIC "SEXYRB01"
+#define RB_DISK_BYTE_ORDER 0x01020304u
+#define RB_DISK_NIL UINT32_MAX
+
+typedef struct rb_disk_header {
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t node_size;
+  uint32_t num_nodes;
+  uint32_t root;
+} rb_disk_header;
+
+typedef struct rb_disk_node {
+  uint32_t left;
+  uint32_t right;
+  uint32_t node_color;
+  my_type data;
+} rb_disk_node;
+
+// read-only tree over a mapped file; nothing is read off disk until
+// a search touches it, and every process mapping the same file shares
+// the same page cache
+typedef struct rb_mapped {
+  void *base;
+  size_t len;
+  const rb_disk_node *nodes;
+  uint32_t num_nodes;
+  uint32_t root;
+  int (*comp)(my_type *, my_type *);
+} rb_mapped;
+
+// writes t to path (through path.tmp and a rename, so anyone who has
+// the old file mapped keeps a consistent copy); returns 1 on success
+// the file and the rename are both fsync'd first, so once this
+// returns 1 the new file survives a crash
+// a concurrent tree's writers are held off for the duration
+int rb_save(sexy_rb_tree *, const char *path);
+
+// fsyncs the directory path is in, so a rename into it sticks;
+// returns 1 on success
+static int sync_parent_dir(const char *path);
+
+// maps a file written by rb_save; NULL if it can't be opened or
+// doesn't look like one (wrong magic, byte order, node size or length)
+rb_mapped *rb_open_mmap(const char *path, int (*)(my_type *, my_type *));
+
+// same as search_baby but the result points into the (read-only)
+// mapping and is only good until rb_close_mmap
+// the map is never written, so comp must not write through its args
+const my_type *search_mapped(my_type *, rb_mapped *);
+int mapped_size(rb_mapped *);
+void rb_close_mmap(rb_mapped *);
+
+// writes the subtree at n into out starting at *next (preorder);
+// returns n's index
+static uint32_t save_subtree(rb_node *n, rb_disk_node *out, uint32_t *next);
+
+/*************
+ * CACHE     *
+ *************/
+
+// bounded cache: the tree does the keyed lookup and every node also
+// sits in a recency list, so touch and evict are O(1) and the key is
+// only ever stored once (in the node)
+// RB_CACHE_LRU: one list, touched nodes go to the front, evict from the back
+// RB_CACHE_LFU: one list per use count, lowest count first; touched
+// nodes move up a list, evict from the back of the lowest (so ties go
+// to the least recently used)
+struct rb_cache_bucket;
+
+typedef struct rb_cache_node {
+  // has to come first: the tree only sees the rb_node and remove_one_child frees it
+  rb_node node;
+
+  // neighbours in the bucket's list, front (most recent) to back
+  struct rb_cache_node *prev;
+  struct rb_cache_node *next;
+  struct rb_cache_bucket *bucket;
+} rb_cache_node;
+
+typedef struct rb_cache_bucket {
+  // use count of everything in the bucket (unused for LRU)
+  unsigned long freq;
+
+  rb_cache_node *head;
+  rb_cache_node *tail;
+
+  // buckets in increasing freq; next doubles as the pool's free list
+  struct rb_cache_bucket *prev;
+  struct rb_cache_bucket *next;
+} rb_cache_bucket;
+
+typedef struct rb_cache {
+  sexy_rb_tree *tree;
+  int capacity;
+
+  // RB_CACHE_LRU or RB_CACHE_LFU
+  int policy;
+
+  // lowest freq first; never more than capacity + 1 in use, so
+  // they all come out of one allocation and touch never mallocs
+  rb_cache_bucket *buckets;
+  rb_cache_bucket *pool;
+  rb_cache_bucket *bucket_mem;
+
+  // gets the data of everything pushed out to make room; takes
+  // ownership of it; NULL means the cache just frees it
+  void (*evict)(my_type *, void *);
+  void *evict_arg;
+} rb_cache;
+
+// NULL if capacity < 1, bad policy or out of memory
+// the cache owns its data like sexy_rb_tree: cache_remove hands it
+// back, free_rb_cache frees whatever's left
+rb_cache *create_rb_cache(int (*)(my_type *, my_type *), int capacity, int policy,
+                          void (*evict)(my_type *, void *), void *evict_arg);
+
+// counts as a use of what it finds; cache_peek doesn't
+my_type *cache_get(my_type *, rb_cache *);
+my_type *cache_peek(my_type *, rb_cache *);
+
+// 1 on success, evicting the coldest entry first if full; 0 if
+// something EQUAL is already cached (left alone, caller keeps data)
+// or out of memory
+int cache_put(my_type *, rb_cache *);
+my_type *cache_remove(my_type *, rb_cache *);
+int cache_size(rb_cache *);
+void free_rb_cache(rb_cache *);
+
+// list plumbing
+static void bucket_push_front(rb_cache_bucket *, rb_cache_node *);
+static void bucket_unlink(rb_cache_node *);
+
+// bucket for freq right after b (or first if b is NULL), taken
+// from the pool if there isn't one; drops b first if it's now empty
+static rb_cache_bucket *bucket_after(rb_cache *, rb_cache_bucket *b, unsigned long freq);
+static void drop_bucket_if_empty(rb_cache *, rb_cache_bucket *);
+
+// moves cn up for one more use
+static void cache_touch(rb_cache *, rb_cache_node *);
+
+// takes cn out of the tree and its list and frees it; returns its data
+static my_type *cache_take_out(rb_cache *, rb_cache_node *);
+
+/*************
+ * PARALLEL  *
+ *************/
+
+// never uses more threads than this (caller's included)
+#define RB_PAR_MAX_THREADS 64
+
+// subtrees of about this many nodes are done on one thread, no splitting
+#define RB_PAR_GRAIN 4096
+
+// how deep subtrees get handed out; more than enough for INT_MAX nodes
+#define RB_PAR_MAX_SPLIT 48
+
+// a subtree waiting for a thread
+typedef struct rb_par_task {
+  rb_node *n;
+  int depth;
+} rb_par_task;
+
+// one per thread: the owner pushes and pops at the bottom, everyone
+// else steals the oldest (biggest) subtree off the top
+typedef struct rb_par_deque {
+  pthread_mutex_t lock;
+  int top;
+  int bottom;
+  rb_par_task tasks[RB_PAR_MAX_SPLIT];
+} rb_par_deque;
+
+typedef struct rb_par {
+  // called on every node, after its left subtree and before its right;
+  // the node's children have already been read, so it can free the node
+  void (*visit)(rb_node *, struct rb_par *);
+  void (*fn)(my_type *, void *);
+  void *arg;
+
+  // subtrees at this depth or deeper aren't split up
+  int split_depth;
+  int nthreads;
+  rb_par_deque *deques;
+
+  // tasks pushed and not finished yet; the walk's done when it's 0
+  long pending;
+  int visited[RB_PAR_MAX_THREADS];
+} rb_par;
+
+// calls fn(data, arg) on everything in the tree, split over up to
+// nthreads threads (the caller's included) that steal subtrees off each
+// other as they run out; each thread goes through its subtrees in
+// order, and with one thread the whole thing is in order
+// fn runs on different data at once, so it has to be thread-safe; it
+// can change the data but not what comp looks at, and nothing can
+// write to the tree while this runs
+// returns how many times fn was called
+int rb_parallel_map(sexy_rb_tree *, void (*fn)(my_type *, void *), void *arg, int nthreads);
+
+// same as free_rb, but the data (and nodes) are freed by nthreads
+// threads: a work-stealing walk for a malloc'ed tree, whole slabs at a
+// time for an arena tree
+void free_rb_parallel(sexy_rb_tree *, int nthreads);
+
+// moves everything in from into into (both have to be made with
+// create_rb and use the same comp), leaving from empty but still to be
+// free_rb'ed; split/join on black height, with the two halves of each
+// split done on different threads up to nthreads
+// runs in O(m log(n / m + 1)) for sizes m <= n instead of m inserts
+// when both have something EQUAL, into's stays and from's goes to
+// on_dup(kept, dup, arg), which owns it after that (on_dup NULL frees
+// it); on_dup can be called from any of the threads
+// returns 1 on success, 0 if either tree has an arena or concurrent
+// mode or they're the same tree (nothing happens)
+int rb_union(sexy_rb_tree *into, sexy_rb_tree *from,
+             void (*on_dup)(my_type *kept, my_type *dup, void *), void *arg,
+             int nthreads);
+
+// runs one thread of a parallel walk until there's nothing left
+static void *par_worker(void *);
+
+// in-order over the subtree at n (at depth in the whole tree), handing
+// right subtrees to the deque for other threads to take while it's
+// above split_depth; returns how many nodes it visited itself
+static int par_walk(rb_par *, int self, rb_node *n, int depth);
+
+// starts nthreads - 1 threads plus this one on a walk from the root
+static void par_run(rb_par *, rb_node *root, int num_nodes, int nthreads);
+
+// number of black nodes from n down to (not counting) NULL; O(log n),
+// so split/join/union carry black heights along instead of calling it
+static int black_height(rb_node *n);
+
+// puts l, k, r back together as one tree, k in the middle; everything
+// in l is LESS than k and everything in r GREATER; l and r have black
+// roots, no parent and black heights hl and hr; returns the new root
+// (black, no parent) and sets *h to its black height
+// O(|hl - hr| + 1)
+static rb_node *join_nodes(rb_node *l, int hl, rb_node *k, rb_node *r, int hr, int *h);
+
+// cuts the tree at n (black root, black height h) into everything LESS
+// than key (*lo, black height *lo_h), the node EQUAL to it if there is
+// one (*eq, on its own), and everything GREATER (*hi, *hi_h)
+// O(log n): the joins on the way back up telescope
+static void split_nodes(rb_node *n, int h, my_type *key, int (*comp)(my_type *, my_type *),
+                        rb_node **lo, int *lo_h, rb_node **eq, rb_node **hi, int *hi_h);
+
+/*************
+ * MULTIMAP  *
+ *************/
+
+// values per key that fit in the node itself before it mallocs
+#define RB_MULTI_INLINE 3
+
+// one node per distinct key; every value EQUAL to the key goes in vals,
+// so the tree's height only depends on how many distinct keys there are
+typedef struct rb_multi_node {
+  // has to come first: the tree only sees the rb_node and frees it as one
+  rb_node node;
+
+  // vals[0 .. count) in insert order; node.data is always vals[0]
+  int count;
+  int cap;
+  // points at small until there are more than RB_MULTI_INLINE
+  my_type **vals;
+  my_type *small[RB_MULTI_INLINE];
+} rb_multi_node;
+
+typedef struct rb_multimap {
+  sexy_rb_tree *tree;
+
+  // values, not keys (that's tree->num_nodes)
+  int num_values;
+} rb_multimap;
+
+// NULL if out of memory; the multimap owns its data like sexy_rb_tree
+rb_multimap *create_rb_multimap(int (*)(my_type *, my_type *));
+
+// adds a value, next to any others EQUAL to it
+// returns 1 on success, 0 if out of memory (caller keeps data)
+int insert_multi(my_type *, rb_multimap *);
+
+// everything EQUAL to key in one descent: sets *vals to them (in insert
+// order) and returns how many; 0 (and *vals NULL) if none
+// *vals belongs to the multimap and is good until the next write
+int equal_range(my_type *key, rb_multimap *, my_type ***vals);
+
+// takes out the newest value EQUAL to key and hands it back (NULL if
+// none); the key's node goes once its last value does
+my_type *remove_multi(my_type *key, rb_multimap *);
+
+// number of values, counting every duplicate
+int multi_size(rb_multimap *);
+void free_rb_multimap(rb_multimap *);
+
+// is_valid_rb_tree plus every node's values EQUAL to its key and the
+// counts adding up
+int is_valid_multimap(rb_multimap *);
+
+// frees every value and value array under n along with the nodes
+static void free_multi_nodes(rb_node *n);
+
+/*************
+ * FROZEN    *
+ *************/
+
+// how many levels below the current node search_frozen prefetches;
+// the 2^4 nodes four levels down from i are keys[16i .. 16i + 16),
+// which is one cache line of int-sized my_types
+#define FROZEN_PREFETCH_LEVELS 4
+
+// an rb_freezer freezes after this many searches in a row with no write
+// in between, or after as many as it has nodes if that's more; either
+// way the O(n) freeze (and the thaw after it) is paid for by at least
+// n searches, so mixed workloads stay O(log n) a call
+#define FREEZE_MIN_READS 64
+
+// read-only tree for lookup-only stretches: no nodes, just the keys in
+// Eytzinger (breadth-first) order from index 1, so i's children are 2i
+// and 2i + 1 and a search is index arithmetic over one array
+// keys has shallow copies of the my_types, so comparisons never chase
+// a pointer; data has the original my_type *'s at the same indexes
+typedef struct rb_frozen {
+  // CACHE_LINE aligned; keys[0] and data[0] are unused
+  my_type *keys;
+  my_type **data;
+  int num_nodes;
+  int (*comp)(my_type *, my_type *);
+} rb_frozen;
+
+// moves everything in t into a frozen layout and frees t; the data
+// itself isn't copied or moved, it now belongs to the rb_frozen
+// NULL (and t untouched) if t is concurrent or out of memory
+rb_frozen *rb_freeze(sexy_rb_tree *);
+
+// makes a plain tree (as from create_rb) out of f and frees f; the data
+// goes back to the tree; NULL (and f untouched) if out of memory
+sexy_rb_tree *rb_thaw(rb_frozen *);
+
+// same as search_baby; the same number of steps whether it hits or not,
+// and nothing inside the loop to mispredict but comp itself
+// comp gets the key copies, so it must not write through its args
+my_type *search_frozen(my_type *, rb_frozen *);
+int frozen_size(rb_frozen *);
+
+// in order, like rb_foreach
+int frozen_foreach(rb_frozen *, int (*cb)(my_type *, void *), void *arg);
+
+// frees the data too, like free_rb
+void free_frozen(rb_frozen *);
+
+// a tree that freezes itself for reads: searches go to the live tree
+// until a run of them with no write in between is long enough to pay
+// for rb_freeze (see FREEZE_MIN_READS), then to search_frozen; the
+// first write that changes anything after that does rb_thaw
+// same contract as sexy_rb_tree; searches change it, so NOT thread safe
+typedef struct rb_freezer {
+  // exactly one of these is non-NULL
+  sexy_rb_tree *tree;
+  rb_frozen *frozen;
+
+  // searches of tree since the last write
+  int reads;
+} rb_freezer;
+
+rb_freezer *create_freezer(int (*)(my_type *, my_type *));
+// insert/remove return 0/NULL if the thaw they need runs out of memory;
+// a duplicate insert or a remove of something that isn't there doesn't
+// thaw
+int insert_freezer(my_type *, rb_freezer *);
+my_type *remove_freezer(my_type *, rb_freezer *);
+// falls back to search_baby if there's no memory to freeze
+my_type *search_freezer(my_type *, rb_freezer *);
+int freezer_foreach(rb_freezer *, int (*cb)(my_type *, void *), void *arg);
+int freezer_size(rb_freezer *);
+void free_freezer(rb_freezer *);
+
+// fills f's slot i and everything under it from *cur onward (in order),
+// taking the data out of the nodes and moving *cur along
+static void freeze_subtree(rb_frozen *f, size_t i, rb_node **cur);
+
+// the other way: puts the data under slot i into out from *next on
+static void thaw_subtree(rb_frozen *f, size_t i, my_type **out, int *next);
+
+// frozen_foreach from slot i down; adds the calls to *count and
+// returns 0 once cb has said stop
+static int frozen_walk(rb_frozen *f, size_t i, int (*cb)(my_type *, void *),
+                       void *arg, int *count);
+
+// the freezer's tree, thawing it first if need be; NULL if out of memory
+static sexy_rb_tree *freezer_tree(rb_freezer *);
+
+/*************
+ * ORDERED   *
+ *************/
+
+// rb_ordered_ops ("rb_tree") and rb_frozen_ordered_ops ("rb_frozen")
+// from ../modularizing_baby/ordered.h, plus rb_of/rb_frozen_of; both
+// are defined at the end of IMPLEMENTATION
+
 /******************
  * IMPLEMENTATION *
  ******************/
@@ -153,6 +1022,23 @@ static rb_node *parent(rb_node *n) {
   return n->parent;
 } 
 
+#if RB_ORDER_STATS
+static int node_size(rb_node *n) {
+  return (n == NULL) ? 0 : n->size;
+}
+
+static void update_size(rb_node *n) {
+  n->size = node_size(n->left) + node_size(n->right) + 1;
+}
+#endif
+
+static void adjust_sizes(rb_node *n, int delta) {
+#if RB_ORDER_STATS
+  for (; n != NULL; n = parent(n))
+    n->size += delta;
+#endif
+}
+
 sexy_rb_tree *create_rb(int (*comp)(my_type *, my_type *)) {
   sexy_rb_tree *ret = (sexy_rb_tree *) malloc(sizeof(sexy_rb_tree));
   if (ret == NULL)
@@ -160,12 +1046,142 @@ sexy_rb_tree *create_rb(int (*comp)(my_type *, my_type *)) {
   
   ret->root = NULL;
   ret->num_nodes = 0;
+  ret->arena = NULL;
+  ret->sync = NULL;
   ret->comp = comp;
   ret->sorp = SUCC;
+
+#if RB_STATS
+  void *stats = NULL;
+  if (posix_memalign(&stats, CACHE_LINE, RB_STATS_SLOTS * sizeof(rb_stats_slot)) != 0) {
+    free(ret);
+    return NULL;
+  }
+  memset(stats, 0, RB_STATS_SLOTS * sizeof(rb_stats_slot));
+  ret->stats = (rb_stats_slot *) stats;
+#endif
   
   return ret;
 }
 
+sexy_rb_tree *create_rb_arena(int (*comp)(my_type *, my_type *), int slab_nodes) {
+  sexy_rb_tree *ret = create_rb(comp);
+  if (ret == NULL)
+    return NULL;
+
+  rb_arena *a = (rb_arena *) malloc(sizeof(rb_arena));
+  if (a == NULL) {
+    free(ret);
+    return NULL;
+  }
+
+  a->slabs = NULL;
+  a->num_slabs = 0;
+  a->slab_nodes = (slab_nodes > 0) ? slab_nodes : SLAB_NODES;
+  // pretend the (nonexistent) current slab is full
+  a->used = a->slab_nodes;
+  a->free_list = NULL;
+
+  ret->arena = a;
+  return ret;
+}
+
+static rb_node *alloc_node(sexy_rb_tree *t) {
+  STAT_ADD(t, node_allocs, 1);
+
+  rb_arena *a = t->arena;
+  if (a == NULL)
+    return (rb_node *) malloc(sizeof(rb_node));
+
+  // reuse removed nodes first
+  if (a->free_list != NULL) {
+    rb_node *n = a->free_list;
+    a->free_list = n->right;
+    return n;
+  }
+
+  if (a->used == a->slab_nodes) {
+    // zeroed so a concurrent reader can only ever see NULL
+    // or a real node in any pointer it picks up
+    rb_slab *s = (rb_slab *) calloc(1, sizeof(rb_slab) + a->slab_nodes * sizeof(rb_node));
+    if (s == NULL)
+      return NULL;
+
+    s->next = a->slabs;
+    a->slabs = s;
+    a->num_slabs++;
+    a->used = 0;
+  }
+
+  return &a->slabs->nodes[a->used++];
+}
+
+static void release_node(rb_node *n, sexy_rb_tree *t) {
+  rb_arena *a = t->arena;
+  if (a == NULL) {
+    free(n);
+    return;
+  }
+
+  // NULL data marks the slot as dead for free_arena
+  set_data(n, NULL);
+  set_right(n, a->free_list);
+  a->free_list = n;
+}
+
+sexy_rb_tree *create_rb_concurrent(int (*comp)(my_type *, my_type *), int slab_nodes,
+                                   int max_readers) {
+  sexy_rb_tree *ret = create_rb_arena(comp, slab_nodes);
+  if (ret == NULL)
+    return NULL;
+
+  if (max_readers <= 0)
+    max_readers = MAX_READERS;
+
+  rb_sync *sync = (rb_sync *) malloc(sizeof(rb_sync));
+  void *readers = NULL;
+  if (sync == NULL ||
+      posix_memalign(&readers, CACHE_LINE, max_readers * sizeof(rb_reader)) != 0) {
+    free(sync);
+    free_rb(ret);
+    return NULL;
+  }
+
+  sync->seq = 0;
+  pthread_mutex_init(&sync->write_lock, NULL);
+  sync->max_readers = max_readers;
+  sync->readers = (rb_reader *) readers;
+
+  for (int i = 0; i < max_readers; i++) {
+    sync->readers[i].ctr = 0;
+    sync->readers[i].in_use = 0;
+    sync->readers[i].tree = ret;
+  }
+
+  ret->sync = sync;
+  return ret;
+}
+
+static void free_arena(rb_arena *a) {
+  rb_slab *s = a->slabs;
+  // only the newest slab can be partly used
+  int live = a->used;
+
+  while (s != NULL) {
+    rb_slab *next = s->next;
+
+    // walk the slab in order instead of chasing tree pointers
+    for (int i = 0; i < live; i++)
+      free(s->nodes[i].data);
+
+    free(s);
+    s = next;
+    live = a->slab_nodes;
+  }
+
+  free(a);
+}
+
 static void free_rb_nodes(rb_node *n) {
   free(n->data);
   if (n->left != NULL)
@@ -176,7 +1192,21 @@ static void free_rb_nodes(rb_node *n) {
 }
 
 void free_rb(sexy_rb_tree *t) {
-  free_rb_nodes(t->root);
+  if (t->sync != NULL) {
+    pthread_mutex_destroy(&t->sync->write_lock);
+    free(t->sync->readers);
+    free(t->sync);
+  }
+
+  if (t->arena != NULL)
+    // nodes all live in the slabs; no need to walk the tree
+    free_arena(t->arena);
+  else if (t->root != NULL)
+    // tree might be empty if everything was removed
+    free_rb_nodes(t->root);
+#if RB_STATS
+  free(t->stats);
+#endif
   free(t);
 }
 
@@ -223,157 +1253,149 @@ static rb_node *get_left(rb_node *n) {
   return n->left;
 }
 
-// assumes both inserting and cur are not NULL and that
-// inserting has already been colored red
-static rb_node *node_insert_node(rb_node *inserting, rb_node *cur, int (*comp)(my_type *, my_type *)) {
-  rb_node *next = NULL;
+static void set_root(sexy_rb_tree *t, rb_node *n) {
+  __atomic_store_n(&t->root, n, __ATOMIC_RELEASE);
+}
+
+static void set_left(rb_node *n, rb_node *l) {
+  __atomic_store_n(&n->left, l, __ATOMIC_RELEASE);
+}
 
-  if (comp(inserting->data, cur->data) == LESS) {
-    // go left
-    next = cur->left;
+static void set_right(rb_node *n, rb_node *r) {
+  __atomic_store_n(&n->right, r, __ATOMIC_RELEASE);
+}
 
-    if (next == NULL) {
-      // base case
-      inserting->left = NULL;
-      inserting->right = NULL;
-      inserting->parent = cur;
-      cur->left = inserting;
-      return inserting;
-    } else {
-      // recursive case
-      return node_insert_node(inserting, next, comp);
-    }
+static void set_data(rb_node *n, my_type *d) {
+  __atomic_store_n(&n->data, d, __ATOMIC_RELEASE);
+}
 
-  } else if (comp(inserting->data, cur->data) == EQUAL) {
-    // exit because DON'T ALLOW DUPLICATES
-    assert(0);
-  } else if (comp(inserting->data, cur->data) == GREATER) {
-    // go right
-    next = cur->right;
-
-    if (next == NULL) {
-      // base case
-      inserting->left = NULL;
-      inserting->right = NULL;
-      inserting->parent = cur;
-      cur->right = inserting;
-      return inserting;
-    } else {
-      // recursive case
-      return node_insert_node(inserting, next, comp);
+static rb_node *sibling(rb_node *n) {
+  rb_node *p = parent(n);
+  if (p == NULL)
+    return NULL;
+  else if (p->left == n)
+    return p->right;
+  else
+    return p->left;
+}
+
+static rb_node *find_insert_parent(my_type *elem, sexy_rb_tree *t, int *dir) {
+  int (*comp)(my_type *, my_type *) = t->comp;
+  rb_node *p = NULL;
+  rb_node *cur = t->root;
+  STAT_LOCAL(depth);
+
+  *dir = LESS;
+
+  while (cur != NULL) {
+    STAT_INC(depth);
+    int res = comp(elem, cur->data);
+
+    if (res == EQUAL) {
+      // DON'T ALLOW DUPLICATES; hand back the one that's there
+      STAT_WALK(t, depth, depth);
+      *dir = EQUAL;
+      return cur;
     }
 
-  } else {
-      // something wrong with constants
-      assert(0);
+    // something wrong with constants otherwise
+    assert(res == LESS || res == GREATER);
 
+    p = cur;
+    *dir = res;
+    cur = (res == LESS) ? cur->left : cur->right;
   }
 
+  STAT_WALK(t, depth, depth);
+  return p;
 }
 
-static rb_node *binary_insert_node(rb_node *n, sexy_rb_tree *t) {
-  if (t->root == NULL) {
-    n->node_color = BLACK;
-    n->parent = NULL;
-    n->left = NULL;
-    n->right = NULL;
-    t->root = n;
+static void link_node(rb_node *n, rb_node *p, int dir, sexy_rb_tree *t) {
+  n->parent = p;
+  // n can be a recycled arena node a reader is still on
+  set_left(n, NULL);
+  set_right(n, NULL);
+#if RB_ORDER_STATS
+  n->size = 1;
+#endif
 
-    return n;
+  if (p == NULL) {
+    n->node_color = BLACK;
+    set_root(t, n);
   } else {
     n->node_color = RED;
-    node_insert_node(n, t->root, t->comp);
+    if (dir == LESS)
+      set_left(p, n);
+    else
+      set_right(p, n);
   }
-
 }
 
-// returns 1 on success
-static int insert_base(rb_node *n, sexy_rb_tree *t) {
-  if (n == get_root(t)) {
-    // inserted root; don't need to fix
-    set_color(n, BLACK);
-    assert(n->parent == NULL);
-    return 1;
-  } else {
-    // check next case
-    return insert_black_parent(n, t);
-  }
-}
+static rb_node *binary_insert_node(rb_node *n, sexy_rb_tree *t) {
+  int dir;
+  rb_node *p = find_insert_parent(n->data, t, &dir);
 
-static int insert_black_parent(rb_node *n, sexy_rb_tree *t) {
-  rb_node *p = parent(n);
-  assert(p != NULL);
+  if (dir == EQUAL)
+    return NULL;
 
-  if (!is_red(p))
-    // black parent; don't need to fix
-    return 1;
-  else
-    return insert_both_red(n, t);
+  link_node(n, p, dir, t);
+  return n;
 }
 
-static int insert_both_red(rb_node *n, sexy_rb_tree *t) {
-  rb_node *u = uncle(n);
-  if (u != NULL && is_red(u)) {
-    set_color(parent(n), BLACK);
-    set_color(u, BLACK);
-    // grand parent should exist because parent
-    // was originally red and root can't be red
-    rb_node *g = grand_parent(n);
-    set_color(g, RED);
+static void insert_fixup(rb_node *n, sexy_rb_tree *t) {
+  insert_rebalance(n, t);
 
-    // recursively call on grandparent
-    // in case we just made the root red
-    return insert_base(g, t);
-  } else {
-    return insert_pred_ublack_opp(n, t);
-  }
+  // inserted root or pushed red all the way up
+  set_color(get_root(t), BLACK);
 }
 
-// parent red, uncle black, parent and child "opposites"
-// i.e. if parent is left of grandparent, child is
-// right of parent, etc.
-static int insert_pred_ublack_opp(rb_node *n, sexy_rb_tree *t) {
-  rb_node *p = parent(n);
-  assert(p != NULL);
-  rb_node *g = grand_parent(n);
-  assert(g != NULL);
-  
-
-  int res = 0;
-  if (get_right(p) == n && p == get_left(g)) {
-    res = lrot(p, t);
-    if (res == 0)
-      return 0;
-    n = n->left;
-  } else if (get_left(p) == n && p == get_right(g)) {
-    res = rrot(p, t);
-    n = n->right;
-  }
-
-  return insert_pred_ublack_same(n, t);
-}
+static void insert_rebalance(rb_node *n, sexy_rb_tree *t) {
+  while (n != get_root(t) && is_red(parent(n))) {
+    STAT_ADD(t, fixup_iterations, 1);
+    rb_node *p = parent(n);
+    // grand parent should exist because parent
+    // is red and root can't be red
+    rb_node *g = grand_parent(n);
+    rb_node *u = uncle(n);
+
+    if (is_red(u)) {
+      // both parent and uncle are red; push the red up
+      // to the grand parent and keep going from there
+      STAT_ADD(t, recolors, 1);
+      set_color(p, BLACK);
+      set_color(u, BLACK);
+      set_color(g, RED);
+      n = g;
+      continue;
+    }
 
-static int insert_pred_ublack_same(rb_node *n, sexy_rb_tree *t) {
-  rb_node *p = parent(n);
-  assert(p != NULL);
-  rb_node *g = grand_parent(n);
-  assert(g != NULL);
+    // parent red, uncle black, parent and child "opposites"
+    // i.e. if parent is left of grandparent, child is
+    // right of parent, etc.; rotate so they're the same way
+    if (n == get_right(p) && p == get_left(g)) {
+      lrot(p, t);
+      n = p;
+      p = parent(n);
+    } else if (n == get_left(p) && p == get_right(g)) {
+      rrot(p, t);
+      n = p;
+      p = parent(n);
+    }
 
-  // p and g about to switch, so need to fix colors
-  set_color(p, BLACK);
-  set_color(g, RED);
+    // p and g about to switch, so need to fix colors
+    set_color(p, BLACK);
+    set_color(g, RED);
 
-  int res = 0;
-  // do the actual switch
-  if (get_left(p) == n)
-    res = rrot(g, t);
-  else
-    res = lrot(g, t);
+    // do the actual switch; tree is fixed after this
+    if (n == get_left(p))
+      rrot(g, t);
+    else
+      lrot(g, t);
 
-  return res;
+    break;
+  }
 }
 
-
 static int rrot(rb_node *n, sexy_rb_tree *t) {
   int update_root = 0;
   if (get_root(t) == n)
@@ -393,8 +1415,8 @@ static int rrot(rb_node *n, sexy_rb_tree *t) {
   rb_node *lr = get_right(l); // g
 
   // do actual shifting
-  n->left = n->left->right;
-  l->right = n;
+  set_left(n, lr);
+  set_right(l, n);
   n->parent = l;
   l->parent = top_parent;
   
@@ -403,13 +1425,21 @@ static int rrot(rb_node *n, sexy_rb_tree *t) {
   
   if (top_parent != NULL) {
     if (top_parent->left == top)
-      top_parent->left = l;
+      set_left(top_parent, l);
     else
-      top_parent->right = l;
+      set_right(top_parent, l);
   }
 
   if (update_root)
-    t->root = l;
+    set_root(t, l);
+
+  STAT_ADD(t, rrots, 1);
+
+#if RB_ORDER_STATS
+  // l takes over n's whole subtree; n lost l and l's left side
+  l->size = n->size;
+  update_size(n);
+#endif
 
   return 1;
 }
@@ -433,8 +1463,8 @@ static int lrot(rb_node *n, sexy_rb_tree *t) {
   rb_node *rr = get_right(r);
 
   // do actual shifting
-  n->right = rl;
-  r->left = n;
+  set_right(n, rl);
+  set_left(r, n);
   n->parent = r;
   r->parent = top_parent;
 
@@ -443,93 +1473,292 @@ static int lrot(rb_node *n, sexy_rb_tree *t) {
   
   if (top_parent != NULL) {
     if (top_parent->left == top)
-      top_parent->left = r;
+      set_left(top_parent, r);
     else
-      top_parent->right = r;
+      set_right(top_parent, r);
   }
 
   if (update_root)
-    t->root = r;
+    set_root(t, r);
+
+  STAT_ADD(t, lrots, 1);
+
+#if RB_ORDER_STATS
+  r->size = n->size;
+  update_size(n);
+#endif
 
   return 1;
 }
 
-static int insert_rb_node(rb_node *n, sexy_rb_tree *t) {
-  rb_node *inserting = binary_insert_node(n, t);
-  return insert_base(inserting, t);
-}
+static void write_begin(sexy_rb_tree *t) {
+  rb_sync *sync = t->sync;
 
-int insert_baby(my_type *data, sexy_rb_tree *t) {
-  rb_node *n = (rb_node *) malloc(sizeof(rb_node));
-  n->data = data;
-  n->node_color = RED;
-  n->parent = NULL;
-  n->left = NULL;
-  n->right = NULL;
+  pthread_mutex_lock(&sync->write_lock);
 
-  if (insert_rb_node(n, t))
-    t->num_nodes++;
+  // seq goes odd before any of the tree changes can be seen
+  __atomic_store_n(&sync->seq, sync->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
 }
 
-my_type *search_baby(my_type *elem, sexy_rb_tree *t) {
-  int (*comp)(my_type *, my_type *) = t->comp;
+static void write_end(sexy_rb_tree *t) {
+  rb_sync *sync = t->sync;
 
-  assert(elem != NULL);
+  // and goes even again only after they're all out
+  __atomic_store_n(&sync->seq, sync->seq + 1, __ATOMIC_RELEASE);
 
-  rb_node *cur = t->root;
-  
-  while (cur != NULL) {
-    if (comp(elem, cur->data) == LESS)
-      cur = cur->left;
-    else if (comp(elem, cur->data) == GREATER)
-      cur = cur->right;
-    else
-      return cur->data;
-  }
-  
-  return NULL;
-  
+  pthread_mutex_unlock(&sync->write_lock);
 }
 
-static rb_node *replace_with_pred(rb_node *n) {
-  rb_node *l = get_left(n);
+int insert_baby(my_type *data, sexy_rb_tree *t) {
+  if (t->sync == NULL)
+    return insert_unlocked(data, t);
 
-  if (l == NULL) {
-    // no left child, so can't replace with predecessor
-    return NULL;
-  } else {
-    // iterate down the tree to the predecessor
-    while (get_right(l) != NULL)
-      l = get_right(l);
+  write_begin(t);
+  int ret = insert_unlocked(data, t);
+  write_end(t);
+  return ret;
+}
 
-    assert(l->data != NULL);
-    n->data = l->data;
+static int insert_unlocked(my_type *data, sexy_rb_tree *t) {
+  STAT_ADD(t, inserts, 1);
 
-    return l;
-  }
-  
-}
+  // find the spot before allocating so duplicates cost nothing
+  int dir;
+  rb_node *p = find_insert_parent(data, t, &dir);
+  if (dir == EQUAL)
+    return 0;
 
+  rb_node *n = alloc_node(t);
+  if (n == NULL)
+    return 0;
 
-static rb_node *replace_with_succ(rb_node *n) {
-  rb_node *r = get_right(n);
+  set_data(n, data);
+  link_node(n, p, dir, t);
+  // sizes have to be right before insert_fixup starts rotating
+  adjust_sizes(p, 1);
+  insert_fixup(n, t);
 
-  if (r == NULL) {
-    return NULL;
-  } else {
+  t->num_nodes++;
+  return 1;
+}
 
-    while (get_left(r) != NULL)
-      r = get_left(r);
+my_type *search_baby(my_type *elem, sexy_rb_tree *t) {
+  assert(elem != NULL);
+  STAT_ADD(t, searches, 1);
 
-    assert(r->data != NULL);
-    n->data = r->data;
+  rb_node *n = search_node(elem, t);
+  return (n != NULL) ? n->data : NULL;
+}
 
-    return r;
+rb_reader *rb_reader_join(sexy_rb_tree *t) {
+  rb_sync *sync = t->sync;
+  if (sync == NULL)
+    return NULL;
+
+  for (int i = 0; i < sync->max_readers; i++) {
+    unsigned long expected = 0;
+    if (__atomic_compare_exchange_n(&sync->readers[i].in_use, &expected, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return &sync->readers[i];
   }
 
+  return NULL;
 }
 
-static rb_node *simple_replace(rb_node *n, int sorp) {
+void rb_reader_leave(rb_reader *r) {
+  // ctr is even between reads, so a free slot never holds up rb_synchronize
+  __atomic_store_n(&r->in_use, 0, __ATOMIC_RELEASE);
+}
+
+my_type *search_baby_read(my_type *elem, rb_reader *r) {
+  sexy_rb_tree *t = r->tree;
+  rb_sync *sync = t->sync;
+  int (*comp)(my_type *, my_type *) = t->comp;
+
+  assert(elem != NULL);
+
+  // tell rb_synchronize we're in here before looking at anything
+  __atomic_store_n(&r->ctr, r->ctr + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  my_type *res;
+  // comparisons from walks that had to start over count too
+  STAT_LOCAL(cmps);
+
+  for (;;) {
+    unsigned long seq = __atomic_load_n(&sync->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      // writer halfway through; let it finish and try again
+      sched_yield();
+      continue;
+    }
+
+    int lost = 0;
+    int depth = 0;
+    rb_node *cur = __atomic_load_n(&t->root, __ATOMIC_ACQUIRE);
+    res = NULL;
+
+    while (cur != NULL) {
+      my_type *d = __atomic_load_n(&cur->data, __ATOMIC_ACQUIRE);
+
+      // NULL data means the node went back to the arena under us;
+      // too deep means a rotation sent us in circles
+      if (d == NULL || ++depth > MAX_READ_DEPTH) {
+        lost = 1;
+        break;
+      }
+
+      STAT_INC(cmps);
+      int c = comp(elem, d);
+      if (c == LESS) {
+        cur = __atomic_load_n(&cur->left, __ATOMIC_ACQUIRE);
+      } else if (c == GREATER) {
+        cur = __atomic_load_n(&cur->right, __ATOMIC_ACQUIRE);
+      } else {
+        res = d;
+        break;
+      }
+    }
+
+    // what we read only counts if no writer started in the meantime
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (!lost && __atomic_load_n(&sync->seq, __ATOMIC_RELAXED) == seq) {
+      STAT_ADD(t, searches, 1);
+      STAT_WALK(t, cmps, depth);
+      break;
+    }
+  }
+
+  __atomic_store_n(&r->ctr, r->ctr + 1, __ATOMIC_RELEASE);
+  return res;
+}
+
+void rb_synchronize(sexy_rb_tree *t) {
+  rb_sync *sync = t->sync;
+  if (sync == NULL)
+    return;
+
+  // pairs with the fence at the start of search_baby_read
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  for (int i = 0; i < sync->max_readers; i++) {
+    rb_reader *r = &sync->readers[i];
+    unsigned long c = __atomic_load_n(&r->ctr, __ATOMIC_ACQUIRE);
+
+    // odd means mid-read; any change means that read is over
+    if (c & 1) {
+      while (__atomic_load_n(&r->ctr, __ATOMIC_ACQUIRE) == c)
+        sched_yield();
+    }
+  }
+}
+
+// where a lookup in search_batch is: either just moved to a node
+// (so fetch its data next) or has the data and needs to compare
+#define BATCH_AT_NODE 0
+#define BATCH_AT_DATA 1
+
+void search_batch(sexy_rb_tree *t, my_type **keys, size_t n, my_type **out) {
+  int (*comp)(my_type *, my_type *) = t->comp;
+  rb_node *cur[SEARCH_BATCH_WIDTH];
+  int stage[SEARCH_BATCH_WIDTH];
+  STAT_LOCAL(cmps);
+
+  for (size_t base = 0; base < n; base += SEARCH_BATCH_WIDTH) {
+    int width = (n - base < SEARCH_BATCH_WIDTH) ? (int) (n - base) : SEARCH_BATCH_WIDTH;
+    int active = 0;
+
+    for (int i = 0; i < width; i++) {
+      assert(keys[base + i] != NULL);
+      out[base + i] = NULL;
+
+      cur[i] = t->root;
+      stage[i] = BATCH_AT_NODE;
+      if (cur[i] != NULL)
+        active++;
+    }
+
+    // each pass does one step of every unfinished lookup; by the time
+    // a lookup comes back around what it prefetched should be there
+    while (active > 0) {
+      for (int i = 0; i < width; i++) {
+        rb_node *c = cur[i];
+        if (c == NULL)
+          continue;
+
+        if (stage[i] == BATCH_AT_NODE) {
+          PREFETCH(c->data);
+          stage[i] = BATCH_AT_DATA;
+          continue;
+        }
+
+        STAT_INC(cmps);
+        int res = comp(keys[base + i], c->data);
+        if (res == EQUAL) {
+          out[base + i] = c->data;
+          cur[i] = NULL;
+          active--;
+          continue;
+        }
+
+        c = (res == LESS) ? c->left : c->right;
+        cur[i] = c;
+        if (c == NULL) {
+          // fell off the tree; not there
+          active--;
+        } else {
+          PREFETCH(c);
+          stage[i] = BATCH_AT_NODE;
+        }
+      }
+    }
+  }
+
+  // lookups are interleaved, so no one depth to report
+  STAT_ADD(t, searches, n);
+  STAT_WALK(t, cmps, 0);
+}
+
+static rb_node *replace_with_pred(rb_node *n) {
+  rb_node *l = get_left(n);
+
+  if (l == NULL) {
+    // no left child, so can't replace with predecessor
+    return NULL;
+  } else {
+    // iterate down the tree to the predecessor
+    while (get_right(l) != NULL)
+      l = get_right(l);
+
+    assert(l->data != NULL);
+    set_data(n, l->data);
+
+    return l;
+  }
+  
+}
+
+
+static rb_node *replace_with_succ(rb_node *n) {
+  rb_node *r = get_right(n);
+
+  if (r == NULL) {
+    return NULL;
+  } else {
+
+    while (get_left(r) != NULL)
+      r = get_left(r);
+
+    assert(r->data != NULL);
+    set_data(n, r->data);
+
+    return r;
+  }
+
+}
+
+static rb_node *simple_replace(rb_node *n, int sorp) {
   rb_node *res = NULL;
 
   if (sorp == SUCC) {
@@ -554,1236 +1783,4972 @@ static rb_node *simple_replace(rb_node *n, int sorp) {
 
 }
 
-static int one_red_parent_black_children(rb_node *n) {
-  rb_node *l = get_left(n);
-  rb_node *r = get_right(n);
-  
-  if (is_red(n)) {
-    if (is_red(l) || is_red(r))
-      return 0;
+static rb_node *search_node(my_type *elem, sexy_rb_tree *t) {
+  int (*comp)(my_type *, my_type *) = t->comp;
+  rb_node *cur = t->root;
+  STAT_LOCAL(depth);
+
+  while (cur != NULL) {
+    STAT_INC(depth);
+    int res = comp(elem, cur->data);
+    if (res == LESS)
+      cur = cur->left;
+    else if (res == GREATER)
+      cur = cur->right;
+    else
+      break;
   }
 
-  //return (red_parent_black_children(l) && red_parent_black_children(r));
+  STAT_WALK(t, depth, depth);
+  return cur;
+}
 
-  return 1;
+static void splice_node(rb_node *n, rb_node *child, sexy_rb_tree *t) {
+  rb_node *p = parent(n);
+
+  if (child != NULL)
+    child->parent = p;
 
+  if (p == NULL)
+    set_root(t, child);
+  else if (p->left == n)
+    set_left(p, child);
+  else
+    set_right(p, child);
 }
 
-static int red_parent_black_children(rb_node *n) {
-  if (!one_red_parent_black_children(n))
-    return 0;
-  
-  if (n->left != NULL) {
-    if (!red_parent_black_children(n->left))
-      return 0;
-  }
+static void remove_fixup(rb_node *n, sexy_rb_tree *t) {
+  while (n != get_root(t)) {
+    STAT_ADD(t, fixup_iterations, 1);
+    rb_node *p = parent(n);
+    rb_node *s = sibling(n);
+
+    // sibling has to exist; n is black so the other
+    // side of p has at least one black node on every path
+    assert(s != NULL);
+
+    if (is_red(s)) {
+      // red sibling; rotate so n gets a black sibling
+      set_color(p, RED);
+      set_color(s, BLACK);
+      if (n == get_left(p))
+        lrot(p, t);
+      else
+        rrot(p, t);
+      s = sibling(n);
+    }
 
-  if (n->right != NULL) {
-    if (!red_parent_black_children(n->right))
-      return 0;
-  }
-  
-  return 1;
+    if (!is_red(get_left(s)) && !is_red(get_right(s))) {
+      set_color(s, RED);
 
-}
+      if (is_red(p)) {
+        // push the missing black into the parent and we're done
+        set_color(p, BLACK);
+        return;
+      }
 
-static int path_max = INT_MIN;
-static int path_min = INT_MAX;
+      // parent now doubly black; move up instead of recursing
+      n = p;
+      continue;
+    }
 
-static void path_black_nodes_helper(rb_node *n, int count) {
-  if (n == NULL) {
-    count++;
-    
-    if (count > path_max)
-      path_max = count;
+    // sibling has a red child; make sure it's the "outside" one
+    if (n == get_left(p) && !is_red(get_right(s))) {
+      set_color(s, RED);
+      set_color(get_left(s), BLACK);
+      rrot(s, t);
+      s = get_right(p);
+    } else if (n == get_right(p) && !is_red(get_left(s))) {
+      set_color(s, RED);
+      set_color(get_right(s), BLACK);
+      lrot(s, t);
+      s = get_left(p);
+    }
 
-    if (count < path_min)
-      path_min = count;
+    // rotate p toward n; s takes p's place and color
+    set_color(s, p->node_color);
+    set_color(p, BLACK);
+    if (n == get_left(p)) {
+      set_color(get_right(s), BLACK);
+      lrot(p, t);
+    } else {
+      set_color(get_left(s), BLACK);
+      rrot(p, t);
+    }
 
     return;
+  }
+}
 
-  } else {
-
-  if (!is_red(n))
-    count++;
+static void remove_one_child(rb_node *n, sexy_rb_tree *t) {
+  assert(get_left(n) == NULL || get_right(n) == NULL);
 
-  path_black_nodes_helper(n->left, count);
-  path_black_nodes_helper(n->right, count);
+  rb_node *child = (get_left(n) != NULL) ? get_left(n) : get_right(n);
 
+  if (is_red(n)) {
+    // removing a red node never changes black heights
+    splice_node(n, child, t);
+  } else if (is_red(child)) {
+    // child takes over n's black
+    splice_node(n, child, t);
+    set_color(child, BLACK);
+  } else {
+    // black leaf; fix while n is still in place, then cut it out
+    assert(child == NULL);
+    remove_fixup(n, t);
+    splice_node(n, NULL, t);
   }
 
+  // n still points at its last parent; everything above lost a node
+  adjust_sizes(parent(n), -1);
+  release_node(n, t);
 }
 
-static int path_black_nodes(rb_node *n) {
-  path_max = INT_MIN;
-  path_min = INT_MAX;
+my_type *remove_baby(my_type *elem, sexy_rb_tree *t) {
+  if (t->sync == NULL)
+    return remove_unlocked(elem, t);
 
-  path_black_nodes_helper(n, 0);
-  
-  if (path_max != path_min)
-    return 0;
+  write_begin(t);
+  my_type *ret = remove_unlocked(elem, t);
+  write_end(t);
+  return ret;
+}
 
-  if (n->left != NULL) {
-    path_max = INT_MIN;
-    path_min = INT_MAX;
-    
-    if (!path_black_nodes(n->left))
-      return 0;
+static my_type *remove_unlocked(my_type *elem, sexy_rb_tree *t) {
+  assert(elem != NULL);
+  STAT_ADD(t, removes, 1);
 
-  }
-  
-  if (n->right != NULL) {
-    path_max = INT_MIN;
-    path_min = INT_MAX;
-    
-    if (!path_black_nodes(n->right))
-      return 0;
+  rb_node *n = search_node(elem, t);
+  if (n == NULL)
+    return NULL;
 
-  }
+  my_type *ret = n->data;
 
-  path_max = INT_MIN;
-  path_min = INT_MAX;
-  
-  return 1;
+  remove_one_child(pick_removed(n, t), t);
+  t->num_nodes--;
+
+  return ret;
 }
 
-static int tree_lt(rb_node *n, my_type *value, int (*comp)(my_type *, my_type *)) {
-  assert(n != NULL);
-  assert(value != NULL);
-  assert(n->data != NULL);
-  assert(value != NULL);
+static rb_node *pick_removed(rb_node *n, sexy_rb_tree *t) {
+  // move pred/succ data up into n, then remove pred/succ instead
+  rb_node *rep = simple_replace(n, t->sorp);
+  if (rep == NULL)
+    return n;
 
-  if (comp(n->data, value) != LESS)
-    return 0;
-  
-  if (n->left != NULL)
-    tree_lt(n->left, value, comp);
+  // alternate so repeated removes don't lean one way
+  if (t->sorp == SUCC)
+    t->sorp = PRED;
+  else
+    t->sorp = SUCC;
 
-  if (n->right != NULL)
-    tree_lt(n->right, value, comp);
+  return rep;
+}
 
-  return 1;
+static void release_nodes(rb_node *n, sexy_rb_tree *t) {
+  if (n == NULL)
+    return;
+
+  release_nodes(n->left, t);
+  release_nodes(n->right, t);
+  release_node(n, t);
 }
 
-static int tree_gt(rb_node *n, my_type *value, int (*comp)(my_type *, my_type *)) {
-  assert(n != NULL);
-  assert(value != NULL);
-  assert(n->data != NULL);
-  assert(value != NULL);
+static int build_balanced(my_type **sorted, size_t lo, size_t hi, rb_node *p,
+                          int dir, int depth, int red_depth, sexy_rb_tree *t) {
+  if (lo == hi)
+    return 1;
+
+  size_t mid = lo + (hi - lo) / 2;
 
-  if (comp(n->data, value) != GREATER)
+  rb_node *n = alloc_node(t);
+  if (n == NULL)
     return 0;
-  
-  if (n->left != NULL) {
-    if (!tree_gt(n->left, value, comp))
-      return 0;
-  }
 
-  if (n->right != NULL) {
-    if (!tree_gt(n->right, value, comp))
-      return 0;
-  }
+  set_data(n, sorted[mid]);
+  // link now so a failure further down can still find n to release it
+  link_node(n, p, dir, t);
+  set_color(n, (depth == red_depth) ? RED : BLACK);
+#if RB_ORDER_STATS
+  n->size = (int) (hi - lo);
+#endif
 
-  return 1;
+  if (!build_balanced(sorted, lo, mid, n, LESS, depth + 1, red_depth, t))
+    return 0;
+
+  return build_balanced(sorted, mid + 1, hi, n, GREATER, depth + 1, red_depth, t);
 }
 
-static int bin_tree_helper(rb_node *n, int (*comp)(my_type *, my_type *)) {
-  assert(n != NULL);
-  
-  if (n->right != NULL) {
-    if (!tree_gt(n->right, n->data, comp))
-      return 0;
-  }
-  
-  if (n->left != NULL) {
-    if (!tree_lt(n->left, n->data, comp))
-      return 0;
-  }
-  
-  return 1;
+int bulk_load_rb(sexy_rb_tree *t, my_type **sorted, size_t n) {
+  if (t->sync == NULL)
+    return bulk_load_unlocked(t, sorted, n);
+
+  write_begin(t);
+  int ret = bulk_load_unlocked(t, sorted, n);
+  write_end(t);
+  return ret;
 }
 
-static int bin_tree(rb_node *n, int (*comp)(my_type *, my_type *)) {
-  assert(n != NULL);
-  
-  if (!bin_tree_helper(n, comp))
+static int bulk_load_unlocked(sexy_rb_tree *t, my_type **sorted, size_t n) {
+  if (t->root != NULL || n > INT_MAX)
     return 0;
 
-  if (n->left != NULL) {
-    if (!bin_tree(n->left, comp))
+  for (size_t i = 1; i < n; i++) {
+    if (t->comp(sorted[i - 1], sorted[i]) != LESS)
       return 0;
   }
 
-  if (n->right != NULL) {
-    if (!bin_tree(n->right, comp))
-      return 0;
+  // halving sizes keeps every leaf within one level of the deepest,
+  // so every level above the deepest is full; if the deepest level
+  // isn't full either, making it red keeps black heights equal
+  int deepest = 0;
+  while (((size_t) 2 << deepest) - 1 < n)
+    deepest++;
+
+  int red_depth = deepest;
+  if (((size_t) 2 << deepest) - 1 == n)
+    // perfect tree; all black works
+    red_depth = -1;
+
+  if (!build_balanced(sorted, 0, n, NULL, LESS, 0, red_depth, t)) {
+    release_nodes(t->root, t);
+    set_root(t, NULL);
+    return 0;
   }
 
+  t->num_nodes = (int) n;
   return 1;
-
 }
 
+rb_node *rb_first(sexy_rb_tree *t) {
+  rb_node *n = t->root;
+  if (n == NULL)
+    return NULL;
 
-int is_valid_rb_tree(sexy_rb_tree *t) {
-  if (t == NULL)
-    return 0;
+  while (get_left(n) != NULL)
+    n = get_left(n);
 
-  rb_node *r = get_root(t);
+  return n;
+}
 
-  if (r == NULL)
-    return 0;
+rb_node *rb_last(sexy_rb_tree *t) {
+  rb_node *n = t->root;
+  if (n == NULL)
+    return NULL;
 
-  // root should be black
-  if (is_red(r))
-    return 0;
+  while (get_right(n) != NULL)
+    n = get_right(n);
 
-  // both children of red parent must be black (or NULL)
-  if (!red_parent_black_children(r))
-    return 0;
+  return n;
+}
 
-  // every simple path from node to descendant
-  // has same number of black nodes
-  if (!path_black_nodes(r))
-    return 0;
+rb_node *rb_next(rb_node *n) {
+  if (get_right(n) != NULL) {
+    // leftmost node of the right subtree
+    n = get_right(n);
+    while (get_left(n) != NULL)
+      n = get_left(n);
+    return n;
+  }
 
-  // should be a valid binary tree
-  if (!bin_tree(r, t->comp))
-    return 0;
+  // otherwise first ancestor we reach from its left side
+  rb_node *p = parent(n);
+  while (p != NULL && n == get_right(p)) {
+    n = p;
+    p = parent(p);
+  }
 
-  return 1;
+  return p;
 }
 
-/***************
- * TEST SCRIPT *
- ***************/
+rb_node *rb_prev(rb_node *n) {
+  if (get_left(n) != NULL) {
+    n = get_left(n);
+    while (get_right(n) != NULL)
+      n = get_right(n);
+    return n;
+  }
 
-// BREAKS ABSTRACTION BARRIER
-// primarily tests binary_insert_node
-static void test_1(void) {
-  // a, b, c ordering
-  sexy_rb_tree *t = create_rb(&int_compare);
-  
-  my_type *x = (my_type *) malloc(sizeof(my_type));
-  my_type *y = (my_type *) malloc(sizeof(my_type));
-  my_type *z = (my_type *) malloc(sizeof(my_type));
+  rb_node *p = parent(n);
+  while (p != NULL && n == get_left(p)) {
+    n = p;
+    p = parent(p);
+  }
 
-  x->x = 1;
-  y->x = 2;
-  z->x = 3;
+  return p;
+}
 
-  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+rb_node *rb_lower_bound(my_type *key, sexy_rb_tree *t) {
+  int (*comp)(my_type *, my_type *) = t->comp;
+  rb_node *cur = t->root;
+  rb_node *best = NULL;
 
-  a->data = x;
-  b->data = y;
-  c->data = z;
+  while (cur != NULL) {
+    int res = comp(cur->data, key);
+    if (res == LESS) {
+      cur = cur->right;
+    } else if (res == GREATER) {
+      // candidate; anything better is to the left
+      best = cur;
+      cur = cur->left;
+    } else {
+      return cur;
+    }
+  }
 
-  // assert basic inserts don't fail
-  assert(binary_insert_node(a, t) != NULL);
-  assert(binary_insert_node(b, t) != NULL);
-  assert(binary_insert_node(c, t) != NULL);
+  return best;
+}
 
-  // assert structure is as it should be
-  assert(t->root == a);
-  assert(t->root->left == NULL);
-  assert(t->root->right == b);
-  assert(t->root->right->right == c);
-  assert(t->root->right->left == NULL);
-  assert(t->root->right->right->left == NULL);
-  assert(t->root->right->right->right == NULL);
+#if RB_ORDER_STATS
+my_type *rb_select(int k, sexy_rb_tree *t) {
+  if (k < 0 || k >= t->num_nodes)
+    return NULL;
 
-  free_rb(t);
+  rb_node *cur = t->root;
+
+  while (cur != NULL) {
+    int left = node_size(cur->left);
+
+    if (k < left) {
+      cur = cur->left;
+    } else if (k == left) {
+      return cur->data;
+    } else {
+      k -= left + 1;
+      cur = cur->right;
+    }
+  }
 
+  // sizes don't add up
+  assert(0);
+  return NULL;
 }
 
-static void test_2(void) {
-  // a, c, b ordering
-  sexy_rb_tree *t = create_rb(&int_compare);
-  
-  my_type *x = (my_type *) malloc(sizeof(my_type));
-  my_type *y = (my_type *) malloc(sizeof(my_type));
-  my_type *z = (my_type *) malloc(sizeof(my_type));
+int rb_rank(my_type *key, sexy_rb_tree *t) {
+  int (*comp)(my_type *, my_type *) = t->comp;
+  rb_node *cur = t->root;
+  int rank = 0;
 
-  x->x = 1;
-  y->x = 2;
-  z->x = 3;
-
-  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
-
-  a->data = x;
-  b->data = y;
-  c->data = z;
+  while (cur != NULL) {
+    int res = comp(key, cur->data);
 
-  // assert basic inserts don't fail
-  assert(binary_insert_node(a, t) != NULL);
-  assert(binary_insert_node(c, t) != NULL);
-  assert(binary_insert_node(b, t) != NULL);
+    if (res == LESS) {
+      cur = cur->left;
+    } else {
+      // cur's left subtree is all less than key
+      rank += node_size(cur->left);
+      if (res == EQUAL)
+        return rank;
 
-  // assert structure is as it should be
-  assert(t->root == a);
-  assert(t->root->left == NULL);
-  assert(t->root->right == c);
-  assert(t->root->right->right == NULL);
-  assert(t->root->right->left == b);
-  assert(t->root->right->left->left == NULL);
-  assert(t->root->right->left->right == NULL);
+      // and so is cur
+      rank++;
+      cur = cur->right;
+    }
+  }
 
-  free_rb(t);
+  return rank;
 }
+#endif
 
-static void test_3(void) {
-  // b, a, c ordering
-  sexy_rb_tree *t = create_rb(&int_compare);
-  
-  my_type *x = (my_type *) malloc(sizeof(my_type));
-  my_type *y = (my_type *) malloc(sizeof(my_type));
-  my_type *z = (my_type *) malloc(sizeof(my_type));
-
-  x->x = 1;
-  y->x = 2;
-  z->x = 3;
+#if RB_STATS
+// next slot to hand out, and the one this thread got (-1 until it asks)
+// __thread is a gcc/clang extension, but so are the __atomic builtins
+static unsigned rb_stats_next_slot;
+static __thread int rb_stats_my_slot = -1;
 
-  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+static rb_counters *stats_of(sexy_rb_tree *t) {
+  if (t->stats == NULL)
+    return NULL;
 
-  a->data = x;
-  b->data = y;
-  c->data = z;
+  if (rb_stats_my_slot < 0)
+    rb_stats_my_slot = (int) (__atomic_fetch_add(&rb_stats_next_slot, 1, __ATOMIC_RELAXED)
+                              % RB_STATS_SLOTS);
+  return &t->stats[rb_stats_my_slot].c;
+}
 
-  assert(binary_insert_node(b, t) != NULL);
-  assert(binary_insert_node(a, t) != NULL);
-  assert(binary_insert_node(c, t) != NULL);
+static void stat_bump(unsigned long *c, unsigned long v) {
+  __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
 
-  assert(t->root == b);
-  assert(t->root->left == a);
-  assert(t->root->right == c);
-  assert(t->root->left->left == NULL);
-  assert(t->root->left->right == NULL);
-  assert(t->root->right->left == NULL);
-  assert(t->root->right->right == NULL);
+static void stat_max(unsigned long *c, unsigned long v) {
+  if (v > __atomic_load_n(c, __ATOMIC_RELAXED))
+    __atomic_store_n(c, v, __ATOMIC_RELAXED);
+}
 
-  free_rb(t);
+rb_counters rb_stats(sexy_rb_tree *t) {
+  rb_counters sum;
+  memset(&sum, 0, sizeof(sum));
+  if (t->stats == NULL)
+    return sum;
+
+  for (int i = 0; i < RB_STATS_SLOTS; i++) {
+    rb_counters *c = &t->stats[i].c;
+    sum.searches += __atomic_load_n(&c->searches, __ATOMIC_RELAXED);
+    sum.inserts += __atomic_load_n(&c->inserts, __ATOMIC_RELAXED);
+    sum.removes += __atomic_load_n(&c->removes, __ATOMIC_RELAXED);
+    sum.comparisons += __atomic_load_n(&c->comparisons, __ATOMIC_RELAXED);
+    sum.lrots += __atomic_load_n(&c->lrots, __ATOMIC_RELAXED);
+    sum.rrots += __atomic_load_n(&c->rrots, __ATOMIC_RELAXED);
+    sum.recolors += __atomic_load_n(&c->recolors, __ATOMIC_RELAXED);
+    sum.fixup_iterations += __atomic_load_n(&c->fixup_iterations, __ATOMIC_RELAXED);
+    sum.node_allocs += __atomic_load_n(&c->node_allocs, __ATOMIC_RELAXED);
+
+    unsigned long d = __atomic_load_n(&c->max_depth, __ATOMIC_RELAXED);
+    if (d > sum.max_depth)
+      sum.max_depth = d;
+  }
 
+  return sum;
 }
+#endif
 
-static void test_4(void) {
-  // b, c, a ordering
-  sexy_rb_tree *t = create_rb(&int_compare);
-  
-  my_type *x = (my_type *) malloc(sizeof(my_type));
-  my_type *y = (my_type *) malloc(sizeof(my_type));
-  my_type *z = (my_type *) malloc(sizeof(my_type));
+int rb_range(my_type *lo, my_type *hi, sexy_rb_tree *t,
+             int (*cb)(my_type *, void *), void *arg) {
+  int (*comp)(my_type *, my_type *) = t->comp;
+  int count = 0;
 
-  x->x = 1;
-  y->x = 2;
-  z->x = 3;
+  for (rb_node *n = rb_lower_bound(lo, t); n != NULL; n = rb_next(n)) {
+    if (comp(n->data, hi) == GREATER)
+      break;
 
-  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+    count++;
+    if (!cb(n->data, arg))
+      break;
+  }
 
-  a->data = x;
-  b->data = y;
-  c->data = z;
+  return count;
+}
 
-  assert(binary_insert_node(b, t) != NULL);
-  assert(binary_insert_node(c, t) != NULL);
-  assert(binary_insert_node(a, t) != NULL);
+int rb_foreach(sexy_rb_tree *t, int (*cb)(my_type *, void *), void *arg) {
+  int count = 0;
 
-  assert(t->root == b);
-  assert(t->root->left == a);
-  assert(t->root->right == c);
-  assert(t->root->left->left == NULL);
-  assert(t->root->left->right == NULL);
-  assert(t->root->right->left == NULL);
-  assert(t->root->right->right == NULL);
+  for (rb_node *n = rb_first(t); n != NULL; n = rb_next(n)) {
+    count++;
+    if (!cb(n->data, arg))
+      break;
+  }
 
-  free_rb(t);
+  return count;
+}
 
+int rb_size(sexy_rb_tree *t) {
+  return t->num_nodes;
 }
 
+static int check_subtree(rb_node *n, rb_node *p, my_type *lo, my_type *hi,
+                         int (*comp)(my_type *, my_type *), int *count) {
+  if (n == NULL)
+    return 1;
 
-static void test_5(void) {
-  // c, a, b ordering
-  sexy_rb_tree *t = create_rb(&int_compare);
-  
-  my_type *x = (my_type *) malloc(sizeof(my_type));
-  my_type *y = (my_type *) malloc(sizeof(my_type));
-  my_type *z = (my_type *) malloc(sizeof(my_type));
+  if (n->parent != p || n->data == NULL)
+    return -1;
 
-  x->x = 1;
-  y->x = 2;
-  z->x = 3;
+  // has to fit between everything above it
+  if (lo != NULL && comp(n->data, lo) != GREATER)
+    return -1;
+  if (hi != NULL && comp(n->data, hi) != LESS)
+    return -1;
 
-  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+  // both children of red parent must be black (or NULL)
+  if (is_red(n) && (is_red(n->left) || is_red(n->right)))
+    return -1;
 
-  a->data = x;
-  b->data = y;
-  c->data = z;
+  int before = *count;
+  (*count)++;
 
-  assert(binary_insert_node(c, t) != NULL);
-  assert(binary_insert_node(a, t) != NULL);
-  assert(binary_insert_node(b, t) != NULL);
+  int l = check_subtree(n->left, n, lo, n->data, comp, count);
+  if (l < 0)
+    return -1;
 
-  assert(t->root == c);
-  assert(t->root->left == a);
-  assert(t->root->right == NULL);
-  assert(t->root->left->left == NULL);
-  assert(t->root->left->right == b);
-  assert(t->root->left->right->left == NULL);
-  assert(t->root->left->right->right == NULL);
+  int r = check_subtree(n->right, n, n->data, hi, comp, count);
+  if (r < 0)
+    return -1;
 
-  free_rb(t);
+  // every simple path from node to descendant
+  // has same number of black nodes
+  if (l != r)
+    return -1;
 
+#if RB_ORDER_STATS
+  if (n->size != *count - before)
+    return -1;
+#else
+  (void) before;
+#endif
+
+  return l + (is_red(n) ? 0 : 1);
 }
 
-static void test_6(void) {
-  // c, b, a ordering
-  sexy_rb_tree *t = create_rb(&int_compare);
-  
-  my_type *x = (my_type *) malloc(sizeof(my_type));
-  my_type *y = (my_type *) malloc(sizeof(my_type));
-  my_type *z = (my_type *) malloc(sizeof(my_type));
+int is_valid_rb_tree(sexy_rb_tree *t) {
+  if (t == NULL)
+    return 0;
 
-  x->x = 1;
-  y->x = 2;
-  z->x = 3;
+  rb_node *r = get_root(t);
 
-  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+  // root should be black
+  if (is_red(r))
+    return 0;
 
-  a->data = x;
-  b->data = y;
-  c->data = z;
+  int count = 0;
+  if (check_subtree(r, NULL, NULL, NULL, t->comp, &count) < 0)
+    return 0;
 
-  assert(binary_insert_node(c, t) != NULL);
-  assert(binary_insert_node(b, t) != NULL);
-  assert(binary_insert_node(a, t) != NULL);
+  return count == t->num_nodes;
+}
 
-  assert(t->root == c);
-  assert(t->root->left == b);
-  assert(t->root->right == NULL);
-  assert(t->root->left->left == a);
-  assert(t->root->left->right == NULL);
-  assert(t->root->left->left->left == NULL);
-  assert(t->root->left->left->right == NULL);
+static int prb_is_red(prb_node *n) {
+  return n != NULL && n->node_color == RED;
+}
 
-  free_rb(t);
+persistent_rb *create_prb(int (*comp)(my_type *, my_type *)) {
+  persistent_rb *ret = (persistent_rb *) malloc(sizeof(persistent_rb));
+  if (ret == NULL)
+    return NULL;
 
+  ret->root = NULL;
+  ret->num_nodes = 0;
+  ret->sorp = SUCC;
+  ret->comp = comp;
+  ret->spare = NULL;
+  ret->num_spare = 0;
+
+  return ret;
 }
 
+static int prb_reserve(persistent_rb *t, int n) {
+  while (t->num_spare < n) {
+    prb_node *s = (prb_node *) malloc(sizeof(prb_node));
+    if (s == NULL)
+      return 0;
 
-static void test_binary_insert(void) {
-  printf("beginning test of binary_insert_node()\n");
-  test_1();
-  test_2();
-  test_3();
-  test_4();
-  test_5();
-  test_6();
-  printf("binary_insert_node() passed!\n");
+    s->left = t->spare;
+    t->spare = s;
+    t->num_spare++;
+  }
+
+  return 1;
 }
 
-static void test_rrot1(void) {
-  // instantiate and initialize data
-  my_type *a = malloc(sizeof(my_type));
-  my_type *b = malloc(sizeof(my_type));
-  my_type *c = malloc(sizeof(my_type));
-  my_type *d = malloc(sizeof(my_type));
-  my_type *e = malloc(sizeof(my_type));
-  my_type *f = malloc(sizeof(my_type));
-  my_type *g = malloc(sizeof(my_type));
-  my_type *h = malloc(sizeof(my_type));
-  my_type *i = malloc(sizeof(my_type));
-  my_type *j = malloc(sizeof(my_type));
-  my_type *k = malloc(sizeof(my_type));
-  my_type *l = malloc(sizeof(my_type));
-  my_type *m = malloc(sizeof(my_type));
+static prb_node *prb_take(persistent_rb *t) {
+  prb_node *s = t->spare;
+  assert(s != NULL);
 
-  a->x = 1;
-  b->x = 2;
-  c->x = 3;
-  d->x = 4;
-  e->x = 5;
-  f->x = 6;
-  g->x = 7;
-  h->x = 8;
-  i->x = 9;
-  j->x = 10;
-  k->x = 11;
-  l->x = 12;
-  m->x = 13;
+  t->spare = s->left;
+  t->num_spare--;
+  return s;
+}
 
-  rb_node *na = malloc(sizeof(rb_node));
-  rb_node *nb = malloc(sizeof(rb_node));
-  rb_node *nc = malloc(sizeof(rb_node));
-  rb_node *nd = malloc(sizeof(rb_node));
-  rb_node *ne = malloc(sizeof(rb_node));
-  rb_node *nf = malloc(sizeof(rb_node));
-  rb_node *ng = malloc(sizeof(rb_node));
-  rb_node *nh = malloc(sizeof(rb_node));
-  rb_node *ni = malloc(sizeof(rb_node));
-  rb_node *nj = malloc(sizeof(rb_node));
-  rb_node *nk = malloc(sizeof(rb_node));
-  rb_node *nl = malloc(sizeof(rb_node));
-  rb_node *nm = malloc(sizeof(rb_node));
+static void prb_release(prb_node *n) {
+  if (n == NULL)
+    return;
 
-  na->data = a;
-  nb->data = b;
-  nc->data = c;
-  nd->data = d;
-  ne->data = e;
-  nf->data = f;
-  ng->data = g;
-  nh->data = h;
-  ni->data = i;
-  nj->data = j;
-  nk->data = k;
-  nl->data = l;
-  nm->data = m;
+  if (__atomic_sub_fetch(&n->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+    prb_release(n->left);
+    prb_release(n->right);
+    free(n);
+  }
+}
 
+void free_prb(persistent_rb *t) {
+  // snapshots keep whatever they share alive
+  prb_release(t->root);
+  while (t->spare != NULL) {
+    prb_node *s = t->spare;
+    t->spare = s->left;
+    free(s);
+  }
+  free(t);
+}
 
-  // set up initial tree
-  na->parent = NULL;
-  na->left = nb;
-  na->right = nc;
+static prb_node *prb_cow(persistent_rb *t, prb_node **link) {
+  prb_node *n = *link;
 
-  nb->parent = na;
-  nb->left = NULL;
-  nb->right = NULL;
+  if (__atomic_load_n(&n->refs, __ATOMIC_ACQUIRE) == 1)
+    return n;
 
-  nc->parent = na;
-  nc->left = nd;
-  nc->right = ne;
+  // can't back out of a fixup halfway through, hence the reserve
+  prb_node *c = prb_take(t);
 
-  nd->parent = nc;
-  nd->left = nf;
-  nd->right = ng;
+  c->data = n->data;
+  c->node_color = n->node_color;
+  c->refs = 1;
+  c->left = n->left;
+  c->right = n->right;
 
-  ne->parent = nc;
-  ne->left = nh;
-  ne->right = ni;
+  // copy points at the same children
+  if (c->left != NULL)
+    __atomic_add_fetch(&c->left->refs, 1, __ATOMIC_RELAXED);
+  if (c->right != NULL)
+    __atomic_add_fetch(&c->right->refs, 1, __ATOMIC_RELAXED);
 
-  nf->parent = nd;
-  nf->left = nj;
-  nf->right = nk;
+  *link = c;
+  prb_release(n);
+  return c;
+}
 
-  ng->parent = nd;
-  ng->left = nl;
-  ng->right = nm;
+static prb_node **prb_link(persistent_rb *t, prb_node **path, int i) {
+  if (i == 0)
+    return &t->root;
+  else if (path[i - 1]->left == path[i])
+    return &path[i - 1]->left;
+  else
+    return &path[i - 1]->right;
+}
 
-  nh->parent = ne;
-  nh->left = NULL;
-  nh->right = NULL;
+// moved subtrees trade one parent for another, so no refs change
+static void prb_lrot(prb_node **link) {
+  prb_node *n = *link;
+  prb_node *r = n->right;
 
-  ni->parent = ne;
-  ni->left = NULL;
-  ni->right = NULL;
+  n->right = r->left;
+  r->left = n;
+  *link = r;
+}
 
-  nj->parent = nf;
-  nj->left = NULL;
-  nj->right = NULL;
+static void prb_rrot(prb_node **link) {
+  prb_node *n = *link;
+  prb_node *l = n->left;
 
-  nk->parent = nf;
-  nk->left = NULL;
-  nk->right = NULL;
+  n->left = l->right;
+  l->right = n;
+  *link = l;
+}
 
-  nl->parent = ng;
-  nl->left = NULL;
-  nl->right = NULL;
+static my_type *prb_search_from(prb_node *cur, my_type *elem,
+                                int (*comp)(my_type *, my_type *)) {
+  assert(elem != NULL);
 
-  nm->parent = ng;
-  nm->left = NULL;
-  nm->right = NULL;
+  while (cur != NULL) {
+    int res = comp(elem, cur->data);
+    if (res == LESS)
+      cur = cur->left;
+    else if (res == GREATER)
+      cur = cur->right;
+    else
+      return cur->data;
+  }
 
-  // rotate nc, which is right of root
-  sexy_rb_tree *t = (sexy_rb_tree *) malloc(sizeof(sexy_rb_tree));
-  t->root = NULL;
+  return NULL;
+}
 
-  rrot(nc, t);
+my_type *search_prb(my_type *elem, persistent_rb *t) {
+  return prb_search_from(t->root, elem, t->comp);
+}
 
-  free(t);
+int insert_prb(my_type *data, persistent_rb *t) {
+  // look before copying anything; DON'T ALLOW DUPLICATES
+  int k = 0;
+  for (prb_node *cur = t->root; cur != NULL; k++) {
+    int res = t->comp(data, cur->data);
+    if (res == EQUAL)
+      return 0;
+    cur = (res == LESS) ? cur->left : cur->right;
+  }
 
-  // test structure
-  assert(na->parent == NULL);
-  assert(na->left == nb);
-  assert(na->right == nd);
+  // the k nodes down, an uncle for every two of them the fixup goes
+  // back up, and the new node
+  if (!prb_reserve(t, k + k / 2 + 1))
+    return 0;
 
-  assert(nb->parent == na);
-  assert(nb->left == NULL);
-  assert(nb->right == NULL);
+  prb_node *n = prb_take(t);
 
-  assert(nc->parent == nd);
-  assert(nc->left == ng);
-  assert(nc->right == ne);
+  n->data = data;
+  n->node_color = RED;
+  n->refs = 1;
+  n->left = NULL;
+  n->right = NULL;
 
-  assert(nd->parent == na);
-  assert(nd->left == nf);
-  assert(nd->right == nc);
+  // make the whole path down mutable
+  prb_node *path[PRB_MAX_DEPTH];
+  k = 0;
+  prb_node **link = &t->root;
 
-  assert(ne->parent == nc);
-  assert(ne->left == nh);
-  assert(ne->right == ni);
+  while (*link != NULL) {
+    prb_node *cur = prb_cow(t, link);
+    path[k++] = cur;
+    link = (t->comp(data, cur->data) == LESS) ? &cur->left : &cur->right;
+  }
 
-  assert(nf->parent == nd);
-  assert(nf->left == nj);
-  assert(nf->right == nk);
+  *link = n;
+  path[k] = n;
+  t->num_nodes++;
+
+  // same as insert_fixup but with the path instead of parent pointers
+  int i = k;
+  while (i >= 2 && prb_is_red(path[i - 1])) {
+    prb_node *p = path[i - 1];
+    // p is red so it isn't the root and g exists
+    prb_node *g = path[i - 2];
+    n = path[i];
+
+    if (p == g->left) {
+      if (prb_is_red(g->right)) {
+        // push the red up to g and keep going from there
+        prb_node *u = prb_cow(t, &g->right);
+        p->node_color = BLACK;
+        u->node_color = BLACK;
+        g->node_color = RED;
+        i -= 2;
+        continue;
+      }
+
+      if (n == p->right) {
+        prb_lrot(&g->left);
+        p = n;
+      }
+
+      p->node_color = BLACK;
+      g->node_color = RED;
+      prb_rrot(prb_link(t, path, i - 2));
+    } else {
+      if (prb_is_red(g->left)) {
+        prb_node *u = prb_cow(t, &g->left);
+        p->node_color = BLACK;
+        u->node_color = BLACK;
+        g->node_color = RED;
+        i -= 2;
+        continue;
+      }
+
+      if (n == p->left) {
+        prb_rrot(&g->right);
+        p = n;
+      }
+
+      p->node_color = BLACK;
+      g->node_color = RED;
+      prb_lrot(prb_link(t, path, i - 2));
+    }
 
-  assert(ng->parent == nc);
-  assert(ng->left == nl);
-  assert(ng->right == nm);
+    break;
+  }
 
-  assert(nh->parent == ne);
-  assert(nh->left == NULL);
-  assert(nh->right == NULL);
+  // root is always on the path, so it's mutable
+  t->root->node_color = BLACK;
+  return 1;
+}
 
-  assert(ni->parent == ne);
-  assert(ni->left == NULL);
-  assert(ni->right == NULL);
+static void prb_remove_fixup(persistent_rb *t, prb_node **path, int i, int n_left) {
+  while (i > 0) {
+    prb_node *p = path[i - 1];
+    prb_node **plink = prb_link(t, path, i - 1);
+
+    // sibling has to exist; the other side of p is at least as black
+    prb_node *s = prb_cow(t, n_left ? &p->right : &p->left);
+
+    if (prb_is_red(s)) {
+      // red sibling; rotate so n gets a black sibling
+      p->node_color = RED;
+      s->node_color = BLACK;
+      if (n_left)
+        prb_lrot(plink);
+      else
+        prb_rrot(plink);
+
+      // s is above p now; p being red means we finish below
+      plink = n_left ? &s->left : &s->right;
+      s = prb_cow(t, n_left ? &p->right : &p->left);
+    }
 
-  assert(nj->parent == nf);
-  assert(nj->left == NULL);
-  assert(nj->right == NULL);
+    if (!prb_is_red(s->left) && !prb_is_red(s->right)) {
+      s->node_color = RED;
 
-  assert(nk->parent == nf);
-  assert(nk->left == NULL);
-  assert(nk->right == NULL);
+      if (prb_is_red(p)) {
+        p->node_color = BLACK;
+        return;
+      }
 
-  assert(nl->parent == ng);
-  assert(nl->left == NULL);
-  assert(nl->right == NULL);
+      // parent now doubly black; move up
+      i--;
+      if (i > 0)
+        n_left = (path[i - 1]->left == p);
+      continue;
+    }
 
-  assert(nm->parent == ng);
-  assert(nm->left == NULL);
-  assert(nm->right == NULL);
+    // sibling has a red child; make sure it's the "outside" one
+    if (n_left && !prb_is_red(s->right)) {
+      prb_node *sl = prb_cow(t, &s->left);
+      s->node_color = RED;
+      sl->node_color = BLACK;
+      prb_rrot(&p->right);
+      s = p->right;
+    } else if (!n_left && !prb_is_red(s->left)) {
+      prb_node *sr = prb_cow(t, &s->right);
+      s->node_color = RED;
+      sr->node_color = BLACK;
+      prb_lrot(&p->left);
+      s = p->left;
+    }
 
-  // clean up
-  free(a);
-  free(b);
-  free(c);
-  free(d);
-  free(e);
-  free(f);
-  free(g);
-  free(h);
-  free(i);
-  free(j);
-  free(k);
-  free(l);
-  free(m);
+    // rotate p toward n; s takes p's place and color
+    s->node_color = p->node_color;
+    p->node_color = BLACK;
+    if (n_left) {
+      prb_cow(t, &s->right)->node_color = BLACK;
+      prb_lrot(plink);
+    } else {
+      prb_cow(t, &s->left)->node_color = BLACK;
+      prb_rrot(plink);
+    }
 
-  free(na);
-  free(nb);
-  free(nc);
-  free(nd);
-  free(ne);
-  free(nf);
-  free(ng);
-  free(nh);
-  free(ni);
-  free(nj);
-  free(nk);
-  free(nl);
-  free(nm);
+    return;
+  }
+}
 
-  return;
+my_type *remove_prb(my_type *elem, persistent_rb *t) {
+  int (*comp)(my_type *, my_type *) = t->comp;
+
+  // look before copying anything, counting the path the removal will
+  // take (down to the pred/succ if it has two children)
+  int k = 0;
+  prb_node *cur = t->root;
+  while (cur != NULL) {
+    int res = comp(elem, cur->data);
+    k++;
+    if (res == EQUAL)
+      break;
+    cur = (res == LESS) ? cur->left : cur->right;
+  }
+  if (cur == NULL)
+    return NULL;
+
+  if (cur->left != NULL && cur->right != NULL) {
+    if (t->sorp == SUCC) {
+      for (cur = cur->right; cur != NULL; cur = cur->left)
+        k++;
+    } else {
+      for (cur = cur->left; cur != NULL; cur = cur->right)
+        k++;
+    }
+  }
+
+  // the k nodes down, then at most a sibling per level the fixup goes
+  // up and 3 more where it stops
+  if (!prb_reserve(t, 2 * k + 3))
+    return NULL;
+
+  prb_node *path[PRB_MAX_DEPTH];
+  k = 0;
+  prb_node **link = &t->root;
+  prb_node *z;
+
+  for (;;) {
+    z = prb_cow(t, link);
+    path[k++] = z;
+
+    int res = comp(elem, z->data);
+    if (res == EQUAL)
+      break;
+    link = (res == LESS) ? &z->left : &z->right;
+  }
+
+  my_type *ret = z->data;
+
+  // two children: pull pred/succ data up and remove that node instead
+  if (z->left != NULL && z->right != NULL) {
+    if (t->sorp == SUCC) {
+      link = &z->right;
+      while (1) {
+        prb_node *c = prb_cow(t, link);
+        path[k++] = c;
+        if (c->left == NULL)
+          break;
+        link = &c->left;
+      }
+      t->sorp = PRED;
+    } else {
+      link = &z->left;
+      while (1) {
+        prb_node *c = prb_cow(t, link);
+        path[k++] = c;
+        if (c->right == NULL)
+          break;
+        link = &c->right;
+      }
+      t->sorp = SUCC;
+    }
+
+    z->data = path[k - 1]->data;
+  }
+
+  prb_node *target = path[k - 1];
+  prb_node *child = (target->left != NULL) ? target->left : target->right;
+  int n_left = (k >= 2 && path[k - 2]->left == target);
+  prb_node **tlink = prb_link(t, path, k - 1);
+  int was_black = !prb_is_red(target);
+
+  // child's reference moves from target to target's parent
+  *tlink = child;
+  target->left = NULL;
+  target->right = NULL;
+  prb_release(target);
+  t->num_nodes--;
+
+  if (was_black) {
+    if (prb_is_red(child))
+      // child takes over target's black
+      prb_cow(t, tlink)->node_color = BLACK;
+    else
+      prb_remove_fixup(t, path, k - 1, n_left);
+  }
+
+  return ret;
 }
 
-// same as test_rrot1 but tree is on other side of parent
-static void test_rrot2(void) {
-  return;
+rb_version *rb_snapshot(persistent_rb *t) {
+  rb_version *v = (rb_version *) malloc(sizeof(rb_version));
+  if (v == NULL)
+    return NULL;
+
+  // the live tree has to copy the root (and path) on its next write
+  v->root = t->root;
+  if (v->root != NULL)
+    __atomic_add_fetch(&v->root->refs, 1, __ATOMIC_RELAXED);
+
+  v->num_nodes = t->num_nodes;
+  v->comp = t->comp;
+
+  return v;
 }
 
-static void test_rrot(void) {
-  test_rrot1();
-  test_rrot2();
+my_type *search_version(my_type *elem, rb_version *v) {
+  return prb_search_from(v->root, elem, v->comp);
 }
 
-// reverse of rrot1
-static void test_lrot1(void) {
-  // instantiate and initialize data
-  my_type *a = malloc(sizeof(my_type));
-  my_type *b = malloc(sizeof(my_type));
-  my_type *c = malloc(sizeof(my_type));
-  my_type *d = malloc(sizeof(my_type));
-  my_type *e = malloc(sizeof(my_type));
-  my_type *f = malloc(sizeof(my_type));
-  my_type *g = malloc(sizeof(my_type));
-  my_type *h = malloc(sizeof(my_type));
-  my_type *i = malloc(sizeof(my_type));
-  my_type *j = malloc(sizeof(my_type));
-  my_type *k = malloc(sizeof(my_type));
-  my_type *l = malloc(sizeof(my_type));
-  my_type *m = malloc(sizeof(my_type));
+int version_foreach(rb_version *v, int (*cb)(my_type *, void *), void *arg) {
+  // no parent pointers, so walk with a stack of left spines
+  prb_node *stack[PRB_MAX_DEPTH];
+  int top = 0;
+  int count = 0;
+  prb_node *cur = v->root;
 
-  a->x = 1;
-  b->x = 2;
-  c->x = 3;
-  d->x = 4;
-  e->x = 5;
-  f->x = 6;
-  g->x = 7;
-  h->x = 8;
-  i->x = 9;
-  j->x = 10;
-  k->x = 11;
-  l->x = 12;
-  m->x = 13;
+  while (cur != NULL || top > 0) {
+    while (cur != NULL) {
+      stack[top++] = cur;
+      cur = cur->left;
+    }
 
-  rb_node *na = malloc(sizeof(rb_node));
-  rb_node *nb = malloc(sizeof(rb_node));
-  rb_node *nc = malloc(sizeof(rb_node));
-  rb_node *nd = malloc(sizeof(rb_node));
-  rb_node *ne = malloc(sizeof(rb_node));
-  rb_node *nf = malloc(sizeof(rb_node));
-  rb_node *ng = malloc(sizeof(rb_node));
-  rb_node *nh = malloc(sizeof(rb_node));
-  rb_node *ni = malloc(sizeof(rb_node));
-  rb_node *nj = malloc(sizeof(rb_node));
-  rb_node *nk = malloc(sizeof(rb_node));
-  rb_node *nl = malloc(sizeof(rb_node));
-  rb_node *nm = malloc(sizeof(rb_node));
+    cur = stack[--top];
+    count++;
+    if (!cb(cur->data, arg))
+      break;
+    cur = cur->right;
+  }
 
-  na->data = a;
-  nb->data = b;
-  nc->data = c;
-  nd->data = d;
-  ne->data = e;
-  nf->data = f;
-  ng->data = g;
-  nh->data = h;
-  ni->data = i;
-  nj->data = j;
-  nk->data = k;
-  nl->data = l;
-  nm->data = m;
+  return count;
+}
 
+void release_version(rb_version *v) {
+  prb_release(v->root);
+  free(v);
+}
 
-  // set up initial tree
-  na->parent = NULL;
-  na->left = nb;
-  na->right = nd;
-  
-  nb->parent = na;
-  nb->left = NULL;
-  nb->right = NULL;
-  
-  nc->parent = nd;
-  nc->left = ng;
-  nc->right = ne;
-  
-  nd->parent = na;
-  nd->left = nf;
-  nd->right = nc;
-  
-  ne->parent = nc;
-  ne->left = nh;
-  ne->right = ni;
-  
-  nf->parent = nd;
-  nf->left = nj;
-  nf->right = nk;
-  
-  ng->parent = nc;
-  ng->left = nl;
-  ng->right = nm;
-  
-  nh->parent = ne;
-  nh->left = NULL;
-  nh->right = NULL;
-  
-  ni->parent = ne;
-  ni->left = NULL;
-  ni->right = NULL;
-  
-  nj->parent = nf;
-  nj->left = NULL;
-  nj->right = NULL;
-  
-  nk->parent = nf;
-  nk->left = NULL;
+// black height of n's subtree, -1 if anything's wrong; same idea as check_subtree
+static int check_prb_subtree(prb_node *n, my_type *lo, my_type *hi,
+                             int (*comp)(my_type *, my_type *), int *count) {
+  if (n == NULL)
+    return 1;
+
+  if (n->refs < 1 || n->data == NULL)
+    return -1;
+  if (lo != NULL && comp(n->data, lo) != GREATER)
+    return -1;
+  if (hi != NULL && comp(n->data, hi) != LESS)
+    return -1;
+  if (prb_is_red(n) && (prb_is_red(n->left) || prb_is_red(n->right)))
+    return -1;
+
+  (*count)++;
+
+  int l = check_prb_subtree(n->left, lo, n->data, comp, count);
+  int r = check_prb_subtree(n->right, n->data, hi, comp, count);
+  if (l < 0 || r < 0 || l != r)
+    return -1;
+
+  return l + (prb_is_red(n) ? 0 : 1);
+}
+
+static int prb_valid(prb_node *root, int num_nodes, int (*comp)(my_type *, my_type *)) {
+  if (prb_is_red(root))
+    return 0;
+
+  int count = 0;
+  if (check_prb_subtree(root, NULL, NULL, comp, &count) < 0)
+    return 0;
+
+  return count == num_nodes;
+}
+
+int is_valid_prb(persistent_rb *t) {
+  return t != NULL && prb_valid(t->root, t->num_nodes, t->comp);
+}
+
+int is_valid_version(rb_version *v) {
+  return v != NULL && prb_valid(v->root, v->num_nodes, v->comp);
+}
+
+static uint32_t save_subtree(rb_node *n, rb_disk_node *out, uint32_t *next) {
+  if (n == NULL)
+    return RB_DISK_NIL;
+
+  uint32_t i = (*next)++;
+
+  // zero the padding so files are byte-for-byte reproducible
+  memset(&out[i], 0, sizeof(rb_disk_node));
+  out[i].node_color = (uint32_t) n->node_color;
+  out[i].data = *n->data;
+  out[i].left = save_subtree(n->left, out, next);
+  out[i].right = save_subtree(n->right, out, next);
+
+  return i;
+}
+
+int rb_save(sexy_rb_tree *t, const char *path) {
+  size_t plen = strlen(path);
+  char *tmp = (char *) malloc(plen + sizeof(".tmp"));
+  if (tmp == NULL)
+    return 0;
+  memcpy(tmp, path, plen);
+  memcpy(tmp + plen, ".tmp", sizeof(".tmp"));
+
+  // readers don't get in the way, only writers
+  if (t->sync != NULL)
+    pthread_mutex_lock(&t->sync->write_lock);
+
+  rb_disk_header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, RB_DISK_MAGIC, sizeof(h.magic));
+  h.byte_order = RB_DISK_BYTE_ORDER;
+  h.node_size = sizeof(rb_disk_node);
+  h.num_nodes = (uint32_t) t->num_nodes;
+
+  rb_disk_node *nodes = NULL;
+  if (t->num_nodes > 0)
+    nodes = (rb_disk_node *) malloc(t->num_nodes * sizeof(rb_disk_node));
+
+  int ok = 0;
+  if (t->num_nodes == 0 || nodes != NULL) {
+    uint32_t next = 0;
+    h.root = save_subtree(t->root, nodes, &next);
+    assert(next == h.num_nodes);
+
+    FILE *f = fopen(tmp, "wb");
+    if (f != NULL) {
+      ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+           (h.num_nodes == 0 ||
+            fwrite(nodes, sizeof(rb_disk_node), h.num_nodes, f) == h.num_nodes);
+      // on disk before the rename can point path at it
+      ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+      ok = (fclose(f) == 0) && ok;
+    }
+  }
+
+  if (t->sync != NULL)
+    pthread_mutex_unlock(&t->sync->write_lock);
+
+  if (ok)
+    ok = rename(tmp, path) == 0;
+  if (!ok)
+    remove(tmp);
+  else
+    // the rename's only a directory entry until the directory's synced
+    ok = sync_parent_dir(path);
+
+  free(nodes);
+  free(tmp);
+  return ok;
+}
+
+static int sync_parent_dir(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *dir;
+  if (slash == NULL) {
+    dir = strdup(".");
+  } else {
+    // "/x" lives in "/"
+    size_t len = (slash == path) ? 1 : (size_t) (slash - path);
+    dir = strndup(path, len);
+  }
+  if (dir == NULL)
+    return 0;
+
+  int fd = open(dir, O_RDONLY);
+  free(dir);
+  if (fd < 0)
+    return 0;
+
+  int ok = fsync(fd) == 0;
+  close(fd);
+  return ok;
+}
+
+rb_mapped *rb_open_mmap(const char *path, int (*comp)(my_type *, my_type *)) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(rb_disk_header)) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t len = (size_t) st.st_size;
+  void *base = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping holds its own reference to the file
+  close(fd);
+  if (base == MAP_FAILED)
+    return NULL;
+
+  const rb_disk_header *h = (const rb_disk_header *) base;
+  if (memcmp(h->magic, RB_DISK_MAGIC, sizeof(h->magic)) != 0 ||
+      h->byte_order != RB_DISK_BYTE_ORDER ||
+      h->node_size != sizeof(rb_disk_node) ||
+      h->num_nodes > INT_MAX ||
+      len != sizeof(rb_disk_header) + (size_t) h->num_nodes * sizeof(rb_disk_node) ||
+      (h->num_nodes == 0) != (h->root == RB_DISK_NIL) ||
+      (h->root != RB_DISK_NIL && h->root >= h->num_nodes)) {
+    munmap(base, len);
+    return NULL;
+  }
+
+  rb_mapped *m = (rb_mapped *) malloc(sizeof(rb_mapped));
+  if (m == NULL) {
+    munmap(base, len);
+    return NULL;
+  }
+
+  m->base = base;
+  m->len = len;
+  m->nodes = (const rb_disk_node *) ((const char *) base + sizeof(rb_disk_header));
+  m->num_nodes = h->num_nodes;
+  m->root = h->root;
+  m->comp = comp;
+
+  // searches go root-down; no point having the OS read ahead
+  posix_madvise(base, len, POSIX_MADV_RANDOM);
+
+  return m;
+}
+
+const my_type *search_mapped(my_type *elem, rb_mapped *m) {
+  assert(elem != NULL);
+
+  uint32_t i = m->root;
+
+  // a corrupt file can't send us out of the map or round in circles
+  for (uint32_t steps = 0; i < m->num_nodes && steps < m->num_nodes; steps++) {
+    const rb_disk_node *n = &m->nodes[i];
+    int res = m->comp(elem, (my_type *) &n->data);
+
+    if (res == LESS)
+      i = n->left;
+    else if (res == GREATER)
+      i = n->right;
+    else
+      return &n->data;
+  }
+
+  return NULL;
+}
+
+int mapped_size(rb_mapped *m) {
+  return (int) m->num_nodes;
+}
+
+void rb_close_mmap(rb_mapped *m) {
+  munmap(m->base, m->len);
+  free(m);
+}
+
+rb_cache *create_rb_cache(int (*comp)(my_type *, my_type *), int capacity, int policy,
+                          void (*evict)(my_type *, void *), void *evict_arg) {
+  if (capacity < 1 || (policy != RB_CACHE_LRU && policy != RB_CACHE_LFU))
+    return NULL;
+
+  rb_cache *c = (rb_cache *) malloc(sizeof(rb_cache));
+  if (c == NULL)
+    return NULL;
+
+  c->tree = create_rb(comp);
+  c->bucket_mem = (rb_cache_bucket *) malloc((capacity + 1) * sizeof(rb_cache_bucket));
+  if (c->tree == NULL || c->bucket_mem == NULL) {
+    if (c->tree != NULL)
+      free_rb(c->tree);
+    free(c->bucket_mem);
+    free(c);
+    return NULL;
+  }
+
+  c->pool = NULL;
+  for (int i = 0; i <= capacity; i++) {
+    c->bucket_mem[i].next = c->pool;
+    c->pool = &c->bucket_mem[i];
+  }
+
+  c->capacity = capacity;
+  c->policy = policy;
+  c->buckets = NULL;
+  c->evict = evict;
+  c->evict_arg = evict_arg;
+
+  return c;
+}
+
+void free_rb_cache(rb_cache *c) {
+  // nodes are malloc'ed rb_cache_nodes with the rb_node first, so the
+  // tree frees them (and the data) the same as its own
+  free_rb(c->tree);
+  free(c->bucket_mem);
+  free(c);
+}
+
+int cache_size(rb_cache *c) {
+  return c->tree->num_nodes;
+}
+
+static void bucket_push_front(rb_cache_bucket *b, rb_cache_node *cn) {
+  cn->bucket = b;
+  cn->prev = NULL;
+  cn->next = b->head;
+
+  if (b->head != NULL)
+    b->head->prev = cn;
+  else
+    b->tail = cn;
+  b->head = cn;
+}
+
+static void bucket_unlink(rb_cache_node *cn) {
+  rb_cache_bucket *b = cn->bucket;
+
+  if (cn->prev != NULL)
+    cn->prev->next = cn->next;
+  else
+    b->head = cn->next;
+
+  if (cn->next != NULL)
+    cn->next->prev = cn->prev;
+  else
+    b->tail = cn->prev;
+}
+
+static void drop_bucket_if_empty(rb_cache *c, rb_cache_bucket *b) {
+  if (b->head != NULL)
+    return;
+
+  if (b->prev != NULL)
+    b->prev->next = b->next;
+  else
+    c->buckets = b->next;
+  if (b->next != NULL)
+    b->next->prev = b->prev;
+
+  b->next = c->pool;
+  c->pool = b;
+}
+
+static rb_cache_bucket *bucket_after(rb_cache *c, rb_cache_bucket *b, unsigned long freq) {
+  rb_cache_bucket *next = (b == NULL) ? c->buckets : b->next;
+  if (next != NULL && next->freq == freq)
+    return next;
+
+  // at most one bucket per entry plus this one, so the pool has one
+  rb_cache_bucket *nb = c->pool;
+  assert(nb != NULL);
+  c->pool = nb->next;
+
+  nb->freq = freq;
+  nb->head = NULL;
+  nb->tail = NULL;
+  nb->prev = b;
+  nb->next = next;
+
+  if (b != NULL)
+    b->next = nb;
+  else
+    c->buckets = nb;
+  if (next != NULL)
+    next->prev = nb;
+
+  return nb;
+}
+
+static void cache_touch(rb_cache *c, rb_cache_node *cn) {
+  rb_cache_bucket *b = cn->bucket;
+
+  bucket_unlink(cn);
+
+  if (c->policy == RB_CACHE_LRU) {
+    bucket_push_front(b, cn);
+    return;
+  }
+
+  // grab the next bucket before b can go back to the pool
+  rb_cache_bucket *nb = bucket_after(c, b, b->freq + 1);
+  bucket_push_front(nb, cn);
+  drop_bucket_if_empty(c, b);
+}
+
+my_type *cache_get(my_type *key, rb_cache *c) {
+  rb_node *n = search_node(key, c->tree);
+  if (n == NULL)
+    return NULL;
+
+  cache_touch(c, (rb_cache_node *) n);
+  return n->data;
+}
+
+my_type *cache_peek(my_type *key, rb_cache *c) {
+  return search_baby(key, c->tree);
+}
+
+static my_type *cache_take_out(rb_cache *c, rb_cache_node *cn) {
+  sexy_rb_tree *t = c->tree;
+  my_type *ret = cn->node.data;
+
+  rb_cache_bucket *b = cn->bucket;
+  bucket_unlink(cn);
+
+  rb_cache_node *gone = (rb_cache_node *) pick_removed(&cn->node, t);
+  if (gone != cn) {
+    // gone's data now lives in cn's node, so cn takes gone's list spot
+    cn->prev = gone->prev;
+    cn->next = gone->next;
+    cn->bucket = gone->bucket;
+
+    if (cn->prev != NULL)
+      cn->prev->next = cn;
+    else
+      cn->bucket->head = cn;
+    if (cn->next != NULL)
+      cn->next->prev = cn;
+    else
+      cn->bucket->tail = cn;
+  }
+
+  drop_bucket_if_empty(c, b);
+
+  remove_one_child(&gone->node, t);
+  t->num_nodes--;
+
+  return ret;
+}
+
+my_type *cache_remove(my_type *key, rb_cache *c) {
+  rb_node *n = search_node(key, c->tree);
+  if (n == NULL)
+    return NULL;
+
+  return cache_take_out(c, (rb_cache_node *) n);
+}
+
+int cache_put(my_type *data, rb_cache *c) {
+  sexy_rb_tree *t = c->tree;
+
+  // find the spot before evicting so duplicates cost nothing
+  int dir;
+  rb_node *p = find_insert_parent(data, t, &dir);
+  if (dir == EQUAL)
+    return 0;
+
+  rb_cache_node *cn = (rb_cache_node *) malloc(sizeof(rb_cache_node));
+  if (cn == NULL)
+    return 0;
+
+  if (t->num_nodes == c->capacity) {
+    my_type *old = cache_take_out(c, c->buckets->tail);
+    if (c->evict != NULL)
+      c->evict(old, c->evict_arg);
+    else
+      free(old);
+
+    // the removal may have rotated p out of the way
+    p = find_insert_parent(data, t, &dir);
+  }
+
+  cn->node.data = data;
+  link_node(&cn->node, p, dir, t);
+  adjust_sizes(p, 1);
+  insert_fixup(&cn->node, t);
+  t->num_nodes++;
+
+  // new entries start at one use
+  if (c->policy == RB_CACHE_LRU)
+    bucket_push_front(bucket_after(c, NULL, 0), cn);
+  else
+    bucket_push_front(bucket_after(c, NULL, 1), cn);
+
+  return 1;
+}
+
+static int par_push(rb_par_deque *d, rb_node *n, int depth) {
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom == RB_PAR_MAX_SPLIT && d->top > 0) {
+    // steals left room at the top; slide everything down
+    memmove(d->tasks, d->tasks + d->top, (d->bottom - d->top) * sizeof(rb_par_task));
+    d->bottom -= d->top;
+    d->top = 0;
+  }
+  int ok = (d->bottom < RB_PAR_MAX_SPLIT);
+  if (ok) {
+    d->tasks[d->bottom].n = n;
+    d->tasks[d->bottom].depth = depth;
+    d->bottom++;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return ok;
+}
+
+// from_top is a steal; otherwise the owner taking back its newest
+static int par_pop(rb_par_deque *d, int from_top, rb_par_task *out) {
+  pthread_mutex_lock(&d->lock);
+  int ok = (d->top < d->bottom);
+  if (ok) {
+    if (from_top)
+      *out = d->tasks[d->top++];
+    else
+      *out = d->tasks[--d->bottom];
+    if (d->top == d->bottom)
+      d->top = d->bottom = 0;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return ok;
+}
+
+// everything under n in order, children read before n is visited
+// returns how many nodes that was
+static int seq_walk(rb_par *p, rb_node *n) {
+  int count = 0;
+  while (n != NULL) {
+    rb_node *r = n->right;
+    count += seq_walk(p, n->left);
+    p->visit(n, p);
+    count++;
+    n = r;
+  }
+  return count;
+}
+
+static int par_walk(rb_par *p, int self, rb_node *n, int depth) {
+  int count = 0;
+  while (n != NULL) {
+    if (depth >= p->split_depth)
+      return count + seq_walk(p, n);
+
+    // put the right side up for grabs while doing the left
+    rb_node *r = n->right;
+    int pushed = 0;
+    if (r != NULL) {
+      __atomic_add_fetch(&p->pending, 1, __ATOMIC_RELAXED);
+      pushed = par_push(&p->deques[self], r, depth + 1);
+      if (!pushed)
+        __atomic_sub_fetch(&p->pending, 1, __ATOMIC_RELAXED);
+    }
+
+    count += par_walk(p, self, n->left, depth + 1);
+    p->visit(n, p);
+    count++;
+
+    if (r == NULL)
+      return count;
+    if (pushed) {
+      // steals only take the oldest, so if r's still here it's at the
+      // bottom; if it's gone someone else has it
+      rb_par_task t;
+      if (!par_pop(&p->deques[self], 0, &t))
+        return count;
+      assert(t.n == r);
+      __atomic_sub_fetch(&p->pending, 1, __ATOMIC_RELAXED);
+    }
+    n = r;
+    depth++;
+  }
+  return count;
+}
+
+// par_worker's argument
+typedef struct rb_par_self {
+  rb_par *p;
+  int self;
+} rb_par_self;
+
+static void *par_worker(void *arg) {
+  rb_par *p = ((rb_par_self *) arg)->p;
+  int self = ((rb_par_self *) arg)->self;
+  rb_par_task t;
+  // kept here and written once, not bumped in p (shared cache lines)
+  int count = 0;
+
+  for (;;) {
+    int got = par_pop(&p->deques[self], 0, &t);
+    for (int i = 1; !got && i < p->nthreads; i++)
+      got = par_pop(&p->deques[(self + i) % p->nthreads], 1, &t);
+
+    if (got) {
+      count += par_walk(p, self, t.n, t.depth);
+      // acq_rel so everything the task did is seen by whoever sees 0
+      __atomic_sub_fetch(&p->pending, 1, __ATOMIC_ACQ_REL);
+    } else if (__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) == 0) {
+      p->visited[self] = count;
+      return NULL;
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+static void par_run(rb_par *p, rb_node *root, int num_nodes, int nthreads) {
+  if (nthreads > RB_PAR_MAX_THREADS)
+    nthreads = RB_PAR_MAX_THREADS;
+  if (nthreads < 1 || num_nodes < 2 * RB_PAR_GRAIN)
+    nthreads = 1;
+
+  // depth d has about num_nodes >> d nodes under each subtree
+  p->split_depth = 0;
+  while (p->split_depth < RB_PAR_MAX_SPLIT && (num_nodes >> p->split_depth) > RB_PAR_GRAIN)
+    p->split_depth++;
+
+  for (int i = 0; i < RB_PAR_MAX_THREADS; i++)
+    p->visited[i] = 0;
+
+  if (nthreads == 1 || root == NULL) {
+    p->visited[0] = seq_walk(p, root);
+    return;
+  }
+
+  rb_par_deque deques[nthreads];
+  pthread_t tids[nthreads];
+  rb_par_self selves[nthreads];
+  int started[nthreads];
+
+  p->nthreads = nthreads;
+  p->deques = deques;
+  p->pending = 1;
+  for (int i = 0; i < nthreads; i++) {
+    pthread_mutex_init(&deques[i].lock, NULL);
+    deques[i].top = deques[i].bottom = 0;
+    selves[i].p = p;
+    selves[i].self = i;
+  }
+  par_push(&deques[0], root, 0);
+
+  // a thread that won't start just means fewer thieves
+  started[0] = 0;
+  for (int i = 1; i < nthreads; i++)
+    started[i] = (pthread_create(&tids[i], NULL, par_worker, &selves[i]) == 0);
+  par_worker(&selves[0]);
+
+  for (int i = 1; i < nthreads; i++) {
+    if (started[i])
+      pthread_join(tids[i], NULL);
+  }
+  for (int i = 0; i < nthreads; i++)
+    pthread_mutex_destroy(&deques[i].lock);
+}
+
+static void visit_map(rb_node *n, rb_par *p) {
+  p->fn(n->data, p->arg);
+}
+
+static void visit_free(rb_node *n, rb_par *p) {
+  (void) p;
+  free(n->data);
+  free(n);
+}
+
+int rb_parallel_map(sexy_rb_tree *t, void (*fn)(my_type *, void *), void *arg, int nthreads) {
+  rb_par p;
+  p.visit = &visit_map;
+  p.fn = fn;
+  p.arg = arg;
+  par_run(&p, t->root, t->num_nodes, nthreads);
+
+  int ret = 0;
+  for (int i = 0; i < RB_PAR_MAX_THREADS; i++)
+    ret += p.visited[i];
+  return ret;
+}
+
+// free_rb_parallel's per-thread share of an arena: slabs[i] for
+// every i that's self mod stride
+typedef struct rb_slab_share {
+  rb_arena *a;
+  rb_slab **slabs;
+  int self;
+  int stride;
+} rb_slab_share;
+
+static void *free_slab_share(void *arg) {
+  rb_slab_share *sh = arg;
+  rb_arena *a = sh->a;
+
+  for (int i = sh->self; i < a->num_slabs; i += sh->stride) {
+    // same as free_arena: only the newest slab (first) is partly used
+    int live = (i == 0) ? a->used : a->slab_nodes;
+    for (int j = 0; j < live; j++)
+      free(sh->slabs[i]->nodes[j].data);
+    free(sh->slabs[i]);
+  }
+  return NULL;
+}
+
+// the slab half of free_rb_parallel; 0 if it didn't do anything
+// (nothing to split up or out of memory), leaving it to free_arena
+static int free_arena_parallel(rb_arena *a, int nthreads) {
+  if (nthreads > a->num_slabs)
+    nthreads = a->num_slabs;
+  if (nthreads < 2)
+    return 0;
+
+  // array of the slabs up front, so no thread ever reads ->next out
+  // of a slab another one already freed
+  rb_slab **slabs = (rb_slab **) malloc(a->num_slabs * sizeof(rb_slab *));
+  if (slabs == NULL)
+    return 0;
+  int i = 0;
+  for (rb_slab *s = a->slabs; s != NULL; s = s->next)
+    slabs[i++] = s;
+  assert(i == a->num_slabs);
+
+  rb_slab_share shares[nthreads];
+  pthread_t tids[nthreads];
+  int started[nthreads];
+  for (i = 0; i < nthreads; i++) {
+    shares[i].a = a;
+    shares[i].slabs = slabs;
+    shares[i].self = i;
+    shares[i].stride = nthreads;
+    started[i] = (i > 0) && pthread_create(&tids[i], NULL, free_slab_share, &shares[i]) == 0;
+  }
+
+  for (i = 0; i < nthreads; i++) {
+    if (!started[i])
+      free_slab_share(&shares[i]);
+  }
+  for (i = 1; i < nthreads; i++) {
+    if (started[i])
+      pthread_join(tids[i], NULL);
+  }
+
+  free(slabs);
+  a->slabs = NULL;
+  a->num_slabs = 0;
+  return 1;
+}
+
+void free_rb_parallel(sexy_rb_tree *t, int nthreads) {
+  if (t->arena != NULL) {
+    // free_arena takes care of whatever's left (maybe all of it)
+    free_arena_parallel(t->arena, nthreads > RB_PAR_MAX_THREADS ? RB_PAR_MAX_THREADS : nthreads);
+  } else if (t->root != NULL) {
+    rb_par p;
+    p.visit = &visit_free;
+    par_run(&p, t->root, t->num_nodes, nthreads);
+    t->root = NULL;
+  }
+
+  // whatever's left: sync, the arena struct, the tree itself
+  free_rb(t);
+}
+
+static int black_height(rb_node *n) {
+  int h = 0;
+  for (; n != NULL; n = n->left) {
+    if (n->node_color == BLACK)
+      h++;
+  }
+  return h;
+}
+
+// black height c has as a tree of its own (see detach) when it's a
+// child of a node with black height h; a red child goes black
+static int child_height(rb_node *c, int h) {
+  return h - 1 + is_red(c);
+}
+
+// makes n the root of a tree of its own
+static rb_node *detach(rb_node *n) {
+  if (n != NULL) {
+    n->parent = NULL;
+    // a red root going black still leaves every path with the same count
+    n->node_color = BLACK;
+  }
+  return n;
+}
+
+static rb_node *join_nodes(rb_node *l, int hl, rb_node *k, rb_node *r, int hr, int *h_out) {
+  if (hl == hr) {
+    // k goes on top as one more black level
+    k->left = l;
+    k->right = r;
+    k->parent = NULL;
+    k->node_color = BLACK;
+    if (l != NULL)
+      l->parent = k;
+    if (r != NULL)
+      r->parent = k;
+#if RB_ORDER_STATS
+    update_size(k);
+#endif
+    *h_out = hl + 1;
+    return k;
+  }
+
+  // walk down the taller tree's inner spine to the first black node
+  // with the shorter tree's black height and put k (red) in its place
+  // with that node and the shorter tree as children; then it's just
+  // like fixing up after an insert of k
+  int taller_left = (hl > hr);
+  rb_node *x = taller_left ? l : r;
+  rb_node *p = NULL;
+  int h = taller_left ? hl : hr;
+  int want = taller_left ? hr : hl;
+
+  while (!((x == NULL || x->node_color == BLACK) && h == want)) {
+    assert(x != NULL);
+    if (x->node_color == BLACK)
+      h--;
+    p = x;
+    x = taller_left ? x->right : x->left;
+  }
+  // the taller root has a bigger black height, so never stops there
+  assert(p != NULL);
+
+  rb_node *shorter = taller_left ? r : l;
+  if (taller_left) {
+    k->left = x;
+    k->right = shorter;
+    p->right = k;
+  } else {
+    k->left = shorter;
+    k->right = x;
+    p->left = k;
+  }
+  k->parent = p;
+  k->node_color = RED;
+  if (x != NULL)
+    x->parent = k;
+  if (shorter != NULL)
+    shorter->parent = k;
+
+#if RB_ORDER_STATS
+  update_size(k);
+  adjust_sizes(p, 1 + node_size(shorter));
+#endif
+
+  // insert_fixup only needs the tree for its root (zeroed, so with
+  // RB_STATS on it just counts nothing)
+  sexy_rb_tree tmp = {0};
+  tmp.root = taller_left ? l : r;
+  insert_rebalance(k, &tmp);
+  *h_out = (taller_left ? hl : hr) + is_red(tmp.root);
+  set_color(tmp.root, BLACK);
+  return tmp.root;
+}
+
+static void split_nodes(rb_node *n, int h, my_type *key, int (*comp)(my_type *, my_type *),
+                        rb_node **lo, int *lo_h, rb_node **eq, rb_node **hi, int *hi_h) {
+  if (n == NULL) {
+    *lo = *eq = *hi = NULL;
+    *lo_h = *hi_h = 0;
+    return;
+  }
+
+  int lh = child_height(n->left, h);
+  int rh = child_height(n->right, h);
+  rb_node *l = detach(n->left);
+  rb_node *r = detach(n->right);
+  int c = comp(key, n->data);
+  rb_node *mid;
+  int mid_h;
+
+  if (c == EQUAL) {
+    *lo = l;
+    *lo_h = lh;
+    *eq = n;
+    *hi = r;
+    *hi_h = rh;
+    n->left = n->right = NULL;
+  } else if (c == LESS) {
+    split_nodes(l, lh, key, comp, lo, lo_h, eq, &mid, &mid_h);
+    *hi = join_nodes(mid, mid_h, n, r, rh, hi_h);
+  } else {
+    split_nodes(r, rh, key, comp, &mid, &mid_h, eq, hi, hi_h);
+    *lo = join_nodes(l, lh, n, mid, mid_h, lo_h);
+  }
+}
+
+// rb_union's shared state
+typedef struct rb_union_ctx {
+  int (*comp)(my_type *, my_type *);
+  void (*on_dup)(my_type *, my_type *, void *);
+  void *arg;
+
+  // halves get their own threads above this depth
+  int spawn_depth;
+  int dups;
+} rb_union_ctx;
+
+static rb_node *union_nodes(rb_node *a, int ah, rb_node *b, int bh,
+                            rb_union_ctx *ctx, int depth, int *h);
+
+// one half of a union_nodes on another thread
+typedef struct rb_union_job {
+  rb_node *a;
+  int ah;
+  rb_node *b;
+  int bh;
+  rb_union_ctx *ctx;
+  int depth;
+  rb_node *ret;
+  int ret_h;
+} rb_union_job;
+
+static void *union_thread(void *arg) {
+  rb_union_job *job = arg;
+  job->ret = union_nodes(job->a, job->ah, job->b, job->bh, job->ctx, job->depth, &job->ret_h);
+  return NULL;
+}
+
+// a and b are separate trees (black roots, no parents) with black
+// heights ah and bh; sets *h to the result's
+static rb_node *union_nodes(rb_node *a, int ah, rb_node *b, int bh,
+                            rb_union_ctx *ctx, int depth, int *h) {
+  if (a == NULL) {
+    *h = bh;
+    return b;
+  }
+  if (b == NULL) {
+    *h = ah;
+    return a;
+  }
+
+  // a's root splits b; each side unions with the matching side of a
+  int alh = child_height(a->left, ah);
+  int arh = child_height(a->right, ah);
+  rb_node *al = detach(a->left);
+  rb_node *ar = detach(a->right);
+  rb_node *bl, *dup, *br;
+  int blh, brh;
+  split_nodes(b, bh, a->data, ctx->comp, &bl, &blh, &dup, &br, &brh);
+
+  if (dup != NULL) {
+    if (ctx->on_dup != NULL)
+      ctx->on_dup(a->data, dup->data, ctx->arg);
+    else
+      free(dup->data);
+    free(dup);
+    __atomic_add_fetch(&ctx->dups, 1, __ATOMIC_RELAXED);
+  }
+
+  rb_node *l, *r;
+  int lh, rh;
+  pthread_t tid;
+  rb_union_job job = {al, alh, bl, blh, ctx, depth + 1, NULL, 0};
+  if (depth < ctx->spawn_depth && pthread_create(&tid, NULL, union_thread, &job) == 0) {
+    r = union_nodes(ar, arh, br, brh, ctx, depth + 1, &rh);
+    pthread_join(tid, NULL);
+    l = job.ret;
+    lh = job.ret_h;
+  } else {
+    l = union_nodes(al, alh, bl, blh, ctx, depth + 1, &lh);
+    r = union_nodes(ar, arh, br, brh, ctx, depth + 1, &rh);
+  }
+
+  return join_nodes(l, lh, a, r, rh, h);
+}
+
+int rb_union(sexy_rb_tree *into, sexy_rb_tree *from,
+             void (*on_dup)(my_type *, my_type *, void *), void *arg,
+             int nthreads) {
+  if (into == from || into->arena != NULL || from->arena != NULL ||
+      into->sync != NULL || from->sync != NULL)
+    return 0;
+
+  rb_union_ctx ctx;
+  ctx.comp = into->comp;
+  ctx.on_dup = on_dup;
+  ctx.arg = arg;
+  ctx.dups = 0;
+
+  // each level doubles the threads going
+  if (nthreads > RB_PAR_MAX_THREADS)
+    nthreads = RB_PAR_MAX_THREADS;
+  ctx.spawn_depth = 0;
+  while ((1 << ctx.spawn_depth) < nthreads)
+    ctx.spawn_depth++;
+  if (into->num_nodes + (long) from->num_nodes < 2 * RB_PAR_GRAIN)
+    ctx.spawn_depth = 0;
+
+  // the only black heights that get walked for; everything under
+  // here works them out from these
+  int h;
+  into->root = union_nodes(into->root, black_height(into->root),
+                           from->root, black_height(from->root), &ctx, 0, &h);
+  assert(h == black_height(into->root));
+  into->num_nodes += from->num_nodes - ctx.dups;
+  from->root = NULL;
+  from->num_nodes = 0;
+  return 1;
+}
+
+rb_multimap *create_rb_multimap(int (*comp)(my_type *, my_type *)) {
+  rb_multimap *m = (rb_multimap *) malloc(sizeof(rb_multimap));
+  if (m == NULL)
+    return NULL;
+
+  m->tree = create_rb(comp);
+  if (m->tree == NULL) {
+    free(m);
+    return NULL;
+  }
+  m->num_values = 0;
+  return m;
+}
+
+int insert_multi(my_type *data, rb_multimap *m) {
+  sexy_rb_tree *t = m->tree;
+  int dir;
+  rb_node *p = find_insert_parent(data, t, &dir);
+
+  if (dir == EQUAL) {
+    // another value for a key that's there; the tree doesn't change
+    rb_multi_node *mn = (rb_multi_node *) p;
+    if (mn->count == mn->cap) {
+      my_type **bigger;
+      if (mn->vals == mn->small) {
+        bigger = (my_type **) malloc(2 * mn->cap * sizeof(my_type *));
+        if (bigger != NULL)
+          memcpy(bigger, mn->small, mn->count * sizeof(my_type *));
+      } else {
+        bigger = (my_type **) realloc(mn->vals, 2 * mn->cap * sizeof(my_type *));
+      }
+      if (bigger == NULL)
+        return 0;
+      mn->vals = bigger;
+      mn->cap *= 2;
+    }
+
+    mn->vals[mn->count++] = data;
+    m->num_values++;
+    return 1;
+  }
+
+  rb_multi_node *mn = (rb_multi_node *) malloc(sizeof(rb_multi_node));
+  if (mn == NULL)
+    return 0;
+
+  mn->count = 1;
+  mn->cap = RB_MULTI_INLINE;
+  mn->vals = mn->small;
+  mn->small[0] = data;
+
+  mn->node.data = data;
+  link_node(&mn->node, p, dir, t);
+  adjust_sizes(p, 1);
+  insert_fixup(&mn->node, t);
+  t->num_nodes++;
+  m->num_values++;
+  return 1;
+}
+
+int equal_range(my_type *key, rb_multimap *m, my_type ***vals) {
+  rb_multi_node *mn = (rb_multi_node *) search_node(key, m->tree);
+  if (mn == NULL) {
+    *vals = NULL;
+    return 0;
+  }
+
+  *vals = mn->vals;
+  return mn->count;
+}
+
+// moves from's values over to to (whose own are gone), small array included
+static void move_values(rb_multi_node *to, rb_multi_node *from) {
+  if (to->vals != to->small)
+    free(to->vals);
+
+  to->count = from->count;
+  to->cap = from->cap;
+  if (from->vals == from->small) {
+    memcpy(to->small, from->small, sizeof(from->small));
+    to->vals = to->small;
+  } else {
+    to->vals = from->vals;
+  }
+  from->vals = from->small;
+}
+
+my_type *remove_multi(my_type *key, rb_multimap *m) {
+  sexy_rb_tree *t = m->tree;
+  rb_multi_node *mn = (rb_multi_node *) search_node(key, t);
+  if (mn == NULL)
+    return NULL;
+
+  my_type *ret = mn->vals[--mn->count];
+  m->num_values--;
+  if (mn->count > 0)
+    // node.data is vals[0], which is still there
+    return ret;
+
+  // last one: the node goes, and remove may move another node's data
+  // (and so its values) into mn
+  rb_multi_node *gone = (rb_multi_node *) pick_removed(&mn->node, t);
+  if (gone != mn)
+    move_values(mn, gone);
+  if (gone->vals != gone->small)
+    free(gone->vals);
+
+  remove_one_child(&gone->node, t);
+  t->num_nodes--;
+  return ret;
+}
+
+int multi_size(rb_multimap *m) {
+  return m->num_values;
+}
+
+static void free_multi_nodes(rb_node *n) {
+  while (n != NULL) {
+    rb_multi_node *mn = (rb_multi_node *) n;
+    rb_node *r = n->right;
+    free_multi_nodes(n->left);
+
+    for (int i = 0; i < mn->count; i++)
+      free(mn->vals[i]);
+    if (mn->vals != mn->small)
+      free(mn->vals);
+    free(mn);
+    n = r;
+  }
+}
+
+void free_rb_multimap(rb_multimap *m) {
+  free_multi_nodes(m->tree->root);
+  m->tree->root = NULL;
+  free_rb(m->tree);
+  free(m);
+}
+
+int is_valid_multimap(rb_multimap *m) {
+  if (!is_valid_rb_tree(m->tree))
+    return 0;
+
+  int values = 0;
+  for (rb_node *n = rb_first(m->tree); n != NULL; n = rb_next(n)) {
+    rb_multi_node *mn = (rb_multi_node *) n;
+    if (mn->count < 1 || mn->count > mn->cap || n->data != mn->vals[0])
+      return 0;
+    if ((mn->vals == mn->small) != (mn->cap == RB_MULTI_INLINE))
+      return 0;
+    for (int i = 1; i < mn->count; i++) {
+      if (m->tree->comp(mn->vals[i], n->data) != EQUAL)
+        return 0;
+    }
+    values += mn->count;
+  }
+
+  return values == m->num_values;
+}
+
+rb_frozen *rb_freeze(sexy_rb_tree *t) {
+  if (t->sync != NULL)
+    return NULL;
+
+  int n = t->num_nodes;
+  rb_frozen *f = (rb_frozen *) malloc(sizeof(rb_frozen));
+  my_type **data = (my_type **) malloc(((size_t) n + 1) * sizeof(my_type *));
+  void *keys = NULL;
+  if (f == NULL || data == NULL ||
+      posix_memalign(&keys, CACHE_LINE, ((size_t) n + 1) * sizeof(my_type)) != 0) {
+    free(f);
+    free(data);
+    return NULL;
+  }
+
+  f->keys = (my_type *) keys;
+  f->data = data;
+  f->num_nodes = n;
+  f->comp = t->comp;
+
+  rb_node *cur = rb_first(t);
+  freeze_subtree(f, 1, &cur);
+  assert(cur == NULL);
+
+  // every node's data is NULL now, so this only frees the nodes
+  free_rb(t);
+  return f;
+}
+
+static void freeze_subtree(rb_frozen *f, size_t i, rb_node **cur) {
+  // size_t so 2i + 1 can't overflow for any int num_nodes
+  if (i > (size_t) f->num_nodes)
+    return;
+
+  freeze_subtree(f, 2 * i, cur);
+
+  rb_node *n = *cur;
+  f->data[i] = n->data;
+  f->keys[i] = *n->data;
+  n->data = NULL;
+  *cur = rb_next(n);
+
+  freeze_subtree(f, 2 * i + 1, cur);
+}
+
+sexy_rb_tree *rb_thaw(rb_frozen *f) {
+  int n = f->num_nodes;
+  sexy_rb_tree *t = create_rb(f->comp);
+  my_type **sorted = (my_type **) malloc(((size_t) n + 1) * sizeof(my_type *));
+  if (t == NULL || sorted == NULL) {
+    free(sorted);
+    if (t != NULL)
+      free_rb(t);
+    return NULL;
+  }
+
+  int next = 0;
+  thaw_subtree(f, 1, sorted, &next);
+  if (!bulk_load_rb(t, sorted, n)) {
+    free(sorted);
+    free_rb(t);
+    return NULL;
+  }
+
+  free(sorted);
+  free(f->keys);
+  free(f->data);
+  free(f);
+  return t;
+}
+
+static void thaw_subtree(rb_frozen *f, size_t i, my_type **out, int *next) {
+  if (i > (size_t) f->num_nodes)
+    return;
+
+  thaw_subtree(f, 2 * i, out, next);
+  out[(*next)++] = f->data[i];
+  thaw_subtree(f, 2 * i + 1, out, next);
+}
+
+my_type *search_frozen(my_type *key, rb_frozen *f) {
+  int (*comp)(my_type *, my_type *) = f->comp;
+  my_type *keys = f->keys;
+  unsigned long n = (unsigned long) f->num_nodes;
+  unsigned long i = 1;
+
+  assert(key != NULL);
+
+  // go right past everything LESS than key, left otherwise, and don't
+  // stop at EQUAL; the prefetch is for FROZEN_PREFETCH_LEVELS steps on,
+  // and only while that's still in keys (even making a pointer past
+  // the end is undefined, let alone prefetching it)
+  while (i <= n) {
+    unsigned long ahead = i << FROZEN_PREFETCH_LEVELS;
+    if (ahead <= n)
+      PREFETCH(&keys[ahead]);
+    i = 2 * i + (comp(&keys[i], key) == LESS);
+  }
+
+  // the path ended with the last left turn and then only right turns;
+  // undoing those and the left turn lands on the smallest key that
+  // isn't LESS than key (or 0 if there isn't one)
+#if defined(__GNUC__)
+  i >>= __builtin_ctzl(~i) + 1;
+#else
+  while (i & 1)
+    i >>= 1;
+  i >>= 1;
+#endif
+
+  if (i == 0 || comp(&keys[i], key) != EQUAL)
+    return NULL;
+  return f->data[i];
+}
+
+int frozen_size(rb_frozen *f) {
+  return f->num_nodes;
+}
+
+int frozen_foreach(rb_frozen *f, int (*cb)(my_type *, void *), void *arg) {
+  int count = 0;
+  frozen_walk(f, 1, cb, arg, &count);
+  return count;
+}
+
+static int frozen_walk(rb_frozen *f, size_t i, int (*cb)(my_type *, void *),
+                       void *arg, int *count) {
+  if (i > (size_t) f->num_nodes)
+    return 1;
+
+  if (!frozen_walk(f, 2 * i, cb, arg, count))
+    return 0;
+  (*count)++;
+  if (!cb(f->data[i], arg))
+    return 0;
+  return frozen_walk(f, 2 * i + 1, cb, arg, count);
+}
+
+void free_frozen(rb_frozen *f) {
+  for (int i = 1; i <= f->num_nodes; i++)
+    free(f->data[i]);
+  free(f->keys);
+  free(f->data);
+  free(f);
+}
+
+rb_freezer *create_freezer(int (*comp)(my_type *, my_type *)) {
+  rb_freezer *z = (rb_freezer *) malloc(sizeof(rb_freezer));
+  if (z == NULL)
+    return NULL;
+
+  z->tree = create_rb(comp);
+  z->frozen = NULL;
+  z->reads = 0;
+  if (z->tree == NULL) {
+    free(z);
+    return NULL;
+  }
+  return z;
+}
+
+static sexy_rb_tree *freezer_tree(rb_freezer *z) {
+  if (z->frozen != NULL) {
+    sexy_rb_tree *t = rb_thaw(z->frozen);
+    if (t == NULL)
+      return NULL;
+    z->tree = t;
+    z->frozen = NULL;
+  }
+  z->reads = 0;
+  return z->tree;
+}
+
+int insert_freezer(my_type *data, rb_freezer *z) {
+  // nothing to change, so no reason to thaw
+  if (z->frozen != NULL && search_frozen(data, z->frozen) != NULL)
+    return 0;
+
+  sexy_rb_tree *t = freezer_tree(z);
+  return (t != NULL) ? insert_baby(data, t) : 0;
+}
+
+my_type *remove_freezer(my_type *key, rb_freezer *z) {
+  if (z->frozen != NULL && search_frozen(key, z->frozen) == NULL)
+    return NULL;
+
+  sexy_rb_tree *t = freezer_tree(z);
+  return (t != NULL) ? remove_baby(key, t) : NULL;
+}
+
+my_type *search_freezer(my_type *key, rb_freezer *z) {
+  if (z->frozen != NULL)
+    return search_frozen(key, z->frozen);
+
+  if (++z->reads < FREEZE_MIN_READS || z->reads < rb_size(z->tree))
+    return search_baby(key, z->tree);
+
+  rb_frozen *f = rb_freeze(z->tree);
+  if (f == NULL) {
+    // try again after another run as long
+    z->reads = 0;
+    return search_baby(key, z->tree);
+  }
+  z->frozen = f;
+  z->tree = NULL;
+  return search_frozen(key, z->frozen);
+}
+
+int freezer_foreach(rb_freezer *z, int (*cb)(my_type *, void *), void *arg) {
+  if (z->frozen != NULL)
+    return frozen_foreach(z->frozen, cb, arg);
+  return rb_foreach(z->tree, cb, arg);
+}
+
+int freezer_size(rb_freezer *z) {
+  return (z->frozen != NULL) ? frozen_size(z->frozen) : rb_size(z->tree);
+}
+
+void free_freezer(rb_freezer *z) {
+  if (z->frozen != NULL)
+    free_frozen(z->frozen);
+  else
+    free_rb(z->tree);
+  free(z);
+}
+
+ORDERED_DEFINE(rb, "rb_tree", sexy_rb_tree, create_rb, insert_baby, search_baby,
+               remove_baby, rb_foreach, rb_size, free_rb)
+ORDERED_DEFINE(rb_frozen, "rb_frozen", rb_freezer, create_freezer, insert_freezer,
+               search_freezer, remove_freezer, freezer_foreach, freezer_size, free_freezer)
+
+/***************
+ * TEST SCRIPT *
+ ***************/
+
+// BREAKS ABSTRACTION BARRIER
+// primarily tests binary_insert_node
+static void test_1(void) {
+  // a, b, c ordering
+  sexy_rb_tree *t = create_rb(&int_compare);
+  
+  my_type *x = (my_type *) malloc(sizeof(my_type));
+  my_type *y = (my_type *) malloc(sizeof(my_type));
+  my_type *z = (my_type *) malloc(sizeof(my_type));
+
+  x->x = 1;
+  y->x = 2;
+  z->x = 3;
+
+  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+
+  a->data = x;
+  b->data = y;
+  c->data = z;
+
+  // assert basic inserts don't fail
+  assert(binary_insert_node(a, t) != NULL);
+  assert(binary_insert_node(b, t) != NULL);
+  assert(binary_insert_node(c, t) != NULL);
+
+  // assert structure is as it should be
+  assert(t->root == a);
+  assert(t->root->left == NULL);
+  assert(t->root->right == b);
+  assert(t->root->right->right == c);
+  assert(t->root->right->left == NULL);
+  assert(t->root->right->right->left == NULL);
+  assert(t->root->right->right->right == NULL);
+
+  free_rb(t);
+
+}
+
+static void test_2(void) {
+  // a, c, b ordering
+  sexy_rb_tree *t = create_rb(&int_compare);
+  
+  my_type *x = (my_type *) malloc(sizeof(my_type));
+  my_type *y = (my_type *) malloc(sizeof(my_type));
+  my_type *z = (my_type *) malloc(sizeof(my_type));
+
+  x->x = 1;
+  y->x = 2;
+  z->x = 3;
+
+  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+
+  a->data = x;
+  b->data = y;
+  c->data = z;
+
+  // assert basic inserts don't fail
+  assert(binary_insert_node(a, t) != NULL);
+  assert(binary_insert_node(c, t) != NULL);
+  assert(binary_insert_node(b, t) != NULL);
+
+  // assert structure is as it should be
+  assert(t->root == a);
+  assert(t->root->left == NULL);
+  assert(t->root->right == c);
+  assert(t->root->right->right == NULL);
+  assert(t->root->right->left == b);
+  assert(t->root->right->left->left == NULL);
+  assert(t->root->right->left->right == NULL);
+
+  free_rb(t);
+}
+
+static void test_3(void) {
+  // b, a, c ordering
+  sexy_rb_tree *t = create_rb(&int_compare);
+  
+  my_type *x = (my_type *) malloc(sizeof(my_type));
+  my_type *y = (my_type *) malloc(sizeof(my_type));
+  my_type *z = (my_type *) malloc(sizeof(my_type));
+
+  x->x = 1;
+  y->x = 2;
+  z->x = 3;
+
+  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+
+  a->data = x;
+  b->data = y;
+  c->data = z;
+
+  assert(binary_insert_node(b, t) != NULL);
+  assert(binary_insert_node(a, t) != NULL);
+  assert(binary_insert_node(c, t) != NULL);
+
+  assert(t->root == b);
+  assert(t->root->left == a);
+  assert(t->root->right == c);
+  assert(t->root->left->left == NULL);
+  assert(t->root->left->right == NULL);
+  assert(t->root->right->left == NULL);
+  assert(t->root->right->right == NULL);
+
+  free_rb(t);
+
+}
+
+static void test_4(void) {
+  // b, c, a ordering
+  sexy_rb_tree *t = create_rb(&int_compare);
+  
+  my_type *x = (my_type *) malloc(sizeof(my_type));
+  my_type *y = (my_type *) malloc(sizeof(my_type));
+  my_type *z = (my_type *) malloc(sizeof(my_type));
+
+  x->x = 1;
+  y->x = 2;
+  z->x = 3;
+
+  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+
+  a->data = x;
+  b->data = y;
+  c->data = z;
+
+  assert(binary_insert_node(b, t) != NULL);
+  assert(binary_insert_node(c, t) != NULL);
+  assert(binary_insert_node(a, t) != NULL);
+
+  assert(t->root == b);
+  assert(t->root->left == a);
+  assert(t->root->right == c);
+  assert(t->root->left->left == NULL);
+  assert(t->root->left->right == NULL);
+  assert(t->root->right->left == NULL);
+  assert(t->root->right->right == NULL);
+
+  free_rb(t);
+
+}
+
+
+static void test_5(void) {
+  // c, a, b ordering
+  sexy_rb_tree *t = create_rb(&int_compare);
+  
+  my_type *x = (my_type *) malloc(sizeof(my_type));
+  my_type *y = (my_type *) malloc(sizeof(my_type));
+  my_type *z = (my_type *) malloc(sizeof(my_type));
+
+  x->x = 1;
+  y->x = 2;
+  z->x = 3;
+
+  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+
+  a->data = x;
+  b->data = y;
+  c->data = z;
+
+  assert(binary_insert_node(c, t) != NULL);
+  assert(binary_insert_node(a, t) != NULL);
+  assert(binary_insert_node(b, t) != NULL);
+
+  assert(t->root == c);
+  assert(t->root->left == a);
+  assert(t->root->right == NULL);
+  assert(t->root->left->left == NULL);
+  assert(t->root->left->right == b);
+  assert(t->root->left->right->left == NULL);
+  assert(t->root->left->right->right == NULL);
+
+  free_rb(t);
+
+}
+
+static void test_6(void) {
+  // c, b, a ordering
+  sexy_rb_tree *t = create_rb(&int_compare);
+  
+  my_type *x = (my_type *) malloc(sizeof(my_type));
+  my_type *y = (my_type *) malloc(sizeof(my_type));
+  my_type *z = (my_type *) malloc(sizeof(my_type));
+
+  x->x = 1;
+  y->x = 2;
+  z->x = 3;
+
+  rb_node *a = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *b = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *c = (rb_node *) malloc(sizeof(rb_node));
+
+  a->data = x;
+  b->data = y;
+  c->data = z;
+
+  assert(binary_insert_node(c, t) != NULL);
+  assert(binary_insert_node(b, t) != NULL);
+  assert(binary_insert_node(a, t) != NULL);
+
+  assert(t->root == c);
+  assert(t->root->left == b);
+  assert(t->root->right == NULL);
+  assert(t->root->left->left == a);
+  assert(t->root->left->right == NULL);
+  assert(t->root->left->left->left == NULL);
+  assert(t->root->left->left->right == NULL);
+
+  free_rb(t);
+
+}
+
+
+static void test_binary_insert(void) {
+  printf("beginning test of binary_insert_node()\n");
+  test_1();
+  test_2();
+  test_3();
+  test_4();
+  test_5();
+  test_6();
+  printf("binary_insert_node() passed!\n");
+}
+
+static void test_rrot1(void) {
+  // instantiate and initialize data
+  my_type *a = malloc(sizeof(my_type));
+  my_type *b = malloc(sizeof(my_type));
+  my_type *c = malloc(sizeof(my_type));
+  my_type *d = malloc(sizeof(my_type));
+  my_type *e = malloc(sizeof(my_type));
+  my_type *f = malloc(sizeof(my_type));
+  my_type *g = malloc(sizeof(my_type));
+  my_type *h = malloc(sizeof(my_type));
+  my_type *i = malloc(sizeof(my_type));
+  my_type *j = malloc(sizeof(my_type));
+  my_type *k = malloc(sizeof(my_type));
+  my_type *l = malloc(sizeof(my_type));
+  my_type *m = malloc(sizeof(my_type));
+
+  a->x = 1;
+  b->x = 2;
+  c->x = 3;
+  d->x = 4;
+  e->x = 5;
+  f->x = 6;
+  g->x = 7;
+  h->x = 8;
+  i->x = 9;
+  j->x = 10;
+  k->x = 11;
+  l->x = 12;
+  m->x = 13;
+
+  // zeroed so the rotations' size upkeep doesn't read garbage
+  rb_node *na = calloc(1, sizeof(rb_node));
+  rb_node *nb = calloc(1, sizeof(rb_node));
+  rb_node *nc = calloc(1, sizeof(rb_node));
+  rb_node *nd = calloc(1, sizeof(rb_node));
+  rb_node *ne = calloc(1, sizeof(rb_node));
+  rb_node *nf = calloc(1, sizeof(rb_node));
+  rb_node *ng = calloc(1, sizeof(rb_node));
+  rb_node *nh = calloc(1, sizeof(rb_node));
+  rb_node *ni = calloc(1, sizeof(rb_node));
+  rb_node *nj = calloc(1, sizeof(rb_node));
+  rb_node *nk = calloc(1, sizeof(rb_node));
+  rb_node *nl = calloc(1, sizeof(rb_node));
+  rb_node *nm = calloc(1, sizeof(rb_node));
+
+  na->data = a;
+  nb->data = b;
+  nc->data = c;
+  nd->data = d;
+  ne->data = e;
+  nf->data = f;
+  ng->data = g;
+  nh->data = h;
+  ni->data = i;
+  nj->data = j;
+  nk->data = k;
+  nl->data = l;
+  nm->data = m;
+
+
+  // set up initial tree
+  na->parent = NULL;
+  na->left = nb;
+  na->right = nc;
+
+  nb->parent = na;
+  nb->left = NULL;
+  nb->right = NULL;
+
+  nc->parent = na;
+  nc->left = nd;
+  nc->right = ne;
+
+  nd->parent = nc;
+  nd->left = nf;
+  nd->right = ng;
+
+  ne->parent = nc;
+  ne->left = nh;
+  ne->right = ni;
+
+  nf->parent = nd;
+  nf->left = nj;
+  nf->right = nk;
+
+  ng->parent = nd;
+  ng->left = nl;
+  ng->right = nm;
+
+  nh->parent = ne;
+  nh->left = NULL;
+  nh->right = NULL;
+
+  ni->parent = ne;
+  ni->left = NULL;
+  ni->right = NULL;
+
+  nj->parent = nf;
+  nj->left = NULL;
+  nj->right = NULL;
+
+  nk->parent = nf;
+  nk->left = NULL;
+  nk->right = NULL;
+
+  nl->parent = ng;
+  nl->left = NULL;
+  nl->right = NULL;
+
+  nm->parent = ng;
+  nm->left = NULL;
+  nm->right = NULL;
+
+  // rotate nc, which is right of root
+  // calloc so an RB_STATS build finds no counters and skips them
+  sexy_rb_tree *t = (sexy_rb_tree *) calloc(1, sizeof(sexy_rb_tree));
+  t->root = NULL;
+
+  rrot(nc, t);
+
+  free(t);
+
+  // test structure
+  assert(na->parent == NULL);
+  assert(na->left == nb);
+  assert(na->right == nd);
+
+  assert(nb->parent == na);
+  assert(nb->left == NULL);
+  assert(nb->right == NULL);
+
+  assert(nc->parent == nd);
+  assert(nc->left == ng);
+  assert(nc->right == ne);
+
+  assert(nd->parent == na);
+  assert(nd->left == nf);
+  assert(nd->right == nc);
+
+  assert(ne->parent == nc);
+  assert(ne->left == nh);
+  assert(ne->right == ni);
+
+  assert(nf->parent == nd);
+  assert(nf->left == nj);
+  assert(nf->right == nk);
+
+  assert(ng->parent == nc);
+  assert(ng->left == nl);
+  assert(ng->right == nm);
+
+  assert(nh->parent == ne);
+  assert(nh->left == NULL);
+  assert(nh->right == NULL);
+
+  assert(ni->parent == ne);
+  assert(ni->left == NULL);
+  assert(ni->right == NULL);
+
+  assert(nj->parent == nf);
+  assert(nj->left == NULL);
+  assert(nj->right == NULL);
+
+  assert(nk->parent == nf);
+  assert(nk->left == NULL);
+  assert(nk->right == NULL);
+
+  assert(nl->parent == ng);
+  assert(nl->left == NULL);
+  assert(nl->right == NULL);
+
+  assert(nm->parent == ng);
+  assert(nm->left == NULL);
+  assert(nm->right == NULL);
+
+  // clean up
+  free(a);
+  free(b);
+  free(c);
+  free(d);
+  free(e);
+  free(f);
+  free(g);
+  free(h);
+  free(i);
+  free(j);
+  free(k);
+  free(l);
+  free(m);
+
+  free(na);
+  free(nb);
+  free(nc);
+  free(nd);
+  free(ne);
+  free(nf);
+  free(ng);
+  free(nh);
+  free(ni);
+  free(nj);
+  free(nk);
+  free(nl);
+  free(nm);
+
+  return;
+}
+
+// same as test_rrot1 but tree is on other side of parent
+static void test_rrot2(void) {
+  return;
+}
+
+static void test_rrot(void) {
+  test_rrot1();
+  test_rrot2();
+}
+
+// reverse of rrot1
+static void test_lrot1(void) {
+  // instantiate and initialize data
+  my_type *a = malloc(sizeof(my_type));
+  my_type *b = malloc(sizeof(my_type));
+  my_type *c = malloc(sizeof(my_type));
+  my_type *d = malloc(sizeof(my_type));
+  my_type *e = malloc(sizeof(my_type));
+  my_type *f = malloc(sizeof(my_type));
+  my_type *g = malloc(sizeof(my_type));
+  my_type *h = malloc(sizeof(my_type));
+  my_type *i = malloc(sizeof(my_type));
+  my_type *j = malloc(sizeof(my_type));
+  my_type *k = malloc(sizeof(my_type));
+  my_type *l = malloc(sizeof(my_type));
+  my_type *m = malloc(sizeof(my_type));
+
+  a->x = 1;
+  b->x = 2;
+  c->x = 3;
+  d->x = 4;
+  e->x = 5;
+  f->x = 6;
+  g->x = 7;
+  h->x = 8;
+  i->x = 9;
+  j->x = 10;
+  k->x = 11;
+  l->x = 12;
+  m->x = 13;
+
+  // zeroed so the rotations' size upkeep doesn't read garbage
+  rb_node *na = calloc(1, sizeof(rb_node));
+  rb_node *nb = calloc(1, sizeof(rb_node));
+  rb_node *nc = calloc(1, sizeof(rb_node));
+  rb_node *nd = calloc(1, sizeof(rb_node));
+  rb_node *ne = calloc(1, sizeof(rb_node));
+  rb_node *nf = calloc(1, sizeof(rb_node));
+  rb_node *ng = calloc(1, sizeof(rb_node));
+  rb_node *nh = calloc(1, sizeof(rb_node));
+  rb_node *ni = calloc(1, sizeof(rb_node));
+  rb_node *nj = calloc(1, sizeof(rb_node));
+  rb_node *nk = calloc(1, sizeof(rb_node));
+  rb_node *nl = calloc(1, sizeof(rb_node));
+  rb_node *nm = calloc(1, sizeof(rb_node));
+
+  na->data = a;
+  nb->data = b;
+  nc->data = c;
+  nd->data = d;
+  ne->data = e;
+  nf->data = f;
+  ng->data = g;
+  nh->data = h;
+  ni->data = i;
+  nj->data = j;
+  nk->data = k;
+  nl->data = l;
+  nm->data = m;
+
+
+  // set up initial tree
+  na->parent = NULL;
+  na->left = nb;
+  na->right = nd;
+  
+  nb->parent = na;
+  nb->left = NULL;
+  nb->right = NULL;
+  
+  nc->parent = nd;
+  nc->left = ng;
+  nc->right = ne;
+  
+  nd->parent = na;
+  nd->left = nf;
+  nd->right = nc;
+  
+  ne->parent = nc;
+  ne->left = nh;
+  ne->right = ni;
+  
+  nf->parent = nd;
+  nf->left = nj;
+  nf->right = nk;
+  
+  ng->parent = nc;
+  ng->left = nl;
+  ng->right = nm;
+  
+  nh->parent = ne;
+  nh->left = NULL;
+  nh->right = NULL;
+  
+  ni->parent = ne;
+  ni->left = NULL;
+  ni->right = NULL;
+  
+  nj->parent = nf;
+  nj->left = NULL;
+  nj->right = NULL;
+  
+  nk->parent = nf;
+  nk->left = NULL;
   nk->right = NULL;
   
-  nl->parent = ng;
-  nl->left = NULL;
-  nl->right = NULL;
+  nl->parent = ng;
+  nl->left = NULL;
+  nl->right = NULL;
+  
+  nm->parent = ng;
+  nm->left = NULL;
+  nm->right = NULL;
+  
+  // rotate nd, which is right of root
+  // calloc so an RB_STATS build finds no counters and skips them
+  sexy_rb_tree *t = (sexy_rb_tree *) calloc(1, sizeof(sexy_rb_tree));
+  t->root = NULL;
+
+  lrot(nd, t);
+  
+  free(t);
+
+  // test structure
+  assert(na->parent == NULL);
+  assert(na->left == nb);
+  assert(na->right == nc);
+  
+  assert(nb->parent == na);
+  assert(nb->left == NULL);
+  assert(nb->right == NULL);
+  
+  assert(nc->parent == na);
+  assert(nc->left == nd);
+  assert(nc->right == ne);
+  
+  assert(nd->parent == nc);
+  assert(nd->left == nf);
+  assert(nd->right == ng);
+  
+  assert(ne->parent == nc);
+  assert(ne->left == nh);
+  assert(ne->right == ni);
+  
+  assert(nf->parent == nd);
+  assert(nf->left == nj);
+  assert(nf->right == nk);
+  
+  assert(ng->parent == nd);
+  assert(ng->left == nl);
+  assert(ng->right == nm);
+  
+  assert(nh->parent == ne);
+  assert(nh->left == NULL);
+  assert(nh->right == NULL);
+  
+  assert(ni->parent == ne);
+  assert(ni->left == NULL);
+  assert(ni->right == NULL);
+  
+  assert(nj->parent == nf);
+  assert(nj->left == NULL);
+  assert(nj->right == NULL);
+  
+  assert(nk->parent == nf);
+  assert(nk->left == NULL);
+  assert(nk->right == NULL);
+  
+  assert(nl->parent == ng);
+  assert(nl->left == NULL);
+  assert(nl->right == NULL);
+  
+  assert(nm->parent == ng);
+  assert(nm->left == NULL);
+  assert(nm->right == NULL);
+  
+  // clean up
+  free(a);
+  free(b);
+  free(c);
+  free(d);
+  free(e);
+  free(f);
+  free(g);
+  free(h);
+  free(i);
+  free(j);
+  free(k);
+  free(l);
+  free(m);
+
+  free(na);
+  free(nb);
+  free(nc);
+  free(nd);
+  free(ne);
+  free(nf);
+  free(ng);
+  free(nh);
+  free(ni);
+  free(nj);
+  free(nk);
+  free(nl);
+  free(nm);
+
+  return;
+}
+
+static void test_lrot2(void) {
+  return;
+}
+
+static void test_lrot(void) {
+  test_lrot1();
+  test_lrot2();
+}
+
+static void test_rots(void) {
+  printf("beginning rot() test\n");
+  test_rrot();
+  test_lrot();
+  printf("rot() passed!\n");
+}
+
+static void test_insert_1(void) {
+  
+  my_type *a = (my_type *) malloc(sizeof(my_type));
+  my_type *b = (my_type *) malloc(sizeof(my_type));
+  my_type *c = (my_type *) malloc(sizeof(my_type));
+
+  a->x = 1;
+  b->x = 2;
+  c->x = 3;
+
+  sexy_rb_tree *t = create_rb(&int_compare);
+
+  insert_baby(a, t);
+  insert_baby(b, t);
+  insert_baby(c, t);
+
+  free_rb(t);
+
+
+}
+
+static void test_insert_2(void) {
+  my_type *d9 = (my_type *) malloc(sizeof(my_type));
+  my_type *d8 = (my_type *) malloc(sizeof(my_type));
+  my_type *d7 = (my_type *) malloc(sizeof(my_type));
+  my_type *d3 = (my_type *) malloc(sizeof(my_type));
+  my_type *d5 = (my_type *) malloc(sizeof(my_type));
+  my_type *d2 = (my_type *) malloc(sizeof(my_type));
   
-  nm->parent = ng;
-  nm->left = NULL;
-  nm->right = NULL;
+
+  d9->x = 9;
+  d8->x = 8;
+  d7->x = 7;
+  d3->x = 3;
+  d5->x = 5;
+  d2->x = 2;
   
-  // rotate nd, which is right of root
-  sexy_rb_tree *t = (sexy_rb_tree *) malloc(sizeof(sexy_rb_tree));
-  t->root = NULL;
+  sexy_rb_tree *t = create_rb(&int_compare);
 
-  lrot(nd, t);
+  insert_baby(d9, t);
+  insert_baby(d8, t);
+  insert_baby(d7, t);
+  insert_baby(d3, t);
+  insert_baby(d5, t);
+  insert_baby(d2, t);
+
+  free_rb(t);
   
-  free(t);
+}
+
+static void test_insert_dup(void) {
+  my_type *a = (my_type *) malloc(sizeof(my_type));
+  my_type *b = (my_type *) malloc(sizeof(my_type));
+  my_type *a_again = (my_type *) malloc(sizeof(my_type));
+
+  a->x = 1;
+  b->x = 2;
+  a_again->x = 1;
+
+  sexy_rb_tree *t = create_rb(&int_compare);
+
+  assert(insert_baby(a, t));
+  assert(insert_baby(b, t));
+
+  // duplicate gets reported and the original stays put
+  assert(!insert_baby(a_again, t));
+  assert(t->num_nodes == 2);
+  assert(search_baby(a_again, t) == a);
+
+  // same through binary_insert_node
+  rb_node *n = (rb_node *) malloc(sizeof(rb_node));
+  n->data = a_again;
+  assert(binary_insert_node(n, t) == NULL);
+  free(n);
+
+  assert(is_valid_rb_tree(t));
+
+  free(a_again);
+  free_rb(t);
+}
+
+static void test_insert(void) {
+  printf("beginning test_insert()\n");
+
+  test_insert_1();
+  test_insert_2();
+  test_insert_dup();
+
+  printf("test_insert() passed!\n");
+}
+
+static void test_search(void) {
+  // number of nodes going into tree for testing
+  int n = 100000;
+
+  printf("beginning test_search with %d elements\n", n);
+
+  sexy_rb_tree *t = create_rb(&int_compare);
+
+  my_type *dat[2*n];
+
+  for(int i = 0; i < 2*n; i++) {
+    dat[i] = (my_type *) malloc(sizeof(my_type));
+  }
+
+  for(int i = 0; i < n; i++) {
+    dat[i]->x = i;
+  }
+
+  for(int i = n; i < 2*n; i++) {
+    dat[i]->x = i;
+  }
+
+  for(int i = 0; i < n; i++) {
+    insert_baby(dat[i], t);
+  }
+
+  for(int i = 0; i < n; i++) {
+    assert(search_baby(dat[i], t) != NULL);
+  }
+  
+  for(int i = n; i < 2*n; i++) {
+    assert(search_baby(dat[i], t) == NULL);
+  }
+
+  for(int i = n; i < 2*n; i++) {
+    free(dat[i]);
+  }
+
+  assert(is_valid_rb_tree(t));
+  
+  free_rb(t);
+
+  printf("test_search passed!\n");
+}
+
+static void test_search_batch(void) {
+  printf("beginning test_search_batch()\n");
+
+  sexy_rb_tree *t = create_rb_arena(&int_compare, 0);
+
+  // nothing in the tree; everything misses
+  my_type probe;
+  probe.x = 5;
+  my_type *probes[1] = { &probe };
+  my_type *res[1] = { &probe };
+  search_batch(t, probes, 1, res);
+  assert(res[0] == NULL);
+
+  // even numbers go in, look up everything 0 .. 2n so half miss
+  int n = 10000;
+  for (int i = 0; i < n; i++) {
+    my_type *d = (my_type *) malloc(sizeof(my_type));
+    d->x = 2 * ((i * 7919) % n);
+    assert(insert_baby(d, t));
+  }
+
+  // odd count so the last batch is a partial one
+  int m = 2 * n + 1;
+  my_type *keys = (my_type *) malloc(m * sizeof(my_type));
+  my_type **key_ptrs = (my_type **) malloc(m * sizeof(my_type *));
+  my_type **out = (my_type **) malloc(m * sizeof(my_type *));
+
+  for (int i = 0; i < m; i++) {
+    keys[i].x = (i * 7919) % m;
+    key_ptrs[i] = &keys[i];
+  }
+
+  search_batch(t, key_ptrs, m, out);
+
+  for (int i = 0; i < m; i++) {
+    assert(out[i] == search_baby(key_ptrs[i], t));
+    if (keys[i].x % 2 == 0 && keys[i].x < 2 * n)
+      assert(out[i] != NULL && out[i]->x == keys[i].x);
+    else
+      assert(out[i] == NULL);
+  }
+
+  // zero-length batch doesn't touch anything
+  search_batch(t, key_ptrs, 0, out);
+
+  free(keys);
+  free(key_ptrs);
+  free(out);
+  free_rb(t);
+
+  printf("test_search_batch() passed!\n");
+}
+
+static void replace_w_pred_test(void) {
+  // initialize data for nodes
+  my_type *a = (my_type *) malloc(sizeof(my_type));
+  my_type *b = (my_type *) malloc(sizeof(my_type));
+  my_type *c = (my_type *) malloc(sizeof(my_type));
+  my_type *d = (my_type *) malloc(sizeof(my_type));
+  my_type *e = (my_type *) malloc(sizeof(my_type));
+
+  a->x = 1;
+  b->x = 2;
+  c->x = 3;
+  d->x = 4;
+  e->x = 5;
+
+  // initialize nodes
+  rb_node *na = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *nb = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *nc = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *nd = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *ne = (rb_node *) malloc(sizeof(rb_node));
+
+  na->data = a;
+  nb->data = b;
+  nc->data = c;
+  nd->data = d;
+  ne->data = e;
+  
+  // set up structure
+  na->left = nb;
+  na->right = nc;
+  na->parent = NULL;
+  
+  nb->left = nd;
+  nb->right = ne;
+  nb->parent = na;
+
+  nc->left = NULL;
+  nc->right = NULL;
+  nc->parent = na;
+
+  nd->left = NULL;
+  nd->right = NULL;
+  nd->parent = nb;
+
+  ne->left = NULL;
+  ne->right = NULL;
+  ne->parent = nb;
+  
+  // test that "fails" in desired circumstances
+  assert(replace_with_pred(nc) == NULL);
+  assert(replace_with_pred(nd) == NULL);
+  assert(replace_with_pred(ne) == NULL);
+
+  // test general case
+  assert(replace_with_pred(na) != NULL);
+  assert(na->data == ne->data);
+
+  // test "minimum working case"
+  assert(replace_with_pred(nb) != NULL);
+  assert(nb->data == nd->data);
+
+  // clean up
+  free(a);
+  free(b);
+  free(c);
+  free(d);
+  free(e);
+
+  free(na);
+  free(nb);
+  free(nc);
+  free(nd);
+  free(ne);
+
+}
+
+
+// very similar to replace_w_pred_test()
+static void replace_w_succ_test(void) {
+  // initialize data for nodes
+  my_type *a = (my_type *) malloc(sizeof(my_type));
+  my_type *b = (my_type *) malloc(sizeof(my_type));
+  my_type *c = (my_type *) malloc(sizeof(my_type));
+  my_type *d = (my_type *) malloc(sizeof(my_type));
+  my_type *e = (my_type *) malloc(sizeof(my_type));
+
+  a->x = 1;
+  b->x = 2;
+  c->x = 3;
+  d->x = 4;
+  e->x = 5;
+
+  // initialize nodes
+  rb_node *na = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *nb = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *nc = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *nd = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *ne = (rb_node *) malloc(sizeof(rb_node));
 
-  // test structure
-  assert(na->parent == NULL);
-  assert(na->left == nb);
-  assert(na->right == nc);
-  
-  assert(nb->parent == na);
-  assert(nb->left == NULL);
-  assert(nb->right == NULL);
-  
-  assert(nc->parent == na);
-  assert(nc->left == nd);
-  assert(nc->right == ne);
-  
-  assert(nd->parent == nc);
-  assert(nd->left == nf);
-  assert(nd->right == ng);
-  
-  assert(ne->parent == nc);
-  assert(ne->left == nh);
-  assert(ne->right == ni);
-  
-  assert(nf->parent == nd);
-  assert(nf->left == nj);
-  assert(nf->right == nk);
-  
-  assert(ng->parent == nd);
-  assert(ng->left == nl);
-  assert(ng->right == nm);
+  na->data = a;
+  nb->data = b;
+  nc->data = c;
+  nd->data = d;
+  ne->data = e;
   
-  assert(nh->parent == ne);
-  assert(nh->left == NULL);
-  assert(nh->right == NULL);
+  // set up structure
+  na->left = nb;
+  na->right = nc;
+  na->parent = NULL;
   
-  assert(ni->parent == ne);
-  assert(ni->left == NULL);
-  assert(ni->right == NULL);
+  nb->left = NULL;
+  nb->right = NULL;
+  nb->parent = na;
+
+  nc->left = nd;
+  nc->right = ne;
+  nc->parent = na;
+
+  nd->left = NULL;
+  nd->right = NULL;
+  nd->parent = nc;
+
+  ne->left = NULL;
+  ne->right = NULL;
+  ne->parent = nc;
   
-  assert(nj->parent == nf);
-  assert(nj->left == NULL);
-  assert(nj->right == NULL);
+  // test that "fails" in desired circumstances
+  assert(replace_with_succ(nb) == NULL);
+  assert(replace_with_succ(nd) == NULL);
+  assert(replace_with_succ(ne) == NULL);
+
+  // test general case
+  assert(replace_with_succ(na) != NULL);
+  assert(na->data == nd->data);
+
+  // test "minimum working case"
+  assert(replace_with_succ(nc) != NULL);
+  assert(nc->data == ne->data);
+
+  // clean up
+  free(a);
+  free(b);
+  free(c);
+  free(d);
+  free(e);
+
+  free(na);
+  free(nb);
+  free(nc);
+  free(nd);
+  free(ne);
+
+}
+
+static void simple_replace_test(void) {
+  // initialize data for nodes
+  my_type *a = (my_type *) malloc(sizeof(my_type));
+  my_type *b = (my_type *) malloc(sizeof(my_type));
+  my_type *c = (my_type *) malloc(sizeof(my_type));
+  my_type *d = (my_type *) malloc(sizeof(my_type));
+  my_type *e = (my_type *) malloc(sizeof(my_type));
+
+  a->x = 1;
+  b->x = 2;
+  c->x = 3;
+  d->x = 4;
+  e->x = 5;
+
+  // initialize nodes
+  rb_node *na = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *nb = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *nc = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *nd = (rb_node *) malloc(sizeof(rb_node));
+  rb_node *ne = (rb_node *) malloc(sizeof(rb_node));
+
+  na->data = a;
+  nb->data = b;
+  nc->data = c;
+  nd->data = d;
+  ne->data = e;
   
-  assert(nk->parent == nf);
-  assert(nk->left == NULL);
-  assert(nk->right == NULL);
+  // set up structure
+  na->left = nb;
+  na->right = nc;
+  na->parent = NULL;
   
-  assert(nl->parent == ng);
-  assert(nl->left == NULL);
-  assert(nl->right == NULL);
+  nb->left = nd;
+  nb->right = ne;
+  nb->parent = na;
+
+  nc->left = NULL;
+  nc->right = NULL;
+  nc->parent = na;
+
+  nd->left = NULL;
+  nd->right = NULL;
+  nd->parent = nb;
+
+  ne->left = NULL;
+  ne->right = NULL;
+  ne->parent = nb;
   
-  assert(nm->parent == ng);
-  assert(nm->left == NULL);
-  assert(nm->right == NULL);
+  // test "fails" when should
+  assert(simple_replace(nc, SUCC) == NULL);
+  assert(simple_replace(nc, PRED) == NULL);
+
+  assert(simple_replace(nd, SUCC) == NULL);
+  assert(simple_replace(nd, PRED) == NULL);
+
+  assert(simple_replace(ne, SUCC) == NULL);
+  assert(simple_replace(ne, PRED) == NULL);
+
+  assert(nc->data == c);
+  assert(nd->data == d);
+  assert(ne->data == e);
+
+  // test "minimal working case"
+  assert(simple_replace(nb, SUCC) == ne);
+  assert(nb->data == e);
+
+  assert(simple_replace(nb, PRED) == nd);
+  assert(nb->data == d);
+
+  // test general case
+  assert(simple_replace(na, PRED) == ne);
+  assert(na->data == e);
   
+  assert(simple_replace(na, SUCC) == nc);
+  assert(na->data == c);
+
   // clean up
   free(a);
   free(b);
   free(c);
   free(d);
   free(e);
-  free(f);
-  free(g);
-  free(h);
-  free(i);
-  free(j);
-  free(k);
-  free(l);
-  free(m);
 
   free(na);
   free(nb);
   free(nc);
   free(nd);
   free(ne);
-  free(nf);
-  free(ng);
-  free(nh);
-  free(ni);
-  free(nj);
-  free(nk);
-  free(nl);
-  free(nm);
 
-  return;
-}
+}
+
+static void replace_test(void) {
+  printf("testing basic data replacement\n");
+  replace_w_pred_test();
+  replace_w_succ_test();
+  simple_replace_test();
+  printf("replacement passed!\n");
+}
+
+static void test_remove_small(void) {
+  my_type *a = (my_type *) malloc(sizeof(my_type));
+  my_type *b = (my_type *) malloc(sizeof(my_type));
+  my_type *c = (my_type *) malloc(sizeof(my_type));
+  my_type *missing = (my_type *) malloc(sizeof(my_type));
+
+  a->x = 1;
+  b->x = 2;
+  c->x = 3;
+  missing->x = 4;
+
+  sexy_rb_tree *t = create_rb(&int_compare);
+
+  insert_baby(a, t);
+  insert_baby(b, t);
+  insert_baby(c, t);
+
+  // removing something not there does nothing
+  assert(remove_baby(missing, t) == NULL);
+  assert(t->num_nodes == 3);
+
+  // root has two children, so uses successor then flips sorp
+  assert(remove_baby(b, t) == b);
+  assert(t->sorp == PRED);
+  assert(t->num_nodes == 2);
+  assert(search_baby(b, t) == NULL);
+  assert(is_valid_rb_tree(t));
+
+  assert(remove_baby(a, t) == a);
+  assert(remove_baby(c, t) == c);
+  assert(t->num_nodes == 0);
+  assert(get_root(t) == NULL);
+
+  // tree should still be usable after being emptied
+  insert_baby(b, t);
+  assert(search_baby(b, t) == b);
+
+  free(a);
+  free(c);
+  free(missing);
+  free_rb(t);
+}
+
+static void test_remove_many(void) {
+  // number of nodes going into tree for testing
+  int n = 20000;
+
+  sexy_rb_tree *t = create_rb(&int_compare);
+
+  my_type **dat = (my_type **) malloc(n * sizeof(my_type *));
+
+  for (int i = 0; i < n; i++) {
+    dat[i] = (my_type *) malloc(sizeof(my_type));
+    dat[i]->x = i;
+  }
+
+  // insert and remove in scattered orders; 7919 is prime
+  // so i * 7919 % n hits every index exactly once
+  for (int i = 0; i < n; i++)
+    insert_baby(dat[(i * 7919) % n], t);
+
+  for (int i = 0; i < n; i += 2) {
+    int k = (i * 7919) % n;
+    assert(remove_baby(dat[k], t) == dat[k]);
+
+    if (i % 1000 == 0)
+      assert(is_valid_rb_tree(t));
+  }
+
+  assert(t->num_nodes == n / 2);
+  assert(is_valid_rb_tree(t));
+
+  for (int i = 0; i < n; i++) {
+    int k = (i * 7919) % n;
+    if (i % 2 == 0)
+      assert(search_baby(dat[k], t) == NULL);
+    else
+      assert(search_baby(dat[k], t) == dat[k]);
+  }
+
+  // remove the rest from the bottom up
+  for (int i = 0; i < n; i++) {
+    int k = (i * 7919) % n;
+    if (i % 2 == 1)
+      assert(remove_baby(dat[k], t) == dat[k]);
+  }
+
+  assert(t->num_nodes == 0);
+  assert(get_root(t) == NULL);
+
+  for (int i = 0; i < n; i++)
+    free(dat[i]);
+  free(dat);
+
+  free_rb(t);
+}
+
+static void test_remove(void) {
+  printf("beginning test_remove()\n");
+  test_remove_small();
+  test_remove_many();
+  printf("test_remove() passed!\n");
+}
+
+static void test_arena(void) {
+  printf("beginning test_arena()\n");
+
+  int n = 1000;
+  // tiny slabs so the test crosses plenty of slab boundaries
+  sexy_rb_tree *t = create_rb_arena(&int_compare, 16);
+  assert(t != NULL);
+  assert(t->arena != NULL);
+  assert(t->arena->num_slabs == 0);
+
+  my_type **dat = (my_type **) malloc(n * sizeof(my_type *));
+  for (int i = 0; i < n; i++) {
+    dat[i] = (my_type *) malloc(sizeof(my_type));
+    dat[i]->x = i;
+    assert(insert_baby(dat[i], t));
+  }
+
+  assert(t->num_nodes == n);
+  assert(t->arena->num_slabs == (n + 15) / 16);
+  assert(is_valid_rb_tree(t));
 
-static void test_lrot2(void) {
-  return;
+  // removed nodes should be reused before any new slab
+  int slabs = t->arena->num_slabs;
+  for (int i = 0; i < n; i += 3)
+    assert(remove_baby(dat[i], t) == dat[i]);
+  for (int i = 0; i < n; i += 3)
+    assert(insert_baby(dat[i], t));
+
+  assert(t->arena->num_slabs == slabs);
+  assert(t->num_nodes == n);
+  assert(is_valid_rb_tree(t));
+
+  for (int i = 0; i < n; i++)
+    assert(search_baby(dat[i], t) == dat[i]);
+
+  // leave some dead nodes on the free list so teardown has to skip them
+  for (int i = 0; i < n; i += 2) {
+    assert(remove_baby(dat[i], t) == dat[i]);
+    free(dat[i]);
+  }
+
+  free(dat);
+  free_rb(t);
+
+  printf("test_arena() passed!\n");
 }
 
-static void test_lrot(void) {
-  test_lrot1();
-  test_lrot2();
+static inline int int_key_compare(const int *a, const int *b) {
+  if (*a < *b)
+    return LESS;
+  else if (*a > *b)
+    return GREATER;
+  else
+    return EQUAL;
 }
 
-static void test_rots(void) {
-  printf("beginning rot() test\n");
-  test_rrot();
-  test_lrot();
-  printf("rot() passed!\n");
+static inline int my_type_key_compare(const my_type *a, const my_type *b) {
+  return int_compare((my_type *) a, (my_type *) b);
 }
 
-static void test_insert_1(void) {
-  
-  my_type *a = (my_type *) malloc(sizeof(my_type));
-  my_type *b = (my_type *) malloc(sizeof(my_type));
-  my_type *c = (my_type *) malloc(sizeof(my_type));
+RB_DEFINE(int_rb, int, int_key_compare)
+RB_DEFINE_PACKED(int_prb, int, int_key_compare)
+RB_DEFINE_INDEXED(int_irb, int, int_key_compare)
+RB_DEFINE(my_rb, my_type, my_type_key_compare)
 
-  a->x = 1;
-  b->x = 2;
-  c->x = 3;
+// pointer keys, i.e. the same thing rb_node holds
+static inline int my_ptr_key_compare(my_type *const *a, my_type *const *b) {
+  return int_compare(*a, *b);
+}
 
-  sexy_rb_tree *t = create_rb(&int_compare);
+RB_DEFINE(ptr_rb, my_type *, my_ptr_key_compare)
+RB_DEFINE_PACKED(ptr_prb, my_type *, my_ptr_key_compare)
+
+// same workload for every layout of the int tree
+#define TEST_GENERIC_INT(name)                                      \
+  static void test_generic_##name(void) {                           \
+    int n = 20000;                                                  \
+    name##_tree *t = name##_create();                               \
+    assert(t != NULL);                                              \
+                                                                    \
+    for (int i = 0; i < n; i++)                                     \
+      assert(name##_insert(t, (i * 7919) % n));                     \
+                                                                    \
+    /* duplicates get turned away instead of asserting */           \
+    assert(!name##_insert(t, 0));                                   \
+    assert(name##_size(t) == n);                                    \
+    assert(name##_is_valid(t));                                     \
+                                                                    \
+    for (int i = 0; i < n; i++)                                     \
+      assert(*name##_search(t, i) == i);                            \
+    assert(name##_search(t, n) == NULL);                            \
+                                                                    \
+    for (int i = 0; i < n; i += 2)                                  \
+      assert(name##_remove(t, (i * 7919) % n));                     \
+    assert(!name##_remove(t, n));                                   \
+    assert(name##_size(t) == n / 2);                                \
+    assert(name##_is_valid(t));                                     \
+                                                                    \
+    for (int i = 0; i < n; i++) {                                   \
+      if (i % 2 == 0)                                               \
+        assert(name##_search(t, (i * 7919) % n) == NULL);           \
+      else                                                          \
+        assert(name##_search(t, (i * 7919) % n) != NULL);           \
+    }                                                               \
+                                                                    \
+    /* put them back so removed slots get reused */                 \
+    for (int i = 0; i < n; i += 2)                                  \
+      assert(name##_insert(t, (i * 7919) % n));                     \
+    assert(name##_size(t) == n);                                    \
+    assert(name##_is_valid(t));                                     \
+                                                                    \
+    name##_free(t);                                                 \
+  }
 
-  insert_baby(a, t);
-  insert_baby(b, t);
-  insert_baby(c, t);
+TEST_GENERIC_INT(int_rb)
+TEST_GENERIC_INT(int_prb)
+TEST_GENERIC_INT(int_irb)
+
+static void test_generic(void) {
+  printf("beginning test_generic()\n");
+
+  test_generic_int_rb();
+  test_generic_int_prb();
+  test_generic_int_irb();
+
+  // compact layouts really are smaller
+  assert(sizeof(ptr_rb_node) == sizeof(rb_node));
+  assert(sizeof(ptr_prb_node) < sizeof(ptr_rb_node));
+  assert(sizeof(int_irb_node) == 16);
+
+  // indexed tree doesn't grow past what it needs after churn
+  int_irb_tree *it = int_irb_create();
+  for (int i = 0; i < 100; i++)
+    assert(int_irb_insert(it, i));
+  uint32_t cap = it->capacity;
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < 100; i++)
+      assert(int_irb_remove(it, i));
+    for (int i = 0; i < 100; i++)
+      assert(int_irb_insert(it, i));
+  }
+  assert(it->capacity == cap);
+  assert(int_irb_is_valid(it));
+  int_irb_free(it);
+
+  // my_type stored inline instead of behind a pointer
+  my_rb_tree *mt = my_rb_create();
+  for (int i = 0; i < 100; i++) {
+    my_type k;
+    k.x = 99 - i;
+    assert(my_rb_insert(mt, k));
+  }
+  assert(my_rb_is_valid(mt));
 
-  free_rb(t);
+  my_type probe;
+  probe.x = 42;
+  assert(my_rb_search(mt, probe)->x == 42);
+  assert(my_rb_remove(mt, probe));
+  assert(my_rb_search(mt, probe) == NULL);
+  assert(my_rb_is_valid(mt));
 
+  my_rb_free(mt);
 
+  printf("test_generic() passed!\n");
 }
 
-static void test_insert_2(void) {
-  my_type *d9 = (my_type *) malloc(sizeof(my_type));
-  my_type *d8 = (my_type *) malloc(sizeof(my_type));
-  my_type *d7 = (my_type *) malloc(sizeof(my_type));
-  my_type *d3 = (my_type *) malloc(sizeof(my_type));
-  my_type *d5 = (my_type *) malloc(sizeof(my_type));
-  my_type *d2 = (my_type *) malloc(sizeof(my_type));
-  
+static void test_bulk_load(void) {
+  printf("beginning test_bulk_load()\n");
 
-  d9->x = 9;
-  d8->x = 8;
-  d7->x = 7;
-  d3->x = 3;
-  d5->x = 5;
-  d2->x = 2;
-  
-  sexy_rb_tree *t = create_rb(&int_compare);
+  // every shape of small tree, complete or not
+  for (int n = 0; n < 70; n++) {
+    sexy_rb_tree *t = create_rb(&int_compare);
+    my_type **dat = (my_type **) malloc((n + 1) * sizeof(my_type *));
 
-  insert_baby(d9, t);
-  insert_baby(d8, t);
-  insert_baby(d7, t);
-  insert_baby(d3, t);
-  insert_baby(d5, t);
-  insert_baby(d2, t);
+    for (int i = 0; i < n; i++) {
+      dat[i] = (my_type *) malloc(sizeof(my_type));
+      dat[i]->x = 2 * i;
+    }
+
+    assert(bulk_load_rb(t, dat, n));
+    assert(t->num_nodes == n);
+
+    if (n == 0) {
+      assert(get_root(t) == NULL);
+    } else {
+      assert(is_valid_rb_tree(t));
+      for (int i = 0; i < n; i++)
+        assert(search_baby(dat[i], t) == dat[i]);
+    }
+
+    // loaded tree is an ordinary tree afterwards
+    my_type *odd = (my_type *) malloc(sizeof(my_type));
+    odd->x = 2 * n + 1;
+    assert(insert_baby(odd, t));
+    assert(is_valid_rb_tree(t));
+    if (n > 0) {
+      assert(remove_baby(dat[n / 2], t) == dat[n / 2]);
+      free(dat[n / 2]);
+      assert(is_valid_rb_tree(t));
+    }
+
+    free(dat);
+    free_rb(t);
+  }
+
+  int n = 100000;
+  my_type **dat = (my_type **) malloc(n * sizeof(my_type *));
+  for (int i = 0; i < n; i++) {
+    dat[i] = (my_type *) malloc(sizeof(my_type));
+    dat[i]->x = i;
+  }
+
+  // won't load into a tree that already has things in it
+  sexy_rb_tree *t = create_rb_arena(&int_compare, 0);
+  assert(insert_baby(dat[0], t));
+  assert(!bulk_load_rb(t, dat + 1, n - 1));
+  assert(remove_baby(dat[0], t) == dat[0]);
+
+  // or out of order data
+  my_type *tmp = dat[10];
+  dat[10] = dat[11];
+  dat[11] = tmp;
+  assert(!bulk_load_rb(t, dat, n));
+  assert(get_root(t) == NULL);
+  dat[11] = dat[10];
+  dat[10] = tmp;
+
+  assert(bulk_load_rb(t, dat, n));
+  assert(t->num_nodes == n);
+  assert(is_valid_rb_tree(t));
+  for (int i = 0; i < n; i++)
+    assert(search_baby(dat[i], t) == dat[i]);
 
+  free(dat);
   free_rb(t);
-  
+
+  printf("test_bulk_load() passed!\n");
 }
 
-static void test_insert(void) {
-  printf("beginning test_insert()\n");
+// adds x values up; gives up once the sum passes *limit (if limit set)
+typedef struct range_sum {
+  long sum;
+  long limit;
+  int last;
+} range_sum;
 
-  test_insert_1();
-  test_insert_2();
+static int range_sum_cb(my_type *d, void *arg) {
+  range_sum *rs = (range_sum *) arg;
 
-  printf("test_insert() passed!\n");
+  // range scans come back in order
+  assert(d->x > rs->last);
+  rs->last = d->x;
+
+  rs->sum += d->x;
+  return (rs->limit == 0 || rs->sum <= rs->limit);
 }
 
-static void test_search(void) {
-  // number of nodes going into tree for testing
-  int n = 100000;
+static void test_iterators(void) {
+  printf("beginning test_iterators()\n");
 
-  printf("beginning test_search with %d elements\n", n);
+  sexy_rb_tree *t = create_rb(&int_compare);
+  my_type key;
+
+  // empty tree has nowhere to go
+  key.x = 0;
+  assert(rb_first(t) == NULL);
+  assert(rb_last(t) == NULL);
+  assert(rb_lower_bound(&key, t) == NULL);
+
+  // even numbers 0 .. 2 * (n - 1), inserted scattered
+  int n = 1000;
+  for (int i = 0; i < n; i++) {
+    my_type *d = (my_type *) malloc(sizeof(my_type));
+    d->x = 2 * ((i * 7919) % n);
+    assert(insert_baby(d, t));
+  }
+
+  int expect = 0;
+  for (rb_node *c = rb_first(t); c != NULL; c = rb_next(c)) {
+    assert(c->data->x == expect);
+    expect += 2;
+  }
+  assert(expect == 2 * n);
+
+  expect = 2 * (n - 1);
+  for (rb_node *c = rb_last(t); c != NULL; c = rb_prev(c)) {
+    assert(c->data->x == expect);
+    expect -= 2;
+  }
+  assert(expect == -2);
+
+  // exact hit, gap, before everything, after everything
+  key.x = 10;
+  assert(rb_lower_bound(&key, t)->data->x == 10);
+  key.x = 11;
+  assert(rb_lower_bound(&key, t)->data->x == 12);
+  key.x = -5;
+  assert(rb_lower_bound(&key, t)->data->x == 0);
+  key.x = 2 * n;
+  assert(rb_lower_bound(&key, t) == NULL);
+
+  my_type lo;
+  my_type hi;
+  range_sum rs;
+
+  // 11 .. 21 holds 12, 14, 16, 18, 20
+  lo.x = 11;
+  hi.x = 21;
+  rs.sum = 0;
+  rs.limit = 0;
+  rs.last = INT_MIN;
+  assert(rb_range(&lo, &hi, t, &range_sum_cb, &rs) == 5);
+  assert(rs.sum == 12 + 14 + 16 + 18 + 20);
+
+  // both ends included
+  lo.x = 12;
+  hi.x = 20;
+  rs.sum = 0;
+  rs.last = INT_MIN;
+  assert(rb_range(&lo, &hi, t, &range_sum_cb, &rs) == 5);
+
+  // callback can stop the scan
+  rs.sum = 0;
+  rs.limit = 30;
+  rs.last = INT_MIN;
+  assert(rb_range(&lo, &hi, t, &range_sum_cb, &rs) == 3);
+
+  // empty range
+  lo.x = 13;
+  hi.x = 13;
+  rs.sum = 0;
+  rs.limit = 0;
+  rs.last = INT_MIN;
+  assert(rb_range(&lo, &hi, t, &range_sum_cb, &rs) == 0);
+
+  free_rb(t);
+
+  printf("test_iterators() passed!\n");
+}
+
+#if RB_ORDER_STATS
+static void test_order_stats(void) {
+  printf("beginning test_order_stats()\n");
 
   sexy_rb_tree *t = create_rb(&int_compare);
+  my_type key;
 
-  my_type *dat[2*n];
+  key.x = 0;
+  assert(rb_select(0, t) == NULL);
+  assert(rb_rank(&key, t) == 0);
 
-  for(int i = 0; i < 2*n; i++) {
+  // even numbers 0 .. 2 * (n - 1) inserted scattered, then remove
+  // every multiple of 4 so both fixups get exercised
+  int n = 5000;
+  my_type **dat = (my_type **) malloc(n * sizeof(my_type *));
+  for (int i = 0; i < n; i++) {
     dat[i] = (my_type *) malloc(sizeof(my_type));
+    dat[i]->x = 2 * i;
+  }
+  for (int i = 0; i < n; i++)
+    assert(insert_baby(dat[(i * 7919) % n], t));
+  for (int i = 0; i < n; i += 2) {
+    assert(remove_baby(dat[i], t) == dat[i]);
+    free(dat[i]);
   }
 
-  for(int i = 0; i < n; i++) {
-    dat[i]->x = i;
+  // what's left is 2, 6, 10, ...; k-th smallest is 4k + 2
+  assert(t->num_nodes == n / 2);
+  assert(is_valid_rb_tree(t));
+
+  for (int k = 0; k < n / 2; k++) {
+    assert(rb_select(k, t)->x == 4 * k + 2);
+
+    key.x = 4 * k + 2;
+    assert(rb_rank(&key, t) == k);
+
+    // missing keys rank where they'd go
+    key.x = 4 * k + 3;
+    assert(rb_rank(&key, t) == k + 1);
   }
 
-  for(int i = n; i < 2*n; i++) {
+  assert(rb_select(-1, t) == NULL);
+  assert(rb_select(n / 2, t) == NULL);
+
+  free(dat);
+  free_rb(t);
+
+  // bulk loaded trees get sizes too
+  t = create_rb(&int_compare);
+  dat = (my_type **) malloc(100 * sizeof(my_type *));
+  for (int i = 0; i < 100; i++) {
+    dat[i] = (my_type *) malloc(sizeof(my_type));
     dat[i]->x = i;
   }
+  assert(bulk_load_rb(t, dat, 100));
+  assert(is_valid_rb_tree(t));
+  for (int k = 0; k < 100; k++)
+    assert(rb_select(k, t) == dat[k]);
 
-  for(int i = 0; i < n; i++) {
-    insert_baby(dat[i], t);
+  free(dat);
+  free_rb(t);
+
+  printf("test_order_stats() passed!\n");
+}
+#endif
+
+// breaks the tree on purpose in each way is_valid_rb_tree should catch
+static void test_validator(void) {
+  printf("beginning test_validator()\n");
+
+  sexy_rb_tree *t = create_rb(&int_compare);
+
+  // empty is fine
+  assert(is_valid_rb_tree(t));
+  assert(!is_valid_rb_tree(NULL));
+
+  int n = 100;
+  for (int i = 0; i < n; i++) {
+    my_type *d = (my_type *) malloc(sizeof(my_type));
+    d->x = i;
+    assert(insert_baby(d, t));
   }
+  assert(is_valid_rb_tree(t));
 
-  for(int i = 0; i < n; i++) {
-    assert(search_baby(dat[i], t) != NULL);
+  rb_node *r = get_root(t);
+  rb_node *lo = rb_first(t);
+  rb_node *hi = rb_last(t);
+
+  // red root
+  set_color(r, RED);
+  assert(!is_valid_rb_tree(t));
+  set_color(r, BLACK);
+
+  // extra black on one path
+  int c = lo->node_color;
+  set_color(lo, (c == RED) ? BLACK : RED);
+  assert(!is_valid_rb_tree(t));
+  set_color(lo, c);
+
+  // red-red: find a red node and make its parent red too
+  rb_node *red = rb_first(t);
+  while (red != NULL && (!is_red(red) || parent(red) == r))
+    red = rb_next(red);
+  assert(red != NULL);
+  c = parent(red)->node_color;
+  set_color(parent(red), RED);
+  assert(!is_valid_rb_tree(t));
+  set_color(parent(red), c);
+
+  // order broken deep down (not against the direct parent)
+  int x = lo->data->x;
+  lo->data->x = hi->data->x + 1;
+  assert(!is_valid_rb_tree(t));
+  lo->data->x = x;
+
+  // bad parent pointer
+  rb_node *pp = parent(lo);
+  lo->parent = r;
+  assert(!is_valid_rb_tree(t));
+  lo->parent = pp;
+
+  // count off
+  t->num_nodes++;
+  assert(!is_valid_rb_tree(t));
+  t->num_nodes--;
+
+#if RB_ORDER_STATS
+  lo->size++;
+  assert(!is_valid_rb_tree(t));
+  lo->size--;
+#endif
+
+  // and it's all back the way it was
+  assert(is_valid_rb_tree(t));
+
+  free_rb(t);
+
+  printf("test_validator() passed!\n");
+}
+
+// shared between the writer and readers in test_concurrent
+typedef struct concurrent_test {
+  sexy_rb_tree *t;
+  // even keys 0 .. 2 * (stable - 1) are always in the tree;
+  // odd keys come and go
+  int stable;
+  int done;
+  long lookups;
+} concurrent_test;
+
+static void *concurrent_reader(void *arg) {
+  concurrent_test *ct = (concurrent_test *) arg;
+  rb_reader *r = rb_reader_join(ct->t);
+  assert(r != NULL);
+
+  my_type key;
+  long lookups = 0;
+  unsigned int seed = (unsigned int) (size_t) r;
+
+  while (!__atomic_load_n(&ct->done, __ATOMIC_ACQUIRE)) {
+    seed = seed * 1103515245u + 12345u;
+    key.x = (int) ((seed >> 8) % (2 * ct->stable));
+
+    my_type *res = search_baby_read(&key, r);
+    // odd ones can be freed as soon as the search is over, so they
+    // can't be looked at here
+    if (key.x % 2 == 0)
+      assert(res != NULL && res->x == key.x);
+
+    lookups++;
   }
-  
-  for(int i = n; i < 2*n; i++) {
-    assert(search_baby(dat[i], t) == NULL);
+
+  __atomic_fetch_add(&ct->lookups, lookups, __ATOMIC_RELAXED);
+  rb_reader_leave(r);
+  return NULL;
+}
+
+static void test_concurrent(void) {
+  printf("beginning test_concurrent()\n");
+
+  // not concurrent, no readers
+  sexy_rb_tree *plain = create_rb(&int_compare);
+  assert(rb_reader_join(plain) == NULL);
+  free_rb(plain);
+
+  int readers = 4;
+  concurrent_test ct;
+  ct.t = create_rb_concurrent(&int_compare, 256, readers + 1);
+  ct.stable = 2000;
+  ct.done = 0;
+  ct.lookups = 0;
+  assert(ct.t != NULL);
+  assert(sizeof(rb_reader) == CACHE_LINE);
+
+  for (int i = 0; i < ct.stable; i++) {
+    my_type *d = (my_type *) malloc(sizeof(my_type));
+    d->x = 2 * ((i * 7919) % ct.stable);
+    assert(insert_baby(d, ct.t));
   }
 
-  for(int i = n; i < 2*n; i++) {
-    free(dat[i]);
+  pthread_t threads[4];
+  for (int i = 0; i < readers; i++)
+    assert(pthread_create(&threads[i], NULL, &concurrent_reader, &ct) == 0);
+
+  // churn the odd keys while the readers go at it
+  int churn = 500;
+  my_type **odd = (my_type **) malloc(churn * sizeof(my_type *));
+  for (int round = 0; round < 20; round++) {
+    for (int i = 0; i < churn; i++) {
+      odd[i] = (my_type *) malloc(sizeof(my_type));
+      odd[i]->x = 2 * ((i * 7919 + round) % ct.stable) + 1;
+      if (!insert_baby(odd[i], ct.t)) {
+        free(odd[i]);
+        odd[i] = NULL;
+      }
+    }
+
+    for (int i = 0; i < churn; i++) {
+      if (odd[i] != NULL)
+        assert(remove_baby(odd[i], ct.t) == odd[i]);
+    }
+
+    // nobody can still be looking at them after this
+    rb_synchronize(ct.t);
+    for (int i = 0; i < churn; i++)
+      free(odd[i]);
   }
 
-  assert(is_valid_rb_tree(t));
-  
-  free_rb(t);
+  __atomic_store_n(&ct.done, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < readers; i++)
+    assert(pthread_join(threads[i], NULL) == 0);
 
-  printf("test_search passed!\n");
+  assert(ct.lookups > 0);
+  assert(ct.t->num_nodes == ct.stable);
+  assert(is_valid_rb_tree(ct.t));
+
+  // slots run out and come back
+  rb_reader *slots[5];
+  for (int i = 0; i < readers + 1; i++)
+    assert((slots[i] = rb_reader_join(ct.t)) != NULL);
+  assert(rb_reader_join(ct.t) == NULL);
+  rb_reader_leave(slots[2]);
+  assert(rb_reader_join(ct.t) == slots[2]);
+
+  free(odd);
+  free_rb(ct.t);
+
+  printf("test_concurrent() passed!\n");
 }
 
-static void replace_w_pred_test(void) {
-  // initialize data for nodes
-  my_type *a = (my_type *) malloc(sizeof(my_type));
-  my_type *b = (my_type *) malloc(sizeof(my_type));
-  my_type *c = (my_type *) malloc(sizeof(my_type));
-  my_type *d = (my_type *) malloc(sizeof(my_type));
-  my_type *e = (my_type *) malloc(sizeof(my_type));
+// nodes only the live tree can see; shared ones cut the walk short
+static int unshared_nodes(prb_node *n) {
+  if (n == NULL || n->refs > 1)
+    return 0;
 
-  a->x = 1;
-  b->x = 2;
-  c->x = 3;
-  d->x = 4;
-  e->x = 5;
+  return 1 + unshared_nodes(n->left) + unshared_nodes(n->right);
+}
 
-  // initialize nodes
-  rb_node *na = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *nb = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *nc = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *nd = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *ne = (rb_node *) malloc(sizeof(rb_node));
+// checks a version holds exactly lo, lo + step, ... < hi in order
+typedef struct version_check {
+  int next;
+  int step;
+} version_check;
 
-  na->data = a;
-  nb->data = b;
-  nc->data = c;
-  nd->data = d;
-  ne->data = e;
-  
-  // set up structure
-  na->left = nb;
-  na->right = nc;
-  na->parent = NULL;
-  
-  nb->left = nd;
-  nb->right = ne;
-  nb->parent = na;
+static int version_check_cb(my_type *d, void *arg) {
+  version_check *vc = (version_check *) arg;
 
-  nc->left = NULL;
-  nc->right = NULL;
-  nc->parent = na;
+  assert(d->x == vc->next);
+  vc->next += vc->step;
+  return 1;
+}
 
-  nd->left = NULL;
-  nd->right = NULL;
-  nd->parent = nb;
+typedef struct export_test {
+  rb_version *v;
+  long sum;
+} export_test;
 
-  ne->left = NULL;
-  ne->right = NULL;
-  ne->parent = nb;
-  
-  // test that "fails" in desired circumstances
-  assert(replace_with_pred(nc) == NULL);
-  assert(replace_with_pred(nd) == NULL);
-  assert(replace_with_pred(ne) == NULL);
+static int export_sum_cb(my_type *d, void *arg) {
+  *(long *) arg += d->x;
+  return 1;
+}
+
+static void *export_thread(void *arg) {
+  export_test *et = (export_test *) arg;
+
+  for (int i = 0; i < 20; i++) {
+    long sum = 0;
+    version_foreach(et->v, &export_sum_cb, &sum);
+    assert(i == 0 || sum == et->sum);
+    et->sum = sum;
+  }
+
+  release_version(et->v);
+  return NULL;
+}
+
+static void test_persistent(void) {
+  printf("beginning test_persistent()\n");
+
+  int n = 2000;
+  my_type **dat = (my_type **) malloc(2 * n * sizeof(my_type *));
+  for (int i = 0; i < 2 * n; i++) {
+    dat[i] = (my_type *) malloc(sizeof(my_type));
+    dat[i]->x = i;
+  }
+
+  persistent_rb *t = create_prb(&int_compare);
+
+  for (int i = 0; i < n; i++)
+    assert(insert_prb(dat[(i * 7919) % n], t));
+  assert(!insert_prb(dat[0], t));
+  assert(t->num_nodes == n);
+  assert(is_valid_prb(t));
+
+  // with no snapshots every node belongs to the live tree
+  assert(unshared_nodes(t->root) == n);
+  // and writes copy nothing, so only the new node comes off the reserve
+  // (once it's big enough nothing gets topped up)
+  assert(prb_reserve(t, 2 * PRB_MAX_DEPTH + 3));
+  int spare = t->num_spare;
+  assert(remove_prb(dat[1], t) == dat[1] && t->num_spare == spare);
+  assert(insert_prb(dat[1], t) && t->num_spare == spare - 1);
+
+  rb_version *v1 = rb_snapshot(t);
+  assert(is_valid_version(v1));
+
+  // one write copies a path, not the tree
+  assert(insert_prb(dat[n], t));
+  assert(unshared_nodes(t->root) < 64);
+  assert(is_valid_prb(t));
+
+  // change the live tree a lot: drop the evens, add n .. 2n
+  for (int i = 0; i < n; i += 2)
+    assert(remove_prb(dat[(i * 7919) % n], t) != NULL);
+  assert(remove_prb(dat[0], t) == NULL);
+  for (int i = n + 1; i < 2 * n; i++)
+    assert(insert_prb(dat[i], t));
+  assert(is_valid_prb(t));
+  assert(t->num_nodes == n / 2 + n);
+
+  // snapshot doesn't see any of it
+  assert(is_valid_version(v1));
+  assert(v1->num_nodes == n);
+  version_check vc;
+  vc.next = 0;
+  vc.step = 1;
+  assert(version_foreach(v1, &version_check_cb, &vc) == n);
+  assert(search_version(dat[0], v1) == dat[0]);
+  assert(search_version(dat[n], v1) == NULL);
+  assert(search_prb(dat[0], t) == NULL);
+  assert(search_prb(dat[n], t) == dat[n]);
+
+  // export from another thread while the live tree keeps changing
+  export_test et;
+  et.v = rb_snapshot(t);
+  et.sum = 0;
+  pthread_t exporter;
+  assert(pthread_create(&exporter, NULL, &export_thread, &et) == 0);
+
+  for (int i = 1; i < n; i += 2)
+    assert(remove_prb(dat[i], t) == dat[i]);
+  for (int i = 0; i < n; i++)
+    assert(insert_prb(dat[i], t));
+
+  assert(pthread_join(exporter, NULL) == 0);
+
+  // exported sum: odds below n plus n .. 2n - 1
+  long expect = 0;
+  for (int i = 1; i < n; i += 2)
+    expect += i;
+  for (int i = n; i < 2 * n; i++)
+    expect += i;
+  assert(et.sum == expect);
+
+  // dropping a snapshot leaves the live tree alone and vice versa
+  release_version(v1);
+  assert(is_valid_prb(t));
+  assert(t->num_nodes == 2 * n);
+
+  rb_version *v2 = rb_snapshot(t);
+  free_prb(t);
+  assert(is_valid_version(v2));
+  vc.next = 0;
+  assert(version_foreach(v2, &version_check_cb, &vc) == 2 * n);
+  release_version(v2);
+
+  // data is ours
+  for (int i = 0; i < 2 * n; i++)
+    free(dat[i]);
+  free(dat);
+
+  printf("test_persistent() passed!\n");
+}
+
+static void test_mmap(void) {
+  printf("beginning test_mmap()\n");
+
+  const char *path = "test_mmap.rb";
+  sexy_rb_tree *t = create_rb(&int_compare);
+
+  // empty tree saves and maps fine
+  assert(rb_save(t, path));
+  rb_mapped *m = rb_open_mmap(path, &int_compare);
+  assert(m != NULL && mapped_size(m) == 0);
+  my_type key;
+  key.x = 0;
+  assert(search_mapped(&key, m) == NULL);
+  rb_close_mmap(m);
+
+  int n = 10000;
+  for (int i = 0; i < n; i++) {
+    my_type *d = (my_type *) malloc(sizeof(my_type));
+    d->x = 2 * ((i * 7919) % n);
+    assert(insert_baby(d, t));
+  }
+
+  assert(rb_save(t, path));
+  m = rb_open_mmap(path, &int_compare);
+  assert(m != NULL && mapped_size(m) == n);
+
+  // same answers as the tree it came from, without the tree
+  for (int i = -1; i < 2 * n + 1; i++) {
+    key.x = i;
+    const my_type *got = search_mapped(&key, m);
+    my_type *want = search_baby(&key, t);
+    assert((got == NULL) == (want == NULL));
+    assert(got == NULL || got->x == i);
+  }
+
+  // preorder: the root's left child is right after it
+  assert(m->root == 0 && m->nodes[0].left == 1);
+
+  // saving over a mapped file leaves the old mapping alone
+  key.x = 0;
+  free(remove_baby(&key, t));
+  assert(rb_save(t, path));
+  assert(search_mapped(&key, m) != NULL);
+  rb_close_mmap(m);
+
+  m = rb_open_mmap(path, &int_compare);
+  assert(m != NULL && mapped_size(m) == n - 1);
+  assert(search_mapped(&key, m) == NULL);
+  rb_close_mmap(m);
+
+  // a truncated file doesn't open
+  assert(truncate(path, sizeof(rb_disk_header) + sizeof(rb_disk_node)) == 0);
+  assert(rb_open_mmap(path, &int_compare) == NULL);
+  assert(rb_open_mmap("no/such/file.rb", &int_compare) == NULL);
+
+  remove(path);
+  free_rb(t);
+  printf("test_mmap() passed!\n");
+}
+
+typedef struct evict_log {
+  int count;
+  int last;
+} evict_log;
+
+static void log_evict(my_type *d, void *arg) {
+  evict_log *log = (evict_log *) arg;
+
+  log->count++;
+  log->last = d->x;
+  free(d);
+}
+
+static my_type *make_int(int x) {
+  my_type *ret = (my_type *) malloc(sizeof(my_type));
+  ret->x = x;
+  return ret;
+}
+
+// buckets in order, lists linked both ways, node count matches tree
+static int cache_lists_ok(rb_cache *c) {
+  int count = 0;
+  rb_cache_bucket *prev = NULL;
 
-  // test general case
-  assert(replace_with_pred(na) != NULL);
-  assert(na->data == ne->data);
+  for (rb_cache_bucket *b = c->buckets; b != NULL; prev = b, b = b->next) {
+    if (b->prev != prev || b->head == NULL)
+      return 0;
+    if (prev != NULL && prev->freq >= b->freq)
+      return 0;
 
-  // test "minimum working case"
-  assert(replace_with_pred(nb) != NULL);
-  assert(nb->data == nd->data);
+    rb_cache_node *last = NULL;
+    for (rb_cache_node *cn = b->head; cn != NULL; last = cn, cn = cn->next) {
+      if (cn->prev != last || cn->bucket != b)
+        return 0;
+      if (search_node(cn->node.data, c->tree) != &cn->node)
+        return 0;
+      count++;
+    }
+    if (b->tail != last)
+      return 0;
+  }
 
-  // clean up
-  free(a);
-  free(b);
-  free(c);
+  return count == cache_size(c) && count <= c->capacity && is_valid_rb_tree(c->tree);
+}
+
+static void test_cache(void) {
+  printf("beginning test_cache()\n");
+
+  evict_log log;
+  log.count = 0;
+  my_type key;
+
+  assert(create_rb_cache(&int_compare, 0, RB_CACHE_LRU, NULL, NULL) == NULL);
+  assert(create_rb_cache(&int_compare, 4, RED, NULL, NULL) == NULL);
+
+  // LRU: touching 0 makes 1 the oldest
+  rb_cache *c = create_rb_cache(&int_compare, 3, RB_CACHE_LRU, &log_evict, &log);
+  for (int i = 0; i < 3; i++)
+    assert(cache_put(make_int(i), c));
+  key.x = 0;
+  assert(cache_get(&key, c)->x == 0);
+
+  my_type *d = make_int(3);
+  assert(cache_put(d, c));
+  assert(log.count == 1 && log.last == 1);
+  key.x = 1;
+  assert(cache_peek(&key, c) == NULL);
+
+  // duplicate put is turned away and doesn't evict
+  assert(!cache_put(d, c));
+  assert(log.count == 1 && cache_size(c) == 3);
+
+  // peek doesn't count as a use: 2 is still the oldest
+  key.x = 2;
+  assert(cache_peek(&key, c)->x == 2);
+  assert(cache_put(make_int(4), c));
+  assert(log.last == 2);
+  assert(cache_lists_ok(c));
+  free_rb_cache(c);
+
+  // LFU: 0 and 1 get used more, so 2 goes first; ties go to the oldest
+  log.count = 0;
+  c = create_rb_cache(&int_compare, 3, RB_CACHE_LFU, &log_evict, &log);
+  for (int i = 0; i < 3; i++)
+    assert(cache_put(make_int(i), c));
+  key.x = 0;
+  cache_get(&key, c);
+  cache_get(&key, c);
+  key.x = 1;
+  cache_get(&key, c);
+  assert(cache_lists_ok(c));
+
+  assert(cache_put(make_int(3), c));
+  assert(log.last == 2);
+  assert(cache_put(make_int(4), c));
+  assert(log.last == 3);
+  key.x = 4;
+  cache_get(&key, c);
+  assert(cache_put(make_int(5), c));
+  assert(log.last == 1);
+  assert(cache_lists_ok(c));
+
+  key.x = 0;
+  d = cache_remove(&key, c);
+  assert(d != NULL && d->x == 0 && cache_size(c) == 2);
   free(d);
-  free(e);
+  assert(cache_remove(&key, c) == NULL);
+  assert(cache_lists_ok(c));
+  free_rb_cache(c);
+
+  // churn both policies; removes move data between tree nodes, so the
+  // lists have to keep following the data around
+  int policies[2] = {RB_CACHE_LRU, RB_CACHE_LFU};
+  for (int j = 0; j < 2; j++) {
+    log.count = 0;
+    c = create_rb_cache(&int_compare, 500, policies[j], &log_evict, &log);
+    srand(16);
+
+    for (int it = 0; it < 50000; it++) {
+      key.x = rand() % 2000;
+      int op = rand() % 4;
+
+      if (op == 0) {
+        free(cache_remove(&key, c));
+      } else if (op == 1) {
+        d = make_int(key.x);
+        if (!cache_put(d, c))
+          free(d);
+      } else {
+        my_type *got = cache_get(&key, c);
+        assert(got == NULL || got->x == key.x);
+      }
+
+      if (it % 5000 == 0)
+        assert(cache_lists_ok(c));
+    }
 
-  free(na);
-  free(nb);
-  free(nc);
-  free(nd);
-  free(ne);
+    assert(cache_size(c) <= 500 && log.count > 0);
+    assert(cache_lists_ok(c));
+    free_rb_cache(c);
+  }
 
+  printf("test_cache() passed!\n");
 }
 
+// rb_parallel_map callbacks
+static void count_seen(my_type *d, void *arg) {
+  __atomic_add_fetch(&((int *) arg)[d->x], 1, __ATOMIC_RELAXED);
+}
 
-// very similar to replace_w_pred_test()
-static void replace_w_succ_test(void) {
-  // initialize data for nodes
-  my_type *a = (my_type *) malloc(sizeof(my_type));
-  my_type *b = (my_type *) malloc(sizeof(my_type));
-  my_type *c = (my_type *) malloc(sizeof(my_type));
-  my_type *d = (my_type *) malloc(sizeof(my_type));
-  my_type *e = (my_type *) malloc(sizeof(my_type));
+static void check_in_order(my_type *d, void *arg) {
+  int *last = arg;
+  assert(d->x > *last);
+  *last = d->x;
+}
 
-  a->x = 1;
-  b->x = 2;
-  c->x = 3;
-  d->x = 4;
-  e->x = 5;
+// rb_union's on_dup
+static void count_dup(my_type *kept, my_type *dup, void *arg) {
+  assert(kept->x == dup->x && kept != dup);
+  free(dup);
+  __atomic_add_fetch((int *) arg, 1, __ATOMIC_RELAXED);
+}
 
-  // initialize nodes
-  rb_node *na = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *nb = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *nc = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *nd = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *ne = (rb_node *) malloc(sizeof(rb_node));
+// tree of every i in [0, n) with i % every == 0, inserted in a random order
+static sexy_rb_tree *make_multiples(int n, int every, unsigned seed) {
+  sexy_rb_tree *t = create_rb(&int_compare);
+  int count = (n + every - 1) / every;
+  int *keys = malloc(count * sizeof(int));
+  for (int i = 0; i < count; i++)
+    keys[i] = i * every;
+
+  srand(seed);
+  for (int i = count - 1; i > 0; i--) {
+    int j = rand() % (i + 1);
+    int tmp = keys[i];
+    keys[i] = keys[j];
+    keys[j] = tmp;
+  }
+  for (int i = 0; i < count; i++)
+    assert(insert_baby(make_int(keys[i]), t));
 
-  na->data = a;
-  nb->data = b;
-  nc->data = c;
-  nd->data = d;
-  ne->data = e;
-  
-  // set up structure
-  na->left = nb;
-  na->right = nc;
-  na->parent = NULL;
-  
-  nb->left = NULL;
-  nb->right = NULL;
-  nb->parent = na;
+  free(keys);
+  return t;
+}
 
-  nc->left = nd;
-  nc->right = ne;
-  nc->parent = na;
+static void test_parallel(void) {
+  printf("beginning test_parallel()\n");
+  enum { N = 200000 };
+  int *seen = calloc(N, sizeof(int));
+
+  // map: every node exactly once, whatever the thread count
+  sexy_rb_tree *t = make_multiples(N, 1, 25);
+  int rounds = 0;
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    assert(rb_parallel_map(t, &count_seen, seen, threads) == N);
+    rounds++;
+    for (int i = 0; i < N; i++)
+      assert(seen[i] == rounds);
+  }
+  int last = -1;
+  assert(rb_parallel_map(t, &check_in_order, &last, 1) == N);
+  assert(last == N - 1);
+
+  sexy_rb_tree *empty = create_rb(&int_compare);
+  assert(rb_parallel_map(empty, &count_seen, seen, 4) == 0);
+
+  // union: evens and multiples of 3 overlap on multiples of 6
+  sexy_rb_tree *a = make_multiples(N, 2, 26);
+  sexy_rb_tree *b = make_multiples(N, 3, 27);
+  int dups = 0;
+  assert(!rb_union(a, a, NULL, NULL, 4));
+  assert(rb_union(a, b, &count_dup, &dups, 4));
+  assert(dups == (N + 5) / 6);
+  assert(is_valid_rb_tree(a));
+  assert(is_valid_rb_tree(b) && b->num_nodes == 0 && get_root(b) == NULL);
+
+  int expect = 0;
+  rb_node *cur = rb_first(a);
+  for (int i = 0; i < N; i++) {
+    if (i % 2 != 0 && i % 3 != 0)
+      continue;
+    assert(cur != NULL && cur->data->x == i);
+    cur = rb_next(cur);
+    expect++;
+  }
+  assert(cur == NULL && a->num_nodes == expect);
+
+  // empty on either side
+  assert(rb_union(a, b, NULL, NULL, 4) && a->num_nodes == expect);
+  assert(rb_union(b, a, NULL, NULL, 4) && b->num_nodes == expect);
+  assert(is_valid_rb_tree(b) && get_root(a) == NULL);
+
+  // all of t again goes in with every other one a duplicate (freed)
+  assert(rb_union(t, b, NULL, NULL, 3));
+  assert(t->num_nodes == N && is_valid_rb_tree(t));
+
+  // arena trees can't give their nodes away
+  sexy_rb_tree *ar = create_rb_arena(&int_compare, 64);
+  assert(!rb_union(t, ar, NULL, NULL, 4) && !rb_union(ar, t, NULL, NULL, 4));
+
+  // lots of small random unions, one thread and several
+  for (int round = 0; round < 200; round++) {
+    sexy_rb_tree *x = create_rb(&int_compare);
+    sexy_rb_tree *y = create_rb(&int_compare);
+    char in[512] = {0};
+    for (int i = 0; i < round % 97; i++) {
+      int k = rand() % 512;
+      my_type *d = make_int(k);
+      if (insert_baby(d, x))
+        in[k] = 1;
+      else
+        free(d);
+    }
+    for (int i = 0; i < round % 89; i++) {
+      int k = rand() % 512;
+      my_type *d = make_int(k);
+      if (insert_baby(d, y))
+        in[k] = 1;
+      else
+        free(d);
+    }
 
-  nd->left = NULL;
-  nd->right = NULL;
-  nd->parent = nc;
+    assert(rb_union(x, y, NULL, NULL, 1 + round % 4));
+    assert(is_valid_rb_tree(x));
+    int c = 0;
+    for (cur = rb_first(x); cur != NULL; cur = rb_next(cur)) {
+      assert(in[cur->data->x]);
+      c++;
+    }
+    for (int k = 0; k < 512; k++)
+      c -= in[k];
+    assert(c == 0);
+    free_rb(x);
+    free_rb(y);
+  }
 
-  ne->left = NULL;
-  ne->right = NULL;
-  ne->parent = nc;
-  
-  // test that "fails" in desired circumstances
-  assert(replace_with_succ(nb) == NULL);
-  assert(replace_with_succ(nd) == NULL);
-  assert(replace_with_succ(ne) == NULL);
+  // parallel free of both kinds
+  for (int i = 0; i < 100000; i++)
+    assert(insert_baby(make_int(i), ar));
+  free_rb_parallel(ar, 4);
+  ar = create_rb_arena(&int_compare, 64);
+  insert_baby(make_int(1), ar);
+  free_rb_parallel(ar, 4);
+  free_rb_parallel(t, 4);
+  free_rb_parallel(a, 4);
+  free_rb_parallel(b, 4);
+  free_rb_parallel(empty, 4);
+  free(seen);
+
+  printf("test_parallel() passed!\n");
+}
 
-  // test general case
-  assert(replace_with_succ(na) != NULL);
-  assert(na->data == nd->data);
+static void test_multimap(void) {
+  printf("beginning test_multimap()\n");
+  rb_multimap *m = create_rb_multimap(&int_compare);
+  my_type key, **vals;
 
-  // test "minimum working case"
-  assert(replace_with_succ(nc) != NULL);
-  assert(nc->data == ne->data);
+  key.x = 5;
+  assert(equal_range(&key, m, &vals) == 0 && vals == NULL);
+  assert(remove_multi(&key, m) == NULL);
 
-  // clean up
-  free(a);
-  free(b);
-  free(c);
-  free(d);
-  free(e);
+  // a handful under one key: spills out of the inline slots
+  my_type *five[8];
+  for (int i = 0; i < 8; i++) {
+    five[i] = make_int(5);
+    assert(insert_multi(five[i], m));
+  }
+  assert(insert_multi(make_int(4), m) && insert_multi(make_int(6), m));
+  assert(m->tree->num_nodes == 3 && multi_size(m) == 10);
+  assert(equal_range(&key, m, &vals) == 8);
+  for (int i = 0; i < 8; i++)
+    assert(vals[i] == five[i]);
+  assert(is_valid_multimap(m));
+
+  // newest first, node goes with the last one
+  for (int i = 7; i >= 0; i--) {
+    assert(remove_multi(&key, m) == five[i]);
+    free(five[i]);
+  }
+  assert(equal_range(&key, m, &vals) == 0);
+  assert(m->tree->num_nodes == 2 && multi_size(m) == 2);
+  assert(is_valid_multimap(m));
+  free_rb_multimap(m);
+
+  // churn against a stack per key; removes move keys between nodes,
+  // so the values have to follow
+  enum { KEYS = 300, MAX_PER = 40 };
+  static my_type *ref[KEYS][MAX_PER];
+  static int num[KEYS];
+  m = create_rb_multimap(&int_compare);
+  srand(26);
+  for (int it = 0; it < 60000; it++) {
+    int k = rand() % KEYS;
+    key.x = k;
+    if (rand() % 2 == 0 && num[k] < MAX_PER) {
+      my_type *d = make_int(k);
+      assert(insert_multi(d, m));
+      ref[k][num[k]++] = d;
+    } else {
+      my_type *d = remove_multi(&key, m);
+      if (num[k] == 0) {
+        assert(d == NULL);
+      } else {
+        assert(d == ref[k][--num[k]]);
+        free(d);
+      }
+    }
 
-  free(na);
-  free(nb);
-  free(nc);
-  free(nd);
-  free(ne);
+    if (it % 6000 == 0) {
+      assert(is_valid_multimap(m));
+      int keys = 0;
+      for (int j = 0; j < KEYS; j++) {
+        key.x = j;
+        assert(equal_range(&key, m, &vals) == num[j]);
+        for (int i = 0; i < num[j]; i++)
+          assert(vals[i] == ref[j][i]);
+        keys += (num[j] > 0);
+      }
+      assert(m->tree->num_nodes == keys);
+    }
+  }
+  // everything left is freed with it
+  free_rb_multimap(m);
 
+  printf("test_multimap() passed!\n");
 }
 
-static void simple_replace_test(void) {
-  // initialize data for nodes
-  my_type *a = (my_type *) malloc(sizeof(my_type));
-  my_type *b = (my_type *) malloc(sizeof(my_type));
-  my_type *c = (my_type *) malloc(sizeof(my_type));
-  my_type *d = (my_type *) malloc(sizeof(my_type));
-  my_type *e = (my_type *) malloc(sizeof(my_type));
-
-  a->x = 1;
-  b->x = 2;
-  c->x = 3;
-  d->x = 4;
-  e->x = 5;
+static void test_frozen(void) {
+  printf("beginning test_frozen()\n");
+  my_type key;
+
+  sexy_rb_tree *c = create_rb_concurrent(&int_compare, 0, 1);
+  assert(rb_freeze(c) == NULL);
+  free_rb(c);
+
+  // every size up to a few full levels, so paths end every which way
+  for (int n = 0; n <= 70; n++) {
+    sexy_rb_tree *t = (n % 2) ? create_rb_arena(&int_compare, 16) : create_rb(&int_compare);
+    // ref[i] holds 2i; inserted shuffled
+    my_type *ref[70];
+    for (int i = 0; i < n; i++) {
+      int j = (i * 71) % n;
+      ref[j] = make_int(2 * j);
+      assert(insert_baby(ref[j], t));
+    }
 
-  // initialize nodes
-  rb_node *na = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *nb = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *nc = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *nd = (rb_node *) malloc(sizeof(rb_node));
-  rb_node *ne = (rb_node *) malloc(sizeof(rb_node));
+    rb_frozen *f = rb_freeze(t);
+    assert(f != NULL && frozen_size(f) == n);
+    assert((uintptr_t) f->keys % CACHE_LINE == 0);
 
-  na->data = a;
-  nb->data = b;
-  nc->data = c;
-  nd->data = d;
-  ne->data = e;
-  
-  // set up structure
-  na->left = nb;
-  na->right = nc;
-  na->parent = NULL;
-  
-  nb->left = nd;
-  nb->right = ne;
-  nb->parent = na;
+    // left subtree, node, right subtree is sorted order
+    for (int i = 1; i <= n; i++) {
+      if (2 * i <= n)
+        assert(f->keys[2 * i].x < f->keys[i].x);
+      if (2 * i + 1 <= n)
+        assert(f->keys[2 * i + 1].x > f->keys[i].x);
+    }
 
-  nc->left = NULL;
-  nc->right = NULL;
-  nc->parent = na;
+    // misses below, between and above everything too
+    for (int k = -1; k <= 2 * n; k++) {
+      key.x = k;
+      my_type *found = search_frozen(&key, f);
+      if (k < 0 || k % 2 == 1 || k == 2 * n)
+        assert(found == NULL);
+      else
+        assert(found == ref[k / 2]);
+    }
 
-  nd->left = NULL;
-  nd->right = NULL;
-  nd->parent = nb;
+    // same pointers come back out
+    t = rb_thaw(f);
+    assert(t != NULL && t->num_nodes == n && is_valid_rb_tree(t));
+    for (int i = 0; i < n; i++)
+      assert(search_baby(ref[i], t) == ref[i]);
+    assert(insert_baby(make_int(-5), t));
+    assert(is_valid_rb_tree(t));
+
+    // and free_frozen frees them
+    if (n % 3 == 0)
+      free_frozen(rb_freeze(t));
+    else
+      free_rb(t);
+  }
 
-  ne->left = NULL;
-  ne->right = NULL;
-  ne->parent = nb;
-  
-  // test "fails" when should
-  assert(simple_replace(nc, SUCC) == NULL);
-  assert(simple_replace(nc, PRED) == NULL);
+  // big enough that the prefetches run past the end of the array
+  sexy_rb_tree *t = create_rb(&int_compare);
+  int n = 100000;
+  for (int i = 0; i < n; i++)
+    assert(insert_baby(make_int((int) ((i * 7919LL) % n)), t));
+  rb_frozen *f = rb_freeze(t);
+  for (int i = 0; i < n; i++) {
+    key.x = i;
+    assert(search_frozen(&key, f)->x == i);
+  }
+  key.x = n;
+  assert(search_frozen(&key, f) == NULL);
+  free_frozen(f);
 
-  assert(simple_replace(nd, SUCC) == NULL);
-  assert(simple_replace(nd, PRED) == NULL);
+  printf("test_frozen() passed!\n");
+}
 
-  assert(simple_replace(ne, SUCC) == NULL);
-  assert(simple_replace(ne, PRED) == NULL);
+// cb for ordered_iterate: data has to come in increasing order;
+// stops once *arg more have gone by
+static int check_ordered(my_type *d, void *arg) {
+  int *state = (int *) arg;
+  assert(d->x > state[0]);
+  state[0] = d->x;
+  return --state[1] > 0;
+}
 
-  assert(nc->data == c);
-  assert(nd->data == d);
-  assert(ne->data == e);
+// the same script through any backend's table
+static void ordered_script(const ordered_ops *ops) {
+  ordered *o = ordered_create(ops, &int_compare);
+  assert(o != NULL && ordered_size(o) == 0);
+
+  // searches in between so rb_frozen keeps freezing and thawing
+  int n = 500;
+  my_type key;
+  for (int i = 0; i < n; i++) {
+    my_type *d = make_int((i * 7) % n);
+    assert(ordered_insert(o, d));
+    assert(ordered_search(o, d) == d);
+    key.x = d->x;
+    assert(!ordered_insert(o, &key));
+  }
+  assert(ordered_size(o) == n);
+
+  key.x = n;
+  assert(ordered_search(o, &key) == NULL && ordered_remove(o, &key) == NULL);
+
+  int state[2] = {-1, n + 1};
+  assert(ordered_iterate(o, &check_ordered, state) == n && state[0] == n - 1);
+  state[0] = -1;
+  state[1] = 10;
+  assert(ordered_iterate(o, &check_ordered, state) == 10 && state[0] == 9);
+
+  for (int i = 0; i < n; i += 2) {
+    key.x = i;
+    my_type *d = ordered_remove(o, &key);
+    assert(d != NULL && d->x == i);
+    free(d);
+    assert(ordered_search(o, &key) == NULL);
+  }
+  assert(ordered_size(o) == n / 2);
 
-  // test "minimal working case"
-  assert(simple_replace(nb, SUCC) == ne);
-  assert(nb->data == e);
+  // the rest go with it
+  ordered_destroy(o);
+}
 
-  assert(simple_replace(nb, PRED) == nd);
-  assert(nb->data == d);
+static void test_ordered(void) {
+  printf("beginning test_ordered()\n");
+  const ordered_ops *table[] = {&rb_ordered_ops, &rb_frozen_ordered_ops};
+  assert(ordered_lookup("rb_tree", table, 2) == &rb_ordered_ops);
+  assert(ordered_lookup("rb_frozen", table, 2) == &rb_frozen_ordered_ops);
+  assert(ordered_lookup("b_tree", table, 2) == NULL);
+
+  ordered_script(&rb_ordered_ops);
+  ordered_script(&rb_frozen_ordered_ops);
+
+  // knowing the backend gets the container back for direct calls
+  ordered *o = ordered_create(&rb_ordered_ops, &int_compare);
+  sexy_rb_tree *t = rb_of(o);
+  assert(t != NULL && rb_frozen_of(o) == NULL);
+  for (int i = 0; i < 100; i++)
+    assert(insert_baby(make_int(i), t));
+  assert(ordered_size(o) == 100 && is_valid_rb_tree(t));
+  ordered_destroy(o);
+
+  o = ordered_create(&rb_frozen_ordered_ops, &int_compare);
+  rb_freezer *z = rb_frozen_of(o);
+  assert(z != NULL && rb_of(o) == NULL);
+  assert(insert_freezer(make_int(1), z));
+  my_type key;
+  key.x = 1;
+  // only a long enough run of searches freezes it
+  for (int i = 1; i < FREEZE_MIN_READS; i++)
+    assert(search_freezer(&key, z)->x == 1 && z->tree != NULL);
+  assert(search_freezer(&key, z)->x == 1 && z->frozen != NULL && z->tree == NULL);
+  // writes that don't change anything leave it frozen
+  assert(!insert_freezer(&key, z) && z->frozen != NULL);
+  key.x = 5;
+  assert(remove_freezer(&key, z) == NULL && z->frozen != NULL);
+  assert(insert_freezer(make_int(2), z) && z->tree != NULL && z->frozen == NULL);
+  ordered_destroy(o);
+
+  // alternating writes and searches never get to freeze, so they cost
+  // what the plain tree does; at this size an O(n) flip per call would
+  // take minutes
+  o = ordered_create(&rb_frozen_ordered_ops, &int_compare);
+  z = rb_frozen_of(o);
+  int n = 200000;
+  for (int i = 0; i < n; i++) {
+    my_type *d = make_int((int) ((i * 7919LL) % n));
+    assert(ordered_insert(o, d));
+    assert(ordered_search(o, d) == d && z->frozen == NULL);
+  }
+  // and a read-only stretch afterwards does
+  for (int i = 0; i < n; i++) {
+    key.x = i;
+    assert(ordered_search(o, &key)->x == i);
+  }
+  assert(z->frozen != NULL && ordered_size(o) == n);
+  ordered_destroy(o);
 
-  // test general case
-  assert(simple_replace(na, PRED) == ne);
-  assert(na->data == e);
-  
-  assert(simple_replace(na, SUCC) == nc);
-  assert(na->data == c);
+  printf("test_ordered() passed!\n");
+}
 
-  // clean up
-  free(a);
-  free(b);
-  free(c);
-  free(d);
-  free(e);
+#if RB_STATS
+typedef struct stats_worker {
+  sexy_rb_tree *t;
+  int n;
+  rb_counters *slot;
+} stats_worker;
+
+static void *stats_searcher(void *arg) {
+  stats_worker *w = (stats_worker *) arg;
+  my_type key;
+  for (int i = 0; i < w->n; i++) {
+    key.x = i;
+    assert(search_baby(&key, w->t) != NULL);
+  }
+  w->slot = stats_of(w->t);
+  return NULL;
+}
 
-  free(na);
-  free(nb);
-  free(nc);
-  free(nd);
-  free(ne);
+static void test_stats(void) {
+  printf("beginning test_stats()\n");
+  sexy_rb_tree *t = create_rb(&int_compare);
+  assert(sizeof(rb_stats_slot) % CACHE_LINE == 0);
+  assert((uintptr_t) t->stats % CACHE_LINE == 0);
+
+  rb_counters c = rb_stats(t);
+  assert(c.searches == 0 && c.inserts == 0 && c.comparisons == 0 && c.max_depth == 0);
+
+  // ascending keys always land rightmost, so only ever lrot
+  int n = 1000;
+  for (int i = 0; i < n; i++)
+    assert(insert_baby(make_int(i), t));
+  my_type key;
+  key.x = 0;
+  assert(!insert_baby(&key, t));
+
+  c = rb_stats(t);
+  assert(c.inserts == n + 1 && c.node_allocs == n);
+  assert(c.lrots > 0 && c.rrots == 0);
+  assert(c.recolors > 0 && c.fixup_iterations >= c.recolors);
+  // red-black height bound: 2 * log2(n + 1) < 20
+  assert(c.max_depth > 0 && c.max_depth < 20);
+  assert(c.comparisons >= n && c.comparisons < (n + 1) * c.max_depth);
+
+  // one comparison per level, so a hit costs at most max_depth
+  rb_counters before = rb_stats(t);
+  for (int i = 0; i < n; i++) {
+    key.x = i;
+    assert(search_baby(&key, t) != NULL);
+  }
+  c = rb_stats(t);
+  assert(c.searches - before.searches == n);
+  assert(c.comparisons - before.comparisons <= n * c.max_depth);
+
+  my_type *keys[64], *out[64], k[64];
+  for (int i = 0; i < 64; i++) {
+    k[i].x = i * 3;
+    keys[i] = &k[i];
+  }
+  search_batch(t, keys, 64, out);
+  assert(rb_stats(t).searches == c.searches + 64);
+
+  // removing the evens puts remove_fixup to work
+  before = rb_stats(t);
+  for (int i = 0; i < n; i += 2) {
+    key.x = i;
+    free(remove_baby(&key, t));
+  }
+  c = rb_stats(t);
+  assert(c.removes - before.removes == n / 2);
+  assert(c.fixup_iterations > before.fixup_iterations);
+  assert(c.node_allocs == n);
+  assert(is_valid_rb_tree(t));
+  free_rb(t);
 
-}
+  // reading threads each count into a slot of their own
+  t = create_rb(&int_compare);
+  for (int i = 0; i < n; i++)
+    assert(insert_baby(make_int(i), t));
+  enum { WORKERS = 4 };
+  pthread_t tids[WORKERS];
+  stats_worker w[WORKERS];
+  before = rb_stats(t);
+  for (int i = 0; i < WORKERS; i++) {
+    w[i].t = t;
+    w[i].n = n;
+    assert(pthread_create(&tids[i], NULL, &stats_searcher, &w[i]) == 0);
+  }
+  for (int i = 0; i < WORKERS; i++)
+    assert(pthread_join(tids[i], NULL) == 0);
+
+  assert(rb_stats(t).searches - before.searches == WORKERS * n);
+  for (int i = 0; i < WORKERS; i++) {
+    assert(w[i].slot != stats_of(t) && w[i].slot->searches == n);
+    for (int j = 0; j < i; j++)
+      assert(w[i].slot != w[j].slot);
+  }
+  free_rb(t);
 
-static void replace_test(void) {
-  printf("testing basic data replacement\n");
-  replace_w_pred_test();
-  replace_w_succ_test();
-  simple_replace_test();
-  printf("replacement passed!\n");
+  printf("test_stats() passed!\n");
 }
+#endif
 
 static void test_all(void) {
   printf("\n");
@@ -1795,12 +6760,102 @@ static void test_all(void) {
   printf("\n");
   test_search();
   printf("\n");
+  test_search_batch();
+  printf("\n");
   replace_test();
   printf("\n");
+  test_validator();
+  printf("\n");
+  test_remove();
+  printf("\n");
+  test_arena();
+  printf("\n");
+  test_generic();
+  printf("\n");
+  test_bulk_load();
+  printf("\n");
+  test_iterators();
+  printf("\n");
+  test_concurrent();
+  printf("\n");
+  test_persistent();
+  printf("\n");
+  test_mmap();
+  printf("\n");
+  test_cache();
+  printf("\n");
+  test_parallel();
+  printf("\n");
+  test_multimap();
+  printf("\n");
+  test_frozen();
+  printf("\n");
+  test_ordered();
+  printf("\n");
+#if RB_STATS
+  test_stats();
+  printf("\n");
+#endif
+#if RB_ORDER_STATS
+  test_order_stats();
+  printf("\n");
+#endif
 }
 
+#ifndef RB_BENCH
 int main(void) {
   test_all();
 }
+#else
+
+/*************
+ * BENCHMARK *
+ *************/
+
+// `make bench`: plain and arena trees through ../bench/bench.h
+#include "../bench/bench.h"
+
+static void *bench_create_rb(void) {
+  return create_rb(&int_compare);
+}
+
+static void *bench_create_arena(void) {
+  return create_rb_arena(&int_compare, 0);
+}
+
+static int bench_insert(void *t, int key) {
+  my_type *d = make_int(key);
+  if (insert_baby(d, (sexy_rb_tree *) t))
+    return 1;
+  free(d);
+  return 0;
+}
+
+static int bench_search(void *t, int key) {
+  my_type k;
+  k.x = key;
+  return search_baby(&k, (sexy_rb_tree *) t) != NULL;
+}
+
+static int bench_remove(void *t, int key) {
+  my_type k;
+  k.x = key;
+  my_type *d = remove_baby(&k, (sexy_rb_tree *) t);
+  free(d);
+  return d != NULL;
+}
+
+static void bench_destroy(void *t) {
+  free_rb((sexy_rb_tree *) t);
+}
+
+int main(int argc, char **argv) {
+  bench_ops ops[] = {
+    {"rb_tree", &bench_create_rb, &bench_insert, &bench_search, &bench_remove, &bench_destroy},
+    {"rb_arena", &bench_create_arena, &bench_insert, &bench_search, &bench_remove, &bench_destroy},
+  };
+  return bench_main(argc, argv, ops, 2);
+}
+#endif
 
 // o hai
@@ -0,0 +1,341 @@
+/***************************************************
+ * Benchmark harness shared by every container     *
+ * include from a container's X_BENCH section and  *
+ * hand bench_main a table of bench_ops            *
+ ***************************************************/
+
+// every workload runs on keys 0 .. n - 1 for n = 1K, 10K, ... up to
+// BENCH_MAX_KEYS (or argv[1], up to 100M); each (container, n) pair
+// runs in its own forked child so peak RSS is just that run's
+// reports ns/op, p50/p99 latency of a sample of ops, last-level cache
+// misses per op (perf counters; "-" where the kernel won't give them
+// out) and peak RSS
+// build with -O2 -D_GNU_SOURCE -lm (the bench targets do)
+
+#ifndef _GNU_SOURCE
+#error "build benchmarks with -D_GNU_SOURCE (wait4, perf_event_open)"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define BENCH_PERF 1
+#else
+#define BENCH_PERF 0
+#endif
+
+#ifndef BENCH_MAX_KEYS
+#define BENCH_MAX_KEYS 1000000
+#endif
+#define BENCH_KEY_LIMIT 100000000
+
+// one op in this many gets timed on its own for the percentiles
+#define BENCH_SAMPLE_EVERY 16
+
+// zipf skew (YCSB's default)
+#define BENCH_ZIPF_THETA 0.99
+
+// share of mixed ops that are reads; the rest are a remove + insert
+#define BENCH_MIXED_READ_PERCENT 90
+
+/*************
+ * INTERFACE *
+ *************/
+
+// what a container has to give the harness; keys are ints, it's up to
+// the adapter to turn them into my_types
+typedef struct bench_ops {
+  const char *name;
+  void *(*create)(void);
+  // 1 if added, 0 if it was already there
+  int (*insert)(void *, int key);
+  // 1 if found
+  int (*search)(void *, int key);
+  // 1 if it was there (and is gone now)
+  int (*remove)(void *, int key);
+  void (*destroy)(void *);
+} bench_ops;
+
+// runs every ops[i] at every size; argv[1] (if there) is the biggest size
+// returns 0 if every run finished and added up, 1 otherwise
+static int bench_main(int argc, char **argv, bench_ops *ops, int num_ops);
+
+/***********************************
+ * helper functions: DO NOT EXPOSE *
+ ***********************************/
+
+static uint64_t bench_rng = 0x9e3779b97f4a7c15ull;
+
+// xorshift64*; plenty for picking keys
+static uint64_t bench_rand(void) {
+  bench_rng ^= bench_rng >> 12;
+  bench_rng ^= bench_rng << 25;
+  bench_rng ^= bench_rng >> 27;
+  return bench_rng * 2685821657736338717ull;
+}
+
+static long long bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// what a bench_now pair costs, taken off every timed op
+static long long bench_timer_cost;
+
+static void bench_calibrate(void) {
+  long long best = -1;
+  for (int i = 0; i < 1000; i++) {
+    long long a = bench_now();
+    long long b = bench_now();
+    if (best < 0 || b - a < best)
+      best = b - a;
+  }
+  bench_timer_cost = best;
+}
+
+static void bench_shuffle(int *a, int n) {
+  for (int i = n - 1; i > 0; i--) {
+    int j = (int) (bench_rand() % (uint64_t) (i + 1));
+    int tmp = a[i];
+    a[i] = a[j];
+    a[j] = tmp;
+  }
+}
+
+// fills out with n zipf-distributed keys from 0 .. range - 1; ranks are
+// hashed to keys so the hot ones aren't all next to each other
+static void bench_zipf(int *out, int n, int range) {
+  double zetan = 0, zeta2 = 1 + pow(0.5, BENCH_ZIPF_THETA);
+  for (int i = 1; i <= range; i++)
+    zetan += 1 / pow(i, BENCH_ZIPF_THETA);
+
+  double alpha = 1 / (1 - BENCH_ZIPF_THETA);
+  double eta = (1 - pow(2.0 / range, 1 - BENCH_ZIPF_THETA)) / (1 - zeta2 / zetan);
+
+  for (int i = 0; i < n; i++) {
+    double u = (bench_rand() >> 11) * (1.0 / 9007199254740992.0);
+    double uz = u * zetan;
+    uint64_t rank;
+    if (uz < 1)
+      rank = 0;
+    else if (uz < zeta2)
+      rank = 1;
+    else
+      rank = (uint64_t) (range * pow(eta * u - eta + 1, alpha));
+    if (rank >= (uint64_t) range)
+      rank = range - 1;
+
+    // fnv-1a over the rank's bytes
+    uint64_t h = 14695981039346656037ull;
+    for (int b = 0; b < 8; b++) {
+      h ^= (rank >> (8 * b)) & 0xff;
+      h *= 1099511628211ull;
+    }
+    out[i] = (int) (h % (uint64_t) range);
+  }
+}
+
+#if BENCH_PERF
+static int bench_perf_fd = -1;
+
+static void bench_perf_open(void) {
+  struct perf_event_attr pe;
+  memset(&pe, 0, sizeof(pe));
+  pe.type = PERF_TYPE_HARDWARE;
+  pe.size = sizeof(pe);
+  pe.config = PERF_COUNT_HW_CACHE_MISSES;
+  pe.disabled = 1;
+  pe.exclude_kernel = 1;
+  pe.exclude_hv = 1;
+  bench_perf_fd = (int) syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+}
+
+static void bench_perf_start(void) {
+  if (bench_perf_fd >= 0) {
+    ioctl(bench_perf_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(bench_perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+// -1 if there's no counter
+static long long bench_perf_stop(void) {
+  long long count;
+  if (bench_perf_fd < 0)
+    return -1;
+  ioctl(bench_perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+  if (read(bench_perf_fd, &count, sizeof(count)) != sizeof(count))
+    return -1;
+  return count;
+}
+#else
+static void bench_perf_open(void) {}
+static void bench_perf_start(void) {}
+static long long bench_perf_stop(void) { return -1; }
+#endif
+
+static int bench_cmp_ll(const void *a, const void *b) {
+  long long x = *(const long long *) a, y = *(const long long *) b;
+  return (x > y) - (x < y);
+}
+
+// op kinds for bench_pass
+#define BENCH_INSERT 0
+#define BENCH_SEARCH 1
+#define BENCH_MIXED 2
+
+// one timed pass of n ops over keys[]; prints a result line
+// returns how many ops "hit" (added / found / read-hit) as a sanity check
+static long bench_pass(bench_ops *ops, void *c, const char *workload, int kind,
+                       int *keys, int n, int *extra, long long *lat) {
+  int samples = 0;
+  long hits = 0;
+
+  bench_perf_start();
+  long long start = bench_now();
+  for (int i = 0; i < n; i++) {
+    int timed = (i % BENCH_SAMPLE_EVERY == 0);
+    long long t0 = timed ? bench_now() : 0;
+
+    if (kind == BENCH_INSERT) {
+      hits += ops->insert(c, keys[i]);
+    } else if (kind == BENCH_SEARCH) {
+      hits += ops->search(c, keys[i]);
+    } else if ((int) (extra[i] % 100) < BENCH_MIXED_READ_PERCENT) {
+      hits += ops->search(c, keys[i]);
+    } else {
+      // update: take a key out and put it straight back
+      if (ops->remove(c, keys[i]))
+        hits += ops->insert(c, keys[i]);
+    }
+
+    if (timed) {
+      long long d = bench_now() - t0 - bench_timer_cost;
+      lat[samples++] = (d < 0) ? 0 : d;
+    }
+  }
+  long long total = bench_now() - start - samples * bench_timer_cost;
+  long long misses = bench_perf_stop();
+
+  qsort(lat, samples, sizeof(long long), &bench_cmp_ll);
+  char miss_str[32];
+  if (misses < 0)
+    snprintf(miss_str, sizeof(miss_str), "-");
+  else
+    snprintf(miss_str, sizeof(miss_str), "%.2f", (double) misses / n);
+
+  printf("%-12s %-12s %10d %9.1f %8lld %8lld %10s\n", ops->name, workload, n,
+         (double) total / n, lat[samples / 2], lat[samples * 99 / 100], miss_str);
+  fflush(stdout);
+  return hits;
+}
+
+// every workload on one container at one size; exits non-zero if an
+// adapter gave back something that doesn't add up
+static void bench_one(bench_ops *ops, int n) {
+  int *perm = malloc(n * sizeof(int));
+  int *keys = malloc(n * sizeof(int));
+  int *mix = malloc(n * sizeof(int));
+  long long *lat = malloc((n / BENCH_SAMPLE_EVERY + 1) * sizeof(long long));
+  if (perm == NULL || keys == NULL || mix == NULL || lat == NULL) {
+    printf("%-12s out of memory at %d keys\n", ops->name, n);
+    exit(1);
+  }
+
+  for (int i = 0; i < n; i++)
+    perm[i] = i;
+
+  // sequential inserts into one container...
+  void *c = ops->create();
+  if (bench_pass(ops, c, "seq-insert", BENCH_INSERT, perm, n, NULL, lat) != n)
+    exit(2);
+  ops->destroy(c);
+
+  // ...random ones into another, which the rest run on
+  bench_shuffle(perm, n);
+  c = ops->create();
+  if (bench_pass(ops, c, "rand-insert", BENCH_INSERT, perm, n, NULL, lat) != n)
+    exit(2);
+
+  for (int i = 0; i < n; i++)
+    keys[i] = (int) (bench_rand() % (uint64_t) n);
+  if (bench_pass(ops, c, "rand-search", BENCH_SEARCH, keys, n, NULL, lat) != n)
+    exit(2);
+
+  bench_zipf(keys, n, n);
+  if (bench_pass(ops, c, "zipf-search", BENCH_SEARCH, keys, n, NULL, lat) != n)
+    exit(2);
+
+  // mixed reuses the zipf keys, so the hot keys take the writes too
+  for (int i = 0; i < n; i++)
+    mix[i] = (int) (bench_rand() % 100);
+  if (bench_pass(ops, c, "zipf-mixed", BENCH_MIXED, keys, n, mix, lat) != n)
+    exit(2);
+
+  ops->destroy(c);
+  free(perm);
+  free(keys);
+  free(mix);
+  free(lat);
+}
+
+/******************
+ * IMPLEMENTATION *
+ ******************/
+
+static int bench_main(int argc, char **argv, bench_ops *ops, int num_ops) {
+  long max = BENCH_MAX_KEYS;
+  if (argc > 1)
+    max = atol(argv[1]);
+  if (max < 1000 || max > BENCH_KEY_LIMIT) {
+    fprintf(stderr, "sizes go from 1000 to %d keys\n", BENCH_KEY_LIMIT);
+    return 1;
+  }
+
+  bench_calibrate();
+  printf("ns/op and latencies in ns (timer cost of %lld ns taken off), "
+         "misses are LLC misses/op\n", bench_timer_cost);
+  printf("%-12s %-12s %10s %9s %8s %8s %10s\n", "container", "workload", "keys",
+         "ns/op", "p50", "p99", "misses/op");
+
+  int failed = 0;
+  for (int i = 0; i < num_ops; i++) {
+    for (long n = 1000; n <= max; n *= 10) {
+      fflush(stdout);
+      pid_t pid = fork();
+      if (pid == 0) {
+        bench_rng ^= (uint64_t) n * 0x632be59bd9b4e019ull;
+        bench_perf_open();
+        bench_one(&ops[i], (int) n);
+        exit(0);
+      }
+
+      int status;
+      struct rusage ru;
+      if (pid < 0 || wait4(pid, &status, 0, &ru) < 0) {
+        perror("fork");
+        return 1;
+      }
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("%-12s FAILED at %ld keys\n", ops[i].name, n);
+        failed = 1;
+        continue;
+      }
+      printf("%-12s %-12s %10ld peak RSS %.1f MB\n", ops[i].name, "(all)", n,
+             ru.ru_maxrss / 1024.0);
+    }
+  }
+
+  return failed;
+}
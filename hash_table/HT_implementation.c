@@ -0,0 +1,626 @@
+/***************************************************
+ * Implementation of an open-addressing hash table *
+ * linear probing with Robin Hood displacement;    *
+ * growing is done a few slots at a time on every  *
+ * write so no one insert pays for a full rehash   *
+ * same my_type conventions as the other           *
+ * containers: the table owns what goes in         *
+ ***************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+
+// same values as the RB tree so comparators work in both
+#define LESS 61
+#define EQUAL 121
+#define GREATER 124
+
+// smallest table (has to be a power of 2)
+#define HT_MIN_CAPACITY 16
+
+// grow once more than HT_MAX_LOAD_NUM / HT_MAX_LOAD_DEN of the slots
+// are taken; Robin Hood keeps probes short even this full
+#define HT_MAX_LOAD_NUM 7
+#define HT_MAX_LOAD_DEN 8
+
+// old-table slots moved over per insert/remove while growing; anything
+// >= 2 finishes before the new table can fill up
+#define HT_MIGRATE_STEP 16
+
+/****************
+ * USER-DEFINED *
+ ****************/
+
+// struct to be put in the table
+typedef struct my_type {
+  int x;
+} my_type;
+
+// comparison function over my_types; only EQUAL matters here, but
+// it's the same function the trees take
+// returns LESS iff "a < b", EQUAL iff "a == b", GREATER iff "a > b"
+int int_compare(my_type *a, my_type *b) {
+  if (a->x < b->x)
+    return LESS;
+  else if (a->x > b->x)
+    return GREATER;
+  else
+    return EQUAL;
+}
+
+// hash over my_types; EQUAL my_types have to hash the same
+// the table uses the low bits, so mix them well (this is murmur3's
+// finalizer)
+uint32_t int_hash(my_type *a) {
+  uint32_t h = (uint32_t) a->x;
+
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+
+  return h;
+}
+
+/*************
+ * INTERFACE *
+ *************/
+
+// 16 bytes, so four to a cache line and a probe walks straight down them
+typedef struct ht_entry {
+  // NULL means the slot's empty
+  my_type *data;
+
+  // kept so probes only call comp on a real match and growing
+  // doesn't have to call the hash function again
+  uint32_t hash;
+
+  // how far the entry is from the slot it hashes to
+  uint32_t dist;
+} ht_entry;
+
+typedef struct ht_table {
+  ht_entry *slots;
+
+  // always a power of 2
+  size_t capacity;
+  size_t count;
+} ht_table;
+
+typedef struct sexy_hash_table {
+  // where inserts go
+  ht_table cur;
+
+  // table being grown out of (capacity 0 if not growing); everything
+  // in old is below migrate_pos or still in old
+  ht_table old;
+  size_t migrate_pos;
+
+  uint32_t (*hash)(my_type *);
+
+  // returns LESS iff "a < b", EQUAL iff "a == b", GREATER iff "a > b"
+  int (*comp)(my_type *, my_type *);
+} sexy_hash_table;
+
+// usual "create, insert, remove, search, and free" functions
+// NULL if out of memory
+// insert_ht returns 1 on success, 0 if something EQUAL is already in
+// the table (table is left alone) or if out of memory
+// remove_ht hands the data back (NULL if it isn't there)
+sexy_hash_table *create_ht(uint32_t (*)(my_type *), int (*)(my_type *, my_type *));
+int insert_ht(my_type *, sexy_hash_table *);
+my_type *remove_ht(my_type *, sexy_hash_table *);
+my_type *search_ht(my_type *, sexy_hash_table *);
+void free_ht(sexy_hash_table *);
+size_t ht_size(sexy_hash_table *);
+
+// checks every entry's dist and hash, the Robin Hood ordering, that
+// nothing's in both tables and that the counts add up
+int is_valid_ht(sexy_hash_table *);
+
+// helper functions: DO NOT EXPOSE
+
+// 0 if out of memory
+static int table_init(ht_table *, size_t capacity);
+
+// slot holding something EQUAL to elem (with hash h), -1 if none
+static long table_find(ht_table *, my_type *elem, uint32_t h,
+                       int (*comp)(my_type *, my_type *));
+
+// search_ht once elem's hash h is already worked out
+static my_type *find_hashed(sexy_hash_table *, my_type *elem, uint32_t h);
+
+// puts data in without looking for duplicates; table can't be full
+static void table_put(ht_table *, my_type *data, uint32_t h);
+
+// empties slot i, pulling the rest of its run back one slot
+static void table_delete(ht_table *, size_t i);
+
+// moves up to HT_MIGRATE_STEP old slots into cur; frees old when done
+static void migrate_some(sexy_hash_table *);
+
+// makes room for one more; 0 if cur is full and can't grow
+static int make_room(sexy_hash_table *);
+
+/******************
+ * IMPLEMENTATION *
+ ******************/
+
+static int table_init(ht_table *t, size_t capacity) {
+  t->slots = (ht_entry *) calloc(capacity, sizeof(ht_entry));
+  if (t->slots == NULL)
+    return 0;
+
+  t->capacity = capacity;
+  t->count = 0;
+  return 1;
+}
+
+sexy_hash_table *create_ht(uint32_t (*hash)(my_type *), int (*comp)(my_type *, my_type *)) {
+  sexy_hash_table *ret = (sexy_hash_table *) malloc(sizeof(sexy_hash_table));
+  if (ret == NULL)
+    return NULL;
+
+  if (!table_init(&ret->cur, HT_MIN_CAPACITY)) {
+    free(ret);
+    return NULL;
+  }
+
+  ret->old.slots = NULL;
+  ret->old.capacity = 0;
+  ret->old.count = 0;
+  ret->migrate_pos = 0;
+  ret->hash = hash;
+  ret->comp = comp;
+
+  return ret;
+}
+
+static void free_table(ht_table *t) {
+  for (size_t i = 0; i < t->capacity; i++)
+    free(t->slots[i].data);
+  free(t->slots);
+}
+
+void free_ht(sexy_hash_table *h) {
+  free_table(&h->cur);
+  free_table(&h->old);
+  free(h);
+}
+
+size_t ht_size(sexy_hash_table *h) {
+  return h->cur.count + h->old.count;
+}
+
+static long table_find(ht_table *t, my_type *elem, uint32_t h,
+                       int (*comp)(my_type *, my_type *)) {
+  if (t->count == 0)
+    return -1;
+
+  size_t mask = t->capacity - 1;
+  size_t i = h & mask;
+
+  for (uint32_t dist = 0; ; dist++, i = (i + 1) & mask) {
+    ht_entry *e = &t->slots[i];
+
+    // Robin Hood: if elem were here, it'd have pushed past this one
+    if (e->data == NULL || e->dist < dist)
+      return -1;
+
+    if (e->hash == h && comp(elem, e->data) == EQUAL)
+      return (long) i;
+  }
+}
+
+static void table_put(ht_table *t, my_type *data, uint32_t h) {
+  size_t mask = t->capacity - 1;
+  size_t i = h & mask;
+  ht_entry cur;
+
+  assert(t->count < t->capacity);
+
+  cur.data = data;
+  cur.hash = h;
+  cur.dist = 0;
+
+  for (;; i = (i + 1) & mask, cur.dist++) {
+    ht_entry *e = &t->slots[i];
+
+    if (e->data == NULL) {
+      *e = cur;
+      t->count++;
+      return;
+    }
+
+    // take from the rich: whoever's closer to home keeps probing
+    if (e->dist < cur.dist) {
+      ht_entry tmp = *e;
+      *e = cur;
+      cur = tmp;
+    }
+  }
+}
+
+static void table_delete(ht_table *t, size_t i) {
+  size_t mask = t->capacity - 1;
+
+  // backward shift instead of tombstones, so probes stay short
+  for (;;) {
+    size_t next = (i + 1) & mask;
+    ht_entry *e = &t->slots[next];
+
+    if (e->data == NULL || e->dist == 0)
+      break;
+
+    t->slots[i] = *e;
+    t->slots[i].dist--;
+    i = next;
+  }
+
+  t->slots[i].data = NULL;
+  t->slots[i].dist = 0;
+  t->count--;
+}
+
+static void migrate_some(sexy_hash_table *h) {
+  ht_table *old = &h->old;
+  if (old->capacity == 0)
+    return;
+
+  for (int step = 0; step < HT_MIGRATE_STEP && h->migrate_pos < old->capacity; step++) {
+    size_t i = h->migrate_pos;
+
+    // deleting pulls the rest of the run into i; keep going until
+    // it's empty so everything below migrate_pos is
+    while (old->slots[i].data != NULL) {
+      ht_entry e = old->slots[i];
+      table_delete(old, i);
+      table_put(&h->cur, e.data, e.hash);
+    }
+
+    h->migrate_pos++;
+  }
+
+  if (h->migrate_pos == old->capacity) {
+    assert(old->count == 0);
+    free(old->slots);
+    old->slots = NULL;
+    old->capacity = 0;
+    h->migrate_pos = 0;
+  }
+}
+
+static int make_room(sexy_hash_table *h) {
+  migrate_some(h);
+
+  ht_table *cur = &h->cur;
+  if ((cur->count + 1) * HT_MAX_LOAD_DEN <= cur->capacity * HT_MAX_LOAD_NUM)
+    return 1;
+
+  // still growing from last time; shouldn't happen with
+  // HT_MIGRATE_STEP >= 2 but finish it off if it does
+  while (h->old.capacity != 0)
+    migrate_some(h);
+
+  ht_table bigger;
+  if (!table_init(&bigger, cur->capacity * 2))
+    // can keep going past the load limit, just not past full
+    return cur->count < cur->capacity;
+
+  // old starts out as everything; migrate_some moves it over bit by bit
+  h->old = *cur;
+  h->migrate_pos = 0;
+  *cur = bigger;
+
+  return 1;
+}
+
+static my_type *find_hashed(sexy_hash_table *h, my_type *elem, uint32_t hv) {
+  long i = table_find(&h->cur, elem, hv, h->comp);
+  if (i >= 0)
+    return h->cur.slots[i].data;
+
+  i = table_find(&h->old, elem, hv, h->comp);
+  if (i >= 0)
+    return h->old.slots[i].data;
+
+  return NULL;
+}
+
+my_type *search_ht(my_type *elem, sexy_hash_table *h) {
+  assert(elem != NULL);
+
+  return find_hashed(h, elem, h->hash(elem));
+}
+
+int insert_ht(my_type *data, sexy_hash_table *h) {
+  assert(data != NULL);
+
+  // one hash for both the duplicate check and the put
+  uint32_t hv = h->hash(data);
+
+  // DON'T ALLOW DUPLICATES
+  if (find_hashed(h, data, hv) != NULL)
+    return 0;
+
+  if (!make_room(h))
+    return 0;
+
+  table_put(&h->cur, data, hv);
+  return 1;
+}
+
+my_type *remove_ht(my_type *elem, sexy_hash_table *h) {
+  assert(elem != NULL);
+
+  uint32_t hv = h->hash(elem);
+  ht_table *t = &h->cur;
+  long i = table_find(t, elem, hv, h->comp);
+
+  if (i < 0) {
+    t = &h->old;
+    i = table_find(t, elem, hv, h->comp);
+    if (i < 0)
+      return NULL;
+  }
+
+  my_type *ret = t->slots[i].data;
+  table_delete(t, (size_t) i);
+
+  // removes help finish a resize too
+  migrate_some(h);
+
+  return ret;
+}
+
+static int table_valid(ht_table *t, uint32_t (*hash)(my_type *)) {
+  size_t mask = t->capacity - 1;
+  size_t count = 0;
+
+  for (size_t i = 0; i < t->capacity; i++) {
+    ht_entry *e = &t->slots[i];
+    if (e->data == NULL)
+      continue;
+
+    count++;
+    if (e->hash != hash(e->data) || ((e->hash + e->dist) & mask) != i)
+      return 0;
+
+    // a run never jumps by more than one: the entry before has to be
+    // at most one closer to home (or this one is home)
+    ht_entry *prev = &t->slots[(i - 1) & mask];
+    if (e->dist > 0 && (prev->data == NULL || prev->dist + 1 < e->dist))
+      return 0;
+  }
+
+  return count == t->count;
+}
+
+int is_valid_ht(sexy_hash_table *h) {
+  if ((h->cur.capacity & (h->cur.capacity - 1)) != 0)
+    return 0;
+  if (!table_valid(&h->cur, h->hash) || !table_valid(&h->old, h->hash))
+    return 0;
+
+  // everything below migrate_pos has moved already
+  for (size_t i = 0; i < h->old.capacity; i++) {
+    my_type *d = h->old.slots[i].data;
+    if (d == NULL)
+      continue;
+    if (i < h->migrate_pos)
+      return 0;
+    if (table_find(&h->cur, d, h->old.slots[i].hash, h->comp) >= 0)
+      return 0;
+  }
+
+  return 1;
+}
+
+/***************
+ * TEST SCRIPT *
+ ***************/
+
+static my_type *make_int(int x) {
+  my_type *ret = (my_type *) malloc(sizeof(my_type));
+  ret->x = x;
+  return ret;
+}
+
+static void test_basic(void) {
+  printf("beginning test_basic()\n");
+
+  sexy_hash_table *h = create_ht(&int_hash, &int_compare);
+  my_type key;
+
+  key.x = 3;
+  assert(search_ht(&key, h) == NULL);
+  assert(remove_ht(&key, h) == NULL);
+
+  my_type *a = make_int(3);
+  assert(insert_ht(a, h));
+  assert(search_ht(&key, h) == a);
+
+  // duplicates are turned away
+  assert(!insert_ht(&key, h));
+  assert(ht_size(h) == 1);
+
+  assert(remove_ht(&key, h) == a);
+  assert(search_ht(&key, h) == NULL);
+  assert(ht_size(h) == 0);
+  assert(is_valid_ht(h));
+  free(a);
+
+  free_ht(h);
+  printf("test_basic() passed!\n");
+}
+
+static void test_grow(void) {
+  printf("beginning test_grow()\n");
+
+  int n = 100000;
+  sexy_hash_table *h = create_ht(&int_hash, &int_compare);
+  size_t max_moved = 0;
+  int saw_growing = 0;
+
+  for (int i = 0; i < n; i++) {
+    size_t before = h->cur.count;
+    size_t cap = h->cur.capacity;
+
+    assert(insert_ht(make_int(i), h));
+
+    // no insert does more than HT_MIGRATE_STEP slots worth of moving
+    // (except the first into a brand new table, which moves nothing)
+    if (h->cur.capacity == cap) {
+      size_t moved = h->cur.count - before - 1;
+      if (moved > max_moved)
+        max_moved = moved;
+    }
+
+    if (h->old.capacity != 0) {
+      saw_growing = 1;
+
+      // everything's findable mid-grow
+      if (i % 997 == 0) {
+        assert(is_valid_ht(h));
+        my_type key;
+        for (int j = 0; j <= i; j += 101) {
+          key.x = j;
+          assert(search_ht(&key, h)->x == j);
+        }
+      }
+    }
+  }
+
+  assert(saw_growing);
+  assert(ht_size(h) == (size_t) n);
+  assert(is_valid_ht(h));
+
+  // a slot can hold a run that all has to move, so allow for that
+  assert(max_moved <= HT_MIGRATE_STEP * 8);
+
+  my_type key;
+  for (int i = -10; i < n + 10; i++) {
+    key.x = i;
+    my_type *got = search_ht(&key, h);
+    assert((got != NULL) == (i >= 0 && i < n));
+  }
+
+  free_ht(h);
+  printf("test_grow() passed!\n");
+}
+
+static void test_churn(void) {
+  printf("beginning test_churn()\n");
+
+  // random inserts and removes, checked against a plain array
+  int n = 5000;
+  sexy_hash_table *h = create_ht(&int_hash, &int_compare);
+  int *in = (int *) calloc(n, sizeof(int));
+  size_t count = 0;
+
+  srand(18);
+  for (int it = 0; it < 300000; it++) {
+    my_type key;
+    key.x = rand() % n;
+
+    if (rand() % 2) {
+      my_type *d = make_int(key.x);
+      int ok = insert_ht(d, h);
+      assert(ok == !in[key.x]);
+      if (!ok)
+        free(d);
+      count += ok;
+      in[key.x] = 1;
+    } else {
+      my_type *got = remove_ht(&key, h);
+      assert((got != NULL) == in[key.x]);
+      if (got != NULL) {
+        free(got);
+        count--;
+      }
+      in[key.x] = 0;
+    }
+
+    if (it % 30000 == 0)
+      assert(is_valid_ht(h));
+  }
+
+  assert(ht_size(h) == count);
+  assert(is_valid_ht(h));
+
+  // clustered keys hash apart too
+  for (int i = 0; i < n; i++) {
+    my_type key;
+    key.x = i;
+    assert((search_ht(&key, h) != NULL) == in[i]);
+  }
+
+  free(in);
+  free_ht(h);
+  printf("test_churn() passed!\n");
+}
+
+static void test_all(void) {
+  test_basic();
+  printf("\n");
+  test_grow();
+  printf("\n");
+  test_churn();
+  printf("\n");
+}
+
+#ifndef HT_BENCH
+int main(void) {
+  test_all();
+}
+#else
+
+/*************
+ * BENCHMARK *
+ *************/
+
+// `make bench`: the ../bench/bench.h workloads; sequential and
+// zipf keys go through int_hash, so they look like any other keys
+#include "../bench/bench.h"
+
+static void *bench_create(void) {
+  return create_ht(&int_hash, &int_compare);
+}
+
+static int bench_insert(void *c, int key) {
+  my_type *d = (my_type *) malloc(sizeof(my_type));
+  d->x = key;
+  if (insert_ht(d, (sexy_hash_table *) c))
+    return 1;
+  free(d);
+  return 0;
+}
+
+static int bench_search(void *c, int key) {
+  my_type k;
+  k.x = key;
+  return search_ht(&k, (sexy_hash_table *) c) != NULL;
+}
+
+static int bench_remove(void *c, int key) {
+  my_type k;
+  k.x = key;
+  my_type *d = remove_ht(&k, (sexy_hash_table *) c);
+  free(d);
+  return d != NULL;
+}
+
+static void bench_destroy(void *c) {
+  free_ht((sexy_hash_table *) c);
+}
+
+int main(int argc, char **argv) {
+  bench_ops ops[] = {
+    {"hash_table", &bench_create, &bench_insert, &bench_search, &bench_remove, &bench_destroy},
+  };
+  return bench_main(argc, argv, ops, 1);
+}
+#endif
@@ -0,0 +1,186 @@
+/***************************************************
+ * Every ordered container behind ordered.h,       *
+ * linked into one program                         *
+ *                                                 *
+ * `./a.out` runs the same checks through every    *
+ * backend; `./a.out <name>` (or ORDERED_BACKEND   *
+ * in the environment) runs them through just the  *
+ * one called that, the way a service would pick   *
+ * its backend from a config                       *
+ *                                                 *
+ * the backends are the containers' own files with *
+ * their main and int_compare renamed; see the     *
+ * GNUmakefile                                     *
+ ***************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// same values as the containers so comparators work in all of them
+#define LESS 61
+#define EQUAL 121
+#define GREATER 124
+
+/****************
+ * USER-DEFINED *
+ ****************/
+
+// has to be the same struct the backends were built with
+typedef struct my_type {
+  int x;
+} my_type;
+
+int int_compare(my_type *a, my_type *b) {
+  if (a->x < b->x)
+    return LESS;
+  else if (a->x > b->x)
+    return GREATER;
+  else
+    return EQUAL;
+}
+
+/*************
+ * INTERFACE *
+ *************/
+
+#include "ordered.h"
+
+// every backend that's linked in, by ordered_ops name
+static const ordered_ops *const backends[] = {
+  &rb_ordered_ops, &rb_frozen_ordered_ops, &bt_ordered_ops, &sl_ordered_ops,
+};
+#define NUM_BACKENDS ((int) (sizeof(backends) / sizeof(backends[0])))
+
+// the backend named by name, or by ORDERED_BACKEND if name is NULL;
+// "rb_tree" if neither says; NULL if the name isn't one of backends
+static const ordered_ops *pick_backend(const char *name);
+
+// the containers' own types stay opaque here; these are the bits of
+// their interfaces the direct path below uses
+typedef struct sexy_rb_tree sexy_rb_tree;
+typedef struct sexy_b_tree sexy_b_tree;
+typedef struct sexy_skip_list sexy_skip_list;
+my_type *search_baby(my_type *, sexy_rb_tree *);
+my_type *search_bt(my_type *, sexy_b_tree *);
+my_type *search_sl(my_type *, sexy_skip_list *);
+
+ORDERED_OF(rb, sexy_rb_tree)
+ORDERED_OF(bt, sexy_b_tree)
+ORDERED_OF(sl, sexy_skip_list)
+
+/******************
+ * IMPLEMENTATION *
+ ******************/
+
+static const ordered_ops *pick_backend(const char *name) {
+  if (name == NULL)
+    name = getenv("ORDERED_BACKEND");
+  if (name == NULL)
+    name = "rb_tree";
+  return ordered_lookup(name, backends, NUM_BACKENDS);
+}
+
+/***************
+ * TEST SCRIPT *
+ ***************/
+
+static my_type *make_int(int x) {
+  my_type *ret = (my_type *) malloc(sizeof(my_type));
+  ret->x = x;
+  return ret;
+}
+
+// cb for ordered_iterate: data has to come in increasing order; adds
+// it all up in *arg
+static int sum_ordered(my_type *d, void *arg) {
+  long *state = (long *) arg;
+  assert(d->x > state[0]);
+  state[0] = d->x;
+  state[1] += d->x;
+  return 1;
+}
+
+// search through the backend's own function if we know it, through
+// the table if not; either way has to find the same thing
+static my_type *search_direct(ordered *o, my_type *key) {
+  if (rb_of(o) != NULL)
+    return search_baby(key, rb_of(o));
+  if (bt_of(o) != NULL)
+    return search_bt(key, bt_of(o));
+  if (sl_of(o) != NULL)
+    return search_sl(key, sl_of(o));
+  return ordered_search(o, key);
+}
+
+// inserts, lookups, removes and an in-order walk; returns the sum the
+// walk saw so backends can be checked against each other
+static long test_backend(const ordered_ops *ops) {
+  printf("beginning test_backend(%s)\n", ops->name);
+  ordered *o = ordered_create(ops, &int_compare);
+  assert(o != NULL);
+
+  int n = 10000;
+  my_type key;
+  for (int i = 0; i < n; i++)
+    assert(ordered_insert(o, make_int((int) ((i * 7919LL) % n))));
+  key.x = 5;
+  assert(!ordered_insert(o, &key));
+  assert(ordered_size(o) == n);
+
+  for (int i = -1; i <= n; i++) {
+    key.x = i;
+    my_type *got = ordered_search(o, &key);
+    assert((i >= 0 && i < n) ? (got != NULL && got->x == i) : (got == NULL));
+    assert(search_direct(o, &key) == got);
+  }
+
+  for (int i = 0; i < n; i += 3) {
+    key.x = i;
+    my_type *d = ordered_remove(o, &key);
+    assert(d != NULL && d->x == i);
+    free(d);
+  }
+
+  long state[2] = {-1, 0};
+  int left = n - (n + 2) / 3;
+  assert(ordered_size(o) == left);
+  assert(ordered_iterate(o, &sum_ordered, state) == left);
+
+  ordered_destroy(o);
+  printf("test_backend(%s) passed!\n", ops->name);
+  return state[1];
+}
+
+static void test_all(void) {
+  assert(pick_backend("b_tree") == &bt_ordered_ops);
+  assert(pick_backend("nope") == NULL);
+
+  long sum = -1;
+  for (int i = 0; i < NUM_BACKENDS; i++) {
+    long s = test_backend(backends[i]);
+    assert(sum < 0 || s == sum);
+    sum = s;
+    printf("\n");
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 && getenv("ORDERED_BACKEND") == NULL) {
+    test_all();
+    return 0;
+  }
+
+  const ordered_ops *ops = pick_backend(argc > 1 ? argv[1] : NULL);
+  if (ops == NULL) {
+    fprintf(stderr, "no such backend; pick one of:");
+    for (int i = 0; i < NUM_BACKENDS; i++)
+      fprintf(stderr, " %s", backends[i]->name);
+    fprintf(stderr, "\n");
+    return 1;
+  }
+
+  test_backend(ops);
+  return 0;
+}
@@ -0,0 +1,158 @@
+/***************************************************
+ * One interface over every ordered container      *
+ *                                                 *
+ * sample.c's idea (keep the comparator in the     *
+ * struct so one implementation serves any type)   *
+ * taken one step further: keep the operations in  *
+ * a table too, so which container backs a set of  *
+ * my_types can be picked at runtime               *
+ *                                                 *
+ * only deals in struct my_type *'s, so it can be  *
+ * included anywhere; the backends' files define   *
+ * their tables with ORDERED_DEFINE                *
+ ***************************************************/
+
+#ifndef ORDERED_H
+#define ORDERED_H
+
+#include <stdlib.h>
+#include <string.h>
+
+struct my_type;
+
+// every backend follows the RB tree's contract: the container owns what
+// gets inserted, insert fails (0) on something EQUAL already in there or
+// out of memory, remove hands the data back (NULL if it wasn't there),
+// destroy frees everything that's left
+typedef struct ordered_ops {
+  const char *name;
+
+  // NULL if out of memory
+  void *(*create)(int (*comp)(struct my_type *, struct my_type *));
+  int (*insert)(void *, struct my_type *);
+  struct my_type *(*search)(void *, struct my_type *);
+  struct my_type *(*remove)(void *, struct my_type *);
+
+  // calls cb(data, arg) on everything in order, stopping early if cb
+  // returns 0; returns how many times cb was called
+  int (*iterate)(void *, int (*cb)(struct my_type *, void *), void *arg);
+  int (*size)(void *);
+  void (*destroy)(void *);
+} ordered_ops;
+
+// a container plus the table that knows what it is
+typedef struct ordered {
+  const ordered_ops *ops;
+  void *impl;
+} ordered;
+
+// the backends; each one's defined in its own container's file, so
+// only link in the ones you use
+//   "rb_tree"   RB_tree, sexy_rb_tree
+//   "rb_frozen" RB_tree, an rb_freezer (frozen between writes)
+//   "b_tree"    B_tree, sexy_b_tree
+//   "skip_list" skip_list, sexy_skip_list
+extern const ordered_ops rb_ordered_ops;
+extern const ordered_ops rb_frozen_ordered_ops;
+extern const ordered_ops bt_ordered_ops;
+extern const ordered_ops sl_ordered_ops;
+
+// the entry in table[0 .. n) called name, NULL if none is
+static inline const ordered_ops *ordered_lookup(const char *name,
+                                                const ordered_ops *const *table, int n) {
+  for (int i = 0; i < n; i++) {
+    if (strcmp(table[i]->name, name) == 0)
+      return table[i];
+  }
+  return NULL;
+}
+
+// NULL if out of memory
+static inline ordered *ordered_create(const ordered_ops *ops,
+                                      int (*comp)(struct my_type *, struct my_type *)) {
+  ordered *o = (ordered *) malloc(sizeof(ordered));
+  if (o == NULL)
+    return NULL;
+
+  o->ops = ops;
+  o->impl = ops->create(comp);
+  if (o->impl == NULL) {
+    free(o);
+    return NULL;
+  }
+  return o;
+}
+
+// one indirect call each; see ORDERED_DEFINE for how to skip it
+static inline int ordered_insert(ordered *o, struct my_type *d) {
+  return o->ops->insert(o->impl, d);
+}
+
+static inline struct my_type *ordered_search(ordered *o, struct my_type *key) {
+  return o->ops->search(o->impl, key);
+}
+
+static inline struct my_type *ordered_remove(ordered *o, struct my_type *key) {
+  return o->ops->remove(o->impl, key);
+}
+
+static inline int ordered_iterate(ordered *o, int (*cb)(struct my_type *, void *), void *arg) {
+  return o->ops->iterate(o->impl, cb, arg);
+}
+
+static inline int ordered_size(ordered *o) {
+  return o->ops->size(o->impl);
+}
+
+static inline void ordered_destroy(ordered *o) {
+  o->ops->destroy(o->impl);
+  free(o);
+}
+
+// defines name_ordered_ops (called label) for a backend of type type
+// whose own functions look like the RB tree's: create(comp),
+// insert(data, c), search(key, c), remove(key, c), foreach(c, cb, arg),
+// size(c) and destroy(c); the table entries are thin static wrappers
+// around them
+// also defines name_of(o): o's container as a type * if o is one of
+// these, NULL if not; hot callers that check once can then call the
+// backend's own functions directly, with no table in the way (and,
+// in the backend's own file, inlined)
+#define ORDERED_DEFINE(name, label, type, create, insert, search, remove,      \
+                       foreach, size, destroy)                                  \
+  static void *name##_o_create(int (*comp)(struct my_type *, struct my_type *)) { \
+    return create(comp);                                                        \
+  }                                                                             \
+  static int name##_o_insert(void *c, struct my_type *d) {                      \
+    return insert(d, (type *) c);                                               \
+  }                                                                             \
+  static struct my_type *name##_o_search(void *c, struct my_type *key) {        \
+    return search(key, (type *) c);                                             \
+  }                                                                             \
+  static struct my_type *name##_o_remove(void *c, struct my_type *key) {        \
+    return remove(key, (type *) c);                                             \
+  }                                                                             \
+  static int name##_o_iterate(void *c, int (*cb)(struct my_type *, void *),     \
+                              void *arg) {                                      \
+    return foreach((type *) c, cb, arg);                                        \
+  }                                                                             \
+  static int name##_o_size(void *c) {                                           \
+    return size((type *) c);                                                    \
+  }                                                                             \
+  static void name##_o_destroy(void *c) {                                       \
+    destroy((type *) c);                                                        \
+  }                                                                             \
+  const ordered_ops name##_ordered_ops = {                                      \
+    label, &name##_o_create, &name##_o_insert, &name##_o_search,                \
+    &name##_o_remove, &name##_o_iterate, &name##_o_size, &name##_o_destroy      \
+  };                                                                            \
+  ORDERED_OF(name, type)
+
+// just name_of, for files that use a backend without defining it
+// (type can be left incomplete)
+#define ORDERED_OF(name, type)                                                  \
+  static inline type *name##_of(ordered *o) {                                   \
+    return (o->ops == &name##_ordered_ops) ? (type *) o->impl : NULL;           \
+  }
+
+#endif
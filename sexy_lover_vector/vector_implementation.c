@@ -1,11 +1,37 @@
+// for pthreads under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
 #include <assert.h>
 
 #define CAP_INIT 1
 #define NO_INDEX_USED -1
 
+// capacity goes up to this percent of what it was when growing
+#define GROWTH_PERCENT 200
+
+// clean_index shrinks the vectore once everything in use fits in this
+// percent of the capacity (0 turns shrinking off)
+#define SHRINK_PERCENT 25
+
+// chunked vectores page storage in blocks of 1 << VEC_CHUNK_BITS slots
+#ifndef VEC_CHUNK_BITS
+#define VEC_CHUNK_BITS 10
+#endif
+#define VEC_CHUNK (1 << VEC_CHUNK_BITS)
+#define VEC_CHUNK_MASK (VEC_CHUNK - 1)
+
+// vectore_map/vectore_reduce don't bother with a thread for fewer slots
+#define VEC_PAR_MIN 4096
+
+// and never use more threads than this
+#define VEC_MAX_THREADS 64
+
 /******************************************************
  * STRUCT DEFINITION OF ELEMENTS THE VECTOR WILL HOLD *
  ******************************************************/
@@ -14,18 +40,68 @@ typedef struct my_type {
   int x;
 } my_type;
 
+// what vectore_reduce folds my_types into
+typedef long long vec_acc;
+
 
 
 /*******************************
  * CONTAINER STRUCT FOR VECTOR *
  *******************************/
 
+// occupancy bitmap word
+typedef uint64_t vec_word;
+#define VEC_WORD_BITS 64
+
+// enough levels of 64 for INT_MAX slots
+#define VEC_BITS_LEVELS 6
+
+// hierarchical occupancy bitmap: bit i of level 0 says slot i is in use,
+// bit i of level l + 1 says word i of level l isn't 0; the top level is
+// one word, so the last set bit or the next one after some index is
+// found in one step per level instead of a walk over the slots
+typedef struct vec_bits {
+  int levels;
+  long long words[VEC_BITS_LEVELS];
+  vec_word *level[VEC_BITS_LEVELS];
+} vec_bits;
+
+// one page of a chunked vectore; used counts the non-NULL slots so the
+// chunk can go back once it's empty
+typedef struct vec_chunk {
+  int used;
+  my_type *slots[VEC_CHUNK];
+} vec_chunk;
+
 typedef struct vectore {
+  // NULL when chunked
   my_type **storage;
+
+  // which storage slots aren't NULL (unused when chunked)
+  vec_bits occupied;
+
+  // chunked only: directory of num_chunks pages, NULL until first write
+  vec_chunk **chunks;
+  int num_chunks;
+
+  // number of indexes covered (for a chunked vectore, by the directory)
   int capacity;
   int last_used_index;
+
+  // GROWTH_PERCENT and SHRINK_PERCENT unless set_vectore_policy says otherwise
+  int growth_percent;
+  int shrink_percent;
 } vectore;
 
+// holds the my_types themselves, one after another, instead of pointers
+// to them; bit i of occupied stands in for storage[i] != NULL
+typedef struct value_vectore {
+  my_type *values;
+  vec_bits occupied;
+  int capacity;
+  int last_used_index;
+} value_vectore;
+
 
 
 /*************
@@ -36,15 +112,41 @@ typedef struct vectore {
 // returns pointer to new vectore on success, NULL on failure
 vectore *new_vectore(void);
 
+// same as new_vectore, but storage is a directory of VEC_CHUNK slot
+// pages that only get allocated when something is written to them; for
+// high, scattered indexes (memory follows what's in use instead of the
+// highest index) at the cost of one more load in get_from_vectore
+// everything else works the same on both kinds
+vectore *new_chunked_vectore(void);
+
 // add a my_type *to a vectore at a specific location
 // returns the new vectore on success, NULL on failure
 // automatically handles resizing vectore if needed
 vectore *add_to_vectore(my_type *, vectore *, int);
 
-// resizes the vectore (increases capacity by factor of 2)
+// resizes the vectore (increases capacity by the growth factor)
 // returns pointer to new vectore on success, NULL on failure
 vectore *resize_vectore(vectore *);
 
+// makes sure there's room for indexes 0 .. n - 1 with one realloc;
+// capacity still goes up in growth factor steps (so repeated adds
+// stay amortized O(1)) but all the steps are worked out up front
+// returns pointer to the vectore on success, NULL on failure (vectore
+// is left as it was)
+vectore *reserve_vectore(vectore *, int n);
+
+// growth_percent > 100 is how much capacity grows by (200 doubles);
+// clean_index shrinks once last_used_index + 1 is at most
+// shrink_percent of capacity (0 never shrinks); shrinking has to kick
+// in well below where growing would, so shrink_percent *
+// growth_percent has to be under 10000
+// returns 1 on success, 0 if the numbers don't make sense (no change)
+int set_vectore_policy(vectore *, int growth_percent, int shrink_percent);
+
+// drops capacity to just what's needed for last_used_index (at least
+// CAP_INIT); returns 1 on success, 0 if realloc failed (still usable)
+int shrink_vectore(vectore *);
+
 // returns the my_type *stored at a certain index
 // does not remove the my_type
 // returns NULL if out of bounds; doesn't error out
@@ -53,6 +155,8 @@ my_type *get_from_vectore(vectore *, int);
 // overwrites a location in the vectore with NULL
 // returns 1 on success, 0 if out of bounds (still usable)
 // DOESN'T FREE WHAT WAS THERE!
+// shrinks the vectore if last_used_index fell to the shrink threshold,
+// leaving one growth step of room so an add right after doesn't regrow
 int clean_index(vectore *, int);
 
 // clean up and free vector
@@ -66,14 +170,220 @@ int get_capacity(vectore *);
 // get last used index in vectore
 int get_last_used_index(vectore *);
 
+// calls cb on every non-NULL index in order along with arg, stopping
+// early if cb returns 0; empty stretches are skipped a bitmap word (or
+// a missing chunk) at a time; cb mustn't add or clean
+// returns the number of indexes visited
+int vectore_foreach_occupied(vectore *, int (*cb)(int, my_type *, void *), void *arg);
+
+// puts elems[0 .. n - 1] at start .. start + n - 1 with one capacity
+// check and a straight copy; same as n add_to_vectores otherwise (takes
+// over the elems, NULL ones clean, doesn't free what was there)
+// returns the vectore on success, NULL on failure (contents unchanged,
+// but the capacity may already have grown)
+vectore *add_range_to_vectore(vectore *, int start, my_type **elems, int n);
+
+// copies whatever's at start .. start + n - 1 into out (NULL for empty
+// or out of bounds); nothing's removed
+// returns 1 on success, 0 if start or n is negative
+int get_range_from_vectore(vectore *, int start, my_type **out, int n);
+
+// calls fn on every non-NULL index with the index range split across
+// up to nthreads threads (the caller's included), so fn has to be safe
+// to run on different elements at once; nothing can add or clean while
+// it runs
+// returns the number of elements visited
+int vectore_map(vectore *, void (*fn)(int, my_type *, void *), void *arg, int nthreads);
+
+// folds every non-NULL element in with step, each thread's part of the
+// range starting from identity, then puts the parts together left to
+// right with combine (so combine only has to be associative); same
+// threading rules as vectore_map
+vec_acc vectore_reduce(vectore *, vec_acc identity,
+		       vec_acc (*step)(vec_acc, int, my_type *, void *),
+		       vec_acc (*combine)(vec_acc, vec_acc), void *arg, int nthreads);
+
+// value_vectore: same idea, but add copies the my_type in and there's
+// nothing for the caller to malloc or free; growth and shrink go by
+// GROWTH_PERCENT and SHRINK_PERCENT
+
+// returns pointer to new value_vectore on success, NULL on failure
+value_vectore *new_value_vectore(void);
+
+// copies elem into a specific location, growing if needed
+// returns the value_vectore on success, NULL on failure (no change)
+value_vectore *add_to_value_vectore(my_type elem, value_vectore *, int);
+
+// returns a pointer to the my_type stored at a certain index, NULL if
+// nothing's there or out of bounds; only good until the next add or
+// clean (either can move storage)
+my_type *get_from_value_vectore(value_vectore *, int);
+
+// marks a location empty; returns 1 on success, 0 if out of bounds
+int clean_value_index(value_vectore *, int);
+
+// calls cb on every occupied index in order along with arg, stopping
+// early if cb returns 0; cb mustn't add or clean
+// returns the number of indexes visited
+int value_vectore_foreach(value_vectore *, int (*cb)(int, my_type *, void *), void *arg);
+
+// returns 1 on success, 0 on failure
+int free_value_vectore(value_vectore *);
+
+int get_value_capacity(value_vectore *);
+int get_value_last_used_index(value_vectore *);
+
 // test the vectore code
 int test_vectore(void);
+int test_vectore_policy(void);
+int test_chunked_vectore(void);
+int test_value_vectore(void);
+int test_vectore_occupied(void);
+int test_vectore_bulk(void);
 
 
 
 /******************
  * IMPLEMENTATION *
  ******************/
+
+// bitmap words needed for n slots
+static long long words_for(long long n) {
+  return (n + VEC_WORD_BITS - 1) / VEC_WORD_BITS;
+}
+
+static void bits_free(vec_bits *b) {
+  for (int l = 0; l < b->levels; l++) {
+    free(b->level[l]);
+  }
+  b->levels = 0;
+}
+
+// makes b cover n slots, keeping level 0 bits below n (there can't be
+// any at or above it) and redoing the levels above from it; all or
+// nothing: returns 1 on success, 0 if out of memory (b untouched)
+static int bits_resize(vec_bits *b, long long n) {
+  vec_bits nb;
+  long long words = words_for(n > 0 ? n : 1);
+
+  nb.levels = 0;
+  do {
+    nb.words[nb.levels] = words;
+    nb.level[nb.levels] = calloc(words, sizeof(vec_word));
+    if (nb.level[nb.levels] == NULL) {
+      bits_free(&nb);
+      return 0;
+    }
+    nb.levels++;
+    words = words_for(words);
+  } while (nb.words[nb.levels - 1] > 1);
+
+  if (b->levels > 0) {
+    long long keep = (b->words[0] < nb.words[0]) ? b->words[0] : nb.words[0];
+    for (long long w = 0; w < keep; w++) {
+      nb.level[0][w] = b->level[0][w];
+    }
+  }
+  for (int l = 1; l < nb.levels; l++) {
+    for (long long w = 0; w < nb.words[l - 1]; w++) {
+      if (nb.level[l - 1][w] != 0)
+	nb.level[l][w / VEC_WORD_BITS] |= (vec_word) 1 << (w % VEC_WORD_BITS);
+    }
+  }
+
+  bits_free(b);
+  *b = nb;
+  return 1;
+}
+
+static int bits_test(vec_bits *b, long long i) {
+  return (b->level[0][i / VEC_WORD_BITS] >> (i % VEC_WORD_BITS)) & 1;
+}
+
+// bits_set/bits_clear starting at some level
+static void bits_set_at(vec_bits *b, int from, long long i) {
+  for (int l = from; l < b->levels; l++) {
+    vec_word *w = &b->level[l][i / VEC_WORD_BITS];
+    vec_word was = *w;
+    *w |= (vec_word) 1 << (i % VEC_WORD_BITS);
+    if (was != 0)
+      // level above already knew about this word
+      break;
+    i /= VEC_WORD_BITS;
+  }
+}
+
+static void bits_clear_at(vec_bits *b, int from, long long i) {
+  for (int l = from; l < b->levels; l++) {
+    vec_word *w = &b->level[l][i / VEC_WORD_BITS];
+    *w &= ~((vec_word) 1 << (i % VEC_WORD_BITS));
+    if (*w != 0)
+      break;
+    i /= VEC_WORD_BITS;
+  }
+}
+
+static void bits_set(vec_bits *b, long long i) {
+  bits_set_at(b, 0, i);
+}
+
+static void bits_clear(vec_bits *b, long long i) {
+  bits_clear_at(b, 0, i);
+}
+
+// overwrites level 0 word w, telling the levels above if it went to or
+// from 0
+static void bits_put_word(vec_bits *b, long long w, vec_word val) {
+  int was = (b->level[0][w] != 0);
+  b->level[0][w] = val;
+  if (was && val == 0)
+    bits_clear_at(b, 1, w);
+  else if (!was && val != 0)
+    bits_set_at(b, 1, w);
+}
+
+// highest set bit, -1 if none
+static long long bits_last(vec_bits *b) {
+  int top = b->levels - 1;
+  if (b->level[top][0] == 0)
+    return -1;
+
+  long long i = VEC_WORD_BITS - 1 - __builtin_clzll(b->level[top][0]);
+  for (int l = top - 1; l >= 0; l--) {
+    i = i * VEC_WORD_BITS + (VEC_WORD_BITS - 1 - __builtin_clzll(b->level[l][i]));
+  }
+  return i;
+}
+
+// lowest set bit at or after i, -1 if none
+static long long bits_next(vec_bits *b, long long i) {
+  int l = 0;
+
+  // go up until some word has a bit at or after where we are...
+  for (;;) {
+    if (l == b->levels)
+      return -1;
+    long long w = i / VEC_WORD_BITS;
+    if (w >= b->words[l])
+      return -1;
+    vec_word bits = b->level[l][w] & (~(vec_word) 0 << (i % VEC_WORD_BITS));
+    if (bits != 0) {
+      i = w * VEC_WORD_BITS + __builtin_ctzll(bits);
+      break;
+    }
+    // next word over, one level up
+    i = w + 1;
+    l++;
+  }
+
+  // ...then back down taking the lowest bit each time
+  while (l > 0) {
+    l--;
+    i = i * VEC_WORD_BITS + __builtin_ctzll(b->level[l][i]);
+  }
+  return i;
+}
+
 vectore *new_vectore(void) {
   vectore *ret = malloc(sizeof(vectore));
   my_type **storage = malloc(sizeof(my_type *) * CAP_INIT);
@@ -81,8 +391,19 @@ vectore *new_vectore(void) {
   assert(storage != NULL);
 
   ret->storage = storage;
+  ret->occupied.levels = 0;
+  // has to run with NDEBUG too, so not inside an assert
+  if (!bits_resize(&ret->occupied, CAP_INIT)) {
+    free(storage);
+    free(ret);
+    return NULL;
+  }
+  ret->chunks = NULL;
+  ret->num_chunks = 0;
   ret->capacity = CAP_INIT;
   ret->last_used_index = NO_INDEX_USED;
+  ret->growth_percent = GROWTH_PERCENT;
+  ret->shrink_percent = SHRINK_PERCENT;
 
   for (int i = 0; i < CAP_INIT; i++) {
     ret->storage[i] = NULL;
@@ -91,6 +412,28 @@ vectore *new_vectore(void) {
   return ret;
 }
 
+vectore *new_chunked_vectore(void) {
+  vectore *ret = malloc(sizeof(vectore));
+  vec_chunk **chunks = malloc(sizeof(vec_chunk *) * CAP_INIT);
+  assert(ret != NULL);
+  assert(chunks != NULL);
+
+  ret->storage = NULL;
+  ret->occupied.levels = 0;
+  ret->chunks = chunks;
+  ret->num_chunks = CAP_INIT;
+  ret->capacity = CAP_INIT * VEC_CHUNK;
+  ret->last_used_index = NO_INDEX_USED;
+  ret->growth_percent = GROWTH_PERCENT;
+  ret->shrink_percent = SHRINK_PERCENT;
+
+  for (int i = 0; i < CAP_INIT; i++) {
+    ret->chunks[i] = NULL;
+  }
+
+  return ret;
+}
+
 int get_capacity(vectore *v) {
   return v->capacity;
 }
@@ -99,32 +442,195 @@ int get_last_used_index (vectore *v) {
   return v->last_used_index;
 }
 
+int set_vectore_policy(vectore *v, int growth_percent, int shrink_percent) {
+  if (growth_percent <= 100 || shrink_percent < 0 || shrink_percent >= 100)
+    return 0;
+  if ((long long) shrink_percent * growth_percent >= 10000)
+    return 0;
+
+  v->growth_percent = growth_percent;
+  v->shrink_percent = shrink_percent;
+  return 1;
+}
+
+// capacity one growth step (of growth_percent) up from cap; always at
+// least cap + 1
+static long long grow_capacity(int growth_percent, long long cap) {
+  long long next = cap * growth_percent / 100;
+  return (next > cap) ? next : cap + 1;
+}
+
+// reallocs the chunk directory to exactly new_num entries, NULLing any
+// new ones; anything cut off has to be empty (and so already freed)
+// returns 1 on success, 0 if realloc failed (v untouched)
+static int set_num_chunks(vectore *v, int new_num) {
+  vec_chunk **new_chunks = (vec_chunk **) realloc(v->chunks, new_num * sizeof(vec_chunk *));
+  if (new_chunks == NULL)
+    return 0;
+
+  for (int i = v->num_chunks; i < new_num; i++) {
+    new_chunks[i] = NULL;
+  }
+
+  v->chunks = new_chunks;
+  v->num_chunks = new_num;
+
+  long long cap = (long long) new_num * VEC_CHUNK;
+  v->capacity = (cap > INT_MAX) ? INT_MAX : (int) cap;
+  return 1;
+}
+
+// chunks needed to cover indexes 0 .. n - 1
+static long long chunks_for(long long n) {
+  return (n + VEC_CHUNK - 1) >> VEC_CHUNK_BITS;
+}
+
+// reallocs storage to exactly new_cap slots, NULLing any new ones
+// (rounded up to whole chunks for a chunked vectore)
+// returns 1 on success, 0 if realloc failed (v untouched)
+static int set_capacity(vectore *v, int new_cap) {
+  if (v->chunks != NULL)
+    return set_num_chunks(v, (int) chunks_for(new_cap));
+
+  my_type **new_storage = (my_type **) realloc(v->storage, new_cap * sizeof(my_type *));
+  if (new_storage == NULL)
+    return 0;
+  // good either way: bigger is just unused, smaller only lost NULLs
+  v->storage = new_storage;
+
+  if (!bits_resize(&v->occupied, new_cap)) {
+    if (new_cap > v->capacity)
+      return 0;
+    // shrinking, old bitmap still covers everything
+  }
+
+  for (int i = v->capacity; i < new_cap; i++) {
+    new_storage[i] = NULL;
+  }
+
+  v->capacity = new_cap;
+  return 1;
+}
+
+// reserve_vectore for a chunked vectore: the directory is what grows
+static vectore *reserve_chunked(vectore *v, int n) {
+  long long need = chunks_for(n);
+  long long new_num = v->num_chunks;
+  while (new_num < need)
+    new_num = grow_capacity(v->growth_percent, new_num);
+
+  if (new_num > chunks_for(INT_MAX))
+    new_num = chunks_for(INT_MAX);
+
+  if (!set_num_chunks(v, (int) new_num))
+    return NULL;
+
+  return v;
+}
+
+vectore *reserve_vectore(vectore *v, int n) {
+  if (n <= v->capacity)
+    return v;
+  if (v->chunks != NULL)
+    return reserve_chunked(v, n);
+
+  // every growth step at once, so only one realloc
+  long long new_cap = v->capacity;
+  while (new_cap < n)
+    new_cap = grow_capacity(v->growth_percent, new_cap);
+
+  if (new_cap > INT_MAX) {
+    // last step overshot; as big as an int index can go is enough
+    new_cap = INT_MAX;
+  }
+
+  if ((size_t) new_cap > SIZE_MAX / sizeof(my_type *))
+    // vector too large
+    return NULL;
+
+  if (!set_capacity(v, (int) new_cap))
+    return NULL;
+
+  return v;
+}
+
 vectore *resize_vectore(vectore *v) {
-  if (get_capacity(v) > INT_MAX/2) {
+  if (v->chunks != NULL) {
+    long long new_num = grow_capacity(v->growth_percent, v->num_chunks);
+    if (new_num > chunks_for(INT_MAX))
+      // vector too large
+      return NULL;
+    return set_num_chunks(v, (int) new_num) ? v : NULL;
+  }
+
+  long long new_cap = grow_capacity(v->growth_percent, v->capacity);
+  if (new_cap > INT_MAX) {
     // vector too large
     return NULL;
   }
 
-  // get local copies of values in v to avoid
-  // multiple dereferences of same data
-  int old_cap = v->capacity;
-  int new_cap = old_cap * 2;
-  my_type **storage = v->storage;
+  return reserve_vectore(v, (int) new_cap);
+}
 
-  // update capacity
-  v->capacity = new_cap;
+int shrink_vectore(vectore *v) {
+  int new_cap = v->last_used_index + 1;
+  if (new_cap < CAP_INIT)
+    new_cap = CAP_INIT;
 
-  my_type **new_storage = (my_type **) realloc(storage, new_cap * sizeof(my_type *));
-  v->storage = new_storage;
+  if (new_cap >= v->capacity)
+    return 1;
+
+  return set_capacity(v, new_cap);
+}
 
-  for (int i = old_cap; i < new_cap; i++) {
-    v->storage[i] = NULL;
+// clean_index's automatic shrink; see set_vectore_policy
+static void maybe_shrink(vectore *v) {
+  long long used = v->last_used_index + 1;
+
+  if (v->chunks != NULL) {
+    // same thing in whole chunks
+    long long used_chunks = chunks_for(used);
+    if (v->shrink_percent == 0 || v->num_chunks <= CAP_INIT)
+      return;
+    if (used_chunks * 100 > (long long) v->num_chunks * v->shrink_percent)
+      return;
+
+    long long new_num = grow_capacity(v->growth_percent, used_chunks > CAP_INIT ? used_chunks : CAP_INIT);
+    if (new_num < v->num_chunks)
+      set_num_chunks(v, (int) new_num);
+    return;
   }
 
-  return v;
+  if (v->shrink_percent == 0 || v->capacity <= CAP_INIT)
+    return;
+  if (used * 100 > (long long) v->capacity * v->shrink_percent)
+    return;
+
+  // keep a growth step of room above what's used
+  long long new_cap = grow_capacity(v->growth_percent, used > CAP_INIT ? used : CAP_INIT);
+  if (new_cap < v->capacity) {
+    // a failed shrink just leaves it bigger than it needs to be
+    set_capacity(v, (int) new_cap);
+  }
 }
 
 int free_vectore(vectore *v) {
+  if (v->chunks != NULL) {
+    for (int c = 0; c < v->num_chunks; c++) {
+      vec_chunk *chunk = v->chunks[c];
+      if (chunk == NULL)
+	continue;
+      for (int i = 0; i < VEC_CHUNK; i++) {
+	free(chunk->slots[i]);
+      }
+      free(chunk);
+    }
+
+    free(v->chunks);
+    free(v);
+    return 1;
+  }
+
   int cap = v->capacity;
   my_type **storage = v->storage;
   for (int i = 0; i < cap; i++) {
@@ -132,24 +638,71 @@ int free_vectore(vectore *v) {
   }
 
   free(v->storage);
+  bits_free(&v->occupied);
   free(v);
 
   return 1;
 }
 
+// highest non-NULL index at or below i in a chunked vectore, skipping
+// whole missing chunks; NO_INDEX_USED if there isn't one
+static int chunked_last_from(vectore *v, int i) {
+  while (i >= 0) {
+    vec_chunk *c = v->chunks[i >> VEC_CHUNK_BITS];
+    if (c == NULL) {
+      // down to the last slot of the chunk before
+      i = ((i >> VEC_CHUNK_BITS) << VEC_CHUNK_BITS) - 1;
+    } else if (c->slots[i & VEC_CHUNK_MASK] == NULL) {
+      i--;
+    } else {
+      return i;
+    }
+  }
+  return NO_INDEX_USED;
+}
+
+// clean_index for a chunked vectore; hands an emptied chunk back and
+// skips whole missing chunks looking for the new last_used_index
+static int clean_chunked(vectore *v, int index) {
+  vec_chunk *chunk = v->chunks[index >> VEC_CHUNK_BITS];
+  if (chunk == NULL)
+    // nothing there to begin with
+    return 1;
+
+  if (chunk->slots[index & VEC_CHUNK_MASK] != NULL) {
+    chunk->slots[index & VEC_CHUNK_MASK] = NULL;
+    if (--chunk->used == 0) {
+      free(chunk);
+      v->chunks[index >> VEC_CHUNK_BITS] = NULL;
+    }
+  }
+
+  if (index == v->last_used_index) {
+    v->last_used_index = chunked_last_from(v, index);
+    maybe_shrink(v);
+  }
+
+  return 1;
+}
+
 int clean_index(vectore *v, int index) {
   if (index >= v->capacity || index < 0) {
     return 0;
+  } else if (v->chunks != NULL) {
+    return clean_chunked(v, index);
   } else {
     v->storage[index] = NULL;
-    
-    // make faster by having local copies of storage and last_used_index
-    // so that not dereferencing many times
+    bits_clear(&v->occupied, index);
+
     if (index == v->last_used_index) {
-      while (v->storage[v->last_used_index] ==  NULL && v->last_used_index >= 0) {
-	v->last_used_index--;
-      }
+      // everything above index is clear, so the new top is the last bit
+      v->last_used_index = (int) bits_last(&v->occupied);
+
+      // only worth checking when the top moved down
+      maybe_shrink(v);
     }
+
+    return 1;
   }
 }
 
@@ -157,29 +710,417 @@ my_type *get_from_vectore(vectore *v, int index) {
   if (index >= v->capacity || index < 0) {
     // out of bounds
     return NULL;
+  } else if (v->chunks != NULL) {
+    vec_chunk *chunk = v->chunks[index >> VEC_CHUNK_BITS];
+    return (chunk == NULL) ? NULL : chunk->slots[index & VEC_CHUNK_MASK];
   } else {
     return v->storage[index];
   }
 }
 
 vectore *add_to_vectore(my_type *elem, vectore *v, int index) {
-  if (index < 0)
+  // capacity tops out at INT_MAX, so INT_MAX itself is never an index
+  if (index < 0 || index == INT_MAX)
     return NULL;
   
-  vectore *res = v;
-  while (index >= res->capacity) {
-    res = resize_vectore(v);
-    if (res == NULL)
-      return NULL;
+  // one realloc no matter how far past capacity index is
+  vectore *res = reserve_vectore(v, index + 1);
+  if (res == NULL)
+    return NULL;
+
+  if (res->chunks != NULL) {
+    if (elem == NULL)
+      // same as cleaning it; don't make a chunk just to hold a NULL
+      return clean_chunked(res, index) ? res : NULL;
+
+    vec_chunk **dir = &res->chunks[index >> VEC_CHUNK_BITS];
+    if (*dir == NULL) {
+      // pages are only made on first write
+      *dir = calloc(1, sizeof(vec_chunk));
+      if (*dir == NULL)
+	return NULL;
+    }
+
+    my_type **slot = &(*dir)->slots[index & VEC_CHUNK_MASK];
+    if (*slot == NULL)
+      (*dir)->used++;
+    *slot = elem;
+  } else {
+    if (elem == NULL)
+      // keeps occupied and last_used_index straight
+      return clean_index(res, index) ? res : NULL;
+    res->storage[index] = elem;
+    bits_set(&res->occupied, index);
   }
 
-  res->storage[index] = elem;
   if (index > res->last_used_index)
     res->last_used_index = index;
 
   return res;
 }
 
+vectore *add_range_to_vectore(vectore *v, int start, my_type **elems, int n) {
+  if (start < 0 || n < 0 || (long long) start + n > INT_MAX)
+    return NULL;
+  if (n == 0)
+    return v;
+
+  if (reserve_vectore(v, start + n) == NULL)
+    return NULL;
+
+  if (v->chunks != NULL) {
+    // a chunk at a time; make every page first so running out of
+    // memory leaves the contents like they were (the directory keeps
+    // whatever reserve_vectore grew it to)
+    int first = start >> VEC_CHUNK_BITS, last = (start + n - 1) >> VEC_CHUNK_BITS;
+    for (int c = first; c <= last; c++) {
+      if (v->chunks[c] == NULL && (v->chunks[c] = calloc(1, sizeof(vec_chunk))) == NULL) {
+	for (int d = first; d < c; d++) {
+	  if (v->chunks[d]->used == 0) {
+	    free(v->chunks[d]);
+	    v->chunks[d] = NULL;
+	  }
+	}
+	return NULL;
+      }
+    }
+
+    for (int i = start; i < start + n; ) {
+      vec_chunk *chunk = v->chunks[i >> VEC_CHUNK_BITS];
+      int off = i & VEC_CHUNK_MASK;
+      int len = VEC_CHUNK - off;
+      if (len > start + n - i)
+	len = start + n - i;
+
+      for (int j = 0; j < len; j++) {
+	chunk->used += (elems[i - start + j] != NULL) - (chunk->slots[off + j] != NULL);
+      }
+      memcpy(&chunk->slots[off], &elems[i - start], len * sizeof(my_type *));
+      if (chunk->used == 0) {
+	// all NULLs
+	free(chunk);
+	v->chunks[i >> VEC_CHUNK_BITS] = NULL;
+      }
+      i += len;
+    }
+
+    // anything above the range is as it was
+    if (start + n - 1 >= v->last_used_index)
+      v->last_used_index = chunked_last_from(v, start + n - 1);
+    return v;
+  }
+
+  memcpy(&v->storage[start], elems, n * sizeof(my_type *));
+
+  // redo occupied a level 0 word at a time from what was copied in
+  for (long long i = start; i < start + n; ) {
+    long long w = i / VEC_WORD_BITS;
+    long long end = (w + 1) * VEC_WORD_BITS;
+    if (end > start + n)
+      end = start + n;
+
+    vec_word val = v->occupied.level[0][w];
+    for (; i < end; i++) {
+      vec_word bit = (vec_word) 1 << (i % VEC_WORD_BITS);
+      val = (elems[i - start] != NULL) ? (val | bit) : (val & ~bit);
+    }
+    bits_put_word(&v->occupied, w, val);
+  }
+  v->last_used_index = (int) bits_last(&v->occupied);
+
+  return v;
+}
+
+int get_range_from_vectore(vectore *v, int start, my_type **out, int n) {
+  if (start < 0 || n < 0)
+    return 0;
+
+  // the part that's actually in storage
+  int in = (start >= v->capacity) ? 0 : v->capacity - start;
+  if (in > n)
+    in = n;
+
+  if (v->chunks != NULL) {
+    for (int i = start; i < start + in; ) {
+      vec_chunk *chunk = v->chunks[i >> VEC_CHUNK_BITS];
+      int off = i & VEC_CHUNK_MASK;
+      int len = VEC_CHUNK - off;
+      if (len > start + in - i)
+	len = start + in - i;
+
+      if (chunk == NULL)
+	memset(&out[i - start], 0, len * sizeof(my_type *));
+      else
+	memcpy(&out[i - start], &chunk->slots[off], len * sizeof(my_type *));
+      i += len;
+    }
+  } else {
+    memcpy(out, &v->storage[start], in * sizeof(my_type *));
+  }
+
+  for (int i = in; i < n; i++) {
+    out[i] = NULL;
+  }
+
+  return 1;
+}
+
+// cb on each non-NULL index in lo .. hi, in order, until cb says stop
+// returns the number visited
+static int foreach_in_range(vectore *v, int lo, int hi, int (*cb)(int, my_type *, void *), void *arg) {
+  int visited = 0;
+
+  if (hi > v->last_used_index)
+    hi = v->last_used_index;
+  if (lo > hi)
+    return 0;
+
+  if (v->chunks != NULL) {
+    for (int c = lo >> VEC_CHUNK_BITS; c <= hi >> VEC_CHUNK_BITS; c++) {
+      vec_chunk *chunk = v->chunks[c];
+      if (chunk == NULL)
+	continue;
+      int from = (c == lo >> VEC_CHUNK_BITS) ? (lo & VEC_CHUNK_MASK) : 0;
+      int to = (c == hi >> VEC_CHUNK_BITS) ? (hi & VEC_CHUNK_MASK) : VEC_CHUNK - 1;
+      for (int i = from; i <= to; i++) {
+	if (chunk->slots[i] == NULL)
+	  continue;
+	visited++;
+	if (!cb((c << VEC_CHUNK_BITS) | i, chunk->slots[i], arg))
+	  return visited;
+      }
+    }
+    return visited;
+  }
+
+  for (long long i = bits_next(&v->occupied, lo); i >= 0 && i <= hi; i = bits_next(&v->occupied, i + 1)) {
+    visited++;
+    if (!cb((int) i, v->storage[i], arg))
+      break;
+  }
+
+  return visited;
+}
+
+int vectore_foreach_occupied(vectore *v, int (*cb)(int, my_type *, void *), void *arg) {
+  return foreach_in_range(v, 0, v->last_used_index, cb, arg);
+}
+
+// one thread's share of a vectore_map/vectore_reduce
+typedef struct vec_job {
+  vectore *v;
+  int lo, hi;
+  void (*map)(int, my_type *, void *);
+  vec_acc (*step)(vec_acc, int, my_type *, void *);
+  void *arg;
+  vec_acc acc;
+  int visited;
+} vec_job;
+
+static int map_one(int i, my_type *e, void *arg) {
+  vec_job *job = arg;
+  job->map(i, e, job->arg);
+  return 1;
+}
+
+static int reduce_one(int i, my_type *e, void *arg) {
+  vec_job *job = arg;
+  job->acc = job->step(job->acc, i, e, job->arg);
+  return 1;
+}
+
+static void *run_job(void *arg) {
+  vec_job *job = arg;
+  job->visited = foreach_in_range(job->v, job->lo, job->hi,
+				  (job->map != NULL) ? map_one : reduce_one, job);
+  return NULL;
+}
+
+// splits 0 .. last_used_index into jobs[0 .. returned - 1] (each a copy
+// of proto) and runs them, jobs[0] on this thread; a thread that can't
+// be started does its share here too
+static int run_jobs(vectore *v, vec_job *proto, vec_job *jobs, int nthreads) {
+  long long slots = (long long) v->last_used_index + 1;
+  long long most = (slots + VEC_PAR_MIN - 1) / VEC_PAR_MIN;
+  int parts = (nthreads < 1) ? 1 : (nthreads > VEC_MAX_THREADS) ? VEC_MAX_THREADS : nthreads;
+  if (parts > most)
+    parts = (most < 1) ? 1 : (int) most;
+
+  pthread_t tids[parts];
+  int started[parts];
+
+  for (int p = 0; p < parts; p++) {
+    jobs[p] = *proto;
+    jobs[p].v = v;
+    jobs[p].lo = (int) (slots * p / parts);
+    jobs[p].hi = (int) (slots * (p + 1) / parts) - 1;
+    started[p] = (p > 0) && pthread_create(&tids[p], NULL, run_job, &jobs[p]) == 0;
+  }
+
+  for (int p = 0; p < parts; p++) {
+    if (!started[p])
+      run_job(&jobs[p]);
+  }
+  for (int p = 1; p < parts; p++) {
+    if (started[p])
+      pthread_join(tids[p], NULL);
+  }
+
+  return parts;
+}
+
+int vectore_map(vectore *v, void (*fn)(int, my_type *, void *), void *arg, int nthreads) {
+  vec_job proto = { .map = fn, .arg = arg };
+  vec_job jobs[VEC_MAX_THREADS];
+
+  int parts = run_jobs(v, &proto, jobs, nthreads);
+  int visited = 0;
+  for (int p = 0; p < parts; p++) {
+    visited += jobs[p].visited;
+  }
+  return visited;
+}
+
+vec_acc vectore_reduce(vectore *v, vec_acc identity,
+		       vec_acc (*step)(vec_acc, int, my_type *, void *),
+		       vec_acc (*combine)(vec_acc, vec_acc), void *arg, int nthreads) {
+  vec_job proto = { .step = step, .arg = arg, .acc = identity };
+  vec_job jobs[VEC_MAX_THREADS];
+
+  int parts = run_jobs(v, &proto, jobs, nthreads);
+  vec_acc ret = jobs[0].acc;
+  for (int p = 1; p < parts; p++) {
+    ret = combine(ret, jobs[p].acc);
+  }
+  return ret;
+}
+
+value_vectore *new_value_vectore(void) {
+  value_vectore *ret = malloc(sizeof(value_vectore));
+  my_type *values = malloc(sizeof(my_type) * CAP_INIT);
+  assert(ret != NULL);
+  assert(values != NULL);
+
+  ret->values = values;
+  ret->occupied.levels = 0;
+  if (!bits_resize(&ret->occupied, CAP_INIT)) {
+    free(values);
+    free(ret);
+    return NULL;
+  }
+  ret->capacity = CAP_INIT;
+  ret->last_used_index = NO_INDEX_USED;
+
+  return ret;
+}
+
+int get_value_capacity(value_vectore *v) {
+  return v->capacity;
+}
+
+int get_value_last_used_index(value_vectore *v) {
+  return v->last_used_index;
+}
+
+// reallocs values and occupied to exactly new_cap slots; slots past the
+// old capacity start out empty, anything cut off has to be empty already
+// returns 1 on success, 0 if a realloc failed (capacity unchanged)
+static int set_value_capacity(value_vectore *v, int new_cap) {
+  my_type *new_values = realloc(v->values, new_cap * sizeof(my_type));
+  if (new_values == NULL)
+    return 0;
+  // good either way: bigger is just unused, smaller only lost empty slots
+  v->values = new_values;
+
+  if (!bits_resize(&v->occupied, new_cap)) {
+    if (new_cap > v->capacity)
+      return 0;
+    // shrinking, old bitmap still covers everything
+  }
+
+  v->capacity = new_cap;
+  return 1;
+}
+
+value_vectore *add_to_value_vectore(my_type elem, value_vectore *v, int index) {
+  // same as add_to_vectore: INT_MAX is past the largest capacity
+  if (index < 0 || index == INT_MAX)
+    return NULL;
+
+  if (index >= v->capacity) {
+    // same growth steps as reserve_vectore, one realloc each
+    long long new_cap = v->capacity;
+    while (new_cap <= index)
+      new_cap = grow_capacity(GROWTH_PERCENT, new_cap);
+    if (new_cap > INT_MAX)
+      new_cap = INT_MAX;
+    if ((size_t) new_cap > SIZE_MAX / sizeof(my_type))
+      // vector too large
+      return NULL;
+    if (!set_value_capacity(v, (int) new_cap))
+      return NULL;
+  }
+
+  v->values[index] = elem;
+  bits_set(&v->occupied, index);
+  if (index > v->last_used_index)
+    v->last_used_index = index;
+
+  return v;
+}
+
+my_type *get_from_value_vectore(value_vectore *v, int index) {
+  if (index >= v->capacity || index < 0)
+    return NULL;
+  if (!bits_test(&v->occupied, index))
+    return NULL;
+  return &v->values[index];
+}
+
+int clean_value_index(value_vectore *v, int index) {
+  if (index >= v->capacity || index < 0)
+    return 0;
+
+  bits_clear(&v->occupied, index);
+
+  if (index == v->last_used_index) {
+    // everything above index is already clear
+    v->last_used_index = (int) bits_last(&v->occupied);
+
+    long long used = v->last_used_index + 1;
+    if (SHRINK_PERCENT != 0 && v->capacity > CAP_INIT &&
+	used * 100 <= (long long) v->capacity * SHRINK_PERCENT) {
+      // one growth step of room, same as maybe_shrink
+      long long new_cap = grow_capacity(GROWTH_PERCENT, used > CAP_INIT ? used : CAP_INIT);
+      if (new_cap < v->capacity)
+	set_value_capacity(v, (int) new_cap);
+    }
+  }
+
+  return 1;
+}
+
+int value_vectore_foreach(value_vectore *v, int (*cb)(int, my_type *, void *), void *arg) {
+  int visited = 0;
+
+  for (long long i = bits_next(&v->occupied, 0); i >= 0; i = bits_next(&v->occupied, i + 1)) {
+    visited++;
+    if (!cb((int) i, &v->values[i], arg))
+      break;
+  }
+
+  return visited;
+}
+
+int free_value_vectore(value_vectore *v) {
+  // my_types live in values; nothing else to free
+  free(v->values);
+  bits_free(&v->occupied);
+  free(v);
+
+  return 1;
+}
+
 /***************
  * TEST SCRIPT *
  ***************/
@@ -237,8 +1178,553 @@ int test_vectore(void) {
   return 1;
 }
 
+int test_vectore_policy(void) {
+  printf("beginning policy tests\n");
+  vectore *v = new_vectore();
+
+  printf("testing reserve\n");
+  assert(reserve_vectore(v, 0) == v);
+  assert(get_capacity(v) == 1);
+  // 1 -> 2 -> 4 -> ... -> 1024 worked out at once
+  assert(reserve_vectore(v, 1000) == v);
+  assert(get_capacity(v) == 1024);
+  assert(get_from_vectore(v, 1023) == NULL);
+  assert(get_last_used_index(v) == NO_INDEX_USED);
+  // already big enough: nothing happens
+  assert(reserve_vectore(v, 10) == v);
+  assert(get_capacity(v) == 1024);
+
+  printf("testing policy checks\n");
+  assert(!set_vectore_policy(v, 100, 10));
+  assert(!set_vectore_policy(v, 150, 100));
+  // shrinking at 50% with 2x growth would thrash
+  assert(!set_vectore_policy(v, 200, 50));
+  assert(v->growth_percent == GROWTH_PERCENT);
+  free_vectore(v);
+
+  printf("testing growth factor\n");
+  v = new_vectore();
+  assert(set_vectore_policy(v, 150, 25));
+  for (int i = 0; i < 10; i++) {
+    my_type *e = malloc(sizeof(my_type));
+    e->x = i;
+    assert(add_to_vectore(e, v, i) == v);
+  }
+  // 1 -> 2 -> 3 -> 4 -> 6 -> 9 -> 13
+  assert(get_capacity(v) == 13);
+  free_vectore(v);
+
+  printf("testing shrink after one sparse high index\n");
+  v = new_vectore();
+  my_type *lo = malloc(sizeof(my_type));
+  my_type *hi = malloc(sizeof(my_type));
+  lo->x = 1;
+  hi->x = 2;
+  assert(add_to_vectore(lo, v, 3) == v);
+  assert(add_to_vectore(hi, v, 1000000) == v);
+  assert(get_capacity(v) >= 1000001);
+
+  free(hi);
+  assert(clean_index(v, 1000000) == 1);
+  assert(get_last_used_index(v) == 3);
+  // one growth step of room over indexes 0 .. 3
+  assert(get_capacity(v) == 8);
+  assert(get_from_vectore(v, 3) == lo);
+
+  // cleaning below the top doesn't move anything
+  assert(clean_index(v, 0) == 1);
+  assert(get_capacity(v) == 8);
+
+  printf("testing explicit shrink\n");
+  assert(shrink_vectore(v));
+  assert(get_capacity(v) == 4);
+  assert(get_from_vectore(v, 3) == lo);
+
+  // shrinking off: high index stays allocated
+  assert(set_vectore_policy(v, 200, 0));
+  hi = malloc(sizeof(my_type));
+  assert(add_to_vectore(hi, v, 5000) == v);
+  free(hi);
+  assert(clean_index(v, 5000) == 1);
+  assert(get_capacity(v) == 8192);
+  free_vectore(v);
+
+  printf("policy tests passed!\n");
+  return 1;
+}
+
+// how many pages a chunked vectore has allocated
+static int count_chunks(vectore *v) {
+  int n = 0;
+  for (int c = 0; c < v->num_chunks; c++) {
+    if (v->chunks[c] != NULL)
+      n++;
+  }
+  return n;
+}
+
+int test_chunked_vectore(void) {
+  printf("beginning chunked tests\n");
+  vectore *v = new_chunked_vectore();
+  assert(get_capacity(v) == VEC_CHUNK);
+  assert(get_last_used_index(v) == NO_INDEX_USED);
+  assert(count_chunks(v) == 0);
+  assert(get_from_vectore(v, 0) == NULL);
+
+  printf("testing one far-off index\n");
+  my_type *far = malloc(sizeof(my_type));
+  far->x = 1;
+  assert(add_to_vectore(far, v, 100000000) == v);
+  assert(get_capacity(v) > 100000000);
+  assert(get_last_used_index(v) == 100000000);
+  // the directory grew, but only the one page is there
+  assert(count_chunks(v) == 1);
+  assert(get_from_vectore(v, 100000000) == far);
+  assert(get_from_vectore(v, 99999999) == NULL);
+  assert(get_from_vectore(v, 0) == NULL);
+
+  printf("testing chunk release\n");
+  my_type *near = malloc(sizeof(my_type));
+  near->x = 2;
+  assert(add_to_vectore(near, v, 5) == v);
+  assert(count_chunks(v) == 2);
+  free(far);
+  assert(clean_index(v, 100000000) == 1);
+  assert(count_chunks(v) == 1);
+  assert(get_last_used_index(v) == 5);
+  // directory back down to a growth step over the one page in use
+  assert(get_capacity(v) == 2 * VEC_CHUNK);
+  assert(get_from_vectore(v, 5) == near);
+
+  // writing NULL is a clean; no page for it
+  assert(add_to_vectore(NULL, v, VEC_CHUNK + 1) == v);
+  assert(count_chunks(v) == 1);
+  // overwriting doesn't count twice
+  my_type *again = malloc(sizeof(my_type));
+  again->x = 3;
+  assert(add_to_vectore(again, v, 5) == v);
+  assert(v->chunks[0]->used == 1);
+  free(near);
+  free(again);
+  assert(clean_index(v, 5) == 1);
+  assert(count_chunks(v) == 0);
+  assert(get_last_used_index(v) == NO_INDEX_USED);
+  free_vectore(v);
+
+  printf("testing against a plain vectore\n");
+  v = new_chunked_vectore();
+  vectore *ref = new_vectore();
+  srand(21);
+  for (int round = 0; round < 20000; round++) {
+    int i = rand() % (8 * VEC_CHUNK);
+    if (rand() % 3 == 0) {
+      free(get_from_vectore(v, i));
+      free(get_from_vectore(ref, i));
+      clean_index(v, i);
+      clean_index(ref, i);
+    } else if (get_from_vectore(v, i) == NULL) {
+      my_type *a = malloc(sizeof(my_type));
+      my_type *b = malloc(sizeof(my_type));
+      a->x = b->x = round;
+      assert(add_to_vectore(a, v, i) == v);
+      assert(add_to_vectore(b, ref, i) == ref);
+    }
+
+    assert(get_last_used_index(v) == get_last_used_index(ref));
+    if (round % 1000 == 0) {
+      for (int j = 0; j < 8 * VEC_CHUNK; j++) {
+	my_type *a = get_from_vectore(v, j);
+	my_type *b = get_from_vectore(ref, j);
+	assert((a == NULL) == (b == NULL));
+	assert(a == NULL || a->x == b->x);
+      }
+    }
+  }
+  free_vectore(v);
+  free_vectore(ref);
+
+  printf("chunked tests passed!\n");
+  return 1;
+}
+
+// value_vectore_foreach callback: adds up x and checks indexes go up
+static int sum_values(int i, my_type *e, void *arg) {
+  long long *acc = arg;
+  assert(i > acc[1]);
+  acc[0] += e->x;
+  acc[1] = i;
+  return 1;
+}
+
+static int stop_at_second(int i, my_type *e, void *arg) {
+  (void) i;
+  (void) e;
+  return ++*(int *) arg < 2;
+}
+
+int test_value_vectore(void) {
+  printf("beginning value tests\n");
+  value_vectore *v = new_value_vectore();
+  assert(get_value_capacity(v) == 1);
+  assert(get_value_last_used_index(v) == NO_INDEX_USED);
+  assert(get_from_value_vectore(v, 0) == NULL);
+  assert(get_from_value_vectore(v, -1) == NULL);
+
+  printf("testing add/get\n");
+  my_type e = { 1 };
+  assert(add_to_value_vectore(e, v, 0) == v);
+  e.x = 3;
+  assert(add_to_value_vectore(e, v, 2) == v);
+  // same growth as the pointer vectore
+  assert(get_value_capacity(v) == 4);
+  assert(get_value_last_used_index(v) == 2);
+  assert(get_from_value_vectore(v, 0)->x == 1);
+  assert(get_from_value_vectore(v, 1) == NULL);
+  assert(get_from_value_vectore(v, 2)->x == 3);
+  // copied in, so changing e does nothing
+  e.x = 4;
+  assert(get_from_value_vectore(v, 2)->x == 3);
+  assert(add_to_value_vectore(e, v, 2) == v);
+  assert(get_from_value_vectore(v, 2)->x == 4);
+  assert(add_to_value_vectore(e, v, -1) == NULL);
+  assert(add_to_value_vectore(e, v, INT_MAX) == NULL);
+  assert(get_value_capacity(v) == 4);
+
+  printf("testing clean across words\n");
+  e.x = 5;
+  assert(add_to_value_vectore(e, v, 130) == v);
+  assert(add_to_value_vectore(e, v, 64) == v);
+  assert(clean_value_index(v, 130) == 1);
+  assert(get_value_last_used_index(v) == 64);
+  assert(clean_value_index(v, 64) == 1);
+  assert(get_value_last_used_index(v) == 2);
+  assert(get_from_value_vectore(v, 64) == NULL);
+  // shrank back to a growth step over 0 .. 2
+  assert(get_value_capacity(v) == 6);
+  assert(get_from_value_vectore(v, 2)->x == 4);
+  assert(clean_value_index(v, 6) == 0);
+  assert(clean_value_index(v, 2) == 1);
+  assert(clean_value_index(v, 0) == 1);
+  assert(get_value_last_used_index(v) == NO_INDEX_USED);
+  free_value_vectore(v);
+
+  printf("testing foreach against an array\n");
+  v = new_value_vectore();
+  enum { N = 5000 };
+  static int ref[N];
+  static char have[N];
+  srand(22);
+  for (int round = 0; round < 40000; round++) {
+    int i = rand() % N;
+    if (rand() % 3 == 0) {
+      clean_value_index(v, i);
+      have[i] = 0;
+    } else {
+      e.x = round;
+      assert(add_to_value_vectore(e, v, i) == v);
+      ref[i] = round;
+      have[i] = 1;
+    }
+
+    if (round % 4000 == 0) {
+      long long want = 0;
+      int count = 0, last = NO_INDEX_USED;
+      for (int j = 0; j < N; j++) {
+	my_type *got = get_from_value_vectore(v, j);
+	assert((got != NULL) == have[j]);
+	if (have[j]) {
+	  assert(got->x == ref[j]);
+	  want += ref[j];
+	  count++;
+	  last = j;
+	}
+      }
+      assert(get_value_last_used_index(v) == last);
+
+      long long acc[2] = { 0, -1 };
+      assert(value_vectore_foreach(v, sum_values, acc) == count);
+      assert(acc[0] == want);
+    }
+  }
+
+  int seen = 0;
+  assert(value_vectore_foreach(v, stop_at_second, &seen) == 2);
+  free_value_vectore(v);
+
+  printf("value tests passed!\n");
+  return 1;
+}
+
+// vectore_foreach_occupied callback: records indexes into arg
+static int collect_index(int i, my_type *e, void *arg) {
+  int *out = arg;
+  assert(e != NULL);
+  out[++out[0]] = i;
+  return 1;
+}
+
+// checks foreach and last_used_index on v against have[0 .. n - 1]
+static void check_occupied(vectore *v, char *have, int n, int *scratch) {
+  int count = 0, last = NO_INDEX_USED;
+  scratch[0] = 0;
+  vectore_foreach_occupied(v, collect_index, scratch);
+  for (int j = 0; j < n; j++) {
+    if (have[j]) {
+      assert(scratch[1 + count] == j);
+      count++;
+      last = j;
+    }
+  }
+  assert(scratch[0] == count);
+  assert(get_last_used_index(v) == last);
+}
+
+int test_vectore_occupied(void) {
+  printf("beginning occupied tests\n");
+
+  printf("testing emptying out\n");
+  vectore *v = new_vectore();
+  my_type *a = malloc(sizeof(my_type));
+  a->x = 1;
+  assert(add_to_vectore(a, v, 0) == v);
+  assert(clean_index(v, 0) == 1);
+  assert(get_last_used_index(v) == NO_INDEX_USED);
+  assert(add_to_vectore(a, v, 0) == v);
+  // adding NULL is a clean too
+  assert(add_to_vectore(NULL, v, 0) == v);
+  assert(get_last_used_index(v) == NO_INDEX_USED);
+  assert(add_to_vectore(NULL, v, 3) == v);
+  assert(get_last_used_index(v) == NO_INDEX_USED);
+  free(a);
+
+  printf("testing many high indexes\n");
+  // four bitmap levels deep
+  enum { N = 300000 };
+  my_type *one = malloc(sizeof(my_type));
+  one->x = 7;
+  assert(add_to_vectore(one, v, 1) == v);
+  set_vectore_policy(v, 200, 0);
+  for (int i = N - 1; i >= N - 2000; i--) {
+    my_type *e = malloc(sizeof(my_type));
+    e->x = i;
+    assert(add_to_vectore(e, v, i) == v);
+  }
+  for (int i = N - 1; i >= N - 2000; i--) {
+    free(get_from_vectore(v, i));
+    assert(clean_index(v, i) == 1);
+    assert(get_last_used_index(v) == ((i == N - 2000) ? 1 : i - 1));
+  }
+  assert(get_capacity(v) >= N);
+  assert(get_from_vectore(v, 1) == one);
+  free_vectore(v);
+
+  printf("testing foreach against an array\n");
+  static char have[N];
+  static int scratch[N + 1];
+  for (int chunked = 0; chunked < 2; chunked++) {
+    v = chunked ? new_chunked_vectore() : new_vectore();
+    for (int j = 0; j < N; j++)
+      have[j] = 0;
+    srand(23);
+    for (int round = 0; round < 30000; round++) {
+      // mostly clustered low, some far out
+      int i = (rand() % 4 == 0) ? rand() % N : rand() % 2000;
+      if (rand() % 3 == 0) {
+	free(get_from_vectore(v, i));
+	clean_index(v, i);
+	have[i] = 0;
+      } else if (!have[i]) {
+	my_type *e = malloc(sizeof(my_type));
+	e->x = i;
+	assert(add_to_vectore(e, v, i) == v);
+	have[i] = 1;
+      }
+
+      if (round % 5000 == 0)
+	check_occupied(v, have, N, scratch);
+    }
+    check_occupied(v, have, N, scratch);
+
+    int stop = 0;
+    assert(vectore_foreach_occupied(v, stop_at_second, &stop) == 2);
+    free_vectore(v);
+  }
+
+  printf("occupied tests passed!\n");
+  return 1;
+}
+
+// vectore_map/vectore_reduce callbacks
+static void bump_x(int i, my_type *e, void *arg) {
+  (void) i;
+  e->x += *(int *) arg;
+}
+
+static vec_acc add_x(vec_acc acc, int i, my_type *e, void *arg) {
+  (void) i;
+  (void) arg;
+  return acc + e->x;
+}
+
+static vec_acc add_acc(vec_acc a, vec_acc b) {
+  return a + b;
+}
+
+// not commutative, so any mixup of the order parts go together in shows
+static vec_acc last_index(vec_acc acc, int i, my_type *e, void *arg) {
+  (void) acc;
+  (void) e;
+  (void) arg;
+  return i;
+}
+
+static vec_acc take_right(vec_acc a, vec_acc b) {
+  return (b == NO_INDEX_USED) ? a : b;
+}
+
+int test_vectore_bulk(void) {
+  printf("beginning bulk tests\n");
+  enum { N = 100000 };
+  static my_type *elems[N];
+  static my_type *out[N];
+
+  for (int chunked = 0; chunked < 2; chunked++) {
+    printf(chunked ? "testing chunked ranges\n" : "testing ranges\n");
+    vectore *v = chunked ? new_chunked_vectore() : new_vectore();
+
+    assert(add_range_to_vectore(v, -1, elems, 1) == NULL);
+    assert(add_range_to_vectore(v, 0, elems, 0) == v);
+    // one past the largest capacity; mustn't wrap into a tiny reserve
+    my_type top = {0};
+    assert(add_to_vectore(&top, v, INT_MAX) == NULL);
+    assert(get_last_used_index(v) == NO_INDEX_USED);
+
+    // every third one NULL, so holes inside words and chunks
+    for (int i = 0; i < N; i++) {
+      if (i % 3 == 0) {
+	elems[i] = NULL;
+      } else {
+	elems[i] = malloc(sizeof(my_type));
+	elems[i]->x = i;
+      }
+    }
+    // top one NULL too
+    free(elems[N - 1]);
+    elems[N - 1] = NULL;
+
+    assert(add_range_to_vectore(v, 10, elems, N) == v);
+    assert(get_capacity(v) >= N + 10);
+    assert(get_last_used_index(v) == N + 8);
+    for (int i = 0; i < N; i++) {
+      assert(get_from_vectore(v, i + 10) == elems[i]);
+    }
+    assert(get_from_vectore(v, 9) == NULL);
+
+    printf("testing get_range\n");
+    assert(get_range_from_vectore(v, -1, out, 1) == 0);
+    // runs past capacity, which comes back NULL
+    int past = get_capacity(v) - 500;
+    assert(get_range_from_vectore(v, past, out, 1000) == 1);
+    for (int i = 0; i < 1000; i++) {
+      assert(out[i] == get_from_vectore(v, past + i));
+    }
+    assert(get_range_from_vectore(v, 10, out, N) == 1);
+    assert(memcmp(out, elems, sizeof(elems)) == 0);
+
+    printf("testing map/reduce\n");
+    int expect_visits = 0;
+    for (int i = 0; i < N; i++) {
+      expect_visits += (elems[i] != NULL);
+    }
+    vec_acc sum = vectore_reduce(v, 0, add_x, add_acc, NULL, 1);
+    for (int threads = 1; threads <= 8; threads *= 2) {
+      int by = 1;
+      assert(vectore_map(v, bump_x, &by, threads) == expect_visits);
+      sum += expect_visits;
+      assert(vectore_reduce(v, 0, add_x, add_acc, NULL, threads) == sum);
+      assert(vectore_reduce(v, NO_INDEX_USED, last_index, take_right, NULL, threads) == N + 8);
+    }
+
+    printf("testing overwrite with a smaller range\n");
+    // NULLs over the top of what's there drops last_used_index
+    static my_type *nulls[64];
+    for (int i = N - 54; i < N; i++) {
+      free(elems[i]);
+      elems[i] = NULL;
+    }
+    assert(add_range_to_vectore(v, N - 44, nulls, 64) == v);
+    assert(get_last_used_index(v) == N + 10 - 56);
+    assert(add_range_to_vectore(v, 5, nulls, 3) == v);
+    assert(get_last_used_index(v) == N + 10 - 56);
+    free_vectore(v);
+  }
+
+  printf("bulk tests passed!\n");
+  return 1;
+}
+
+#ifndef VEC_BENCH
 int main(void) {
   test_vectore();
+  test_vectore_policy();
+  test_chunked_vectore();
+  test_value_vectore();
+  test_vectore_occupied();
+  test_vectore_bulk();
+}
+#else
+
+/*************
+ * BENCHMARK *
+ *************/
+
+// `make bench`: the ../bench/bench.h workloads with keys as indexes,
+// on a plain and a chunked vectore
+#include "../bench/bench.h"
+
+static void *bench_create(void) {
+  return new_vectore();
+}
+
+static void *bench_create_chunked(void) {
+  return new_chunked_vectore();
+}
+
+static int bench_insert(void *v, int key) {
+  // add overwrites, so check first like the other containers' inserts
+  if (get_from_vectore((vectore *) v, key) != NULL)
+    return 0;
+  my_type *e = malloc(sizeof(my_type));
+  e->x = key;
+  if (add_to_vectore(e, (vectore *) v, key) != NULL)
+    return 1;
+  free(e);
+  return 0;
+}
+
+static int bench_search(void *v, int key) {
+  return get_from_vectore((vectore *) v, key) != NULL;
+}
+
+static int bench_remove(void *v, int key) {
+  my_type *e = get_from_vectore((vectore *) v, key);
+  if (e == NULL)
+    return 0;
+  free(e);
+  return clean_index((vectore *) v, key);
+}
+
+static void bench_destroy(void *v) {
+  free_vectore((vectore *) v);
+}
+
+int main(int argc, char **argv) {
+  bench_ops ops[] = {
+    {"vectore", &bench_create, &bench_insert, &bench_search, &bench_remove, &bench_destroy},
+    {"chunked", &bench_create_chunked, &bench_insert, &bench_search, &bench_remove, &bench_destroy},
+  };
+  return bench_main(argc, argv, ops, 2);
 }
+#endif
 
 
@@ -0,0 +1,1075 @@
+/***************************************************
+ * Implementation of a lock-free skip list         *
+ * same comparator contract as RB_tree's           *
+ * sexy_rb_tree; insert, remove and search are all *
+ * CAS-based so any number of threads can write    *
+ * at once (Fraser / Herlihy-Shavit style, with    *
+ * the mark for "being removed" in the low bit of  *
+ * each next pointer)                              *
+ ***************************************************/
+
+// for pthreads and clock_gettime under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+// ordered_ops, so the list can be picked at runtime with the RB tree
+// and B-tree; sl_ordered_ops is at the end of IMPLEMENTATION
+#include "../modularizing_baby/ordered.h"
+
+// same values as the RB tree so comparators work in both
+#define LESS 61
+#define EQUAL 121
+#define GREATER 124
+
+// tallest tower; 1 / p ^ SL_MAX_LEVEL is way past anything we'd hold
+#define SL_MAX_LEVEL 32
+
+// chance a tower goes up another level if create_sl isn't given one
+#define SL_DEFAULT_P 0.25
+
+// bytes per pool chunk; towers are bump-allocated out of these
+#define SL_CHUNK_BYTES (1 << 20)
+
+/****************
+ * USER-DEFINED *
+ ****************/
+
+// struct to be put in the list
+typedef struct my_type {
+  int x;
+} my_type;
+
+// comparison function over my_types
+// returns LESS iff "a < b", EQUAL iff "a == b", GREATER iff "a > b"
+int int_compare(my_type *a, my_type *b) {
+  if (a->x < b->x)
+    return LESS;
+  else if (a->x > b->x)
+    return GREATER;
+  else
+    return EQUAL;
+}
+
+/*************
+ * INTERFACE *
+ *************/
+
+// links are uintptr_t so the low bit can mark the node they come out
+// of as removed; a marked link is never changed again
+typedef struct sl_node {
+  my_type *data;
+
+  // next tower on the retired or free stack it's on; separate from
+  // data and next[] so threads still walking past it read what they
+  // expect
+  struct sl_node *spare;
+
+  // levels 0 .. height - 1 are in use
+  int height;
+
+  uintptr_t next[];
+} sl_node;
+
+typedef struct sl_chunk {
+  struct sl_chunk *next;
+
+  // bytes handed out so far; only ever grows (atomically)
+  size_t used;
+
+  char mem[];
+} sl_chunk;
+
+// chunks never go back before free_sl; towers only get reused through
+// sl_reclaim, so a thread still looking at a removed node never sees
+// its memory change under it
+typedef struct sl_pool {
+  // newest chunk; older ones hang off ->next
+  sl_chunk *current;
+} sl_pool;
+
+typedef struct sexy_skip_list {
+  // sentinel tower of SL_MAX_LEVEL with no data
+  sl_node *head;
+
+  // changed atomically; exact once writers are done
+  int num_nodes;
+
+  // a tower goes up one more level with probability p
+  uint32_t p_threshold;
+
+  // splitmix64 counter; every random level takes the next value
+  uint64_t rng;
+
+  sl_pool pool;
+
+  // towers remove_sl took out (and ones an insert lost a race with),
+  // chained through spare; only pushed to while the list's in use
+  sl_node *retired;
+
+  // towers sl_reclaim made safe to reuse, by height - 1, chained
+  // through spare; only popped from while the list's in use, so
+  // neither stack can ABA
+  sl_node *free_towers[SL_MAX_LEVEL];
+
+  // returns LESS iff "a < b", EQUAL iff "a == b", GREATER iff "a > b"
+  int (*comp)(my_type *, my_type *);
+} sexy_skip_list;
+
+// usual "create, insert, remove, search, and free" functions
+// p is the chance a tower grows another level (SL_DEFAULT_P if it
+// isn't between 0 and 1); NULL if out of memory
+// insert/remove/search are safe from any number of threads at once;
+// create and free aren't
+// insert_sl returns 1 on success, 0 if something EQUAL is already in
+// the list or if out of memory; the list owns what goes in
+// remove_sl hands the data back (NULL if it's not there), but another
+// thread in search_sl might still be reading it: don't free it until
+// those are done
+// memory is O(total inserts) between sl_reclaim calls, not O(current
+// size): removed towers stay allocated until then
+sexy_skip_list *create_sl(int (*)(my_type *, my_type *), double p);
+int insert_sl(my_type *, sexy_skip_list *);
+my_type *remove_sl(my_type *, sexy_skip_list *);
+my_type *search_sl(my_type *, sexy_skip_list *);
+void free_sl(sexy_skip_list *);
+
+// puts every tower removed since the last call back on free lists that
+// insert_sl takes from before the pool; call with no other thread in
+// insert/remove/search (between phases of a long-running workload,
+// say); returns how many towers it freed up
+int sl_reclaim(sexy_skip_list *);
+
+// calls cb(data, arg) on everything in order (it's just level 0),
+// stopping early if cb returns 0; returns how many times cb was called
+// fine alongside writers, but then whatever they're in the middle of
+// may or may not be seen
+int sl_foreach(sexy_skip_list *, int (*cb)(my_type *, void *), void *arg);
+int sl_size(sexy_skip_list *);
+
+// every level sorted, every tower on all its levels and no marked
+// nodes left over; only call with no writers running
+int is_valid_skip_list(sexy_skip_list *);
+
+// helper functions: DO NOT EXPOSE
+
+// marked pointer plumbing
+static sl_node *sl_ref(uintptr_t link);
+static int sl_marked(uintptr_t link);
+static int sl_cas(uintptr_t *link, uintptr_t expect, uintptr_t want);
+static uintptr_t sl_load(uintptr_t *link);
+
+// lock-free bump allocation; NULL if out of memory
+static void *pool_alloc(sl_pool *, size_t bytes);
+static void pool_free(sl_pool *);
+
+// lock-free push/pop on a stack chained through spare; pop is only
+// safe while nothing pushes onto that stack (see free_towers)
+static void sl_push(sl_node **stack, sl_node *n);
+static sl_node *sl_pop(sl_node **stack);
+
+// a tower of height height, off the free list if there's one there
+static sl_node *alloc_tower(sexy_skip_list *, int height);
+
+// height for a new tower (1 .. SL_MAX_LEVEL)
+static int random_height(sexy_skip_list *);
+
+// fills preds/succs with the nodes either side of elem on every level,
+// cutting out marked nodes along the way; returns 1 if succs[0] holds
+// something EQUAL to elem
+static int sl_find(my_type *elem, sexy_skip_list *, sl_node **preds, sl_node **succs);
+
+// create_sl with the default p, for sl_ordered_ops
+static sexy_skip_list *create_sl_default(int (*)(my_type *, my_type *));
+
+/******************
+ * IMPLEMENTATION *
+ ******************/
+
+static sl_node *sl_ref(uintptr_t link) {
+  return (sl_node *) (link & ~(uintptr_t) 1);
+}
+
+static int sl_marked(uintptr_t link) {
+  return (int) (link & 1);
+}
+
+static int sl_cas(uintptr_t *link, uintptr_t expect, uintptr_t want) {
+  return __atomic_compare_exchange_n(link, &expect, want, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static uintptr_t sl_load(uintptr_t *link) {
+  return __atomic_load_n(link, __ATOMIC_ACQUIRE);
+}
+
+static void *pool_alloc(sl_pool *pool, size_t bytes) {
+  // keep every tower pointer-aligned (and the mark bit free)
+  bytes = (bytes + sizeof(uintptr_t) - 1) & ~(sizeof(uintptr_t) - 1);
+  assert(bytes <= SL_CHUNK_BYTES);
+
+  for (;;) {
+    sl_chunk *c = __atomic_load_n(&pool->current, __ATOMIC_ACQUIRE);
+
+    if (c != NULL) {
+      size_t off = __atomic_fetch_add(&c->used, bytes, __ATOMIC_RELAXED);
+      if (off + bytes <= SL_CHUNK_BYTES)
+        return c->mem + off;
+    }
+
+    // chunk's full: race to put a new one in front; losers free theirs
+    sl_chunk *nc = (sl_chunk *) malloc(sizeof(sl_chunk) + SL_CHUNK_BYTES);
+    if (nc == NULL)
+      return NULL;
+    nc->next = c;
+    nc->used = bytes;
+
+    if (__atomic_compare_exchange_n(&pool->current, &c, nc, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      return nc->mem;
+    free(nc);
+  }
+}
+
+static void pool_free(sl_pool *pool) {
+  sl_chunk *c = pool->current;
+
+  while (c != NULL) {
+    sl_chunk *next = c->next;
+    free(c);
+    c = next;
+  }
+}
+
+static void sl_push(sl_node **stack, sl_node *n) {
+  sl_node *top = __atomic_load_n(stack, __ATOMIC_RELAXED);
+  do {
+    n->spare = top;
+  } while (!__atomic_compare_exchange_n(stack, &top, n, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static sl_node *sl_pop(sl_node **stack) {
+  sl_node *top = __atomic_load_n(stack, __ATOMIC_ACQUIRE);
+  // top->spare can't change under us: nothing pushes meanwhile
+  while (top != NULL &&
+         !__atomic_compare_exchange_n(stack, &top, top->spare, 1,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    ;
+  return top;
+}
+
+static sl_node *alloc_tower(sexy_skip_list *l, int height) {
+  sl_node *n = sl_pop(&l->free_towers[height - 1]);
+  if (n != NULL)
+    return n;
+  return (sl_node *) pool_alloc(&l->pool, sizeof(sl_node) + height * sizeof(uintptr_t));
+}
+
+sexy_skip_list *create_sl(int (*comp)(my_type *, my_type *), double p) {
+  sexy_skip_list *ret = (sexy_skip_list *) malloc(sizeof(sexy_skip_list));
+  if (ret == NULL)
+    return NULL;
+
+  if (!(p > 0.0 && p < 1.0))
+    p = SL_DEFAULT_P;
+
+  ret->pool.current = NULL;
+  ret->head = (sl_node *) pool_alloc(&ret->pool,
+                                     sizeof(sl_node) + SL_MAX_LEVEL * sizeof(uintptr_t));
+  if (ret->head == NULL) {
+    free(ret);
+    return NULL;
+  }
+
+  ret->head->data = NULL;
+  ret->head->height = SL_MAX_LEVEL;
+  for (int i = 0; i < SL_MAX_LEVEL; i++)
+    ret->head->next[i] = 0;
+
+  ret->retired = NULL;
+  for (int i = 0; i < SL_MAX_LEVEL; i++)
+    ret->free_towers[i] = NULL;
+
+  ret->num_nodes = 0;
+  ret->p_threshold = (uint32_t) (p * 4294967296.0);
+  ret->rng = 0;
+  ret->comp = comp;
+
+  return ret;
+}
+
+void free_sl(sexy_skip_list *l) {
+  // removed towers are unlinked already; only free what's still in
+  for (sl_node *n = sl_ref(l->head->next[0]); n != NULL; n = sl_ref(n->next[0]))
+    free(n->data);
+
+  pool_free(&l->pool);
+  free(l);
+}
+
+static int random_height(sexy_skip_list *l) {
+  // splitmix64 over a shared counter: one atomic add, no lock
+  uint64_t z = __atomic_add_fetch(&l->rng, 0x9E3779B97F4A7C15ull, __ATOMIC_RELAXED);
+  int height = 1;
+
+  for (;;) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+
+    for (int i = 0; i < 2; i++) {
+      if (height == SL_MAX_LEVEL || (uint32_t) (z >> (32 * i)) >= l->p_threshold)
+        return height;
+      height++;
+    }
+  }
+}
+
+static int sl_find(my_type *elem, sexy_skip_list *l, sl_node **preds, sl_node **succs) {
+  int (*comp)(my_type *, my_type *) = l->comp;
+
+retry:
+  ;
+  sl_node *pred = l->head;
+
+  for (int level = SL_MAX_LEVEL - 1; level >= 0; level--) {
+    sl_node *cur = sl_ref(sl_load(&pred->next[level]));
+
+    while (cur != NULL) {
+      uintptr_t succ = sl_load(&cur->next[level]);
+
+      // cur is being removed: help cut it out before going on
+      if (sl_marked(succ)) {
+        if (!sl_cas(&pred->next[level], (uintptr_t) cur, (uintptr_t) sl_ref(succ)))
+          // pred changed (or got marked itself); start over
+          goto retry;
+        cur = sl_ref(succ);
+        continue;
+      }
+
+      if (comp(elem, cur->data) != GREATER)
+        break;
+
+      pred = cur;
+      cur = sl_ref(succ);
+    }
+
+    preds[level] = pred;
+    succs[level] = cur;
+  }
+
+  return succs[0] != NULL && comp(elem, succs[0]->data) == EQUAL;
+}
+
+my_type *search_sl(my_type *elem, sexy_skip_list *l) {
+  int (*comp)(my_type *, my_type *) = l->comp;
+
+  assert(elem != NULL);
+
+  // never writes: steps over marked nodes instead of cutting them out
+  sl_node *pred = l->head;
+  sl_node *cur = NULL;
+
+  for (int level = SL_MAX_LEVEL - 1; level >= 0; level--) {
+    cur = sl_ref(sl_load(&pred->next[level]));
+
+    while (cur != NULL) {
+      uintptr_t succ = sl_load(&cur->next[level]);
+
+      if (sl_marked(succ)) {
+        cur = sl_ref(succ);
+        continue;
+      }
+
+      if (comp(elem, cur->data) != GREATER)
+        break;
+
+      pred = cur;
+      cur = sl_ref(succ);
+    }
+  }
+
+  if (cur != NULL && comp(elem, cur->data) == EQUAL)
+    return cur->data;
+
+  return NULL;
+}
+
+int insert_sl(my_type *data, sexy_skip_list *l) {
+  assert(data != NULL);
+
+  sl_node *preds[SL_MAX_LEVEL];
+  sl_node *succs[SL_MAX_LEVEL];
+
+  // look before allocating so duplicates cost nothing
+  if (sl_find(data, l, preds, succs))
+    return 0;
+
+  int height = random_height(l);
+  sl_node *n = alloc_tower(l, height);
+  if (n == NULL)
+    return 0;
+
+  n->data = data;
+  n->height = height;
+
+  for (;;) {
+    for (int i = 0; i < height; i++)
+      n->next[i] = (uintptr_t) succs[i];
+
+    // linking level 0 is what puts n in the list
+    if (sl_cas(&preds[0]->next[0], (uintptr_t) succs[0], (uintptr_t) n))
+      break;
+
+    // lost a race; the tower was never visible so it can just be reused
+    if (sl_find(data, l, preds, succs)) {
+      // but someone got the same key in first; sl_reclaim gets n back
+      sl_push(&l->retired, n);
+      return 0;
+    }
+  }
+
+  __atomic_add_fetch(&l->num_nodes, 1, __ATOMIC_RELAXED);
+
+  // the rest of the levels are only shortcuts; link them best effort
+  for (int i = 1; i < height; i++) {
+    for (;;) {
+      uintptr_t mine = sl_load(&n->next[i]);
+
+      // n is being removed already; no point linking it any higher
+      if (sl_marked(mine))
+        return 1;
+
+      // succs may be stale after a retry; point n at the current one
+      if (sl_ref(mine) != succs[i] && !sl_cas(&n->next[i], mine, (uintptr_t) succs[i]))
+        continue;
+
+      if (sl_cas(&preds[i]->next[i], (uintptr_t) succs[i], (uintptr_t) n)) {
+        // a remove that started before this link went in may already
+        // be past level i; cut n back out ourselves
+        if (sl_marked(sl_load(&n->next[0]))) {
+          sl_find(data, l, preds, succs);
+          return 1;
+        }
+        break;
+      }
+
+      // something changed around n on level i; find its neighbours again
+      if (!sl_find(data, l, preds, succs) || succs[0] != n)
+        return 1;
+    }
+  }
+
+  return 1;
+}
+
+my_type *remove_sl(my_type *elem, sexy_skip_list *l) {
+  assert(elem != NULL);
+
+  sl_node *preds[SL_MAX_LEVEL];
+  sl_node *succs[SL_MAX_LEVEL];
+
+  if (!sl_find(elem, l, preds, succs))
+    return NULL;
+
+  sl_node *n = succs[0];
+
+  // mark top down so nobody can link n any higher while it goes
+  for (int i = n->height - 1; i >= 1; i--) {
+    uintptr_t succ = sl_load(&n->next[i]);
+    while (!sl_marked(succ)) {
+      sl_cas(&n->next[i], succ, succ | 1);
+      succ = sl_load(&n->next[i]);
+    }
+  }
+
+  // whoever marks level 0 is the one that removed it
+  for (;;) {
+    uintptr_t succ = sl_load(&n->next[0]);
+    if (sl_marked(succ))
+      return NULL;
+
+    if (sl_cas(&n->next[0], succ, succ | 1))
+      break;
+  }
+
+  __atomic_sub_fetch(&l->num_nodes, 1, __ATOMIC_RELAXED);
+
+  // cut it out of every level now rather than leaving it to others
+  sl_find(elem, l, preds, succs);
+
+  // other threads can still be on it; only sl_reclaim reuses it
+  my_type *ret = n->data;
+  sl_push(&l->retired, n);
+  return ret;
+}
+
+int sl_reclaim(sexy_skip_list *l) {
+  // nobody else is in here, so plain loads and stores are fine; cut out
+  // any marked tower a racing insert left linked on a higher level
+  for (int level = 0; level < SL_MAX_LEVEL; level++) {
+    sl_node *pred = l->head;
+    while (sl_ref(pred->next[level]) != NULL) {
+      sl_node *cur = sl_ref(pred->next[level]);
+      if (sl_marked(cur->next[level]))
+        pred->next[level] = (uintptr_t) sl_ref(cur->next[level]);
+      else
+        pred = cur;
+    }
+  }
+
+  int count = 0;
+  sl_node *n = l->retired;
+  l->retired = NULL;
+  while (n != NULL) {
+    sl_node *next = n->spare;
+    n->spare = l->free_towers[n->height - 1];
+    l->free_towers[n->height - 1] = n;
+    count++;
+    n = next;
+  }
+
+  return count;
+}
+
+int is_valid_skip_list(sexy_skip_list *l) {
+  int count = 0;
+
+  for (int level = 0; level < SL_MAX_LEVEL; level++) {
+    sl_node *prev = NULL;
+
+    for (uintptr_t link = l->head->next[level]; sl_ref(link) != NULL;
+         link = sl_ref(link)->next[level]) {
+      sl_node *n = sl_ref(link);
+
+      if (sl_marked(link) || sl_marked(n->next[level]) || n->height <= level)
+        return 0;
+      if (prev != NULL && l->comp(n->data, prev->data) != GREATER)
+        return 0;
+
+      if (level == 0) {
+        count++;
+      } else {
+        // every tower on level i has to be on level i - 1 too
+        sl_node *below = l->head;
+        while (below != NULL && below != n)
+          below = sl_ref(below->next[level - 1]);
+        if (below != n)
+          return 0;
+      }
+
+      prev = n;
+    }
+  }
+
+  return count == l->num_nodes;
+}
+
+int sl_foreach(sexy_skip_list *l, int (*cb)(my_type *, void *), void *arg) {
+  int count = 0;
+
+  for (sl_node *n = sl_ref(sl_load(&l->head->next[0])); n != NULL; ) {
+    uintptr_t next = sl_load(&n->next[0]);
+
+    // a marked link means n's been removed; step over it like search_sl
+    if (!sl_marked(next)) {
+      count++;
+      if (!cb(n->data, arg))
+        break;
+    }
+    n = sl_ref(next);
+  }
+
+  return count;
+}
+
+int sl_size(sexy_skip_list *l) {
+  return __atomic_load_n(&l->num_nodes, __ATOMIC_RELAXED);
+}
+
+static sexy_skip_list *create_sl_default(int (*comp)(my_type *, my_type *)) {
+  return create_sl(comp, 0);
+}
+
+ORDERED_DEFINE(sl, "skip_list", sexy_skip_list, create_sl_default, insert_sl, search_sl,
+               remove_sl, sl_foreach, sl_size, free_sl)
+
+/***************
+ * TEST SCRIPT *
+ ***************/
+
+static my_type *make_int(int x) {
+  my_type *ret = (my_type *) malloc(sizeof(my_type));
+  ret->x = x;
+  return ret;
+}
+
+static void test_single_thread(void) {
+  printf("beginning test_single_thread()\n");
+
+  int n = 20000;
+  sexy_skip_list *l = create_sl(&int_compare, 0.5);
+  assert(is_valid_skip_list(l));
+
+  my_type key;
+  key.x = 0;
+  assert(search_sl(&key, l) == NULL);
+  assert(remove_sl(&key, l) == NULL);
+
+  // scattered order; 7919 is prime so this hits every i once
+  for (int i = 0; i < n; i++)
+    assert(insert_sl(make_int(2 * ((i * 7919) % n)), l));
+  assert(l->num_nodes == n);
+  assert(is_valid_skip_list(l));
+
+  // duplicates are turned away
+  key.x = 10;
+  assert(!insert_sl(&key, l));
+  assert(l->num_nodes == n);
+
+  for (int i = -1; i < 2 * n + 1; i++) {
+    key.x = i;
+    my_type *got = search_sl(&key, l);
+    if (i >= 0 && i < 2 * n && i % 2 == 0)
+      assert(got != NULL && got->x == i);
+    else
+      assert(got == NULL);
+  }
+
+  for (int i = 0; i < 2 * n; i += 4) {
+    key.x = i;
+    my_type *got = remove_sl(&key, l);
+    assert(got != NULL && got->x == i);
+    free(got);
+    assert(search_sl(&key, l) == NULL);
+  }
+  assert(l->num_nodes == n / 2);
+  assert(is_valid_skip_list(l));
+
+  free_sl(l);
+  printf("test_single_thread() passed!\n");
+}
+
+static int count_chunks(sexy_skip_list *l) {
+  int count = 0;
+  for (sl_chunk *c = l->pool.current; c != NULL; c = c->next)
+    count++;
+  return count;
+}
+
+static void test_reclaim(void) {
+  printf("beginning test_reclaim()\n");
+
+  // a few MB of towers a round; without reuse the pool would keep
+  // growing by that much every round
+  int n = 50000;
+  sexy_skip_list *l = create_sl(&int_compare, 0);
+  my_type key;
+  int chunks = 0;
+
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < n; i++)
+      assert(insert_sl(make_int((int) ((i * 7919LL) % n)), l));
+    for (int i = 0; i < n; i++) {
+      key.x = i;
+      free(remove_sl(&key, l));
+    }
+    assert(l->num_nodes == 0 && is_valid_skip_list(l));
+
+    assert(sl_reclaim(l) == n);
+    assert(sl_reclaim(l) == 0);
+    if (round == 0)
+      chunks = count_chunks(l);
+    // heights come out differently each round, so a little slack
+    assert(count_chunks(l) <= chunks + 1);
+  }
+
+  // reused towers still make a good list
+  for (int i = 0; i < n; i++)
+    assert(insert_sl(make_int(i), l));
+  assert(is_valid_skip_list(l) && l->num_nodes == n);
+
+  free_sl(l);
+  printf("test_reclaim() passed!\n");
+}
+
+static void test_heights(void) {
+  printf("beginning test_heights()\n");
+
+  // about p of the towers on each level make it to the next
+  double ps[3] = {0.25, 0.5, 0.75};
+  for (int j = 0; j < 3; j++) {
+    sexy_skip_list *l = create_sl(&int_compare, ps[j]);
+    int counts[SL_MAX_LEVEL + 1] = {0};
+    int n = 100000;
+
+    for (int i = 0; i < n; i++) {
+      int h = random_height(l);
+      assert(h >= 1 && h <= SL_MAX_LEVEL);
+      counts[h]++;
+    }
+
+    // P(height == 1) is 1 - p
+    double ones = counts[1] / (double) n;
+    assert(ones > (1 - ps[j]) - 0.02 && ones < (1 - ps[j]) + 0.02);
+
+    free_sl(l);
+  }
+
+  // nonsense p falls back to the default
+  sexy_skip_list *l = create_sl(&int_compare, 2.0);
+  assert(l->p_threshold == (uint32_t) (SL_DEFAULT_P * 4294967296.0));
+  free_sl(l);
+
+  printf("test_heights() passed!\n");
+}
+
+#define SL_TEST_THREADS 4
+
+typedef struct sl_worker {
+  sexy_skip_list *l;
+  int id;
+  int n;
+
+  // what this thread got out of the list; other threads might still be
+  // comparing against it, so it can't be free'd until they're joined
+  my_type **removed;
+  int num_removed;
+
+  int inserted;
+} sl_worker;
+
+static void sl_worker_init(sl_worker *w, sexy_skip_list *l, int id, int n) {
+  w->l = l;
+  w->id = id;
+  w->n = n;
+  w->removed = (my_type **) malloc(n * sizeof(my_type *));
+  w->num_removed = 0;
+  w->inserted = 0;
+}
+
+static void sl_worker_done(sl_worker *w) {
+  for (int i = 0; i < w->num_removed; i++)
+    free(w->removed[i]);
+  free(w->removed);
+}
+
+// thread id inserts every key == id mod SL_TEST_THREADS, then pulls
+// out half of them; everyone hits the same parts of the list at once
+static void *sl_insert_remove_worker(void *arg) {
+  sl_worker *w = (sl_worker *) arg;
+
+  for (int i = w->id; i < w->n; i += SL_TEST_THREADS)
+    assert(insert_sl(make_int(i), w->l));
+
+  my_type key;
+  for (int i = w->id; i < w->n; i += 2 * SL_TEST_THREADS) {
+    key.x = i;
+    my_type *got = remove_sl(&key, w->l);
+    assert(got != NULL && got->x == i);
+    w->removed[w->num_removed++] = got;
+  }
+
+  return NULL;
+}
+
+// every thread fights over the same keys; exactly one insert and one
+// remove of each can win at a time
+static void *sl_contend_worker(void *arg) {
+  sl_worker *w = (sl_worker *) arg;
+
+  for (int i = 0; i < w->n; i++) {
+    my_type *d = make_int(i);
+    if (insert_sl(d, w->l))
+      w->inserted++;
+    else
+      free(d);
+  }
+
+  my_type key;
+  for (int i = 0; i < w->n; i++) {
+    key.x = i;
+    my_type *got = remove_sl(&key, w->l);
+    if (got != NULL)
+      w->removed[w->num_removed++] = got;
+  }
+
+  return NULL;
+}
+
+static void test_concurrent(void) {
+  printf("beginning test_concurrent()\n");
+
+  int n = 40000;
+  pthread_t threads[SL_TEST_THREADS];
+  sl_worker workers[SL_TEST_THREADS];
+
+  sexy_skip_list *l = create_sl(&int_compare, 0);
+  for (int i = 0; i < SL_TEST_THREADS; i++) {
+    sl_worker_init(&workers[i], l, i, n);
+    assert(pthread_create(&threads[i], NULL, &sl_insert_remove_worker, &workers[i]) == 0);
+  }
+  for (int i = 0; i < SL_TEST_THREADS; i++)
+    assert(pthread_join(threads[i], NULL) == 0);
+  for (int i = 0; i < SL_TEST_THREADS; i++)
+    sl_worker_done(&workers[i]);
+
+  assert(l->num_nodes == n / 2);
+  assert(is_valid_skip_list(l));
+
+  my_type key;
+  for (int i = 0; i < n; i++) {
+    key.x = i;
+    int kept = (i % (2 * SL_TEST_THREADS)) >= SL_TEST_THREADS;
+    assert((search_sl(&key, l) != NULL) == kept);
+  }
+  free_sl(l);
+
+  // twice over the same list, the second time on reclaimed towers
+  l = create_sl(&int_compare, 0);
+  int inserts = 0;
+  int removes = 0;
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < SL_TEST_THREADS; i++) {
+      sl_worker_init(&workers[i], l, i, n);
+      assert(pthread_create(&threads[i], NULL, &sl_contend_worker, &workers[i]) == 0);
+    }
+
+    int round_removes = 0;
+    for (int i = 0; i < SL_TEST_THREADS; i++)
+      assert(pthread_join(threads[i], NULL) == 0);
+    for (int i = 0; i < SL_TEST_THREADS; i++) {
+      inserts += workers[i].inserted;
+      round_removes += workers[i].num_removed;
+      sl_worker_done(&workers[i]);
+    }
+    removes += round_removes;
+
+    // removes can run ahead of slower threads' inserts, so those keys
+    // can go in twice; but every win has to be matched
+    assert(inserts >= n && inserts - removes == l->num_nodes);
+    assert(is_valid_skip_list(l));
+
+    // every removed tower, plus any an insert lost to a duplicate
+    assert(sl_reclaim(l) >= round_removes);
+  }
+  free_sl(l);
+
+  printf("test_concurrent() passed!\n");
+}
+
+// cb for sl_foreach: data has to come in increasing order; stops
+// once *arg more have gone by
+static int check_ordered(my_type *d, void *arg) {
+  int *state = (int *) arg;
+  assert(d->x > state[0]);
+  state[0] = d->x;
+  return --state[1] > 0;
+}
+
+static void test_ordered(void) {
+  printf("beginning test_ordered()\n");
+  ordered *o = ordered_create(&sl_ordered_ops, &int_compare);
+  assert(o != NULL && ordered_size(o) == 0);
+  assert(strcmp(o->ops->name, "skip_list") == 0);
+
+  int n = 5000;
+  my_type key;
+  for (int i = 0; i < n; i++) {
+    my_type *d = make_int((i * 7919) % n);
+    assert(ordered_insert(o, d));
+    assert(ordered_search(o, d) == d);
+  }
+  key.x = 3;
+  assert(!ordered_insert(o, &key));
+  assert(ordered_size(o) == n);
+
+  int state[2] = {-1, n + 1};
+  assert(ordered_iterate(o, &check_ordered, state) == n && state[0] == n - 1);
+  state[0] = -1;
+  state[1] = 40;
+  assert(ordered_iterate(o, &check_ordered, state) == 40 && state[0] == 39);
+
+  for (int i = 0; i < n; i += 2) {
+    key.x = i;
+    my_type *d = ordered_remove(o, &key);
+    assert(d != NULL && d->x == i);
+    free(d);
+  }
+  assert(ordered_size(o) == n / 2 && ordered_search(o, &key) == NULL);
+
+  // removed nodes are skipped, so only the odds come out
+  state[0] = -1;
+  state[1] = n + 1;
+  assert(ordered_iterate(o, &check_ordered, state) == n / 2);
+
+  // knowing it's a skip list gets the list back for direct calls
+  sexy_skip_list *l = sl_of(o);
+  assert(l != NULL && is_valid_skip_list(l));
+  key.x = 1;
+  assert(search_sl(&key, l)->x == 1);
+
+  ordered_destroy(o);
+  printf("test_ordered() passed!\n");
+}
+
+static void test_all(void) {
+  test_single_thread();
+  printf("\n");
+  test_heights();
+  printf("\n");
+  test_reclaim();
+  printf("\n");
+  test_concurrent();
+  printf("\n");
+  test_ordered();
+  printf("\n");
+}
+
+#ifndef SL_BENCH
+int main(void) {
+  test_all();
+}
+#else
+
+/*************
+ * BENCHMARK *
+ *************/
+
+// head-to-head against RB_tree's concurrent mode: every thread inserts
+// its own keys while searching for everyone's; the RB tree has to
+// serialize its writers, the skip list doesn't
+// built by `make bench`, which links in RBT_implementation.c (with its
+// main and int_compare renamed); these are the bits of its interface
+// we use, with the tree types left opaque
+typedef struct sexy_rb_tree sexy_rb_tree;
+typedef struct rb_reader rb_reader;
+sexy_rb_tree *create_rb_concurrent(int (*)(my_type *, my_type *), int slab_nodes,
+                                   int max_readers);
+rb_reader *rb_reader_join(sexy_rb_tree *);
+void rb_reader_leave(rb_reader *);
+my_type *search_baby_read(my_type *, rb_reader *);
+int insert_baby(my_type *, sexy_rb_tree *);
+void free_rb(sexy_rb_tree *);
+
+#define BENCH_KEYS 400000
+#define BENCH_SEARCHES_PER_INSERT 4
+
+typedef struct bench_worker {
+  sexy_skip_list *l;
+  sexy_rb_tree *t;
+  int id;
+  int threads;
+} bench_worker;
+
+static void *bench_thread(void *arg) {
+  bench_worker *w = (bench_worker *) arg;
+  rb_reader *r = (w->t != NULL) ? rb_reader_join(w->t) : NULL;
+  unsigned seed = (unsigned) w->id * 2654435761u + 1;
+  long found = 0;
+
+  for (int i = w->id; i < BENCH_KEYS; i += w->threads) {
+    my_type *d = make_int((int) ((i * 7919LL) % BENCH_KEYS));
+    if (w->l != NULL)
+      insert_sl(d, w->l);
+    else
+      insert_baby(d, w->t);
+
+    for (int j = 0; j < BENCH_SEARCHES_PER_INSERT; j++) {
+      my_type key;
+      seed = seed * 1103515245u + 12345u;
+      key.x = (int) ((seed >> 8) % BENCH_KEYS);
+      found += ((w->l != NULL) ? search_sl(&key, w->l) : search_baby_read(&key, r)) != NULL;
+    }
+  }
+
+  if (r != NULL)
+    rb_reader_leave(r);
+  return (void *) found;
+}
+
+static double bench_run(int threads, int use_sl) {
+  pthread_t tids[64];
+  bench_worker w[64];
+  sexy_skip_list *l = use_sl ? create_sl(&int_compare, 0) : NULL;
+  sexy_rb_tree *t = use_sl ? NULL : create_rb_concurrent(&int_compare, 0, threads);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int i = 0; i < threads; i++) {
+    w[i].l = l;
+    w[i].t = t;
+    w[i].id = i;
+    w[i].threads = threads;
+    pthread_create(&tids[i], NULL, &bench_thread, &w[i]);
+  }
+  for (int i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (use_sl)
+    free_sl(l);
+  else
+    free_rb(t);
+
+  double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  return BENCH_KEYS * (1.0 + BENCH_SEARCHES_PER_INSERT) / secs / 1e6;
+}
+
+// the single-threaded ../bench/bench.h workloads come first, so the
+// skip list lines up against every other container's `make bench`
+#include "../bench/bench.h"
+
+static void *bench_create(void) {
+  return create_sl(&int_compare, 0);
+}
+
+static int bench_insert(void *l, int key) {
+  my_type *d = make_int(key);
+  if (insert_sl(d, (sexy_skip_list *) l))
+    return 1;
+  free(d);
+  return 0;
+}
+
+static int bench_search(void *l, int key) {
+  my_type k;
+  k.x = key;
+  return search_sl(&k, (sexy_skip_list *) l) != NULL;
+}
+
+static int bench_remove(void *l, int key) {
+  my_type k;
+  k.x = key;
+  my_type *d = remove_sl(&k, (sexy_skip_list *) l);
+  free(d);
+  return d != NULL;
+}
+
+static void bench_destroy(void *l) {
+  free_sl((sexy_skip_list *) l);
+}
+
+int main(int argc, char **argv) {
+  bench_ops ops[] = {
+    {"skip_list", &bench_create, &bench_insert, &bench_search, &bench_remove, &bench_destroy},
+  };
+  if (bench_main(argc, argv, ops, 1) != 0)
+    return 1;
+
+  printf("\n%d keys, %d searches per insert, Mops/s\n", BENCH_KEYS, BENCH_SEARCHES_PER_INSERT);
+  printf("threads  skip_list  rb_tree\n");
+
+  int counts[4] = {1, 2, 4, 8};
+  for (int i = 0; i < 4; i++)
+    printf("%7d  %9.2f  %7.2f\n", counts[i], bench_run(counts[i], 1), bench_run(counts[i], 0));
+}
+#endif
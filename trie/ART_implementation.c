@@ -0,0 +1,1248 @@
+/***************************************************
+ * Implementation of an adaptive radix trie (ART)  *
+ * string keys; lookups cost O(key length), no     *
+ * comparator and no log n                         *
+ * inner nodes come in 4/16/48/256 child sizes and *
+ * grow/shrink as children come and go; runs of    *
+ * single-child nodes are squashed into a prefix   *
+ * thanks to Leis et al., "The Adaptive Radix      *
+ * Tree: ARTful Indexing for Main-Memory Databases" *
+ ***************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define ART_SSE2 1
+#endif
+
+// node types
+#define NODE4 1
+#define NODE16 2
+#define NODE48 3
+#define NODE256 4
+
+// prefix bytes kept in each node; longer prefixes are only counted
+// and get checked against a leaf's key instead
+#define ART_MAX_PREFIX 10
+
+/****************
+ * USER-DEFINED *
+ ****************/
+
+// struct to be put in the trie; the key lives in the same malloc so
+// free()ing a my_type frees its key too
+typedef struct my_type {
+  int x;
+  char key[];
+} my_type;
+
+// string the trie indexes a my_type by; has to stay put while it's in
+// the trie; the trie uses all of it plus the '\0', so no key is ever
+// a prefix of another key and keys can't have '\0's in them
+const char *my_key(my_type *d) {
+  return d->key;
+}
+
+/*************
+ * INTERFACE *
+ *************/
+
+// every inner node starts with this
+typedef struct art_node {
+  uint8_t type;
+  uint16_t num_children;
+
+  // bytes every key under this node has in common past the byte that
+  // led here; only the first ART_MAX_PREFIX are kept in partial
+  uint32_t partial_len;
+  unsigned char partial[ART_MAX_PREFIX];
+} art_node;
+
+// children hold either an art_node * or a my_type * with the low bit
+// set (a leaf); my_types come from malloc so that bit is always free
+// sorted keys[i] leads to children[i]
+typedef struct art_node4 {
+  art_node n;
+  unsigned char keys[4];
+  art_node *children[4];
+} art_node4;
+
+typedef struct art_node16 {
+  art_node n;
+  unsigned char keys[16];
+  art_node *children[16];
+} art_node16;
+
+// child_index[c] is 1 + where byte c's child is in children (0 if none)
+typedef struct art_node48 {
+  art_node n;
+  unsigned char child_index[256];
+  art_node *children[48];
+} art_node48;
+
+typedef struct art_node256 {
+  art_node n;
+  art_node *children[256];
+} art_node256;
+
+typedef struct sexy_art {
+  art_node *root;
+  int num_keys;
+
+  const char *(*key)(my_type *);
+} sexy_art;
+
+// usual "create, insert, remove, search, and free" functions; the
+// trie owns what goes in like the trees do (NULL if out of memory)
+// insert_art returns 1 on success, 0 if the key's already there (trie
+// left alone) or out of memory; remove_art hands the data back
+sexy_art *create_art(const char *(*key)(my_type *));
+int insert_art(my_type *, sexy_art *);
+my_type *remove_art(const char *key, sexy_art *);
+my_type *search_art(const char *key, sexy_art *);
+void free_art(sexy_art *);
+
+// calls cb(data, arg) in key order on everything whose key starts with
+// prefix ("" is everything); stops early if cb returns 0; returns how
+// many times cb was called
+int art_prefix_scan(const char *prefix, sexy_art *, int (*cb)(my_type *, void *), void *arg);
+
+// the entry with the longest key that's a prefix of query (query
+// itself counts), NULL if none; e.g. routing tables
+my_type *art_longest_prefix(const char *query, sexy_art *);
+
+// checks node sizes and ordering, that every leaf's key matches the
+// path to it and the stored prefixes, and num_keys
+int is_valid_art(sexy_art *);
+
+// helper functions: DO NOT EXPOSE
+
+// leaf tagging
+static int is_leaf(art_node *);
+static my_type *leaf_data(art_node *);
+static art_node *make_leaf(my_type *);
+
+// NULL if out of memory
+static art_node *alloc_art_node(uint8_t type);
+
+// slot byte c's child is in, NULL if none
+static art_node **find_child(art_node *, unsigned char c);
+
+// leftmost leaf under n
+static my_type *minimum(art_node *n);
+
+// how many of n's prefix bytes key[depth ..] matches, only looking at
+// the stored ones (so up to ART_MAX_PREFIX)
+static uint32_t check_prefix(art_node *n, const unsigned char *key, size_t len, size_t depth);
+
+// same but over the whole prefix (goes to a leaf for the bytes that
+// aren't stored)
+static uint32_t prefix_mismatch(art_node *n, const unsigned char *key, size_t len,
+                                size_t depth, sexy_art *);
+
+// adds child under byte c, growing n (and changing *ref) if it's full
+// returns 0 if out of memory (nothing changed)
+static int add_child(art_node *n, art_node **ref, unsigned char c, art_node *child);
+
+// takes out the child under byte c, shrinking n (and changing *ref) if
+// it's gotten small enough; never fails
+static void remove_child(art_node *n, art_node **ref, unsigned char c);
+
+// calls cb on every leaf under n in order; returns 0 if cb said stop
+static int iterate(art_node *n, int (*cb)(my_type *, void *), void *arg, int *count);
+
+/******************
+ * IMPLEMENTATION *
+ ******************/
+
+static int is_leaf(art_node *n) {
+  return ((uintptr_t) n & 1) != 0;
+}
+
+static my_type *leaf_data(art_node *n) {
+  return (my_type *) ((uintptr_t) n & ~(uintptr_t) 1);
+}
+
+static art_node *make_leaf(my_type *d) {
+  assert(((uintptr_t) d & 1) == 0);
+  return (art_node *) ((uintptr_t) d | 1);
+}
+
+// key bytes including the '\0'
+static const unsigned char *leaf_key(my_type *d, sexy_art *t, size_t *len) {
+  const char *k = t->key(d);
+  *len = strlen(k) + 1;
+  return (const unsigned char *) k;
+}
+
+static art_node *alloc_art_node(uint8_t type) {
+  size_t size;
+
+  switch (type) {
+  case NODE4:
+    size = sizeof(art_node4);
+    break;
+  case NODE16:
+    size = sizeof(art_node16);
+    break;
+  case NODE48:
+    size = sizeof(art_node48);
+    break;
+  default:
+    size = sizeof(art_node256);
+  }
+
+  art_node *n = (art_node *) calloc(1, size);
+  if (n != NULL)
+    n->type = type;
+  return n;
+}
+
+sexy_art *create_art(const char *(*key)(my_type *)) {
+  sexy_art *ret = (sexy_art *) malloc(sizeof(sexy_art));
+  if (ret == NULL)
+    return NULL;
+
+  ret->root = NULL;
+  ret->num_keys = 0;
+  ret->key = key;
+
+  return ret;
+}
+
+static void free_art_nodes(art_node *n) {
+  if (n == NULL)
+    return;
+
+  if (is_leaf(n)) {
+    free(leaf_data(n));
+    return;
+  }
+
+  switch (n->type) {
+  case NODE4:
+    for (int i = 0; i < n->num_children; i++)
+      free_art_nodes(((art_node4 *) n)->children[i]);
+    break;
+  case NODE16:
+    for (int i = 0; i < n->num_children; i++)
+      free_art_nodes(((art_node16 *) n)->children[i]);
+    break;
+  case NODE48:
+    for (int i = 0; i < n->num_children; i++)
+      free_art_nodes(((art_node48 *) n)->children[i]);
+    break;
+  default:
+    for (int i = 0; i < 256; i++)
+      free_art_nodes(((art_node256 *) n)->children[i]);
+  }
+
+  free(n);
+}
+
+void free_art(sexy_art *t) {
+  free_art_nodes(t->root);
+  free(t);
+}
+
+static art_node **find_child(art_node *n, unsigned char c) {
+  switch (n->type) {
+  case NODE4: {
+    art_node4 *p = (art_node4 *) n;
+    for (int i = 0; i < n->num_children; i++)
+      if (p->keys[i] == c)
+        return &p->children[i];
+    return NULL;
+  }
+  case NODE16: {
+    art_node16 *p = (art_node16 *) n;
+#if ART_SSE2
+    // all 16 keys in one compare
+    __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char) c),
+                                 _mm_loadu_si128((const __m128i *) p->keys));
+    int mask = _mm_movemask_epi8(cmp) & ((1 << n->num_children) - 1);
+    if (mask != 0)
+      return &p->children[__builtin_ctz(mask)];
+#else
+    for (int i = 0; i < n->num_children; i++)
+      if (p->keys[i] == c)
+        return &p->children[i];
+#endif
+    return NULL;
+  }
+  case NODE48: {
+    art_node48 *p = (art_node48 *) n;
+    if (p->child_index[c] != 0)
+      return &p->children[p->child_index[c] - 1];
+    return NULL;
+  }
+  default: {
+    art_node256 *p = (art_node256 *) n;
+    if (p->children[c] != NULL)
+      return &p->children[c];
+    return NULL;
+  }
+  }
+}
+
+static my_type *minimum(art_node *n) {
+  while (!is_leaf(n)) {
+    switch (n->type) {
+    case NODE4:
+      n = ((art_node4 *) n)->children[0];
+      break;
+    case NODE16:
+      n = ((art_node16 *) n)->children[0];
+      break;
+    case NODE48: {
+      art_node48 *p = (art_node48 *) n;
+      int c = 0;
+      while (p->child_index[c] == 0)
+        c++;
+      n = p->children[p->child_index[c] - 1];
+      break;
+    }
+    default: {
+      art_node256 *p = (art_node256 *) n;
+      int c = 0;
+      while (p->children[c] == NULL)
+        c++;
+      n = p->children[c];
+    }
+    }
+  }
+
+  return leaf_data(n);
+}
+
+static uint32_t check_prefix(art_node *n, const unsigned char *key, size_t len, size_t depth) {
+  uint32_t max = n->partial_len < ART_MAX_PREFIX ? n->partial_len : ART_MAX_PREFIX;
+  if (len - depth < max)
+    max = (uint32_t) (len - depth);
+
+  uint32_t i = 0;
+  while (i < max && n->partial[i] == key[depth + i])
+    i++;
+  return i;
+}
+
+static uint32_t prefix_mismatch(art_node *n, const unsigned char *key, size_t len,
+                                size_t depth, sexy_art *t) {
+  uint32_t i = check_prefix(n, key, len, depth);
+  if (i < ART_MAX_PREFIX || n->partial_len <= ART_MAX_PREFIX)
+    return i;
+
+  // rest of the prefix isn't stored; any leaf underneath has it
+  size_t llen;
+  const unsigned char *lkey = leaf_key(minimum(n), t, &llen);
+  uint32_t max = n->partial_len;
+  if (len - depth < max)
+    max = (uint32_t) (len - depth);
+
+  while (i < max && lkey[depth + i] == key[depth + i])
+    i++;
+  return i;
+}
+
+my_type *search_art(const char *key, sexy_art *t) {
+  assert(key != NULL);
+
+  const unsigned char *k = (const unsigned char *) key;
+  size_t len = strlen(key) + 1;
+  size_t depth = 0;
+  art_node *n = t->root;
+
+  while (n != NULL) {
+    if (is_leaf(n)) {
+      // prefixes past ART_MAX_PREFIX were skipped, so check it all
+      my_type *d = leaf_data(n);
+      return (strcmp(t->key(d), key) == 0) ? d : NULL;
+    }
+
+    if (n->partial_len != 0) {
+      uint32_t stored = n->partial_len < ART_MAX_PREFIX ? n->partial_len : ART_MAX_PREFIX;
+      if (check_prefix(n, k, len, depth) != stored)
+        return NULL;
+      depth += n->partial_len;
+    }
+
+    if (depth >= len)
+      return NULL;
+
+    art_node **child = find_child(n, k[depth]);
+    n = (child != NULL) ? *child : NULL;
+    depth++;
+  }
+
+  return NULL;
+}
+
+static int add_child(art_node *n, art_node **ref, unsigned char c, art_node *child) {
+  switch (n->type) {
+  case NODE4: {
+    art_node4 *p = (art_node4 *) n;
+    if (n->num_children < 4) {
+      int i = 0;
+      while (i < n->num_children && p->keys[i] < c)
+        i++;
+      memmove(p->keys + i + 1, p->keys + i, n->num_children - i);
+      memmove(p->children + i + 1, p->children + i, (n->num_children - i) * sizeof(art_node *));
+      p->keys[i] = c;
+      p->children[i] = child;
+      n->num_children++;
+      return 1;
+    }
+
+    art_node16 *bigger = (art_node16 *) alloc_art_node(NODE16);
+    if (bigger == NULL)
+      return 0;
+    memcpy(&bigger->n, n, sizeof(art_node));
+    bigger->n.type = NODE16;
+    memcpy(bigger->keys, p->keys, 4);
+    memcpy(bigger->children, p->children, 4 * sizeof(art_node *));
+    *ref = &bigger->n;
+    free(n);
+    return add_child(&bigger->n, ref, c, child);
+  }
+  case NODE16: {
+    art_node16 *p = (art_node16 *) n;
+    if (n->num_children < 16) {
+      int i = 0;
+      while (i < n->num_children && p->keys[i] < c)
+        i++;
+      memmove(p->keys + i + 1, p->keys + i, n->num_children - i);
+      memmove(p->children + i + 1, p->children + i, (n->num_children - i) * sizeof(art_node *));
+      p->keys[i] = c;
+      p->children[i] = child;
+      n->num_children++;
+      return 1;
+    }
+
+    art_node48 *bigger = (art_node48 *) alloc_art_node(NODE48);
+    if (bigger == NULL)
+      return 0;
+    memcpy(&bigger->n, n, sizeof(art_node));
+    bigger->n.type = NODE48;
+    memcpy(bigger->children, p->children, 16 * sizeof(art_node *));
+    for (int i = 0; i < 16; i++)
+      bigger->child_index[p->keys[i]] = (unsigned char) (i + 1);
+    *ref = &bigger->n;
+    free(n);
+    return add_child(&bigger->n, ref, c, child);
+  }
+  case NODE48: {
+    art_node48 *p = (art_node48 *) n;
+    if (n->num_children < 48) {
+      // removes keep children packed, so the next free slot is the end
+      p->children[n->num_children] = child;
+      p->child_index[c] = (unsigned char) (n->num_children + 1);
+      n->num_children++;
+      return 1;
+    }
+
+    art_node256 *bigger = (art_node256 *) alloc_art_node(NODE256);
+    if (bigger == NULL)
+      return 0;
+    memcpy(&bigger->n, n, sizeof(art_node));
+    bigger->n.type = NODE256;
+    for (int i = 0; i < 256; i++)
+      if (p->child_index[i] != 0)
+        bigger->children[i] = p->children[p->child_index[i] - 1];
+    *ref = &bigger->n;
+    free(n);
+    return add_child(&bigger->n, ref, c, child);
+  }
+  default: {
+    art_node256 *p = (art_node256 *) n;
+    p->children[c] = child;
+    n->num_children++;
+    return 1;
+  }
+  }
+}
+
+int insert_art(my_type *data, sexy_art *t) {
+  assert(data != NULL);
+
+  size_t len;
+  const unsigned char *key = leaf_key(data, t, &len);
+  art_node **ref = &t->root;
+  size_t depth = 0;
+
+  for (;;) {
+    art_node *n = *ref;
+
+    if (n == NULL) {
+      *ref = make_leaf(data);
+      break;
+    }
+
+    if (is_leaf(n)) {
+      size_t llen;
+      const unsigned char *lkey = leaf_key(leaf_data(n), t, &llen);
+
+      // DON'T ALLOW DUPLICATES
+      if (llen == len && memcmp(lkey, key, len) == 0)
+        return 0;
+
+      // split the leaf: new node holds whatever the two keys share
+      // (they're '\0' terminated so they have to differ somewhere)
+      art_node *split = alloc_art_node(NODE4);
+      if (split == NULL)
+        return 0;
+
+      size_t lcp = 0;
+      while (lkey[depth + lcp] == key[depth + lcp])
+        lcp++;
+
+      split->partial_len = (uint32_t) lcp;
+      memcpy(split->partial, key + depth, lcp < ART_MAX_PREFIX ? lcp : ART_MAX_PREFIX);
+      // split has room, so these can't fail
+      add_child(split, &split, lkey[depth + lcp], n);
+      add_child(split, &split, key[depth + lcp], make_leaf(data));
+      *ref = split;
+      break;
+    }
+
+    if (n->partial_len != 0) {
+      uint32_t diff = prefix_mismatch(n, key, len, depth, t);
+
+      if (diff < n->partial_len) {
+        // key leaves the prefix partway: new node above n for the
+        // shared bit, n keeps what's after the byte they split on
+        art_node *split = alloc_art_node(NODE4);
+        if (split == NULL)
+          return 0;
+
+        split->partial_len = diff;
+        memcpy(split->partial, n->partial, diff < ART_MAX_PREFIX ? diff : ART_MAX_PREFIX);
+
+        if (n->partial_len <= ART_MAX_PREFIX) {
+          add_child(split, &split, n->partial[diff], n);
+          n->partial_len -= diff + 1;
+          memmove(n->partial, n->partial + diff + 1, n->partial_len);
+        } else {
+          // n's prefix isn't all stored; get the bytes from a leaf
+          size_t llen;
+          const unsigned char *lkey = leaf_key(minimum(n), t, &llen);
+          add_child(split, &split, lkey[depth + diff], n);
+          n->partial_len -= diff + 1;
+          memcpy(n->partial, lkey + depth + diff + 1,
+                 n->partial_len < ART_MAX_PREFIX ? n->partial_len : ART_MAX_PREFIX);
+        }
+
+        add_child(split, &split, key[depth + diff], make_leaf(data));
+        *ref = split;
+        break;
+      }
+
+      depth += n->partial_len;
+    }
+
+    art_node **child = find_child(n, key[depth]);
+    if (child == NULL) {
+      if (!add_child(n, ref, key[depth], make_leaf(data)))
+        return 0;
+      break;
+    }
+
+    ref = child;
+    depth++;
+  }
+
+  t->num_keys++;
+  return 1;
+}
+
+static void remove_child(art_node *n, art_node **ref, unsigned char c) {
+  switch (n->type) {
+  case NODE4: {
+    art_node4 *p = (art_node4 *) n;
+    int i = 0;
+    while (p->keys[i] != c)
+      i++;
+    memmove(p->keys + i, p->keys + i + 1, n->num_children - i - 1);
+    memmove(p->children + i, p->children + i + 1, (n->num_children - i - 1) * sizeof(art_node *));
+    n->num_children--;
+
+    if (n->num_children > 1)
+      return;
+
+    // one child left: squash n into it, merging prefixes
+    art_node *child = p->children[0];
+    if (!is_leaf(child)) {
+      unsigned char merged[ART_MAX_PREFIX];
+      uint32_t len = n->partial_len;
+      if (len > ART_MAX_PREFIX)
+        len = ART_MAX_PREFIX;
+      memcpy(merged, n->partial, len);
+      if (len < ART_MAX_PREFIX)
+        merged[len++] = p->keys[0];
+      uint32_t take = child->partial_len;
+      if (take > ART_MAX_PREFIX - len)
+        take = ART_MAX_PREFIX - len;
+      memcpy(merged + len, child->partial, take);
+
+      memcpy(child->partial, merged, len + take);
+      child->partial_len += n->partial_len + 1;
+    }
+
+    *ref = child;
+    free(n);
+    return;
+  }
+  case NODE16: {
+    art_node16 *p = (art_node16 *) n;
+    int i = 0;
+    while (p->keys[i] != c)
+      i++;
+    memmove(p->keys + i, p->keys + i + 1, n->num_children - i - 1);
+    memmove(p->children + i, p->children + i + 1, (n->num_children - i - 1) * sizeof(art_node *));
+    n->num_children--;
+
+    // shrink with some slack so a key going in and out doesn't thrash
+    if (n->num_children != 3)
+      return;
+
+    art_node4 *smaller = (art_node4 *) alloc_art_node(NODE4);
+    // too small to be worth failing over; stay a NODE16
+    if (smaller == NULL)
+      return;
+    memcpy(&smaller->n, n, sizeof(art_node));
+    smaller->n.type = NODE4;
+    memcpy(smaller->keys, p->keys, 3);
+    memcpy(smaller->children, p->children, 3 * sizeof(art_node *));
+    *ref = &smaller->n;
+    free(n);
+    return;
+  }
+  case NODE48: {
+    art_node48 *p = (art_node48 *) n;
+    int pos = p->child_index[c] - 1;
+    int last = n->num_children - 1;
+
+    // keep children packed: last one moves into the hole
+    if (pos != last) {
+      p->children[pos] = p->children[last];
+      for (int i = 0; i < 256; i++) {
+        if (p->child_index[i] == last + 1) {
+          p->child_index[i] = (unsigned char) (pos + 1);
+          break;
+        }
+      }
+    }
+    p->child_index[c] = 0;
+    n->num_children--;
+
+    if (n->num_children != 12)
+      return;
+
+    art_node16 *smaller = (art_node16 *) alloc_art_node(NODE16);
+    if (smaller == NULL)
+      return;
+    memcpy(&smaller->n, n, sizeof(art_node));
+    smaller->n.type = NODE16;
+    int j = 0;
+    for (int i = 0; i < 256; i++) {
+      if (p->child_index[i] != 0) {
+        smaller->keys[j] = (unsigned char) i;
+        smaller->children[j] = p->children[p->child_index[i] - 1];
+        j++;
+      }
+    }
+    *ref = &smaller->n;
+    free(n);
+    return;
+  }
+  default: {
+    art_node256 *p = (art_node256 *) n;
+    p->children[c] = NULL;
+    n->num_children--;
+
+    if (n->num_children != 37)
+      return;
+
+    art_node48 *smaller = (art_node48 *) alloc_art_node(NODE48);
+    if (smaller == NULL)
+      return;
+    memcpy(&smaller->n, n, sizeof(art_node));
+    smaller->n.type = NODE48;
+    int j = 0;
+    for (int i = 0; i < 256; i++) {
+      if (p->children[i] != NULL) {
+        smaller->children[j] = p->children[i];
+        smaller->child_index[i] = (unsigned char) (j + 1);
+        j++;
+      }
+    }
+    *ref = &smaller->n;
+    free(n);
+  }
+  }
+}
+
+my_type *remove_art(const char *key, sexy_art *t) {
+  assert(key != NULL);
+
+  const unsigned char *k = (const unsigned char *) key;
+  size_t len = strlen(key) + 1;
+  art_node **ref = &t->root;
+  size_t depth = 0;
+
+  if (t->root == NULL)
+    return NULL;
+
+  if (is_leaf(t->root)) {
+    my_type *d = leaf_data(t->root);
+    if (strcmp(t->key(d), key) != 0)
+      return NULL;
+    t->root = NULL;
+    t->num_keys--;
+    return d;
+  }
+
+  for (;;) {
+    art_node *n = *ref;
+
+    if (n->partial_len != 0) {
+      uint32_t stored = n->partial_len < ART_MAX_PREFIX ? n->partial_len : ART_MAX_PREFIX;
+      if (check_prefix(n, k, len, depth) != stored)
+        return NULL;
+      depth += n->partial_len;
+    }
+
+    if (depth >= len)
+      return NULL;
+
+    art_node **child = find_child(n, k[depth]);
+    if (child == NULL)
+      return NULL;
+
+    if (is_leaf(*child)) {
+      my_type *d = leaf_data(*child);
+      if (strcmp(t->key(d), key) != 0)
+        return NULL;
+
+      remove_child(n, ref, k[depth]);
+      t->num_keys--;
+      return d;
+    }
+
+    ref = child;
+    depth++;
+  }
+}
+
+static int iterate(art_node *n, int (*cb)(my_type *, void *), void *arg, int *count) {
+  if (is_leaf(n)) {
+    (*count)++;
+    return cb(leaf_data(n), arg);
+  }
+
+  switch (n->type) {
+  case NODE4:
+    for (int i = 0; i < n->num_children; i++)
+      if (!iterate(((art_node4 *) n)->children[i], cb, arg, count))
+        return 0;
+    break;
+  case NODE16:
+    for (int i = 0; i < n->num_children; i++)
+      if (!iterate(((art_node16 *) n)->children[i], cb, arg, count))
+        return 0;
+    break;
+  case NODE48: {
+    art_node48 *p = (art_node48 *) n;
+    for (int i = 0; i < 256; i++)
+      if (p->child_index[i] != 0 && !iterate(p->children[p->child_index[i] - 1], cb, arg, count))
+        return 0;
+    break;
+  }
+  default: {
+    art_node256 *p = (art_node256 *) n;
+    for (int i = 0; i < 256; i++)
+      if (p->children[i] != NULL && !iterate(p->children[i], cb, arg, count))
+        return 0;
+  }
+  }
+
+  return 1;
+}
+
+int art_prefix_scan(const char *prefix, sexy_art *t, int (*cb)(my_type *, void *), void *arg) {
+  assert(prefix != NULL);
+
+  // the prefix's '\0' isn't part of what has to match
+  const unsigned char *p = (const unsigned char *) prefix;
+  size_t plen = strlen(prefix);
+  size_t depth = 0;
+  art_node *n = t->root;
+  int count = 0;
+
+  while (n != NULL) {
+    if (is_leaf(n)) {
+      my_type *d = leaf_data(n);
+      if (strncmp(t->key(d), prefix, plen) == 0) {
+        count++;
+        cb(d, arg);
+      }
+      return count;
+    }
+
+    if (depth == plen) {
+      iterate(n, cb, arg, &count);
+      return count;
+    }
+
+    if (n->partial_len != 0) {
+      uint32_t m = prefix_mismatch(n, p, plen, depth, t);
+
+      // prefix runs out inside n's: everything under n matches
+      if (depth + m == plen) {
+        iterate(n, cb, arg, &count);
+        return count;
+      }
+      if (m < n->partial_len)
+        return 0;
+
+      depth += n->partial_len;
+    }
+
+    art_node **child = find_child(n, p[depth]);
+    n = (child != NULL) ? *child : NULL;
+    depth++;
+  }
+
+  return count;
+}
+
+// whether d's key is a prefix of query (qlen bytes, no '\0')
+static int key_is_prefix(my_type *d, const char *query, size_t qlen, sexy_art *t) {
+  const char *k = t->key(d);
+  size_t klen = strlen(k);
+
+  return klen <= qlen && memcmp(k, query, klen) == 0;
+}
+
+my_type *art_longest_prefix(const char *query, sexy_art *t) {
+  assert(query != NULL);
+
+  const unsigned char *q = (const unsigned char *) query;
+  size_t qlen = strlen(query);
+  size_t depth = 0;
+  my_type *best = NULL;
+  art_node *n = t->root;
+
+  // every key that's a prefix of query ends in a '\0' leaf hanging off
+  // some node on query's path; they only get longer going down
+  while (n != NULL) {
+    if (is_leaf(n)) {
+      my_type *d = leaf_data(n);
+      return key_is_prefix(d, query, qlen, t) ? d : best;
+    }
+
+    if (n->partial_len != 0) {
+      uint32_t stored = n->partial_len < ART_MAX_PREFIX ? n->partial_len : ART_MAX_PREFIX;
+      // prefix bytes are never '\0', so if query stops or differs inside
+      // it every key down here is too long or wrong
+      if (check_prefix(n, q, qlen, depth) != stored)
+        return best;
+      depth += n->partial_len;
+    }
+
+    if (depth > qlen)
+      return best;
+
+    // candidates are checked all the way, which also covers prefix
+    // bytes past ART_MAX_PREFIX that were skipped
+    art_node **term = find_child(n, '\0');
+    if (term != NULL && is_leaf(*term) && key_is_prefix(leaf_data(*term), query, qlen, t))
+      best = leaf_data(*term);
+
+    if (depth == qlen)
+      return best;
+
+    art_node **child = find_child(n, q[depth]);
+    if (child == NULL)
+      return best;
+    n = *child;
+    depth++;
+  }
+
+  return best;
+}
+
+// every leaf under n (reached with depth bytes done, all equal to
+// anchor's) has to agree with anchor on those and with n's prefix
+static int check_art_node(art_node *n, size_t depth, my_type *anchor, sexy_art *t, int *count) {
+  size_t alen;
+  const unsigned char *akey = leaf_key(anchor, t, &alen);
+
+  if (is_leaf(n)) {
+    size_t len;
+    const unsigned char *key = leaf_key(leaf_data(n), t, &len);
+    (*count)++;
+    return len >= depth && memcmp(key, akey, depth) == 0;
+  }
+
+  // shrinking leaves some slack, so the only hard minimum is that a
+  // node with one child would have been squashed
+  int max_kids = (n->type == NODE4) ? 4 : (n->type == NODE16) ? 16 : (n->type == NODE48) ? 48 : 256;
+  if (n->num_children > max_kids || n->num_children < 2)
+    return 0;
+
+  size_t mlen;
+  my_type *m = minimum(n);
+  const unsigned char *mkey = leaf_key(m, t, &mlen);
+  size_t stored = n->partial_len < ART_MAX_PREFIX ? n->partial_len : ART_MAX_PREFIX;
+  if (mlen <= depth + n->partial_len || memcmp(mkey, akey, depth) != 0 ||
+      memcmp(n->partial, mkey + depth, stored) != 0)
+    return 0;
+
+  size_t next = depth + n->partial_len;
+  int seen = 0;
+  int last = -1;
+
+  for (int c = 0; c < 256; c++) {
+    art_node **child = find_child(n, (unsigned char) c);
+    if (child == NULL)
+      continue;
+
+    // sorted node types have to actually be sorted
+    if (c <= last)
+      return 0;
+    last = c;
+    seen++;
+
+    // child's smallest key has to have gotten here, and then the rest
+    // of the child's keys have to agree with it that far
+    size_t clen;
+    my_type *cmin = minimum(*child);
+    const unsigned char *ckey = leaf_key(cmin, t, &clen);
+    if (clen <= next || memcmp(ckey, mkey, next) != 0 || ckey[next] != c)
+      return 0;
+    if (!check_art_node(*child, next + 1, cmin, t, count))
+      return 0;
+  }
+
+  if (n->type == NODE4 || n->type == NODE16) {
+    unsigned char *keys = (n->type == NODE4) ? ((art_node4 *) n)->keys : ((art_node16 *) n)->keys;
+    for (int i = 1; i < n->num_children; i++)
+      if (keys[i - 1] >= keys[i])
+        return 0;
+  }
+
+  return seen == n->num_children;
+}
+
+int is_valid_art(sexy_art *t) {
+  if (t->root == NULL)
+    return t->num_keys == 0;
+
+  int count = 0;
+  if (!check_art_node(t->root, 0, minimum(t->root), t, &count))
+    return 0;
+
+  return count == t->num_keys;
+}
+
+/***************
+ * TEST SCRIPT *
+ ***************/
+
+static my_type *make_entry(const char *key, int x) {
+  size_t len = strlen(key) + 1;
+  my_type *ret = (my_type *) malloc(sizeof(my_type) + len);
+  ret->x = x;
+  memcpy(ret->key, key, len);
+  return ret;
+}
+
+static int node_type_count(art_node *n, uint8_t type) {
+  if (n == NULL || is_leaf(n))
+    return 0;
+
+  int ret = (n->type == type);
+  for (int c = 0; c < 256; c++) {
+    art_node **child = find_child(n, (unsigned char) c);
+    if (child != NULL)
+      ret += node_type_count(*child, type);
+  }
+  return ret;
+}
+
+static void test_basic(void) {
+  printf("beginning test_basic()\n");
+
+  sexy_art *t = create_art(&my_key);
+  assert(search_art("a", t) == NULL);
+  assert(remove_art("a", t) == NULL);
+  assert(is_valid_art(t));
+
+  // keys that are prefixes of each other, the empty key, and keys with
+  // shared runs longer than ART_MAX_PREFIX
+  const char *keys[] = {"", "a", "ab", "abc", "abd", "b", "romane", "romanus", "romulus",
+                        "rubens", "ruber", "rubicon", "rubicundus",
+                        "a_very_long_shared_prefix_0", "a_very_long_shared_prefix_1",
+                        "a_very_long_shared_prefix_12", "a_very_long_shared_pre"};
+  int n = sizeof(keys) / sizeof(keys[0]);
+
+  for (int i = 0; i < n; i++) {
+    assert(insert_art(make_entry(keys[i], i), t));
+    assert(is_valid_art(t));
+  }
+  assert(t->num_keys == n);
+
+  // duplicates are turned away
+  my_type *dup = make_entry("abc", 99);
+  assert(!insert_art(dup, t));
+  free(dup);
+
+  for (int i = 0; i < n; i++)
+    assert(search_art(keys[i], t)->x == i);
+  assert(search_art("abe", t) == NULL);
+  assert(search_art("a_very_long_shared_prefix_", t) == NULL);
+  assert(search_art("a_very_long_shared_prefix_2", t) == NULL);
+  assert(search_art("rom", t) == NULL);
+  assert(search_art("romanes", t) == NULL);
+
+  // take them out in a different order than they went in
+  for (int i = n - 1; i >= 0; i -= 2) {
+    my_type *d = remove_art(keys[i], t);
+    assert(d != NULL && d->x == i);
+    free(d);
+    assert(search_art(keys[i], t) == NULL);
+    assert(is_valid_art(t));
+  }
+  for (int i = n - 2; i >= 0; i -= 2)
+    assert(search_art(keys[i], t)->x == i);
+  for (int i = n - 2; i >= 0; i -= 2) {
+    free(remove_art(keys[i], t));
+    assert(is_valid_art(t));
+  }
+  assert(t->num_keys == 0 && t->root == NULL);
+
+  free_art(t);
+  printf("test_basic() passed!\n");
+}
+
+static void test_node_sizes(void) {
+  printf("beginning test_node_sizes()\n");
+
+  sexy_art *t = create_art(&my_key);
+  char key[3] = {'x', 0, 0};
+
+  // one node with a child for every byte goes NODE4 -> ... -> NODE256
+  for (int c = 1; c < 256; c++) {
+    key[1] = (char) c;
+    assert(insert_art(make_entry(key, c), t));
+
+    uint8_t want = (c <= 4) ? NODE4 : (c <= 16) ? NODE16 : (c <= 48) ? NODE48 : NODE256;
+    // the root has 'x' as its prefix and every key past that
+    assert(c == 1 || t->root->type == want);
+  }
+  assert(is_valid_art(t));
+  assert(node_type_count(t->root, NODE256) == 1);
+
+  // and back down again
+  for (int c = 255; c >= 1; c--) {
+    key[1] = (char) c;
+    my_type *d = remove_art(key, t);
+    assert(d != NULL && d->x == c);
+    free(d);
+
+    if (c % 8 == 0)
+      assert(is_valid_art(t));
+  }
+  assert(t->root == NULL);
+
+  free_art(t);
+  printf("test_node_sizes() passed!\n");
+}
+
+typedef struct scan_log {
+  char last[64];
+  int count;
+} scan_log;
+
+static int scan_cb(my_type *d, void *arg) {
+  scan_log *log = (scan_log *) arg;
+
+  // in key order
+  assert(log->count == 0 || strcmp(log->last, d->key) < 0);
+  strncpy(log->last, d->key, sizeof(log->last) - 1);
+  log->count++;
+  return 1;
+}
+
+static int stop_cb(my_type *d, void *arg) {
+  (void) d;
+  return --*(int *) arg > 0;
+}
+
+static void test_many(void) {
+  printf("beginning test_many()\n");
+
+  int n = 50000;
+  sexy_art *t = create_art(&my_key);
+  char key[64];
+
+  // user/<id>/<field> style namespace
+  const char *fields[] = {"name", "email", "session"};
+  for (int i = 0; i < n; i++) {
+    int id = (i * 7919) % n;
+    snprintf(key, sizeof(key), "user/%d/%s", id / 3, fields[id % 3]);
+    assert(insert_art(make_entry(key, id), t));
+  }
+  assert(t->num_keys == n);
+  assert(is_valid_art(t));
+
+  for (int id = 0; id < n; id++) {
+    snprintf(key, sizeof(key), "user/%d/%s", id / 3, fields[id % 3]);
+    assert(search_art(key, t)->x == id);
+  }
+
+  // every node type shows up with keys like these
+  assert(node_type_count(t->root, NODE4) > 0);
+  assert(node_type_count(t->root, NODE16) > 0);
+
+  // prefix scans
+  scan_log log;
+  log.count = 0;
+  assert(art_prefix_scan("", t, &scan_cb, &log) == n && log.count == n);
+
+  log.count = 0;
+  assert(art_prefix_scan("user/12/", t, &scan_cb, &log) == 3);
+  log.count = 0;
+  // user/12/..., user/120/... to user/129/..., user/1200/... to ...
+  int want = 3 + 30 + 300 + 3000;
+  assert(art_prefix_scan("user/12", t, &scan_cb, &log) == want && log.count == want);
+  assert(art_prefix_scan("user/12/name/", t, &scan_cb, &log) == 0);
+  assert(art_prefix_scan("nobody", t, &scan_cb, &log) == 0);
+
+  int budget = 10;
+  assert(art_prefix_scan("user/1", t, &stop_cb, &budget) == 10);
+
+  // clear out a third of it
+  for (int id = 0; id < n; id += 3) {
+    snprintf(key, sizeof(key), "user/%d/%s", id / 3, fields[id % 3]);
+    free(remove_art(key, t));
+  }
+  assert(is_valid_art(t));
+  log.count = 0;
+  assert(art_prefix_scan("user/12/", t, &scan_cb, &log) == 2);
+
+  free_art(t);
+  printf("test_many() passed!\n");
+}
+
+static void test_longest_prefix(void) {
+  printf("beginning test_longest_prefix()\n");
+
+  sexy_art *t = create_art(&my_key);
+  assert(art_longest_prefix("10.1.2.3", t) == NULL);
+
+  const char *routes[] = {"10.", "10.1.", "10.1.2.", "192.168.", "10.1.2.3",
+                          "/usr/local/share/", "/usr/"};
+  for (int i = 0; i < 7; i++)
+    assert(insert_art(make_entry(routes[i], i), t));
+
+  assert(art_longest_prefix("10.1.2.3", t)->x == 4);
+  assert(art_longest_prefix("10.1.2.4", t)->x == 2);
+  assert(art_longest_prefix("10.1.9.9", t)->x == 1);
+  assert(art_longest_prefix("10.200.0.1", t)->x == 0);
+  assert(art_longest_prefix("192.168.0.1", t)->x == 3);
+  assert(art_longest_prefix("192.169.0.1", t) == NULL);
+  assert(art_longest_prefix("10", t) == NULL);
+  assert(art_longest_prefix("", t) == NULL);
+  assert(art_longest_prefix("/usr/local/share/man", t)->x == 5);
+  assert(art_longest_prefix("/usr/local/bin", t)->x == 6);
+  assert(art_longest_prefix("/usr/locals", t)->x == 6);
+
+  // the empty key is a prefix of everything
+  assert(insert_art(make_entry("", 7), t));
+  assert(art_longest_prefix("172.16.0.1", t)->x == 7);
+  assert(art_longest_prefix("10.1.2.4", t)->x == 2);
+
+  free_art(t);
+  printf("test_longest_prefix() passed!\n");
+}
+
+static void test_all(void) {
+  test_basic();
+  printf("\n");
+  test_node_sizes();
+  printf("\n");
+  test_many();
+  printf("\n");
+  test_longest_prefix();
+  printf("\n");
+}
+
+#ifndef ART_BENCH
+int main(void) {
+  test_all();
+}
+#else
+
+/*************
+ * BENCHMARK *
+ *************/
+
+// `make bench`: the ../bench/bench.h workloads with each int key
+// spelled as 8 hex digits, most significant first, so sequential keys
+// share long prefixes the way sorted string keys do
+#include "../bench/bench.h"
+
+static void bench_key(int key, char *out) {
+  static const char hex[] = "0123456789abcdef";
+  for (int i = 7; i >= 0; i--) {
+    out[i] = hex[key & 0xf];
+    key >>= 4;
+  }
+  out[8] = '\0';
+}
+
+static void *bench_create(void) {
+  return create_art(&my_key);
+}
+
+static int bench_insert(void *c, int key) {
+  char k[9];
+  bench_key(key, k);
+  my_type *d = make_entry(k, key);
+  if (insert_art(d, (sexy_art *) c))
+    return 1;
+  free(d);
+  return 0;
+}
+
+static int bench_search(void *c, int key) {
+  char k[9];
+  bench_key(key, k);
+  return search_art(k, (sexy_art *) c) != NULL;
+}
+
+static int bench_remove(void *c, int key) {
+  char k[9];
+  bench_key(key, k);
+  my_type *d = remove_art(k, (sexy_art *) c);
+  free(d);
+  return d != NULL;
+}
+
+static void bench_destroy(void *c) {
+  free_art((sexy_art *) c);
+}
+
+int main(int argc, char **argv) {
+  bench_ops ops[] = {
+    {"art", &bench_create, &bench_insert, &bench_search, &bench_remove, &bench_destroy},
+  };
+  return bench_main(argc, argv, ops, 1);
+}
+#endif